@@ -52,6 +52,9 @@ typedef struct NFRClient       * PNFRClient;
 typedef struct NFRHost         * PNFRHost;
 typedef struct NFRMemory       * PNFRMemory;
 typedef struct NFRRemoteMemory * PNFRRemoteMemory;
+typedef struct NFRHostDiff     * PNFRHostDiff;
+typedef struct NFRHostSwapchain * PNFRHostSwapchain;
+typedef struct NFRCopyEngine   * PNFRCopyEngine;
 
 extern int nfr_LogLevel;
 
@@ -62,9 +65,21 @@ struct NFRRemoteMemory
   uint64_t             addr;
   uint64_t             size;
   uint64_t             rkey;
+  /* Remote keys of the region on each rail. railKeys[0] is the same as rkey;
+     only the first railCount entries are valid. */
+  uint64_t             railKeys[NETFR_MAX_RAILS];
+  /* Serial of the last write posted into this region, set when the write is
+     posted rather than when it completes. 0 if the contents of the region are
+     unknown, e.g. because it was just registered or a write was canceled. */
+  uint32_t             writeSerial;
+  /* Order in which the client released the region, higher values being more
+     recent */
+  uint32_t             releaseSerial;
   uint32_t             align;
   uint8_t              state;
   uint8_t              index;
+  uint8_t              railCount;
+  uint8_t              priority;   // Client preference, higher is preferred
 };
 
 struct NFRCallbackInfo
@@ -81,14 +96,310 @@ enum NFRTransportType
   NFR_TRANSPORT_MAX
 };
 
+enum NFRCompression
+{
+  /* LZ4 on TCP channels if NetFR was built with LZ4 support, no compression
+     on RDMA channels, where the link is faster than the compressor */
+  NFR_COMPRESSION_DEFAULT = 0,
+  NFR_COMPRESSION_NONE    = 1,
+  NFR_COMPRESSION_LZ4     = 2,
+  NFR_COMPRESSION_MAX
+};
+
+/* Priority classes of queued messages. Higher classes are sent first, and
+   messages within a class are sent in order. */
+enum NFRSendPriority
+{
+  NFR_SEND_PRIORITY_HIGH   = 0,  // E.g., input and cursor updates
+  NFR_SEND_PRIORITY_NORMAL = 1,
+  NFR_SEND_PRIORITY_LOW    = 2,  // E.g., bulk metadata
+  NFR_SEND_PRIORITY_MAX
+};
+
+/* Handling of a message submitted while the send queue is full */
+enum NFRSendQueuePolicy
+{
+  // Fail the submission with -ENOSPC
+  NFR_SEND_QUEUE_REJECT      = 0,
+  /* Drop the oldest message of the lowest priority class which is not above
+     that of the new message, otherwise reject */
+  NFR_SEND_QUEUE_DROP_OLDEST = 1,
+  /* Replace a queued message of the same priority and nonzero key in place,
+     whether or not the queue is full, otherwise reject when full */
+  NFR_SEND_QUEUE_COALESCE    = 2,
+  NFR_SEND_QUEUE_POLICY_MAX
+};
+
+struct NFRSendQueueStats
+{
+  /* Messages currently waiting in the queue */
+  uint32_t queued;
+  /* Messages which had to be queued, because no credits or send contexts
+     were available or earlier messages were still queued */
+  uint64_t deferred;
+  /* Queued messages replaced by a newer one with the same key */
+  uint64_t coalesced;
+  /* Queued messages dropped to make room, or which could not be sent */
+  uint64_t dropped;
+  /* Messages rejected because the queue was full */
+  uint64_t rejected;
+};
+
+/* Shape and limits of the communication buffer of a channel. Fields left at 0
+   take their default values: 60 transmit and 60 receive slots, 6 write slots,
+   2 ack slots, NETFR_MESSAGE_MAX_SIZE byte messages, NETFR_CREDIT_COUNT
+   credits and NETFR_MAX_MEM_REGIONS memory regions. The receive side limits
+   are advertised to the peer on connection, so the two sides need not use the
+   same geometry. */
+struct NFRChannelGeometry
+{
+  uint16_t txSlots;     // Message send contexts
+  uint16_t rxSlots;     // Message receive contexts
+  uint16_t writeSlots;  // Concurrent RDMA buffer writes
+  uint16_t ackSlots;    // Concurrent acknowledgements
+  /* Size of the largest message the channel can send or receive, header
+     included. A power of 2 between NETFR_MESSAGE_MIN_SIZE and
+     NETFR_MESSAGE_MAX_SIZE. */
+  uint32_t slotSize;
+  /* Initial number of messages the peer may send before waiting for an
+     acknowledgement, at most rxSlots and NETFR_MAX_CREDIT_COUNT, and more than
+     NETFR_RESERVED_CREDIT_COUNT. The window then adapts to how quickly the
+     messages are read. */
+  uint16_t credits;
+  /* Memory regions which can be attached, at most NETFR_MAX_MEM_REGIONS. One
+     of them holds the communication buffer. */
+  uint16_t memRegions;
+};
+
 struct NFRInitOpts
 {
   uint32_t              apiVersion;
   uint64_t              flags;
   struct sockaddr_in    addrs[NETFR_NUM_CHANNELS];
   uint8_t               transportTypes[NETFR_NUM_CHANNELS];
+  /* Number of rails (endpoints) to open per channel, up to NETFR_MAX_RAILS. 0
+     is treated as 1, i.e. no striping. Both sides must use the same value. */
+  uint8_t               railCounts[NETFR_NUM_CHANNELS];
+  /* Addresses of the additional rails, railAddrs[i][r - 1] being the address
+     of rail r on channel i. Rails use the transport type of their channel. If
+     an entry is left zeroed, the channel address is used with its port
+     incremented by r * NETFR_NUM_CHANNELS, which results in parallel
+     connections to the same address. */
+  struct sockaddr_in    railAddrs[NETFR_NUM_CHANNELS][NETFR_MAX_RAILS - 1];
+  /* Compression of RDMA buffer writes per channel, see NFRCompression. A
+     channel only uses compression if both sides enable it. */
+  uint8_t               compression[NETFR_NUM_CHANNELS];
+  /* If nonzero and all channels use the same transport, the channels share a
+     single domain and receive context, drawing from one pool of receive
+     buffers instead of one pool per channel. The credits offered to the peer
+     are divided among the channels accordingly. */
+  uint8_t               sharedRx;
+  /* If nonzero, messages are received back to back into a few large buffers
+     using FI_MULTI_RECV instead of one slot per message, where the provider
+     supports it. */
+  uint8_t               multiRecv;
+  // Communication buffer geometry of each channel
+  struct NFRChannelGeometry geometry[NETFR_NUM_CHANNELS];
+  /* Number of slots of the eager message ring per channel, at most
+     NETFR_EAGER_MAX_SLOTS, or 0 to disable it. With the ring, the client
+     exposes a registered ring of slots, and the host writes small data
+     messages directly into it using RDMA writes instead of sending them, so
+     the client finds them by polling its memory. This saves the receive
+     processing and acknowledgements of the messages, and is meant for the
+     low-latency channel. The ring is used if both sides enable it, with the
+     client's slot count. */
+  uint16_t              eagerSlots[NETFR_NUM_CHANNELS];
+  /* Number of latest value registers per channel, at most
+     NETFR_MAX_REGISTERS, or 0 to disable them. The client exposes the
+     registers, which the host overwrites with nfrHostWriteRegister and the
+     client reads with nfrClientReadRegister, e.g. for the cursor position.
+     The registers are available if both sides enable them, with the client's
+     register count. */
+  uint8_t               registers[NETFR_NUM_CHANNELS];
+  /* If nonzero, the client can pull frames the host publishes with
+     nfrHostPublishFrame by reading them with RDMA reads, instead of the host
+     pushing every frame. Memory attached by the host is then readable by the
+     client. Pulling is available if both sides enable it. */
+  uint8_t               pull[NETFR_NUM_CHANNELS];
+  /* Number of content cache slots per channel, at most NETFR_MAX_CACHE_SLOTS,
+     or 0 to disable the cache. The client keeps the messages the host sends
+     with nfrHostSendCached in registered slots of NETFR_CACHE_SLOT_SIZE bytes,
+     and the host sends a short reference instead when the same content is
+     sent again, e.g. for cursor images. The cache is available if both sides
+     enable it, with the client's slot count. */
+  uint8_t               cacheSlots[NETFR_NUM_CHANNELS];
+};
+
+/* A region of a buffer to be written by a partial write. A range consists of
+   one or more rows of ``length`` bytes, with consecutive rows placed ``pitch``
+   bytes apart, e.g. a rectangle of an image. */
+struct NFRWriteRange
+{
+  uint64_t localOffset;   // Offset of the first row in the local buffer
+  uint64_t remoteOffset;  // Offset of the first row in the remote buffer
+  uint32_t length;        // Length of a row in bytes
+  uint32_t rows;          // Number of rows; 0 is treated as 1
+  uint32_t localPitch;    // Distance between rows in the local buffer
+  uint32_t remotePitch;   // Distance between rows in the remote buffer
+};
+
+/* A write range whose data is held in a specific local memory region. Used to
+   gather data from several local regions into one remote buffer, such as the
+   planes of a multi-planar image or a cursor shape and its mask. */
+struct NFRWriteSegment
+{
+  PNFRMemory           localMem;  // Local memory region holding the data
+  struct NFRWriteRange range;     // Local offsets are relative to localMem
+};
+
+/* A region of a buffer which was updated by the peer, as reported to the
+   receiver of a write. */
+struct NFRUpdateRange
+{
+  uint32_t offset;        // Offset of the first row in the buffer
+  uint32_t length;        // Length of a row in bytes
+  uint32_t pitch;         // Distance between rows
+  uint32_t rows;          // Number of rows, at least 1
+};
+
+struct NFRRailStats
+{
+  /* Payload bytes written using RDMA on this rail */
+  uint64_t bytesWritten;
+  /* Number of RDMA write operations posted on this rail */
+  uint64_t writesPosted;
+  /* Number of RDMA write operations completed on this rail */
+  uint64_t writesCompleted;
+  /* Number of RDMA read operations posted and completed on this rail, and
+     the payload bytes read */
+  uint64_t readsPosted;
+  uint64_t readsCompleted;
+  uint64_t bytesRead;
+  /* Whether the rail currently has a connected endpoint */
+  uint8_t  connected;
+};
+
+struct NFRCompressionStats
+{
+  /* Number of buffer writes sent compressed */
+  uint64_t writesCompressed;
+  /* Number of eligible buffer writes sent uncompressed, because the data did
+     not compress well enough or the staging buffer was in use */
+  uint64_t writesSkipped;
+  /* Size of the compressed writes before and after compression */
+  uint64_t bytesIn;
+  uint64_t bytesOut;
+  /* Whether compression was negotiated for the current connection */
+  uint8_t  enabled;
+};
+
+struct NFRCreditStats
+{
+  /* Messages the peer currently allows to be unacknowledged, and the data
+     messages sent which are not yet acknowledged */
+  uint32_t window;
+  uint32_t outstanding;
+  /* Window last granted to the peer, and the received data messages which
+     have not yet been read */
+  uint32_t granted;
+  uint32_t pending;
+  /* Smoothed and minimum time in nanoseconds from sending a data message to
+     its acknowledgement, including the time the peer took to read it. 0 if
+     unknown. */
+  uint64_t rtt;
+  uint64_t minRtt;
+  /* Total time in nanoseconds that data messages could not be sent for lack
+     of credits, and the number of times it happened */
+  uint64_t starvedTime;
+  uint64_t starvedCount;
+};
+
+struct NFRLinkEstimate
+{
+  /* Estimated bandwidth of the link in bytes per second, the highest delivery
+     rate of the recent writes. 0 until the first write has completed. */
+  uint64_t bandwidth;
+  /* Smoothed and minimum round trip time in nanoseconds, 0 if unknown */
+  uint64_t rtt;
+  uint64_t minRtt;
+  /* Bytes of the writes in progress which have not yet completed, including
+     the segments of a paced write which have not yet been posted */
+  uint64_t queuedBytes;
+  /* Estimated time to drain the queued bytes in nanoseconds */
+  uint64_t queueDelay;
+  /* Current pacing rate in bytes per second, 0 if the channel is not paced */
+  uint64_t pacingRate;
+};
+
+enum NFRCopySimd
+{
+  /* Best instruction set supported by the CPU, used on one thread only for
+     copies larger than the last level cache */
+  NFR_COPY_SIMD_AUTO,
+  NFR_COPY_SIMD_NONE,     // Plain memcpy
+  NFR_COPY_SIMD_AVX2,
+  NFR_COPY_SIMD_AVX512,
+  NFR_COPY_SIMD_MAX
 };
 
+struct NFRCopyOpts
+{
+  /* Number of threads a large copy is split over, including the calling
+     thread. 0 selects a number based on the CPU count. */
+  uint32_t threads;
+  /* Instruction set used for non-temporal stores. If the CPU does not support
+     the requested set, the best supported one below it is used. */
+  uint8_t  simd;
+};
+
+/**
+ * @brief Create a copy engine for large buffers, such as frames copied into
+ *        registered memory or out of a received buffer.
+ *
+ * Copies of at least ``NETFR_COPY_NT_MIN_SIZE`` bytes bypass the cache with
+ * non-temporal stores, so that they do not evict the working set of the
+ * application, and larger ones are split into chunks copied in parallel.
+ * Smaller copies use memcpy.
+ *
+ * Non-temporal stores on one thread are not faster than memcpy, and are slower
+ * while the destination fits in the cache. With ``NFR_COPY_SIMD_AUTO``, copies
+ * made on the calling thread therefore use memcpy up to the size of the last
+ * level cache. An explicit instruction set streams from
+ * ``NETFR_COPY_NT_MIN_SIZE``, trading throughput for the working set.
+ *
+ * @param opts    Engine options, may be null for the defaults
+ *
+ * @param result  Engine handle
+ *
+ * @return        0 on success, negative error code on failure
+ */
+int nfrCopyEngineCreate(const struct NFRCopyOpts * opts,
+                        PNFRCopyEngine * result);
+
+/**
+ * @brief Copy a buffer using a copy engine. The copy is complete and visible
+ *        to other threads and devices when the function returns.
+ *
+ * An engine must not be used by multiple threads at the same time.
+ *
+ * @param engine  Engine handle, or null to use memcpy
+ *
+ * @param dst     Destination buffer
+ *
+ * @param src     Source buffer, which must not overlap the destination
+ *
+ * @param length  Number of bytes to copy
+ */
+void nfrCopy(PNFRCopyEngine engine, void * dst, const void * src,
+             uint64_t length);
+
+/**
+ * @brief Free a copy engine.
+ *
+ * @param engine  Engine handle, set to null afterwards
+ */
+void nfrCopyEngineFree(PNFRCopyEngine * engine);
+
 /**
  * @brief Free resources associated with a memory region.
  * 
@@ -38,6 +38,12 @@ enum
   /* The host sent a message using the standard ``nfrHostSendData`` function.
      This is ideal for small high-frequency messages or metadata updates. */
   NFR_CLIENT_EVENT_DATA,
+  /* A frame requested with ``nfrClientPullFrame`` was read into memRegion at
+     payloadOffset. The serial is the generation of the frame. */
+  NFR_CLIENT_EVENT_FRAME,
+  /* The host sent a message with ``nfrHostSendLarge``, which was reassembled
+     from its fragments. The message is at largeData. */
+  NFR_CLIENT_EVENT_LARGE_DATA,
   NFR_CLIENT_EVENT_MAX
 };
 
@@ -47,6 +53,15 @@ struct NFRClientEvent
    * message data reside. */
   PNFRMemory memRegion;
 
+  /* Only valid for NFR_CLIENT_EVENT_MEM_WRITE. The regions of the memory region
+   * which were updated by the write. Data outside of these ranges is left as it
+   * was after the previous write into the same region. If rangeCount is 0, the
+   * peer did not write any data, and the contents are the same as after the
+   * previous write. The array remains valid until the memory region is
+   * released using nfrAckBuffer. */
+  const struct NFRUpdateRange * ranges;
+  uint32_t rangeCount;
+
   /* The user-defined OOB data associated with the event. */
   uint64_t udata;
   
@@ -69,6 +84,19 @@ struct NFRClientEvent
   /* The index of the channel this message was received on. */
   uint8_t channelIndex;
 
+  /* Only valid for NFR_CLIENT_EVENT_MEM_WRITE. The metadata the host attached
+   * to the write with nfrHostSetWriteMetadata, or null if there is none. It
+   * remains valid until the memory region is released using nfrAckBuffer. */
+  const void * metadata;
+  uint32_t metadataLength;
+
+  /* Only valid for NFR_CLIENT_EVENT_LARGE_DATA. The reassembled message, which
+   * stays valid until the next call to nfrClientProcess on the channel, or
+   * until the buffer is replaced with nfrClientSetLargeBuffer. A message taken
+   * from the content cache is instead at payloadOffset in memRegion, which is
+   * the registered cache. */
+  const void * largeData;
+
   /* If the event type is NFR_CLIENT_EVENT_DATA, this field will contain
    * the message that was sent over the fabric. */
   alignas(16) char inlineData[NETFR_MESSAGE_MAX_PAYLOAD_SIZE];
@@ -104,6 +132,21 @@ struct NFRClientEvent
 PNFRMemory nfrClientAttachMemory(PNFRClient client, void * buffer,
                                  uint64_t size, uint8_t index);
 
+/**
+ * @brief Set the priority of a memory region for the host's client-hinted
+ *        placement policy.
+ *
+ * Regions with a higher priority are written first, for example a region
+ * which is already imported by the GPU. The priority is sent to the host when
+ * the region is next made available to it, i.e. when it is first synced after
+ * being attached, or after it is released with nfrAckBuffer.
+ *
+ * @param mem       Memory region
+ *
+ * @param priority  Priority, 0 by default
+ */
+void nfrClientSetBufferPriority(PNFRMemory mem, uint8_t priority);
+
 /**
  * @brief Allocate memory to be used with RDMA writes.
  *
@@ -205,6 +248,259 @@ void nfrClientFree(PNFRClient * res);
 int nfrClientSendData(struct NFRClient * client, int channelID, 
                       const void * data, uint32_t length, uint64_t udata);
 
+/**
+ * @brief Send arbitrary data to the host, queueing it if it cannot be sent
+ *        yet.
+ *
+ * If no credits or send contexts are available, or messages of the same or a
+ * higher priority are already queued, the message is copied into the send
+ * queue of the channel and posted by nfrClientProcess as credits return.
+ *
+ * @param client     Client handle
+ *
+ * @param channelID  Channel index
+ *
+ * @param data       Data to send
+ *
+ * @param length     Length of the data
+ *
+ * @param udata      User data to associate with the message
+ *
+ * @param priority   Priority class, see NFRSendPriority
+ *
+ * @param key        Coalescing key, see NFR_SEND_QUEUE_COALESCE, or 0
+ *
+ * @return           0 if the message was sent or queued, negative on error.
+ *                   ``-ENOSPC`` if the queue is full.
+ */
+int nfrClientQueueData(PNFRClient client, int channelID, const void * data,
+                       uint32_t length, uint64_t udata, uint8_t priority,
+                       uint64_t key);
+
+/**
+ * @brief Configure the send queue of a channel.
+ *
+ * Each channel starts with a queue of ``NETFR_SEND_QUEUE_DEFAULT_DEPTH``
+ * messages which rejects messages when full. The queue must be empty to be
+ * resized.
+ *
+ * @param client     Client handle
+ *
+ * @param channelID  Channel index
+ *
+ * @param depth      Number of messages, at most
+ *                   ``NETFR_SEND_QUEUE_MAX_DEPTH``, or 0 to disable queueing
+ *
+ * @param policy     Overflow policy, see NFRSendQueuePolicy
+ *
+ * @return           0 on success, ``-EBUSY`` if messages are queued, or
+ *                   another negative error code
+ */
+int nfrClientSetSendQueue(PNFRClient client, int channelID, uint32_t depth,
+                          uint8_t policy);
+
+/**
+ * @brief Get the send queue statistics of a channel.
+ *
+ * @param client     Client handle
+ *
+ * @param channelID  Channel index
+ *
+ * @param stats      Output statistics
+ *
+ * @return           0 on success, negative on error
+ */
+int nfrClientGetSendQueueStats(PNFRClient client, int channelID,
+                               struct NFRSendQueueStats * stats);
+
+/**
+ * @brief Configure the coalescing of small data messages on a channel.
+ *
+ * See nfrHostSetCoalescing. Packed messages are sent once the threshold or
+ * deadline is reached, or when nfrClientFlush is called.
+ *
+ * @param client        Client handle
+ *
+ * @param channelID     Channel index
+ *
+ * @param threshold     Packed size in bytes, or 0 to disable
+ *
+ * @param deadlineUs    Longest time a message is held back in microseconds
+ *
+ * @return              0 on success, negative error code on failure
+ */
+int nfrClientSetCoalescing(PNFRClient client, int channelID, 
+                           uint32_t threshold, uint32_t deadlineUs);
+
+/**
+ * @brief Send the packed messages of a channel without waiting for the
+ *        coalescing threshold or deadline.
+ *
+ * @param client        Client handle
+ *
+ * @param channelID     Channel index
+ *
+ * @return              0 on success, negative error code on failure
+ */
+int nfrClientFlush(PNFRClient client, int channelID);
+
+/**
+ * @brief Send a message larger than NETFR_MESSAGE_MAX_PAYLOAD_SIZE to the
+ *        host without a remote buffer.
+ *
+ * See nfrHostSendLarge. The host reads the message with nfrHostReadLarge.
+ *
+ * @param client        Client handle
+ *
+ * @param channelID     Channel index
+ *
+ * @param data          Data buffer, which can be reused once this returns
+ *
+ * @param length        Length of the data, at most
+ *                      NETFR_LARGE_MESSAGE_MAX_SIZE
+ *
+ * @param udata         User data associated with the message
+ *
+ * @return              0 on success, -EBUSY if the previous large message is
+ *                      still being sent, or another negative error code
+ */
+int nfrClientSendLarge(PNFRClient client, int channelID, const void * data,
+                       uint32_t length, uint64_t udata);
+
+/**
+ * @brief Set the buffer large messages from the host are reassembled into.
+ *
+ * See nfrHostSetLargeBuffer. Without a buffer, the channel allocates one.
+ *
+ * @param client        Client handle
+ *
+ * @param channelID     Channel index
+ *
+ * @param buffer        Buffer, or null to let the channel allocate one
+ *
+ * @param size          Size of the buffer
+ *
+ * @return              0 on success, -EBUSY if a message is being reassembled,
+ *                      or another negative error code
+ */
+int nfrClientSetLargeBuffer(PNFRClient client, int channelID, void * buffer,
+                            uint32_t size);
+
+/**
+ * @brief Write data into a memory region exposed by the host.
+ *
+ * This is the counterpart of nfrHostWriteBuffer for bulk data sent to the
+ * host, such as clipboard images, captured audio or dropped files, which
+ * would otherwise have to be split into many messages. The data is written
+ * with a single RDMA write into the smallest available region the host
+ * exposed with nfrHostExposeMemory, followed by a notification which the host
+ * receives from nfrHostReadBuffer. The region becomes available again once
+ * the host releases it.
+ *
+ * @param localMem      Local memory region holding the data, attached with
+ *                      nfrClientAttachMemory
+ *
+ * @param localOffset   Offset of the data in the local memory region
+ *
+ * @param length        Length of the data
+ *
+ * @param udata         User data reported to the host along with the write
+ *
+ * @param cbInfo        Local completion callback, may be null
+ *
+ * @return              The index of the host region written to on success,
+ *                      -ENOBUFS if no suitable region is available, or another
+ *                      negative error code
+ */
+int nfrClientWriteBuffer(PNFRMemory localMem, uint64_t localOffset,
+                         uint64_t length, uint64_t udata,
+                         struct NFRCallbackInfo * cbInfo);
+
+/**
+ * @brief Copy the payload of a buffer write out of the memory region, then
+ *        release the region with nfrAckBuffer.
+ *
+ * The payload, from payloadOffset to payloadOffset + payloadLength in the
+ * memory region, is copied to the start of dst with the copy engine, so that a
+ * large frame neither occupies a single core nor evicts the cache. The event's
+ * ranges and metadata are no longer valid afterwards.
+ *
+ * @param engine   Copy engine, or null to use memcpy
+ *
+ * @param evt      An NFR_CLIENT_EVENT_MEM_WRITE event
+ *
+ * @param dst      Destination buffer, e.g. an upload buffer
+ *
+ * @param dstSize  Size of the destination buffer
+ *
+ * @return         The number of bytes copied, -ENOBUFS if dst is too small, in
+ *                 which case the region is not released, or another negative
+ *                 error code
+ */
+int nfrClientCopyOut(PNFRCopyEngine engine, const struct NFRClientEvent * evt,
+                     void * dst, uint64_t dstSize);
+
+/**
+ * @brief Request the next frame published by the host in pull mode.
+ *
+ * Once the host has published a frame newer than the last one pulled, it is
+ * read into the memory region with an RDMA read, and nfrClientProcess reports
+ * it as an NFR_CLIENT_EVENT_FRAME event. A read torn by the host overwriting
+ * the frame is discarded, and the next frame is read instead. See
+ * nfrHostPublishFrame.
+ *
+ * @param localMem      Memory region to read the frame into, which must not
+ *                      be in use until the event is reported
+ *
+ * @param localOffset   Offset in the memory region
+ *
+ * @return              0 on success, -EBUSY if a frame is already being
+ *                      pulled, -ENOTSUP if pull mode was not negotiated, or
+ *                      another negative error code
+ */
+int nfrClientPullFrame(PNFRMemory localMem, uint64_t localOffset);
+
+/**
+ * @brief Read the latest value of a register written by the host.
+ *
+ * Reading a register does not involve the host, so it can be polled as often
+ * as needed, e.g. once per displayed frame for the cursor position. See
+ * nfrHostWriteRegister.
+ *
+ * @param client        Client handle
+ *
+ * @param channelID     Channel index
+ *
+ * @param index         Register index
+ *
+ * @param data          Buffer receiving the value, of at least
+ *                      NETFR_REGISTER_MAX_PAYLOAD bytes
+ *
+ * @param length        On input, the size of the buffer; on output, the length
+ *                      of the value
+ *
+ * @return              1 if the value changed since the last read, 0 if not,
+ *                      -ENODATA if the register was never written, -EAGAIN if
+ *                      the value is being overwritten, -ENOENT if the host does
+ *                      not support registers, or another negative error code
+ */
+int nfrClientReadRegister(PNFRClient client, int channelID, uint8_t index,
+                          void * data, uint32_t * length);
+
+/**
+ * @brief Get the state of the adaptive credit window of a channel.
+ *
+ * @param client     Client handle
+ *
+ * @param channelID  Channel index
+ *
+ * @param stats      Output statistics
+ *
+ * @return           0 on success, negative on error
+ */
+int nfrClientGetCreditStats(PNFRClient client, int channelID,
+                            struct NFRCreditStats * stats);
+
 #ifdef __cplusplus
 }
 #endif
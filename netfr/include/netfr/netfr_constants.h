@@ -25,7 +25,7 @@
 extern "C" {
 #endif
 
-#define NETFR_VERSION 1
+#define NETFR_VERSION 6
 #define NETFR_MAGIC   "NetFrame"
 
 /* NetFR can store a limited amount of additional user data when performing its
@@ -39,39 +39,132 @@ extern "C" {
    (high-bandwidth) and secondary (low-latency) channels. */
 #define NETFR_NUM_CHANNELS 2
 
-/* The total number of NetFR-managed memory regions that can be allocated. These
+/* The maximum number of rails per channel. A rail is an additional fabric
+   endpoint, either on a different NIC/port or a parallel connection to the same
+   address, used to stripe large RDMA writes. Rail 0 is the channel's own
+   endpoint, which also carries all of the messaging traffic. */
+#define NETFR_MAX_RAILS 4
+
+/* Writes smaller than this size are never striped across rails. Striped writes
+   can only be confirmed to the peer once every rail has completed its part, so
+   for small writes the extra round trip outweighs the bandwidth gain. */
+#define NETFR_RAIL_STRIPE_MIN_SIZE (1 << 20)
+
+/* Stripe boundaries are aligned to this many bytes */
+#define NETFR_RAIL_STRIPE_ALIGN 4096
+
+/* The maximum number of ranges that can be updated by a single partial write,
+   and hence listed in a single write notification. Each range can cover
+   multiple rows of a 2D region, such as a damage rectangle. */
+#define NETFR_MAX_WRITE_RANGES 64
+
+/* The maximum size of the metadata which can be attached to a single buffer
+   write and delivered inline with its notification, see
+   nfrHostSetWriteMetadata. */
+#define NETFR_WRITE_METADATA_MAX_SIZE 256
+
+/* Remote offset which lets nfrHostWriteBuffer place the data at the offset
+   with the same alignment as the local data, relative to the remote buffer's
+   page size */
+#define NETFR_REMOTE_OFFSET_AUTO ((uint64_t) -1)
+
+/* Pacing rate which follows the estimated bandwidth of the link, see
+   nfrHostSetPacing */
+#define NETFR_PACING_AUTO ((uint64_t) -1)
+
+/* Default token bucket size of a paced channel in bytes, i.e., the amount of
+   data which may be sent in a single burst */
+#define NETFR_PACING_DEFAULT_BURST (1 << 20)
+
+/* Default and maximum number of messages the send queue of a channel holds
+   while waiting for credits, see nfrHostSetSendQueue */
+#define NETFR_SEND_QUEUE_DEFAULT_DEPTH 32
+#define NETFR_SEND_QUEUE_MAX_DEPTH 256
+
+/* Size of a slot of the eager message ring, and the maximum number of slots,
+   see NFRInitOpts.eagerSlots. A slot holds a 24 byte header and a trailing
+   byte besides the message, so messages of up to 231 bytes are written into
+   the ring. */
+#define NETFR_EAGER_SLOT_SIZE 256
+#define NETFR_EAGER_MAX_SLOTS 1024
+
+/* Size of a latest value register and the maximum number of registers per
+   channel, see NFRInitOpts.registers. A register holds a value of up to
+   NETFR_REGISTER_MAX_PAYLOAD bytes besides its sequence numbers. */
+#define NETFR_REGISTER_SIZE 64
+#define NETFR_MAX_REGISTERS 64
+#define NETFR_REGISTER_MAX_PAYLOAD 52
+
+/* Size of a slot of the client's content cache and the maximum number of slots
+   per channel, see NFRInitOpts.cacheSlots. Messages of up to a slot are
+   cached, e.g. cursor images. */
+#define NETFR_CACHE_SLOT_SIZE (1 << 18)
+#define NETFR_MAX_CACHE_SLOTS 64
+
+/* Default edge length in pixels of the square tiles compared by the frame
+   difference engine */
+#define NETFR_DIFF_DEFAULT_TILE_SIZE 64
+
+/* The maximum number of staging buffers in a host swapchain. Each one uses a
+   memory region of the channel. */
+#define NETFR_MAX_SWAPCHAIN_IMAGES 8
+
+/* Copies of at least this size are made with non-temporal stores by a copy
+   engine with an explicit instruction set; smaller ones are likely to be read
+   again soon and stay in cache. NFR_COPY_SIMD_AUTO starts at the size of the
+   last level cache instead. */
+#define NETFR_COPY_NT_MIN_SIZE (256 * 1024)
+
+/* The maximum number of NetFR-managed memory regions that can be allocated. These
    are used specifically for RDMA write operations and are managed internally by
    the NetFR library. You can also allocate your own self-managed memory regions
    which do not count towards this limit. However, such regions cannot be used
-   with the standard NetFR protocol functions. */
+   with the standard NetFR protocol functions. The limit can be lowered per
+   channel with NFRChannelGeometry. */
 #define NETFR_MAX_MEM_REGIONS 32
 
-/* The total number of context slots for the NetFR library. A context slot is
+/* The default total number of context slots of a channel. A context slot is
    used to store the state of a single operation, a pointer to an exclusively
    owned buffer, the callback to invoke upon its completion, as well as the user
    data to pass to the callback. */
 #define NETFR_TOTAL_CONTEXT_COUNT 128
 
+/* The maximum total number of context slots of a channel */
+#define NETFR_MAX_CONTEXT_COUNT 1024
+
 /* The maximum amount of data which can be exchanged on connection setup via
-   the Libfabric connection manager channel. */
-#define NETFR_CM_MESSAGE_MAX_SIZE 16
+   the Libfabric connection manager channel. This fits within the private data
+   limit of RDMA CM connection requests. */
+#define NETFR_CM_MESSAGE_MAX_SIZE 32
 
-/* The maximum size of a message including the header (not for RDMA buffers) */
+/* The maximum size of a message including the header (not for RDMA buffers).
+   This is also the default message size of a channel. */
 #define NETFR_MESSAGE_MAX_SIZE 4096
 
+/* The minimum message size a channel can be configured with. Internal messages
+   always fit within this size. */
+#define NETFR_MESSAGE_MIN_SIZE 2048
+
 /* The maximum size of user messages, with the header and padding subtracted. */
 #define NETFR_MESSAGE_MAX_PAYLOAD_SIZE (NETFR_MESSAGE_MAX_SIZE - 32)
 
+/* The maximum size of a large message, which is split into fragments of up to
+   NETFR_MESSAGE_MAX_PAYLOAD_SIZE bytes and reassembled by the receiver. */
+#define NETFR_LARGE_MESSAGE_MAX_SIZE (1 << 24)
+
 /* The maximum size of a/an (R)DMA buffer is determined by the provider and
    hardware capabilities for the maximum buffer size that can be handled in a
    single work request. For RDMA, this is typically 1 GiB; we set a limit of 256
    MiB as this covers most use cases. */
 #define NETFR_MAX_BUFFER_SIZE (1 << 28)
 
-/* The number of transmit credits, i.e., the number of messages that can be sent
-   before waiting for an acknowledgment. */
+/* The default number of transmit credits, i.e., the number of messages that can
+   be sent before waiting for an acknowledgment. */
 #define NETFR_CREDIT_COUNT 60
 
+/* The maximum number of transmit credits a channel can be configured with */
+#define NETFR_MAX_CREDIT_COUNT 255
+
 /* The number of reserved credits for internal operations. If the number of
    credits falls below this level, functions such as nfrClientSendData and
    nfrHostSendData will fail until all other ops are done, but the system will
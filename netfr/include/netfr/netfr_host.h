@@ -42,7 +42,9 @@ extern "C" {
  * 
  * @param udata         User data associated with the message
  * 
- * @return              0 on success, negative error code on failure
+ * @return              0 on success, -EAGAIN if no message is available or
+ *                      it cannot be acknowledged until nfrHostProcess is
+ *                      called, or another negative error code
  */
 int nfrHostReadData(struct NFRHost * host, int channelID, void * data,
                     uint32_t * maxLength, uint64_t * udata);
@@ -51,7 +53,8 @@ int nfrHostReadData(struct NFRHost * host, int channelID, void * data,
  * @brief Send data to the client
  *
  * The maximum length of data which can be sent using this function is
- * defined as NETFR_MESSAGE_MAX_PAYLOAD_SIZE.
+ * defined as NETFR_MESSAGE_MAX_PAYLOAD_SIZE. Equivalent to nfrHostQueueData
+ * with normal priority and no key.
  *
  * @param host          Host handle
  *
@@ -66,6 +69,268 @@ int nfrHostReadData(struct NFRHost * host, int channelID, void * data,
 int nfrHostSendData(PNFRHost host, int channelID, const void * data, 
                     uint32_t length, uint64_t udata);
 
+/**
+ * @brief Send data to the client, queueing it if it cannot be sent yet.
+ *
+ * If no credits or send contexts are available, or messages of the same or a
+ * higher priority are already queued, the message is copied into the send
+ * queue of the channel and posted by nfrHostProcess as credits return. The
+ * data buffer can be reused as soon as this function returns.
+ *
+ * @param host          Host handle
+ *
+ * @param channelID     Channel index
+ *
+ * @param data          Data buffer
+ *
+ * @param length        Length of the data buffer
+ *
+ * @param udata         User data associated with the message
+ *
+ * @param priority      Priority class, see NFRSendPriority
+ *
+ * @param key           Coalescing key, see NFR_SEND_QUEUE_COALESCE, or 0
+ *
+ * @return              0 if the message was sent or queued, negative error
+ *                      code on failure. -ENOSPC if the queue is full, or
+ *                      -EAGAIN if the send queue is disabled and the message
+ *                      cannot be sent yet.
+ */
+int nfrHostQueueData(PNFRHost host, int channelID, const void * data, 
+                     uint32_t length, uint64_t udata, uint8_t priority,
+                     uint64_t key);
+
+/**
+ * @brief Configure the send queue of a channel.
+ *
+ * Each channel starts with a queue of NETFR_SEND_QUEUE_DEFAULT_DEPTH messages
+ * which rejects messages when full. The queue must be empty to be resized.
+ *
+ * @param host          Host handle
+ *
+ * @param channelID     Channel index
+ *
+ * @param depth         Number of messages, at most NETFR_SEND_QUEUE_MAX_DEPTH,
+ *                      or 0 to disable queueing
+ *
+ * @param policy        Overflow policy, see NFRSendQueuePolicy
+ *
+ * @return              0 on success, -EBUSY if messages are queued, or another
+ *                      negative error code
+ */
+int nfrHostSetSendQueue(PNFRHost host, int channelID, uint32_t depth,
+                        uint8_t policy);
+
+/**
+ * @brief Get the send queue statistics of a channel.
+ *
+ * @param host          Host handle
+ *
+ * @param channelID     Channel index
+ *
+ * @param stats         Output statistics
+ *
+ * @return              0 on success, negative error code on failure
+ */
+int nfrHostGetSendQueueStats(PNFRHost host, int channelID,
+                             struct NFRSendQueueStats * stats);
+
+/**
+ * @brief Configure the coalescing of small data messages on a channel.
+ *
+ * Messages are packed into a single message until the packed size reaches the
+ * threshold or the oldest one has waited for the deadline, which saves
+ * contexts, credits and acknowledgements when many small messages are sent.
+ * The peer still receives every message individually. Coalescing is disabled
+ * by default; messages with a coalescing key are never packed.
+ *
+ * @param host          Host handle
+ *
+ * @param channelID     Channel index
+ *
+ * @param threshold     Packed size in bytes, at most
+ *                      NETFR_MESSAGE_MAX_PAYLOAD_SIZE, or 0 to disable. Packed
+ *                      messages are kept within the largest message the
+ *                      client accepts, even if the threshold is higher.
+ *
+ * @param deadlineUs    Longest time a message is held back in microseconds
+ *
+ * @return              0 on success, negative error code on failure
+ */
+int nfrHostSetCoalescing(PNFRHost host, int channelID, uint32_t threshold,
+                         uint32_t deadlineUs);
+
+/**
+ * @brief Send a message larger than NETFR_MESSAGE_MAX_PAYLOAD_SIZE to the
+ *        client without a remote buffer.
+ *
+ * The message is copied and split into fragments which are sent as regular
+ * data messages, as many at a time as the credits allow; nfrHostProcess posts
+ * the rest as credits return. The client reassembles the fragments and reports
+ * the message as a single NFR_CLIENT_EVENT_LARGE_DATA event. One large message
+ * is sent at a time per channel. Messages larger than a few hundred KiB are
+ * better written with nfrHostWriteBuffer.
+ *
+ * @param host          Host handle
+ *
+ * @param channelID     Channel index
+ *
+ * @param data          Data buffer, which can be reused once this returns
+ *
+ * @param length        Length of the data, at most
+ *                      NETFR_LARGE_MESSAGE_MAX_SIZE
+ *
+ * @param udata         User data associated with the message
+ *
+ * @return              0 on success, -EBUSY if the previous large message is
+ *                      still being sent, or another negative error code
+ */
+int nfrHostSendLarge(PNFRHost host, int channelID, const void * data,
+                     uint32_t length, uint64_t udata);
+
+/**
+ * @brief Read a large message sent by the client with nfrClientSendLarge.
+ *
+ * Consumes the fragments received so far, which nfrHostReadData skips, and
+ * returns the message once all of its fragments have arrived. The message is
+ * reassembled into the buffer set with nfrHostSetLargeBuffer, or else into a
+ * buffer allocated by the channel, and stays valid until the next call.
+ *
+ * @param host          Host handle
+ *
+ * @param channelID     Channel index
+ *
+ * @param data          Output pointer to the message
+ *
+ * @param length        Output length of the message
+ *
+ * @param udata         Output user data associated with the message, may be
+ *                      null
+ *
+ * @return              0 if a message was read, -EAGAIN if no message is
+ *                      complete or the fragments received cannot be
+ *                      acknowledged until nfrHostProcess is called,
+ *                      -ENOBUFS if a message did not fit into the
+ *                      buffer and was discarded, or another negative error
+ *                      code
+ */
+int nfrHostReadLarge(PNFRHost host, int channelID, const void ** data,
+                     uint32_t * length, uint64_t * udata);
+
+/**
+ * @brief Set the buffer large messages from the client are reassembled into.
+ *
+ * The buffer must stay valid until it is replaced. Messages larger than it are
+ * discarded. Setting a new buffer after each message hands the previous one
+ * over to the caller.
+ *
+ * @param host          Host handle
+ *
+ * @param channelID     Channel index
+ *
+ * @param buffer        Buffer, or null to let the channel allocate one
+ *
+ * @param size          Size of the buffer
+ *
+ * @return              0 on success, -EBUSY if a message is being reassembled,
+ *                      or another negative error code
+ */
+int nfrHostSetLargeBuffer(PNFRHost host, int channelID, void * buffer,
+                          uint32_t size);
+
+/**
+ * @brief Send a message the client is likely to have received before, e.g. a
+ *        cursor image, through the client's content cache.
+ *
+ * The message is hashed, and if the client has reported holding the same
+ * content in its cache, only a reference to the cache slot is sent. The client
+ * then reports the cached copy as an NFR_CLIENT_EVENT_LARGE_DATA event, just as
+ * it reports the message when it is sent in full. Otherwise the message is
+ * sent like nfrHostSendLarge, and the client stores it in the least recently
+ * used slot. Without a cache, or for messages larger than
+ * NETFR_CACHE_SLOT_SIZE, this is the same as nfrHostSendLarge. See
+ * NFRInitOpts.cacheSlots.
+ *
+ * @param host          Host handle
+ *
+ * @param channelID     Channel index
+ *
+ * @param data          Data buffer, which can be reused once this returns
+ *
+ * @param length        Length of the data
+ *
+ * @param udata         User data associated with the message
+ *
+ * @return              0 on success, -EBUSY if the previous large message is
+ *                      still being sent, or another negative error code
+ */
+int nfrHostSendCached(PNFRHost host, int channelID, const void * data,
+                      uint32_t length, uint64_t udata);
+
+/**
+ * @brief Set the value of a latest value register of the client.
+ *
+ * Registers hold state of which only the latest value matters, such as the
+ * cursor position. The value is written directly into the client's memory
+ * without a message, credit or acknowledgement, and the client reads it with
+ * nfrClientReadRegister. Only one write per register is in flight; values set
+ * in the meantime replace each other, and the latest one is written by
+ * nfrHostProcess once the write completes.
+ *
+ * Values set before the client is connected are written once it announces its
+ * registers. See NFRInitOpts.registers.
+ *
+ * @param host          Host handle
+ *
+ * @param channelID     Channel index
+ *
+ * @param index         Register index, below the number of registers
+ *
+ * @param data          Value
+ *
+ * @param length        Length of the value, at most NETFR_REGISTER_MAX_PAYLOAD
+ *
+ * @return              0 on success, -ENOTSUP if the channel has no registers,
+ *                      or another negative error code on failure
+ */
+int nfrHostWriteRegister(PNFRHost host, int channelID, uint8_t index,
+                         const void * data, uint32_t length);
+
+/**
+ * @brief Start a batch of operations on a channel.
+ *
+ * Until the batch is flushed, messages and write notifications are queued
+ * instead of being handed to the provider, and writes are posted with FI_MORE.
+ * nfrHostFlush then posts the queued operations as a single batch, so that the
+ * NIC is notified once. This is useful when several messages are sent in a
+ * row, such as a cursor shape, its position and a frame.
+ *
+ * Operations in a batch still consume contexts and credits, and fail with
+ * ``-EAGAIN`` once these run out. Message order is preserved by the channel
+ * serials rather than the order of posting.
+ *
+ * @param host       Host handle
+ *
+ * @param channelID  Channel index
+ *
+ * @return           0 on success, negative error code on failure
+ */
+int nfrHostBeginBatch(PNFRHost host, int channelID);
+
+/**
+ * @brief End a batch of operations on a channel, and post the queued
+ *        operations and packed messages.
+ *
+ * @param host       Host handle
+ *
+ * @param channelID  Channel index
+ *
+ * @return           0 on success, negative error code on failure. Operations
+ *                   which the provider cannot accept right now are posted
+ *                   later by nfrHostProcess.
+ */
+int nfrHostFlush(PNFRHost host, int channelID);
+
 /**
  * @brief Perform background processing tasks. 
  *
@@ -108,6 +373,64 @@ int nfrHostInit(const struct NFRInitOpts * opts, PNFRHost * result);
  */
 int nfrHostClientsConnected(PNFRHost host, int index);
 
+enum NFRPlacementPolicy
+{
+  /* The smallest buffer which can hold the data */
+  NFR_PLACEMENT_BEST_FIT,
+  /* The buffer most recently released by the client, which is the most likely
+     to still be in the client's caches */
+  NFR_PLACEMENT_MRU,
+  /* Buffers are written strictly in index order, skipping buffers which are
+     too small. If the next buffer is still in use, the write fails with
+     ``-EBUSY``, so the client can release buffers in the order they were
+     written, like a swapchain. */
+  NFR_PLACEMENT_ROUND_ROBIN,
+  /* The buffer with the highest priority set by the client using
+     nfrClientSetBufferPriority, then the smallest one */
+  NFR_PLACEMENT_CLIENT_HINT,
+  /* A user-defined hook */
+  NFR_PLACEMENT_CUSTOM,
+  NFR_PLACEMENT_MAX
+};
+
+/**
+ * @brief Remote buffer placement hook.
+ *
+ * @param uData       User data passed to nfrHostSetPlacement
+ *
+ * @param candidates  Remote buffers which are available and large enough for
+ *                    the write
+ *
+ * @param count       Number of candidates, at least 1
+ *
+ * @param size        Size of the write
+ *
+ * @return            The position of the chosen buffer in ``candidates``, or a
+ *                    negative error code to fail the write
+ */
+typedef int (*NFRPlacementFn)(void * uData,
+                              const struct NFRRemoteMemory * const * candidates,
+                              uint32_t count, uint64_t size);
+
+/**
+ * @brief Set how the remote buffer is chosen for writes which do not specify
+ *        one, such as nfrHostWriteBuffer.
+ *
+ * @param host       Host handle
+ *
+ * @param channelID  Channel index
+ *
+ * @param policy     Placement policy, see NFRPlacementPolicy
+ *
+ * @param hook       Placement hook, only used with NFR_PLACEMENT_CUSTOM
+ *
+ * @param uData      User data passed to the hook
+ *
+ * @return           0 on success, negative error code on failure
+ */
+int nfrHostSetPlacement(PNFRHost host, int channelID, uint8_t policy,
+                        NFRPlacementFn hook, void * uData);
+
 /**
  * @brief Perform an RDMA write operation to a suitable remote memory region.
  *
@@ -117,22 +440,463 @@ int nfrHostClientsConnected(PNFRHost host, int index);
  * completion notifications locally, the callback function in the callback info
  * structure must be set.
  *
+ * If the channel has multiple rails, writes of at least
+ * ``NETFR_RAIL_STRIPE_MIN_SIZE`` bytes are striped across all connected rails
+ * on which both memory regions are registered. The remote side is notified
+ * once, after all stripes have completed.
+ *
+ * If compression was negotiated on the channel, writes of at least 64 KiB are
+ * compressed in slices on the channel's compression thread pool, which the
+ * calling thread takes part in and waits for, and written to a staging buffer
+ * provided by the client, which decompresses them into the target buffer
+ * before reporting the write. Data which does not compress well is sent as is.
+ * Compressed writes are never striped.
+ *
+ * If the channel is paced, a write which exceeds a segment or the available
+ * tokens is split into segments which are posted by nfrHostProcess as the
+ * pacing rate allows. Only such a write returns ``-EAGAIN`` while the previous
+ * paced write is still in progress; smaller writes are posted right away. See
+ * nfrHostSetPacing. Once a paced write is accepted, a segment which cannot be
+ * posted cancels it through the callback rather than the return value, which
+ * may happen before this function returns.
+ *
+ * The remote buffer is chosen according to the placement policy of the
+ * channel, best-fit by default.
+ *
  * @param localMem 
  * 
  * @param localOffset 
  * 
- * @param remoteOffset 
+ * @param remoteOffset  Offset in the remote buffer, or NETFR_REMOTE_OFFSET_AUTO
+ *                      to use the offset of the local data within its page,
+ *                      so that both sides of the transfer share the same
+ *                      alignment. The offset used is reported to the client.
  * 
  * @param length 
  * 
  * @param cbInfo
  * 
- * @return int 
+ * @return          The index of the remote buffer written to on success, which
+ *                  can be passed to nfrHostWriteBufferRanges to update the same
+ *                  buffer later. Negative error code on failure.
  */
 int nfrHostWriteBuffer(PNFRMemory localMem, uint64_t localOffset,
                        uint64_t remoteOffset, uint64_t length,
                        struct NFRCallbackInfo * cbInfo);
 
+/**
+ * @brief Copy data into a local memory region and write it to the client, as
+ *        with nfrHostWriteBuffer.
+ *
+ * The data is copied with the copy engine, so that a large frame neither
+ * occupies a single core nor evicts the cache. The memory region must not
+ * still be in use by a previous write.
+ *
+ * @param engine        Copy engine, or null to use memcpy
+ *
+ * @param localMem      Local memory region the data is copied into
+ *
+ * @param localOffset   Offset in the local memory region
+ *
+ * @param remoteOffset  Offset in the remote buffer, as for nfrHostWriteBuffer
+ *
+ * @param src           Data to write
+ *
+ * @param length        Length of the data
+ *
+ * @param cbInfo        Local completion callback, may be null
+ *
+ * @return              The index of the remote buffer written to, or a
+ *                      negative error code, as for nfrHostWriteBuffer
+ */
+int nfrHostCopyWriteBuffer(PNFRCopyEngine engine, PNFRMemory localMem,
+                           uint64_t localOffset, uint64_t remoteOffset,
+                           const void * src, uint64_t length,
+                           struct NFRCallbackInfo * cbInfo);
+
+/**
+ * @brief Attach user data and metadata to the next buffer write on a channel.
+ *
+ * The metadata is copied and carried inline in the notification of the next
+ * write posted on the channel by any of the nfrHostWriteBuffer functions, so
+ * that small per-write information such as a frame header arrives together
+ * with the data instead of as a separate message. The client receives it in
+ * the metadata field of the NFR_CLIENT_EVENT_MEM_WRITE event, and the user
+ * data in its udata field. Writes posted without metadata carry none.
+ *
+ * The metadata is channel state rather than an argument of the write: it
+ * applies to whichever write is posted next on the channel, including writes
+ * made by nfrHostSwapchainPresent, and is cleared once that write is posted.
+ * If the write fails, the metadata is kept for the next attempt. Setting the
+ * metadata again before a write replaces it.
+ *
+ * @param host       Host handle
+ *
+ * @param channelID  Channel index
+ *
+ * @param udata      User data reported with the write
+ *
+ * @param meta       Metadata, may be null if length is 0
+ *
+ * @param length     Size of the metadata, at most
+ *                   NETFR_WRITE_METADATA_MAX_SIZE bytes
+ *
+ * @return           0 on success, negative error code on failure
+ */
+int nfrHostSetWriteMetadata(PNFRHost host, int channelID, uint64_t udata,
+                            const void * meta, uint32_t length);
+
+/**
+ * @brief Perform a partial RDMA write, updating only the given ranges of a
+ *        remote buffer.
+ *
+ * This is intended for damage-based updates: if only parts of a frame have
+ * changed, only these parts are written into the remote buffer which holds the
+ * previous frame. The ranges are transferred with as few write operations as
+ * the provider allows, followed by a single notification listing the updated
+ * ranges, which the client receives in ``NFRClientEvent::ranges``. If the
+ * ranges need more write operations than the transmit queue has room for, the
+ * rest is posted in batches by nfrHostProcess, and the notification follows
+ * the last batch.
+ *
+ * Partial writes are not striped across rails.
+ *
+ * @param localMem    Local memory region holding the data
+ *
+ * @param ranges      Ranges to write. Remote offsets are relative to the start
+ *                    of the remote buffer.
+ *
+ * @param count       Number of ranges, up to ``NETFR_MAX_WRITE_RANGES``. If 0,
+ *                    no data is written, and the client is notified that the
+ *                    contents of the buffer are unchanged.
+ *
+ * @param remoteIndex Index of the remote buffer to write to, as returned by a
+ *                    previous write. The client must have released the buffer,
+ *                    and must not have re-registered it since. If -1, the
+ *                    smallest suitable buffer is used, and its previous
+ *                    contents are undefined.
+ *
+ * @param cbInfo      Local completion callback, may be null
+ *
+ * @return            The index of the remote buffer on success, negative error
+ *                    code on failure.
+ *
+ *                    ``-EBUSY`` if the requested buffer is still in use by a
+ *                    previous write or by the client.
+ *
+ *                    ``-ESTALE`` if the requested buffer no longer holds the
+ *                    data of a previous write, in which case the entire buffer
+ *                    must be written again.
+ *
+ *                    ``-EAGAIN`` if the previous partial write on the
+ *                    channel is still being posted in batches.
+ */
+int nfrHostWriteBufferRanges(PNFRMemory localMem,
+                             const struct NFRWriteRange * ranges,
+                             uint32_t count, int remoteIndex,
+                             struct NFRCallbackInfo * cbInfo);
+
+/**
+ * @brief Write data gathered from several local memory regions into a single
+ *        remote buffer.
+ *
+ * This works like nfrHostWriteBufferRanges, except that each range can be
+ * taken from a different local memory region, which avoids packing the data
+ * into one buffer first. The client receives a single notification listing
+ * the destination ranges.
+ *
+ * @param segments    Segments to write. All memory regions must be attached to
+ *                    the same channel.
+ *
+ * @param count       Number of segments, from 1 to ``NETFR_MAX_WRITE_RANGES``
+ *
+ * @param remoteIndex Index of the remote buffer to write to, or -1, as for
+ *                    nfrHostWriteBufferRanges
+ *
+ * @param cbInfo      Local completion callback, may be null
+ *
+ * @return            The index of the remote buffer on success, negative error
+ *                    code on failure, as for nfrHostWriteBufferRanges.
+ */
+int nfrHostWriteBufferSG(const struct NFRWriteSegment * segments,
+                         uint32_t count, int remoteIndex,
+                         struct NFRCallbackInfo * cbInfo);
+
+/**
+ * @brief Write a 2D region, such as an image, into the smallest suitable
+ *        remote buffer, changing its row pitch on the way.
+ *
+ * Rows are written directly from the local buffer, so an image with padded
+ * rows does not need to be repacked before sending. If the pitches match, the
+ * region is written as a single block.
+ *
+ * @param localMem     Local memory region holding the data
+ *
+ * @param localOffset  Offset of the first row in the local memory region
+ *
+ * @param localPitch   Distance between rows in the local memory region
+ *
+ * @param remoteOffset Offset of the first row in the remote buffer
+ *
+ * @param remotePitch  Distance between rows in the remote buffer
+ *
+ * @param rowLength    Number of bytes to write per row
+ *
+ * @param rows         Number of rows
+ *
+ * @param cbInfo       Local completion callback, may be null
+ *
+ * @return             The index of the remote buffer on success, negative
+ *                     error code on failure. Regions with more rows than the
+ *                     provider can queue at once are posted in batches, as
+ *                     for nfrHostWriteBufferRanges.
+ */
+int nfrHostWriteBuffer2D(PNFRMemory localMem, uint64_t localOffset,
+                         uint32_t localPitch, uint64_t remoteOffset,
+                         uint32_t remotePitch, uint32_t rowLength,
+                         uint32_t rows, struct NFRCallbackInfo * cbInfo);
+
+/**
+ * @brief Create a write range covering a rectangle of an image.
+ *
+ * The image is assumed to have the same layout in the local and remote
+ * buffers.
+ *
+ * @param localBase   Offset of the image in the local buffer
+ *
+ * @param remoteBase  Offset of the image in the remote buffer
+ *
+ * @param pitch       Distance between image rows in bytes
+ *
+ * @param bpp         Bytes per pixel
+ *
+ * @param x, y        Position of the rectangle in pixels
+ *
+ * @param width       Width of the rectangle in pixels
+ *
+ * @param height      Height of the rectangle in pixels
+ */
+inline static struct NFRWriteRange nfrHostRectRange(uint64_t localBase,
+                                                    uint64_t remoteBase,
+                                                    uint32_t pitch,
+                                                    uint32_t bpp,
+                                                    uint32_t x, uint32_t y,
+                                                    uint32_t width,
+                                                    uint32_t height)
+{
+  struct NFRWriteRange r;
+  uint64_t offset = (uint64_t) y * pitch + (uint64_t) x * bpp;
+  r.localOffset   = localBase + offset;
+  r.remoteOffset  = remoteBase + offset;
+  r.length        = width * bpp;
+  r.rows          = height;
+  r.localPitch    = pitch;
+  r.remotePitch   = pitch;
+  return r;
+}
+
+enum NFRDiffSimd
+{
+  NFR_DIFF_SIMD_AUTO,     // Best instruction set supported by the CPU
+  NFR_DIFF_SIMD_NONE,     // Plain memcmp
+  NFR_DIFF_SIMD_SSE2,
+  NFR_DIFF_SIMD_AVX2,
+  NFR_DIFF_SIMD_AVX512,
+  NFR_DIFF_SIMD_MAX
+};
+
+struct NFRDiffOpts
+{
+  uint32_t width;     // Frame width in pixels
+  uint32_t height;    // Frame height in pixels
+  uint32_t bpp;       // Bytes per pixel
+  uint32_t pitch;     // Distance between rows in bytes; 0 for width * bpp
+  /* Tile edge length in pixels; 0 for NETFR_DIFF_DEFAULT_TILE_SIZE */
+  uint32_t tileSize;
+  /* Number of threads used to compare a frame, including the calling thread.
+     0 selects a number based on the frame size and CPU count. */
+  uint32_t threads;
+  /* Instruction set used for comparisons. If the CPU does not support the
+     requested set, the best supported one below it is used. */
+  uint8_t  simd;
+};
+
+/**
+ * @brief Create a frame difference engine.
+ *
+ * The engine keeps a shadow copy of the last frame written into each remote
+ * buffer of a channel. New frames are compared against the shadow of the
+ * buffer they are written into tile by tile, and only the changed tiles are
+ * sent using a partial write. This is useful when the producer of the frames
+ * cannot report the damaged regions itself.
+ *
+ * @param host       Host handle. If null, the engine can only be used with
+ *                   nfrHostDiffUpdate, e.g. for benchmarking.
+ *
+ * @param channelID  Channel the frames are written on
+ *
+ * @param opts       Frame geometry and engine options
+ *
+ * @param result     Engine handle
+ *
+ * @return           0 on success, negative error code on failure
+ */
+int nfrHostDiffCreate(PNFRHost host, int channelID,
+                      const struct NFRDiffOpts * opts, PNFRHostDiff * result);
+
+/**
+ * @brief Write a frame to the client, sending only the tiles which changed.
+ *
+ * Of the remote buffers which are available and still hold a frame previously
+ * written by this engine, the one holding the most recent frame is updated.
+ * If there is no such buffer, or most of the frame has changed, the entire
+ * frame is written into the smallest suitable buffer instead. A frame which
+ * is identical to the buffer contents results in a notification without any
+ * data being written.
+ *
+ * The shadow copy is updated when the write is posted, so the frame must not
+ * be modified until the write has completed.
+ *
+ * @param diff         Engine handle
+ *
+ * @param localMem     Local memory region holding the frame
+ *
+ * @param localOffset  Offset of the frame in the local memory region
+ *
+ * @param cbInfo       Local completion callback, may be null
+ *
+ * @return             The index of the remote buffer written to, or a negative
+ *                     error code, as for nfrHostWriteBufferRanges.
+ */
+int nfrHostDiffWrite(PNFRHostDiff diff, PNFRMemory localMem,
+                     uint64_t localOffset, struct NFRCallbackInfo * cbInfo);
+
+/**
+ * @brief Compare a frame against a shadow copy, then update the shadow.
+ *
+ * This performs the comparison step of nfrHostDiffWrite without writing
+ * anything.
+ *
+ * @param diff       Engine handle
+ *
+ * @param index      Shadow copy index, below ``NETFR_MAX_MEM_REGIONS``
+ *
+ * @param frame      Frame data
+ *
+ * @param ranges     Output ranges, relative to the start of the frame
+ *
+ * @param maxRanges  Size of the ranges array, at least 1
+ *
+ * @return           The number of ranges that changed, or a negative error
+ *                   code. If the shadow copy was not valid, or most of the
+ *                   frame has changed, a single range covering the entire
+ *                   frame is returned.
+ */
+int nfrHostDiffUpdate(PNFRHostDiff diff, int index, const void * frame,
+                      struct NFRWriteRange * ranges, uint32_t maxRanges);
+
+/**
+ * @brief Discard a shadow copy, so that the next frame written into the buffer
+ *        is sent in its entirety.
+ *
+ * @param diff   Engine handle
+ *
+ * @param index  Shadow copy index, or -1 for all of them
+ */
+void nfrHostDiffInvalidate(PNFRHostDiff diff, int index);
+
+/**
+ * @brief Free a frame difference engine.
+ *
+ * @param diff  Engine handle, set to null afterwards
+ */
+void nfrHostDiffFree(PNFRHostDiff * diff);
+
+/**
+ * @brief Create a swapchain of registered staging buffers on a channel.
+ *
+ * The producer acquires a free image, fills it and presents it, which writes
+ * it to the client. The image returns to the pool as soon as its write has
+ * completed, while the client may still be reading the remote buffer, so that
+ * capturing the next frame, the transfer and the client's processing overlap.
+ * Acquiring only fails while all images are in flight.
+ *
+ * A channel can have one swapchain. Each image uses one of the channel's
+ * memory regions.
+ *
+ * @param host       Host handle
+ *
+ * @param channelID  Channel the images are written on
+ *
+ * @param count      Number of images, at most NETFR_MAX_SWAPCHAIN_IMAGES
+ *
+ * @param size       Size of each image
+ *
+ * @param result     Swapchain handle
+ *
+ * @return           0 on success, negative error code on failure
+ */
+int nfrHostSwapchainCreate(PNFRHost host, int channelID, uint32_t count,
+                           uint64_t size, PNFRHostSwapchain * result);
+
+/**
+ * @brief Acquire the next free image of a swapchain. Images are handed out in
+ *        the order they became free.
+ *
+ * @param sc      Swapchain handle
+ *
+ * @param data    Set to the image's buffer, which the caller may fill until
+ *                the image is presented or released
+ *
+ * @return        The index of the image, -EAGAIN if all images are in flight,
+ *                or another negative error code
+ */
+int nfrHostSwapchainAcquire(PNFRHostSwapchain sc, void ** data);
+
+/**
+ * @brief Write an acquired image to the client, as with nfrHostWriteBuffer.
+ *
+ * Metadata for the write can be attached beforehand with
+ * nfrHostSetWriteMetadata. If the write fails, the image stays acquired, and
+ * can be presented again or released.
+ *
+ * @param sc      Swapchain handle
+ *
+ * @param index   Image index returned by nfrHostSwapchainAcquire
+ *
+ * @param length  Number of bytes at the start of the image to write
+ *
+ * @param cbInfo  Local completion callback, may be null
+ *
+ * @return        The index of the remote buffer written to, or a negative
+ *                error code, as for nfrHostWriteBuffer
+ */
+int nfrHostSwapchainPresent(PNFRHostSwapchain sc, int index, uint64_t length,
+                            struct NFRCallbackInfo * cbInfo);
+
+/**
+ * @brief Return an acquired image to the pool without presenting it, e.g. to
+ *        drop a frame.
+ *
+ * @param sc     Swapchain handle
+ *
+ * @param index  Image index returned by nfrHostSwapchainAcquire
+ *
+ * @return       0 on success, negative error code on failure
+ */
+int nfrHostSwapchainRelease(PNFRHostSwapchain sc, int index);
+
+/**
+ * @brief Free a swapchain and its images.
+ *
+ * No image may be in flight, e.g. after the client has disconnected and
+ * nfrHostProcess has canceled the outstanding writes. The swapchain must be
+ * freed before the host.
+ *
+ * @param sc  Swapchain handle, set to null afterwards
+ */
+void nfrHostSwapchainFree(PNFRHostSwapchain * sc);
+
 /**
  * @brief Attach an existing memory buffer to a fabric resource.
  *
@@ -156,6 +920,210 @@ int nfrHostWriteBuffer(PNFRMemory localMem, uint64_t localOffset,
 PNFRMemory nfrHostAttachMemory(PNFRHost host, void * buffer,
                                uint64_t size, uint8_t index);
 
+/* A write by the client into an exposed memory region, see nfrHostReadBuffer */
+struct NFRHostBufferEvent
+{
+  /* The memory region the client wrote into */
+  PNFRMemory memRegion;
+
+  /* The regions of the memory region which were updated by the write. The
+     array remains valid until the memory region is released using
+     nfrAckBuffer. */
+  const struct NFRUpdateRange * ranges;
+  uint32_t rangeCount;
+
+  /* The user-defined OOB data passed to nfrClientWriteBuffer */
+  uint64_t udata;
+
+  /* The unique incrementing ID of the write, relative to the client's
+     messages */
+  uint32_t serial;
+
+  /* The offset and size of the payload in the memory region */
+  uint32_t payloadOffset;
+  uint32_t payloadLength;
+
+  /* The index of the channel the write was received on */
+  uint8_t channelIndex;
+};
+
+/**
+ * @brief Attach a memory region the client can write into.
+ *
+ * Unlike nfrHostAttachMemory, which attaches the source of the host's own
+ * writes, the region is announced to the client by nfrHostProcess, after which
+ * the client can write bulk data such as clipboard contents or captured audio
+ * into it with nfrClientWriteBuffer. Each write is reported by
+ * nfrHostReadBuffer, and the region is returned to the client by releasing it
+ * with nfrAckBuffer.
+ *
+ * The region must not be freed while a client is connected.
+ *
+ * @param host    Host handle
+ *
+ * @param buffer  Memory buffer
+ *
+ * @param size    Size of the memory buffer
+ *
+ * @param index   The channel index to make the memory region available on
+ *
+ * @return        The memory region, or null on failure
+ */
+PNFRMemory nfrHostExposeMemory(PNFRHost host, void * buffer,
+                               uint64_t size, uint8_t index);
+
+/**
+ * @brief Get the oldest write of the client into an exposed memory region
+ *        which has not been reported yet.
+ *
+ * @param host       Host handle
+ *
+ * @param channelID  Channel index
+ *
+ * @param evt        Output event
+ *
+ * @return           0 on success, -EAGAIN if there is no new write, or
+ *                   another negative error code
+ */
+int nfrHostReadBuffer(PNFRHost host, int channelID,
+                      struct NFRHostBufferEvent * evt);
+
+/**
+ * @brief Publish a frame for the client to pull.
+ *
+ * In pull mode, the host does not write every frame into the client's
+ * buffers. Instead, it publishes the location of its newest frame, and the
+ * client reads it with an RDMA read when it is ready for the next frame, e.g.
+ * once per displayed frame. Frames published in the meantime replace each
+ * other, so a client displaying at a lower rate than the host renders only
+ * transfers the frames it displays. See NFRInitOpts.pull.
+ *
+ * The frame must stay in place until it is replaced by a newer one, or until
+ * the region is invalidated with nfrHostInvalidateFrame before overwriting it.
+ * Publishing a frame invalidates the frame it replaces, so the region of the
+ * previous frame may be reused as soon as this function returns. Reads of the
+ * previous frame which are still in progress are then discarded by the client.
+ *
+ * @param localMem  Memory region holding the frame, attached with
+ *                  nfrHostAttachMemory
+ *
+ * @param offset    Offset of the frame in the memory region
+ *
+ * @param length    Length of the frame
+ *
+ * @param udata     User data reported to the client along with the frame
+ *
+ * @return          0 on success, -ENOTSUP if pull mode is not enabled, or
+ *                  another negative error code
+ */
+int nfrHostPublishFrame(PNFRMemory localMem, uint64_t offset, uint64_t length,
+                        uint64_t udata);
+
+/**
+ * @brief Invalidate the published frames in a memory region before it is
+ *        overwritten.
+ *
+ * Reads of the frame which are in progress are detected as torn by the client
+ * and discarded, and the client waits for the next published frame.
+ *
+ * @param localMem  Memory region about to be overwritten
+ *
+ * @return          0 on success, negative error code on failure
+ */
+int nfrHostInvalidateFrame(PNFRMemory localMem);
+
+
+/**
+ * @brief Get the statistics of a single rail of a channel.
+ *
+ * @param host       Host handle
+ *
+ * @param channelID  Channel index
+ *
+ * @param rail       Rail index, where 0 is the channel endpoint itself
+ *
+ * @param stats      Output statistics
+ *
+ * @return           0 on success, -EINVAL if the rail does not exist
+ */
+int nfrHostGetRailStats(PNFRHost host, int channelID, int rail,
+                        struct NFRRailStats * stats);
+
+/**
+ * @brief Pace the buffer writes of a channel.
+ *
+ * Writes are limited to the given rate using a token bucket. Writes larger
+ * than a segment of at most 256 KiB, or which exceed the available tokens, are
+ * split into segments and posted as tokens become available, so a large frame
+ * never occupies the link for its entire duration and traffic on other
+ * channels can be interleaved. nfrHostProcess must be called regularly to post
+ * the segments.
+ *
+ * Partial and compressed writes are not split, but are charged to the bucket.
+ * Paced writes are never striped.
+ *
+ * @param host       Host handle
+ *
+ * @param channelID  Channel index
+ *
+ * @param rate       Rate in bytes per second, 0 to disable pacing, or
+ *                   NETFR_PACING_AUTO to pace slightly above the estimated
+ *                   bandwidth of the link, see nfrHostGetLinkEstimate. Writes
+ *                   are not paced until an estimate is available.
+ *
+ * @param burst      Size of the token bucket in bytes, or 0 for
+ *                   NETFR_PACING_DEFAULT_BURST
+ *
+ * @return           0 on success, negative error code on failure
+ */
+int nfrHostSetPacing(PNFRHost host, int channelID, uint64_t rate,
+                     uint64_t burst);
+
+/**
+ * @brief Get the estimated state of the link of a channel.
+ *
+ * The estimate is built from the completion times of buffer writes and the
+ * arrival times of message acknowledgements. It can be used to decide whether
+ * to skip frames, e.g., when the queue delay exceeds the frame interval.
+ *
+ * @param host       Host handle
+ *
+ * @param channelID  Channel index
+ *
+ * @param est        Output estimate
+ *
+ * @return           0 on success, negative error code on failure
+ */
+int nfrHostGetLinkEstimate(PNFRHost host, int channelID,
+                           struct NFRLinkEstimate * est);
+
+/**
+ * @brief Get the compression statistics of a channel.
+ *
+ * @param host       Host handle
+ *
+ * @param channelID  Channel index
+ *
+ * @param stats      Output statistics
+ *
+ * @return           0 on success, negative error code on failure
+ */
+int nfrHostGetCompressionStats(PNFRHost host, int channelID,
+                               struct NFRCompressionStats * stats);
+
+/**
+ * @brief Get the state of the adaptive credit window of a channel.
+ *
+ * @param host       Host handle
+ *
+ * @param channelID  Channel index
+ *
+ * @param stats      Output statistics
+ *
+ * @return           0 on success, negative error code on failure
+ */
+int nfrHostGetCreditStats(PNFRHost host, int channelID,
+                          struct NFRCreditStats * stats);
 
 void nfrHostFree(PNFRHost * res);
 
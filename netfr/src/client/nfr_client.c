@@ -18,15 +18,21 @@
  * Place, Suite 330, Boston, MA 02111-1307 USA
  */
 
+#include <inttypes.h>
+
 #include "common/nfr_protocol.h"
 #include "common/nfr_resource.h"
 #include "common/nfr_log.h"
 #include "common/nfr_mem.h"
 #include "common/nfr.h"
+#include "common/nfr_compress.h"
+#include "common/nfr_credit.h"
 
 #include "client/nfr_client_callback.h"
 #include "client/nfr_client.h"
 
+static int nfr_ClientPostData(void * owner, const void * data, 
+                              uint32_t length, uint64_t udata, uint8_t records);
 
 /**
  * @brief Initiate the connection to the server. This is a non-blocking function
@@ -50,36 +56,12 @@ int nfr_InitiateConnection(struct NFRResource * res, struct sockaddr_in * tgt)
     free(info->dest_addr);
   info->dest_addr    = tgt;
   info->dest_addrlen = sizeof(*tgt);
-  int ret = fi_endpoint(res->domain, info, &res->ep, res);
+  int ret = nfr_ResourceCreateEndpoint(res, info);
   info->dest_addr    = 0;
   info->dest_addrlen = 0;
   fi_freeinfo(info);
   if (ret < 0)
-  {
-    NFR_LOG_DEBUG("Failed to create EP: %s (%d)", fi_strerror(-ret), ret);
     return ret;
-  }
-
-  ret = fi_ep_bind(res->ep, &res->eq->fid, 0);
-  if (ret < 0)
-  {
-    NFR_LOG_DEBUG("Failed to bind EP to EQ: %s (%d)", fi_strerror(-ret), ret);
-    goto closeEP;
-  }
-
-  ret = fi_ep_bind(res->ep, &res->cq->fid, FI_SEND | FI_RECV);
-  if (ret < 0)
-  {
-    NFR_LOG_DEBUG("Failed to bind EP to CQ: %s (%d)", fi_strerror(-ret), ret);
-    goto closeEP;
-  }
-
-  ret = fi_enable(res->ep);
-  if (ret < 0)
-  {
-    NFR_LOG_DEBUG("Failed to enable EP: %s (%d)", fi_strerror(-ret), ret);
-    goto closeEP;
-  }
 
   size_t cmDataSize = 0, size = sizeof(cmDataSize);
   ret = fi_getopt(&res->ep->fid, FI_OPT_ENDPOINT, FI_OPT_CM_DATA_SIZE,
@@ -94,6 +76,10 @@ int nfr_InitiateConnection(struct NFRResource * res, struct sockaddr_in * tgt)
 
   struct NFRMsgClientHello hello;
   nfr_SetHeader(&hello.header, NFR_MSG_CLIENT_HELLO);
+  hello.features = res->offeredFeatures;
+  hello.credits  = nfr_ResourceRxCredits(res);
+  hello.maxMessage = (uint16_t) nfr_ResourceRxPool(res)->commBuf.info.slotSize;
+  hello.memRegions = (uint8_t) nfr_ResourceMemRegionCount(res);
   ret = fi_connect(res->ep, (void *) tgt, &hello, sizeof(hello));
   if (ret < 0)
   {
@@ -110,6 +96,36 @@ closeEP:
   return ret;
 }
 
+/**
+ * @brief Start the eager ring over, as the host does once the ring is
+ *        announced. The ring is announced again with the other buffers, and
+ *        its memory is cleared so that entries of the previous connection are
+ *        not mistaken for new ones.
+ */
+static void nfr_ClientEagerRestart(struct NFRClientChannel * ch)
+{
+  if (!ch->eager.mem)
+    return;
+  memset(ch->eager.mem->addr, 0, ch->eager.mem->size);
+  nfr_EagerReset(&ch->eager);
+  ch->eager.mem->state = MEM_STATE_AVAILABLE_UNSYNCED;
+}
+
+/**
+ * @brief Clear the registers and the last sequence numbers read, so that values
+ *        of the previous connection are neither returned nor mistaken for
+ *        unchanged ones. The registers are announced again with the other
+ *        buffers.
+ */
+static void nfr_ClientRegistersRestart(struct NFRClientChannel * ch)
+{
+  if (!ch->registers)
+    return;
+  memset(ch->registers->addr, 0, ch->registers->size);
+  memset(ch->registerSeq, 0, sizeof(ch->registerSeq));
+  ch->registers->state = MEM_STATE_AVAILABLE_UNSYNCED;
+}
+
 /**
  * @brief Check whether the system is connected yet.
  * 
@@ -155,22 +171,49 @@ int nfr_CheckConnState(struct NFRResource * res)
   switch (event)
   {
     case FI_CONNECTED:
-      res->connState = NFR_CONN_STATE_CONNECTED;
-      return 1;
+      break;
     case FI_SHUTDOWN:
     {
       struct NFRClient * client = res->parentTopLevel;
+      struct NFRClientChannel * ch = 0;
       for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
       {
         if (client->channels[i].res == res)
         {
           NFR_LOG_DEBUG("Server disconnected from channel %d, closing EP", i);
+          ch = client->channels + i;
           break;
         }
       }
+      nfr_ResourceReclaimTx(res, 0);
       fi_close(&res->ep->fid);
       res->ep = 0;
       res->connState = NFR_CONN_STATE_DISCONNECTED;
+      res->features  = 0;
+
+      // The host starts its side of the ring and registers over when they
+      // are announced on the next connection
+      if (ch)
+      {
+        nfr_ClientEagerRestart(ch);
+        nfr_ClientRegistersRestart(ch);
+
+        // Host regions are only usable once the new host exposes them
+        for (int i = 0; i < NETFR_MAX_MEM_REGIONS; ++i)
+        {
+          ch->hostRegions[i].state       = NFR_RMEM_NONE;
+          ch->hostRegions[i].writeSerial = 0;
+        }
+
+        /* The descriptor refers to the previous host's memory, and a new host
+           numbers its frames from 1 again. A requested frame is read once
+           the new host publishes one, like after a canceled read. */
+        struct NFRClientPull * pull = &ch->pull;
+        memset(&pull->desc, 0, sizeof(pull->desc));
+        pull->lastGeneration = 0;
+        if (pull->state != NFR_PULL_IDLE && pull->state != NFR_PULL_DONE)
+          pull->state = NFR_PULL_WANTED;
+      }
       return -FI_ECONNRESET;
     }
     default:
@@ -178,8 +221,21 @@ int nfr_CheckConnState(struct NFRResource * res)
       return -EIO;
   }
 
+  /* Not every provider passes the accept data on. Without it, the connection
+     is usable but no optional features are enabled. */
   struct NFRMsgServerHello * helloResp = (struct NFRMsgServerHello *) entry.data;
-  if (memcmp(helloResp->header.magic, NETFR_MAGIC, 8) != 0
+  if ((size_t) ret <= offsetof(struct NFRExtCMEntry, data))
+  {
+    NFR_LOG_DEBUG("Server hello not received, disabling optional features");
+    res->features  = 0;
+    nfr_CreditReset(res, NETFR_CREDIT_COUNT);
+    nfr_ResourceSetPeerLimits(res, 0, 0);
+    res->connState = NFR_CONN_STATE_CONNECTED;
+    return 1;
+  }
+
+  if ((size_t) ret < offsetof(struct NFRExtCMEntry, data) + sizeof(*helloResp)
+      || memcmp(helloResp->header.magic, NETFR_MAGIC, 8) != 0
       || helloResp->header.version != NETFR_VERSION
       || helloResp->header.type != NFR_MSG_SERVER_HELLO)
   {
@@ -188,12 +244,19 @@ int nfr_CheckConnState(struct NFRResource * res)
     goto close_ep;
   }
 
+  // The server can only enable features that were offered
+  res->features  = helloResp->features & res->offeredFeatures;
+  nfr_CreditReset(res, nfr_ResourcePeerCredits(helloResp->credits));
+  nfr_ResourceSetPeerLimits(res, helloResp->maxMessage, helloResp->memRegions);
   res->connState = NFR_CONN_STATE_CONNECTED;
+  NFR_LOG_DEBUG("Connected, features 0x%x, %u credits, %u byte messages",
+                res->features, res->txCredits, nfr_ResourceMaxMessage(res));
   return 1;
 
 close_ep:
   fi_close(&res->ep->fid);
   res->ep = 0;
+  res->connState = NFR_CONN_STATE_DISCONNECTED;
   return ret;
 }
 
@@ -204,11 +267,26 @@ PNFRMemory nfrClientAttachMemory(PNFRClient client, void * buffer,
   assert(size);
   assert(index < NETFR_NUM_CHANNELS);
 
-  struct NFRResource * res = client->channels[index].res;
-  return nfr_RdmaAttach(res, buffer, size,
-                        FI_READ | FI_WRITE | FI_REMOTE_WRITE, 
-                        NFR_MEM_TYPE_USER_MANAGED,
-                        MEM_STATE_AVAILABLE_UNSYNCED);
+  struct NFRClientChannel * ch = client->channels + index;
+  PNFRMemory mem = nfr_RdmaAttach(ch->res, buffer, size,
+                                  FI_READ | FI_WRITE | FI_REMOTE_WRITE, 
+                                  NFR_MEM_TYPE_USER_MANAGED,
+                                  MEM_STATE_AVAILABLE_UNSYNCED);
+  if (mem)
+    nfr_RdmaAttachRails(mem, ch->rails, ch->railCount,
+                        FI_READ | FI_WRITE | FI_REMOTE_WRITE);
+  return mem;
+}
+
+void nfrClientSetBufferPriority(PNFRMemory mem, uint8_t priority)
+{
+  assert(mem);
+  if (!mem)
+    return;
+
+  /* A buffer the host knows about may already be the target of a write, so
+     it cannot be synced again until the client has released it */
+  mem->priority = priority;
 }
 
 int nfr_ClientGetOldestBufUpdate(struct NFRClientChannel * ch,
@@ -248,6 +326,11 @@ int nfr_ClientGetOldestBufUpdate(struct NFRClientChannel * ch,
           evt->memRegion     = mem;
           evt->payloadOffset = mem->payloadOffset;
           evt->payloadLength = mem->payloadLength;
+          evt->udata         = mem->udata;
+          evt->ranges        = mem->ranges;
+          evt->rangeCount    = mem->rangeCount;
+          evt->metadata      = mem->metaLength ? mem->meta : 0;
+          evt->metadataLength = mem->metaLength;
           limSerial          = mem->channelSerial;
           haveData = 1;
         }
@@ -261,6 +344,108 @@ int nfr_ClientGetOldestBufUpdate(struct NFRClientChannel * ch,
   return 0;
 }
 
+/**
+ * @brief Allocate the staging buffer for compressed writes.
+ *
+ * The buffer is sized for the largest buffer attached when it is created, so
+ * writes into buffers attached later may have to be sent uncompressed.
+ *
+ * If the buffer cannot be allocated, compressed writes are not used on this
+ * connection; the host falls back to uncompressed writes without a staging
+ * buffer.
+ */
+static void nfr_ClientOpenStaging(struct NFRClientChannel * ch)
+{
+  struct NFRResource * res = ch->res;
+  uint64_t maxSize = 0;
+  for (int i = 0; i < NETFR_MAX_MEM_REGIONS; ++i)
+  {
+    struct NFRMemory * mem = res->memRegions + i;
+    if (mem->state != MEM_STATE_EMPTY && mem->memType != NFR_MEM_TYPE_INTERNAL
+        && mem->size > maxSize)
+      maxSize = mem->size;
+  }
+
+  if (maxSize < NFR_COMPRESS_MIN_SIZE)
+    return;
+
+  uint64_t size = nfr_CompressBound(maxSize);
+  ch->staging = nfr_RdmaAttach(res, 0, size, 
+                               FI_READ | FI_WRITE | FI_REMOTE_WRITE,
+                               NFR_MEM_TYPE_SYSTEM_MANAGED,
+                               MEM_STATE_AVAILABLE_UNSYNCED);
+  if (!ch->staging)
+  {
+    NFR_LOG_WARNING("Failed to allocate %" PRIu64 " byte staging buffer, "
+                    "disabling compression", size);
+    res->features &= ~NFR_FEATURE_LZ4;
+    return;
+  }
+
+  if (!ch->decompressPool)
+  {
+    uint32_t threads = nfr_GetCpuCount() / 2;
+    if (threads > 4)
+      threads = 4;
+    if (threads > 1 && nfr_ThreadPoolCreate(threads, &ch->decompressPool) < 0)
+      ch->decompressPool = 0;
+  }
+
+  NFR_LOG_DEBUG("Allocated %" PRIu64 " byte staging buffer", size);
+}
+
+/**
+ * @brief Allocate the eager message ring, which is announced to the host along
+ *        with the other buffers.
+ *
+ * If the ring cannot be allocated, the host keeps sending the messages.
+ */
+static void nfr_ClientOpenEager(struct NFRClientChannel * ch)
+{
+  struct NFRResource * res = ch->res;
+  uint64_t size = (uint64_t) res->eagerSlots * NETFR_EAGER_SLOT_SIZE;
+  ch->eager.mem = nfr_RdmaAttach(res, 0, size, 
+                                 FI_READ | FI_WRITE | FI_REMOTE_WRITE,
+                                 NFR_MEM_TYPE_SYSTEM_MANAGED,
+                                 MEM_STATE_AVAILABLE_UNSYNCED);
+  if (!ch->eager.mem)
+  {
+    NFR_LOG_WARNING("Failed to allocate %" PRIu64 " byte eager ring, "
+                    "disabling it",
+                    size);
+    res->features &= ~NFR_FEATURE_EAGER_RING;
+    return;
+  }
+
+  ch->eager.slots = res->eagerSlots;
+  nfr_ClientEagerRestart(ch);
+  NFR_LOG_DEBUG("Allocated eager ring of %u slots", ch->eager.slots);
+}
+
+/**
+ * @brief Allocate the latest value registers, which are announced to the host
+ *        along with the other buffers.
+ */
+static void nfr_ClientOpenRegisters(struct NFRClientChannel * ch)
+{
+  struct NFRResource * res = ch->res;
+  uint64_t size = (uint64_t) res->registerCount * NETFR_REGISTER_SIZE;
+  ch->registers = nfr_RdmaAttach(res, 0, size, 
+                                 FI_READ | FI_WRITE | FI_REMOTE_WRITE,
+                                 NFR_MEM_TYPE_SYSTEM_MANAGED,
+                                 MEM_STATE_AVAILABLE_UNSYNCED);
+  if (!ch->registers)
+  {
+    NFR_LOG_WARNING("Failed to allocate %u registers, disabling them",
+                    res->registerCount);
+    res->features &= ~NFR_FEATURE_REGISTERS;
+    return;
+  }
+
+  nfr_ClientRegistersRestart(ch);
+  NFR_LOG_DEBUG("Allocated %u registers", res->registerCount);
+}
+
 int nfr_ClientResyncBufs(PNFRClient client, uint8_t index)
 {
   assert(client);
@@ -270,6 +455,15 @@ int nfr_ClientResyncBufs(PNFRClient client, uint8_t index)
   struct NFRResource * res = ch->res;
   int nUpdated = 0;
 
+  if ((res->features & NFR_FEATURE_LZ4) && !ch->staging)
+    nfr_ClientOpenStaging(ch);
+  if ((res->features & NFR_FEATURE_EAGER_RING) && !ch->eager.mem)
+    nfr_ClientOpenEager(ch);
+  if ((res->features & NFR_FEATURE_REGISTERS) && !ch->registers)
+    nfr_ClientOpenRegisters(ch);
+  if ((res->features & NFR_FEATURE_CACHE) && !ch->cache.mem)
+    nfr_ClientCacheOpen(ch);
+
   for (int i = 0; i < NETFR_MAX_MEM_REGIONS; ++i)
   {   
     if (res->memRegions[i].state == MEM_STATE_AVAILABLE_UNSYNCED
@@ -278,12 +472,32 @@ int nfr_ClientResyncBufs(PNFRClient client, uint8_t index)
       NFR_LOG_DEBUG("Syncing buffer %d state", i);
       
       struct NFRMsgBufferState msg;
+      memset(&msg, 0, sizeof(msg));
       nfr_SetHeader(&msg.header, NFR_MSG_BUFFER_STATE);
-      msg.pageSize = 0;
-      msg.addr     = (uintptr_t) res->memRegions[i].addr;
-      msg.size     = res->memRegions[i].size;
-      msg.rkey     = fi_mr_key(res->memRegions[i].mr);
-      msg.index    = i;
+      msg.flags     = res->memRegions + i == ch->staging 
+                      ? NFR_BUFFER_FLAG_STAGING : 0;
+      if (res->memRegions + i == ch->eager.mem)
+      {
+        // The host resets its position once it receives the ring
+        nfr_ClientEagerRestart(ch);
+        msg.flags   = NFR_BUFFER_FLAG_EAGER_RING;
+      }
+      if (res->memRegions + i == ch->registers)
+      {
+        nfr_ClientRegistersRestart(ch);
+        msg.flags   = NFR_BUFFER_FLAG_REGISTERS;
+      }
+      if (res->memRegions + i == ch->cache.mem)
+        msg.flags   = NFR_BUFFER_FLAG_CACHE;
+      msg.priority  = res->memRegions[i].priority;
+      msg.pageSize  = nfr_GetPageSize();
+      msg.addr      = (uintptr_t) res->memRegions[i].addr;
+      msg.size      = res->memRegions[i].size;
+      msg.rkey      = fi_mr_key(res->memRegions[i].mr);
+      msg.index     = i;
+      msg.railCount = nfr_MemRailCount(res->memRegions + i);
+      for (int r = 1; r < msg.railCount; ++r)
+        msg.railKeys[r - 1] = fi_mr_key(res->memRegions[i].railMr[r]);
 
       struct NFR_CallbackInfo cbInfo = {0};
       cbInfo.callback = nfr_ClientProcessInternalTx;
@@ -312,6 +526,158 @@ int nfr_ClientResyncBufs(PNFRClient client, uint8_t index)
   return nUpdated;
 }
 
+/**
+ * @brief Post an RDMA read from the host's memory.
+ *
+ * @return 0 on success, -EAGAIN if no context is available, or another
+ *         negative error code
+ */
+static int nfr_ClientPostRead(struct NFRClientChannel * ch, void * buf,
+                              void * desc, uint64_t length, uint64_t addr,
+                              uint64_t key, struct NFRFabricContext * ctx)
+{
+  struct NFRResource * res = ch->res;
+
+  struct iovec iov;
+  iov.iov_base = buf;
+  iov.iov_len  = length;
+
+  struct fi_rma_iov rmaIov;
+  rmaIov.addr = addr;
+  rmaIov.len  = length;
+  rmaIov.key  = key;
+
+  struct fi_msg_rma msg = {0};
+  msg.msg_iov       = &iov;
+  msg.desc          = &desc;
+  msg.iov_count     = 1;
+  msg.rma_iov       = &rmaIov;
+  msg.rma_iov_count = 1;
+  msg.context       = ctx;
+
+  memset(&ctx->cbInfo, 0, sizeof(ctx->cbInfo));
+  ctx->cbInfo.callback = nfr_ClientProcessInternalRead;
+  ctx->cbInfo.uData[0] = ch;
+  ctx->txSeq = nfr_ResourceNextTxSeq(res);
+  ssize_t ret = fi_readmsg(res->ep, &msg, FI_COMPLETION);
+  if (ret < 0)
+  {
+    if (ret != -FI_EAGAIN)
+      NFR_LOG_DEBUG("Failed to post read: %s (%d)", fi_strerror((int) -ret),
+                    (int) ret);
+    NFR_RESET_CONTEXT(ctx);
+    return ret == -FI_EAGAIN ? -EAGAIN : (int) ret;
+  }
+
+  ctx->state   = CTX_STATE_WAITING;
+  ctx->pending = 1;
+  ++res->stats.readsPosted;
+  res->stats.bytesRead += length;
+  return 0;
+}
+
+/**
+ * @brief Post the next read of a requested frame: the frame itself once the
+ *        host has published a new one, then the generation of its region.
+ *
+ * @return 0 on success, negative error code on failure
+ */
+static int nfr_ClientPullAdvance(struct NFRClientChannel * ch)
+{
+  struct NFRClientPull * pull = &ch->pull;
+  struct NFRResource * res = ch->res;
+  int ret;
+
+  switch (pull->state)
+  {
+    case NFR_PULL_WANTED:
+    {
+      if (!pull->desc.generation 
+          || pull->desc.generation == pull->lastGeneration)
+        return 0;
+      if (pull->desc.length > pull->mem->size - pull->offset)
+      {
+        NFR_LOG_WARNING("Frame %" PRIu64 " of %" PRIu64 " bytes does not fit, "
+                        "skipping it",
+                        pull->desc.generation, pull->desc.length);
+        pull->lastGeneration = pull->desc.generation;
+        return -ENOBUFS;
+      }
+
+      struct NFRFabricContext * ctx = nfr_ContextGet(res, NFR_OP_SEND, 0);
+      if (!ctx)
+        return 0;
+      pull->reading = pull->desc;
+      ret = nfr_ClientPostRead(ch, (uint8_t *) pull->mem->addr + pull->offset,
+                               fi_mr_desc(pull->mem->mr), pull->reading.length,
+                               pull->reading.addr, pull->reading.rkey, ctx);
+      if (ret < 0)
+        return ret == -EAGAIN ? 0 : ret;
+      pull->state = NFR_PULL_READING;
+      return 0;
+    }
+    case NFR_PULL_READ:
+    {
+      struct NFRFabricContext * ctx = nfr_ContextGet(res, NFR_OP_SEND, 0);
+      if (!ctx)
+        return 0;
+      ret = nfr_ClientPostRead(ch, ctx->slot->data,
+                               fi_mr_desc(res->commBuf.memRegion->mr),
+                               sizeof(uint64_t), pull->reading.genAddr,
+                               pull->reading.genKey, ctx);
+      if (ret < 0)
+        return ret == -EAGAIN ? 0 : ret;
+      pull->state = NFR_PULL_CHECKING;
+      return 0;
+    }
+    default:
+      return 0;
+  }
+}
+
+/**
+ * @brief Return the next message of the oldest eager ring entry as an event,
+ *        and release the entry after its last record.
+ */
+static int nfr_ClientReadEager(struct NFRClientChannel * ch, int index,
+                               const struct NFREagerEntry * entry,
+                               struct NFRClientEvent * evt)
+{
+  struct NFREagerRing * ring = &ch->eager;
+  memset(evt, 0, offsetof(struct NFRClientEvent, inlineData));
+  evt->type          = NFR_CLIENT_EVENT_DATA;
+  evt->channelIndex  = index;
+  evt->serial        = entry->channelSerial + ring->record;
+  evt->payloadOffset = 0;
+
+  if (entry->records)
+  {
+    struct NFRMsgRecord rec;
+    const uint8_t * recData;
+    if (nfr_CoalesceRecord(entry->data, entry->length, ring->record, &rec,
+                           &recData) < 0)
+    {
+      assert(!"Invalid packed record");
+      nfr_EagerConsume(ring, ch->res);
+      return -EBADMSG;
+    }
+    evt->payloadLength = rec.length;
+    evt->udata         = rec.udata;
+    memcpy(evt->inlineData, recData, rec.length);
+    if (++ring->record < entry->records)
+      return 1;
+  }
+  else
+  {
+    evt->payloadLength = entry->length;
+    evt->udata         = entry->udata;
+    memcpy(evt->inlineData, entry->data, entry->length);
+  }
+
+  nfr_EagerConsume(ring, ch->res);
+  return 1;
+}
+
 int nfrClientProcess(PNFRClient client, int index, struct NFRClientEvent * evt)
 {
   assert(client);
@@ -337,7 +703,7 @@ int nfrClientProcess(PNFRClient client, int index, struct NFRClientEvent * evt)
   struct NFRClientChannel * ch = &client->channels[index];
   struct NFRResource * res = client->channels[index].res;
   assert(res);
-  ASSERT_COMM_BUF_READY(ch->res->commBuf);
+  ASSERT_COMM_BUF_READY(ch->res);
   
   ret = nfr_CheckConnState(res);
   if (ret < 0)
@@ -349,6 +715,18 @@ int nfrClientProcess(PNFRClient client, int index, struct NFRClientEvent * evt)
   
   if (ch->res->connState != NFR_CONN_STATE_CONNECTED)
     return -ENOTCONN;
+
+  // Rails only need to be monitored for disconnections; the host stops
+  // striping over them once they are gone
+  for (int r = 1; r < ch->railCount; ++r)
+  {
+    if (ch->rails[r]->connState != NFR_CONN_STATE_CONNECTED)
+      continue;
+    ret = nfr_CheckConnState(ch->rails[r]);
+    if (ret < 0)
+      NFR_LOG_WARNING("Channel %d rail %d lost: %s (%d)", index, r,
+                      fi_strerror(-ret), ret);
+  }
   
   // If any buffers have been freed or newly allocated, resync them
   ret = nfr_ClientResyncBufs(client, index);
@@ -365,7 +743,7 @@ int nfrClientProcess(PNFRClient client, int index, struct NFRClientEvent * evt)
     if (ret == -FI_EAVAIL && cqe.isError)
     {
       assert(ch->parent);
-      return NFR_PRINT_CQ_ERROR(NFR_LOG_LEVEL_ERROR, ch, &cqe.entry.err);
+      return NFR_PRINT_CQ_ERROR(NFR_LOG_LEVEL_ERROR, ch, &cqe);
     }
     return ret;
   }
@@ -378,7 +756,52 @@ int nfrClientProcess(PNFRClient client, int index, struct NFRClientEvent * evt)
   if (ret < 0)
     return ret;
 
+  // Send the packed records held back for too long
+  if (nfr_CoalesceExpired(&ch->coalesce, nfr_GetTimeNs()))
+    nfr_CoalesceFlush(&ch->coalesce, &ch->sendq, ch, nfr_ClientPostData);
+
+  // Send the queued messages the returned credits allow
+  nfr_SendQFlush(&ch->sendq, ch, nfr_ClientPostData);
+
+  // Then the fragments of a large message, within the same credit window
+  ret = nfr_FragmentFlush(&ch->fragment, ch, nfr_ClientPostData);
+  if (ret < 0)
+    NFR_LOG_WARNING("Large message on channel %d dropped: %s (%d)", index,
+                    fi_strerror(-ret), ret);
+
+  // Tell the host which cached messages it can refer to
+  ret = nfr_ClientCacheReport(ch);
+  if (ret < 0)
+    NFR_LOG_WARNING("Failed to report cache state on channel %d: %s (%d)",
+                    index, fi_strerror(-ret), ret);
+
+  // Retry a failed eager ring position update
+  nfr_EagerReport(&ch->eager, res);
+
+  // A pulled frame is reported as soon as it has been read
+  ret = nfr_ClientPullAdvance(ch);
+  if (ret < 0 && ret != -ENOBUFS)
+    NFR_LOG_WARNING("Failed to pull frame on channel %d: %s (%d)", index,
+                    fi_strerror(-ret), ret);
+  if (ch->pull.state == NFR_PULL_DONE)
+  {
+    struct NFRClientPull * pull = &ch->pull;
+    memset(evt, 0, offsetof(struct NFRClientEvent, inlineData));
+    evt->type          = NFR_CLIENT_EVENT_FRAME;
+    evt->channelIndex  = index;
+    evt->memRegion     = pull->mem;
+    evt->payloadOffset = pull->offset;
+    evt->payloadLength = pull->reading.length;
+    evt->udata         = pull->reading.udata;
+    evt->serial        = (uint32_t) pull->reading.generation;
+    pull->lastGeneration = pull->reading.generation;
+    pull->mem            = 0;
+    pull->state          = NFR_PULL_IDLE;
+    return 1;
+  }
+
   // Find the buffer updates first
+next_message:
   evt->serial = 0;
   int bufRet = nfr_ClientGetOldestBufUpdate(ch, evt);
 
@@ -386,6 +809,16 @@ int nfrClientProcess(PNFRClient client, int index, struct NFRClientEvent * evt)
   struct NFRFabricContext * ctx = 0;
   ret = nfr_ContextGetOldestMessage(ch->res, &ctx);
   
+  // And the eager ring, whose entries are ordered by the same serials
+  const struct NFREagerEntry * entry = nfr_EagerPeek(&ch->eager);
+  if (entry)
+  {
+    uint32_t serial = entry->channelSerial + ch->eager.record;
+    if ((!ret || nfr_SerialBefore(serial, ctx->slot->channelSerial))
+        && (!bufRet || nfr_SerialBefore(serial, evt->serial)))
+      return nfr_ClientReadEager(ch, index, entry, evt);
+  }
+
   // No message
   if (!ret && !bufRet)
     return 0;
@@ -413,26 +846,58 @@ int nfrClientProcess(PNFRClient client, int index, struct NFRClientEvent * evt)
   if (   (ret && !bufRet)
       || (ret && bufRet && (ctx->slot->channelSerial - sub < evt->serial - sub)))
   {
-    struct NFRMsgHostData * msg = (struct NFRMsgHostData *) ctx->slot->data;
+    struct NFRMsgHostData * msg = (struct NFRMsgHostData *) \
+      nfr_ContextData(ctx);
     
     // Context manager should catch these
-    assert(msg->length < NETFR_MESSAGE_MAX_PAYLOAD_SIZE);
-    assert(msg->channelSerial == ctx->slot->channelSerial);
-    assert(msg->msgSerial == ctx->slot->msgSerial);
+    struct NFRDataSlot * slot = ctx->slot;
+    assert(msg->length <= NETFR_MESSAGE_MAX_PAYLOAD_SIZE);
+    assert(msg->channelSerial + slot->record == slot->channelSerial);
+    assert(msg->msgSerial + slot->record == slot->msgSerial);
 
-    // Copy the message out of the context
     memset(evt, 0, offsetof(struct NFRClientEvent, inlineData));
     evt->type          = NFR_CLIENT_EVENT_DATA;
     evt->channelIndex  = index;
-    evt->serial        = ctx->slot->channelSerial;
-    evt->payloadLength = msg->length;
+    evt->serial        = slot->channelSerial;
     evt->payloadOffset = 0;
-    evt->udata         = msg->udata;
-    memcpy(evt->inlineData, ctx->slot->data, msg->length);
+
+    // Fragments are acknowledged as they arrive, and the large message is
+    // returned once the last one has
+    int complete = 1;
+    if (msg->records == NFR_MSG_FRAGMENT)
+      complete = nfr_ClientReadFragment(ch, msg, evt);
+    // Packed records are returned as one event each, and the message is
+    // acknowledged after the last one
+    else if (msg->records)
+    {
+      struct NFRMsgRecord rec;
+      const uint8_t * recData;
+      ret = nfr_CoalesceRecord(msg->data, msg->length, slot->record, &rec,
+                               &recData);
+      assert(ret == 0);
+      evt->payloadLength = rec.length;
+      evt->udata         = rec.udata;
+      memcpy(evt->inlineData, recData, rec.length);
+      if (++slot->record < msg->records)
+      {
+        ++slot->channelSerial;
+        ++slot->msgSerial;
+        return 1;
+      }
+    }
+    else
+    {
+      // Copy the message out of the context
+      evt->payloadLength = msg->length;
+      evt->udata         = msg->udata;
+      memcpy(evt->inlineData, nfr_ContextData(ctx), msg->length);
+    }
 
     // Reuse the context to send the ack
-    struct NFRMsgHostDataAck * ack = (struct NFRMsgHostDataAck *) ctx->slot->data;
+    struct NFRMsgHostDataAck * ack = (struct NFRMsgHostDataAck *) \
+      nfr_ContextData(ctx);
     nfr_SetHeader(&ack->header, NFR_MSG_HOST_DATA_ACK);
+    ack->credits = nfr_CreditRead(ch->res);
 
     struct NFR_CallbackInfo cbInfo = {0};
     cbInfo.callback = nfr_ClientProcessInternalTx;
@@ -451,6 +916,8 @@ int nfrClientProcess(PNFRClient client, int index, struct NFRClientEvent * evt)
     }
 
     NFR_LOG_TRACE("Sent ack for message %u", evt->serial);
+    if (!complete)
+      goto next_message;
     return 1;
   }
 
@@ -458,35 +925,31 @@ int nfrClientProcess(PNFRClient client, int index, struct NFRClientEvent * evt)
   abort();
 }
 
-int nfrClientSendData(struct NFRClient * client, int channelID, 
-                      const void * data, uint32_t length, uint64_t udata)
+// Post a data message directly, see NFR_SendQPostFn
+static int nfr_ClientPostData(void * owner, const void * data, 
+                              uint32_t length, uint64_t udata, uint8_t records)
 {
-  assert(client);
-  assert(data);
-  assert(channelID >= 0 && channelID < NETFR_NUM_CHANNELS);
-  assert(length < NETFR_MESSAGE_MAX_PAYLOAD_SIZE);
-
-  if (!client || !data || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
-    return -EINVAL;
-
-  if (length > NETFR_MESSAGE_MAX_PAYLOAD_SIZE)
+  struct NFRClientChannel * ch = owner;
+  int channelID = (int) (ch - ch->parent->channels);
+  if (length + offsetof(struct NFRMsgClientData, data) 
+      > nfr_ResourceMaxMessage(ch->res))
   {
-    NFR_LOG_DEBUG("Data too large: %u", length);
+    NFR_LOG_DEBUG("Data too large for channel %d: %u", channelID, length);
     return -ENOBUFS;
   }
 
-  struct NFRClientChannel * ch = client->channels + channelID;
   if (ch->res->txCredits < NETFR_RESERVED_CREDIT_COUNT)
   {
     NFR_LOG_DEBUG("No%scredits on channel %d", 
               ch->res->txCredits < NETFR_RESERVED_CREDIT_COUNT ? " low-prio " 
                                                                : " ",
               channelID);
+    nfr_CreditStarved(ch->res);
     return -EAGAIN;
   }
 
   struct NFRResource * res = ch->res;
-  ASSERT_COMM_BUF_READY(res->commBuf);
+  ASSERT_COMM_BUF_READY(res);
 
   struct NFRFabricContext * ctx = nfr_ContextGet(res, NFR_OP_SEND, 0);
   if (!ctx)
@@ -498,8 +961,14 @@ int nfrClientSendData(struct NFRClient * client, int channelID,
   msg->msgSerial     = ++ch->msgSerial;
   msg->channelSerial = ++ch->channelSerial;
   msg->udata         = udata;
+  msg->records       = records;
   memcpy(msg->data, data, length);
 
+  // Each packed record takes a serial of its own
+  uint8_t extra = nfr_MsgSerials(records) - 1;
+  ch->msgSerial     += extra;
+  ch->channelSerial += extra;
+
   struct NFR_CallbackInfo cbInfo = {0};
   cbInfo.callback = nfr_ClientProcessInternalTx;
 
@@ -513,13 +982,313 @@ int nfrClientSendData(struct NFRClient * client, int channelID,
   if (ret < 0)
   {
     NFR_RESET_CONTEXT(ctx);
-    --ch->msgSerial;
-    --ch->channelSerial;
+    ch->msgSerial     -= extra + 1;
+    ch->channelSerial -= extra + 1;
+    return (int) ret;
+  }
+
+  nfr_CreditSent(ch->res);
+  return 0;
+}
+
+int nfrClientSendData(struct NFRClient * client, int channelID, 
+                      const void * data, uint32_t length, uint64_t udata)
+{
+  return nfrClientQueueData(client, channelID, data, length, udata,
+                            NFR_SEND_PRIORITY_NORMAL, 0);
+}
+
+int nfrClientQueueData(PNFRClient client, int channelID, const void * data,
+                       uint32_t length, uint64_t udata, uint8_t priority,
+                       uint64_t key)
+{
+  assert(client);
+  assert(data);
+  assert(channelID >= 0 && channelID < NETFR_NUM_CHANNELS);
+  assert(length < NETFR_MESSAGE_MAX_PAYLOAD_SIZE);
+
+  if (!client || !data || channelID < 0 || channelID >= NETFR_NUM_CHANNELS
+      || priority >= NFR_SEND_PRIORITY_MAX)
+    return -EINVAL;
+
+  if (length > NETFR_MESSAGE_MAX_PAYLOAD_SIZE)
+  {
+    NFR_LOG_DEBUG("Data too large: %u", length);
+    return -ENOBUFS;
+  }
+
+  struct NFRClientChannel * ch = client->channels + channelID;
+  uint32_t maxPayload = nfr_ResourceMaxMessage(ch->res)
+                        - offsetof(struct NFRMsgClientData, data);
+  return nfr_CoalesceSubmit(&ch->coalesce, &ch->sendq, ch, nfr_ClientPostData,
+                            data, length, udata, priority, key, maxPayload);
+}
+
+int nfrClientSetCoalescing(PNFRClient client, int channelID, 
+                           uint32_t threshold, uint32_t deadlineUs)
+{
+  assert(client);
+  if (!client || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
+
+  struct NFRClientChannel * ch = client->channels + channelID;
+  int ret = nfr_CoalesceFlush(&ch->coalesce, &ch->sendq, ch, 
+                              nfr_ClientPostData);
+  if (ret < 0)
     return ret;
+  return nfr_CoalesceInit(&ch->coalesce, threshold, deadlineUs);
+}
+
+int nfrClientFlush(PNFRClient client, int channelID)
+{
+  assert(client);
+  if (!client || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
+
+  struct NFRClientChannel * ch = client->channels + channelID;
+  int ret = nfr_CoalesceFlush(&ch->coalesce, &ch->sendq, ch, 
+                              nfr_ClientPostData);
+  return ret == -ENOSPC || ret == -EAGAIN ? 0 : ret;
+}
+
+int nfrClientSendLarge(PNFRClient client, int channelID, const void * data,
+                       uint32_t length, uint64_t udata)
+{
+  assert(client);
+  assert(data);
+  if (!client || !data || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
+
+  struct NFRClientChannel * ch = client->channels + channelID;
+  struct NFRResource * res = ch->res;
+  if (!res->ep)
+    return -ENOTCONN;
+
+  uint32_t maxPayload = nfr_ResourceMaxMessage(res)
+                        - offsetof(struct NFRMsgClientData, data);
+  int ret = nfr_FragmentSubmit(&ch->fragment, data, length, udata, maxPayload,
+                               0, 0);
+  if (ret < 0)
+    return ret;
+
+  // Queued messages go first, and nfrClientProcess posts the fragments the
+  // credits do not cover yet
+  nfr_SendQFlush(&ch->sendq, ch, nfr_ClientPostData);
+  ret = nfr_FragmentFlush(&ch->fragment, ch, nfr_ClientPostData);
+  return ret < 0 ? ret : 0;
+}
+
+int nfrClientSetLargeBuffer(PNFRClient client, int channelID, void * buffer,
+                            uint32_t size)
+{
+  assert(client);
+  if (!client || channelID < 0 || channelID >= NETFR_NUM_CHANNELS
+      || (buffer && !size))
+    return -EINVAL;
+
+  return nfr_ReassembleSetBuffer(&client->channels[channelID].reassemble,
+                                 buffer, size);
+}
+
+/**
+ * @brief Find the channel a local memory region is attached to.
+ */
+static struct NFRClientChannel * nfr_ClientMemChannel(PNFRMemory localMem)
+{
+  struct NFRResource * res = localMem->parentResource;
+  struct NFRClient * client = (struct NFRClient *) res->parentTopLevel;
+  assert(client);
+
+  for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
+  {
+    if (client->channels[i].res == res)
+      return client->channels + i;
   }
 
-  --ch->res->txCredits;
-  return ret;
+  assert(!"Resource not found in client");
+  return 0;
+}
+
+int nfrClientWriteBuffer(PNFRMemory localMem, uint64_t localOffset,
+                         uint64_t length, uint64_t udata,
+                         struct NFRCallbackInfo * cbInfo)
+{
+  assert(localMem);
+  if (!localMem || !length || length > NETFR_MAX_BUFFER_SIZE
+      || localOffset + length > localMem->size)
+    return -EINVAL;
+
+  ASSERT_COMM_BUF_READY(localMem->parentResource);
+
+  struct NFRClientChannel * ch = nfr_ClientMemChannel(localMem);
+  if (!ch)
+    return -EINVAL;
+  if (!ch->res->ep)
+    return -ENOTCONN;
+
+  // The smallest region the data fits in, as with the host's default policy
+  struct NFRRemoteMemory * remoteMem = 0;
+  for (int i = 0; i < NETFR_MAX_MEM_REGIONS; ++i)
+  {
+    struct NFRRemoteMemory * rmem = ch->hostRegions + i;
+    if (rmem->state == NFR_RMEM_AVAILABLE && rmem->size >= length
+        && (!remoteMem || rmem->size < remoteMem->size))
+      remoteMem = rmem;
+  }
+  if (!remoteMem)
+  {
+    NFR_LOG_TRACE("Could not find suitable host buffer");
+    return -ENOBUFS;
+  }
+
+  struct NFR_CallbackInfo icbInfo = {0};
+  icbInfo.callback = nfr_ClientProcessInternalWrite;
+  icbInfo.uData[0] = ch;
+  icbInfo.uData[1] = remoteMem;
+  if (cbInfo)
+  {
+    icbInfo.uData[2] = cbInfo->callback;
+    memcpy(&icbInfo.uData[NFR_USER_CB_INDEX], cbInfo->uData,
+           sizeof(cbInfo->uData));
+  }
+
+  struct NFR_CallbackInfo scbInfo = {0};
+  scbInfo.callback = nfr_ClientProcessInternalTx;
+
+  struct NFR_TransferInfo ti = {0};
+  ti.opType                  = NFR_OP_WRITE;
+  ti.length                  = length;
+  ti.udata                   = udata;
+  ti.cbInfo                  = &scbInfo;
+  ti.writeOpts.localMem      = localMem;
+  ti.writeOpts.localOffset   = localOffset;
+  ti.writeOpts.remoteMem     = remoteMem;
+  ti.writeOpts.remoteOffset  = 0;
+  ti.writeOpts.writeCbInfo   = &icbInfo;
+  ti.writeOpts.writeSerial   = ++ch->writeSerial;
+  ti.writeOpts.channelSerial = ++ch->channelSerial;
+
+  remoteMem->state = NFR_RMEM_ALLOCATED;
+  ssize_t ret = nfr_PostTransfer(ch->res, &ti);
+  if (ret < 0)
+  {
+    --ch->writeSerial;
+    --ch->channelSerial;
+    remoteMem->state = NFR_RMEM_AVAILABLE;
+    return (int) ret;
+  }
+
+  remoteMem->writeSerial = ti.writeOpts.writeSerial;
+  NFR_LOG_DEBUG("Posted RDMA write from %p -> %p", localMem->addr,
+                (void *) (uintptr_t) remoteMem->addr);
+  return remoteMem->index;
+}
+
+int nfrClientCopyOut(PNFRCopyEngine engine, const struct NFRClientEvent * evt,
+                     void * dst, uint64_t dstSize)
+{
+  assert(evt);
+  assert(dst);
+  if (!evt || !dst || evt->type != NFR_CLIENT_EVENT_MEM_WRITE
+      || !evt->memRegion)
+    return -EINVAL;
+  if (evt->payloadLength > dstSize)
+    return -ENOBUFS;
+
+  PNFRMemory mem = evt->memRegion;
+  nfrCopy(engine, dst, (const uint8_t *) mem->addr + evt->payloadOffset,
+          evt->payloadLength);
+  nfrAckBuffer(mem);
+  return (int) evt->payloadLength;
+}
+
+int nfrClientPullFrame(PNFRMemory localMem, uint64_t localOffset)
+{
+  assert(localMem);
+  if (!localMem || localOffset >= localMem->size)
+    return -EINVAL;
+
+  struct NFRClientChannel * ch = nfr_ClientMemChannel(localMem);
+  if (!ch)
+    return -EINVAL;
+  if (!(ch->res->features & NFR_FEATURE_PULL))
+    return -ENOTSUP;
+  if (ch->pull.state != NFR_PULL_IDLE)
+    return -EBUSY;
+
+  ch->pull.mem    = localMem;
+  ch->pull.offset = localOffset;
+  ch->pull.state  = NFR_PULL_WANTED;
+  int ret = nfr_ClientPullAdvance(ch);
+  return ret == -ENOBUFS ? 0 : ret;
+}
+
+int nfrClientReadRegister(PNFRClient client, int channelID, uint8_t index,
+                          void * data, uint32_t * length)
+{
+  assert(client);
+  assert(length);
+  if (!client || !data || !length || channelID < 0 
+      || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
+
+  struct NFRClientChannel * ch = client->channels + channelID;
+  if (!ch->registers)
+    return -ENOENT;
+  if (index >= ch->res->registerCount)
+    return -EINVAL;
+  if (*length < NETFR_REGISTER_MAX_PAYLOAD)
+    return -ENOBUFS;
+
+  const volatile struct NFRRegister * reg = 
+    (const volatile struct NFRRegister *) 
+      ((uint8_t *) ch->registers->addr + (uint64_t) index * NETFR_REGISTER_SIZE);
+
+  /* The host writes seq first and seqEnd last, so the value is consistent if
+     seq still matches the seqEnd read before it */
+  for (int i = 0; i < NFR_REGISTER_READ_RETRIES; ++i)
+  {
+    uint32_t seqEnd = reg->seqEnd;
+    atomic_thread_fence(memory_order_acquire);
+    uint32_t len = reg->length;
+    if (len > NETFR_REGISTER_MAX_PAYLOAD)
+      continue;
+    memcpy(data, (const void *) reg->data, len);
+    atomic_thread_fence(memory_order_acquire);
+    if (reg->seq != seqEnd)
+      continue;
+
+    if (!seqEnd)
+      return -ENODATA;
+    *length = len;
+    if (seqEnd == ch->registerSeq[index])
+      return 0;
+    ch->registerSeq[index] = seqEnd;
+    return 1;
+  }
+  return -EAGAIN;
+}
+
+int nfrClientSetSendQueue(PNFRClient client, int channelID, uint32_t depth,
+                          uint8_t policy)
+{
+  assert(client);
+  if (!client || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
+
+  return nfr_SendQInit(&client->channels[channelID].sendq, depth, policy);
+}
+
+int nfrClientGetSendQueueStats(PNFRClient client, int channelID,
+                               struct NFRSendQueueStats * stats)
+{
+  assert(client);
+  assert(stats);
+  if (!client || !stats || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
+
+  *stats = client->channels[channelID].sendq.stats;
+  return 0;
 }
 
 int nfrClientConnect(struct NFRClient * client)
@@ -531,49 +1300,56 @@ int nfrClientConnect(struct NFRClient * client)
   // Initialize the connection
   int ret;
   int connOk = 0;
+  int connTotal = 0;
   for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
   {
-    switch (client->channels[i].res->connState)
+    struct NFRClientChannel * ch = client->channels + i;
+    connTotal += ch->railCount;
+    for (int r = 0; r < ch->railCount; ++r)
     {
-      case NFR_CONN_STATE_READY_TO_CONNECT:
+      struct NFRResource * res = ch->rails[r];
+      assert(res);
+      if (!res)
       {
-        struct NFRResource * res = client->channels[i].res;
-        assert(res);
-        if (!res)
+        NFR_LOG_DEBUG("Resource not found");
+        return -EINVAL;
+      }
+
+      switch (res->connState)
+      {
+        case NFR_CONN_STATE_READY_TO_CONNECT:
         {
-          NFR_LOG_DEBUG("Resource not found");
-          return -EINVAL;
+          struct sockaddr_in tgt = nfr_GetRailAddr(&client->peerInfo, i, r);
+          ret = nfr_InitiateConnection(res, &tgt);
+          if (ret < 0)
+          {
+            NFR_LOG_DEBUG("Failed to initiate connection on channel %d rail "
+                          "%d: %s (%d)", i, r, fi_strerror(-ret), ret);
+            return ret;
+          }
+          break;
         }
-
-        ret = nfr_InitiateConnection(res, &client->peerInfo.addrs[i]);
-        if (ret < 0)
+        case NFR_CONN_STATE_CONNECTING:
         {
-          NFR_LOG_DEBUG("Failed to initiate connection on channel %d: %s (%d)",
-                        i, fi_strerror(-ret), ret);
-          return ret;
+          ret = nfr_CheckConnState(res);
+          if (ret < 0)
+          {
+            NFR_LOG_DEBUG("Connection error: %s (%d)",
+                          fi_strerror(-ret), ret);
+            return ret;
+          }
+          break;
         }
-        break;
-      }
-      case NFR_CONN_STATE_CONNECTING:
-      {
-        ret = nfr_CheckConnState(client->channels[i].res);
-        if (ret < 0)
+        case NFR_CONN_STATE_CONNECTED:
         {
-          NFR_LOG_DEBUG("Connection error: %s (%d)",
-                        fi_strerror(-ret), ret);
-          return ret;
+          ++connOk;
+          break;
         }
-        break;
-      }
-      case NFR_CONN_STATE_CONNECTED:
-      {
-        ++connOk;
-        break;
       }
     }
   }
 
-  if (connOk == NETFR_NUM_CHANNELS)
+  if (connOk == connTotal)
     return 0;
 
   return -EAGAIN;
@@ -612,8 +1388,22 @@ int nfrClientInit(const struct NFRInitOpts * opts,
   {
     client->channels[i].parent = client;
     client->channels[i].res = res[i];
-    client->channels[i].res->txCredits = NETFR_CREDIT_COUNT;
-    struct NFRCommBufInfo info = nfr_GetDefaultCommBufInfo();
+    for (int j = 0; j < NETFR_MAX_MEM_REGIONS; ++j)
+    {
+      client->channels[i].hostRegions[j].parentResource = res[i];
+      client->channels[i].hostRegions[j].index = j;
+    }
+    nfr_CreditReset(res[i], NETFR_CREDIT_COUNT);
+    client->channels[i].res->txCallback = nfr_ClientProcessInternalTx;
+    // Channels sharing a receive pool only need their transmit slots
+    struct NFRCommBufInfo info = res[i]->commBuf.info;
+    if (nfr_ResourceRxPool(res[i]) != res[i])
+      info.rxSlots = 0;
+    else if (res[i]->multiRecv)
+    {
+      info.multiRecvBufs = nfr_MultiRecvBufCount(&info);
+      info.multiRecvSize = NFR_MULTI_RECV_SIZE;
+    }
     ret = nfr_CommBufOpen(res[i], &info);
     if (ret < 0)
     {
@@ -621,7 +1411,17 @@ int nfrClientInit(const struct NFRInitOpts * opts,
                     fi_strerror(-ret), ret);
       goto closeResources;
     }
+    ret = nfr_SendQInit(&client->channels[i].sendq,
+                        NETFR_SEND_QUEUE_DEFAULT_DEPTH, NFR_SEND_QUEUE_REJECT);
+    if (ret < 0)
+      goto closeResources;
     client->channels[i].res->connState = NFR_CONN_STATE_READY_TO_CONNECT;
+
+    client->channels[i].rails[0] = res[i];
+    ret = nfr_ResourceOpenRails(opts, i, client->channels[i].rails);
+    if (ret < 0)
+      goto closeResources;
+    client->channels[i].railCount = ret;
   }
 
   memcpy(&client->peerInfo, peerInfo, sizeof(*peerInfo));
@@ -629,22 +1429,60 @@ int nfrClientInit(const struct NFRInitOpts * opts,
   return 0;
 
 closeResources:
-  for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
+  // Channels sharing the first channel's domain are closed before it
+  for (int i = NETFR_NUM_CHANNELS - 1; i >= 0; --i)
   {
+    for (int r = 1; client && r < NETFR_MAX_RAILS; ++r)
+      nfr_ResourceClose(client->channels[i].rails[r]);
+    if (client)
+    {
+      nfr_CoalesceFree(&client->channels[i].coalesce);
+      nfr_SendQFree(&client->channels[i].sendq);
+      nfr_FragmentFree(&client->channels[i].fragment);
+      nfr_ReassembleFree(&client->channels[i].reassemble);
+    }
     nfr_ResourceClose(res[i]);
   }
   free(client);
   return ret;
 }
 
+int nfrClientGetCreditStats(PNFRClient client, int channelID,
+                            struct NFRCreditStats * stats)
+{
+  assert(client);
+  assert(stats);
+  if (!client || !stats || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
+
+  nfr_CreditGetStats(client->channels[channelID].res, stats);
+  return 0;
+}
+
 void nfrClientFree(PNFRClient * res)
 {
   if (!res || !*res)
     return;
 
   struct NFRClient * client = *res;
-  for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
+  for (int i = NETFR_NUM_CHANNELS - 1; i >= 0; --i)
   {
+    for (int r = 1; r < client->channels[i].railCount; ++r)
+      nfr_ResourceClose(client->channels[i].rails[r]);
+
+    nfr_ThreadPoolFree(&client->channels[i].decompressPool);
+    nfr_CoalesceFree(&client->channels[i].coalesce);
+    nfr_SendQFree(&client->channels[i].sendq);
+    nfr_FragmentFree(&client->channels[i].fragment);
+    nfr_ReassembleFree(&client->channels[i].reassemble);
+    nfr_EagerFree(&client->channels[i].eager);
+    if (client->channels[i].registers)
+      nfrFreeMemory(&client->channels[i].registers);
+    if (client->channels[i].cache.mem)
+      nfrFreeMemory(&client->channels[i].cache.mem);
+    if (client->channels[i].staging)
+      nfrFreeMemory(&client->channels[i].staging);
+
     if (client->channels[i].res)
     {
       nfr_CommBufClose(&client->channels[i].res->commBuf);
@@ -25,6 +25,49 @@
 #include <stdatomic.h>
 #include <stdalign.h>
 
+#include "netfr/netfr_client.h"
+
+#include "common/nfr_thread.h"
+#include "common/nfr_sendq.h"
+#include "common/nfr_coalesce.h"
+#include "common/nfr_fragment.h"
+#include "common/nfr_eager.h"
+
+/* Number of attempts at reading a register being overwritten by the host */
+#define NFR_REGISTER_READ_RETRIES 16
+
+enum NFRClientPullState
+{
+  NFR_PULL_IDLE,
+  NFR_PULL_WANTED,    // Waiting for a frame newer than the last one
+  NFR_PULL_READING,   // Frame read in flight
+  NFR_PULL_READ,      // Frame read, generation not checked yet
+  NFR_PULL_CHECKING,  // Generation read in flight
+  NFR_PULL_DONE       // Frame read intact, not reported yet
+};
+
+/* Frame pulled from the host, see nfrClientPullFrame */
+struct NFRClientPull
+{
+  struct NFRMsgFrameDesc desc;      // Newest frame published by the host
+  struct NFRMsgFrameDesc reading;   // Frame being read
+  uint64_t             lastGeneration;
+  struct NFRMemory   * mem;         // Destination of the read
+  uint64_t             offset;
+  uint64_t             torn;        // Reads discarded after an overwrite
+  uint8_t              state;
+};
+
+/* Content cache the host stores messages in, see nfrHostSendCached */
+struct NFRClientCache
+{
+  struct NFRMemory   * mem;         // NETFR_CACHE_SLOT_SIZE bytes per slot
+  uint64_t             hash[NETFR_MAX_CACHE_SLOTS];
+  uint32_t             length[NETFR_MAX_CACHE_SLOTS];
+  uint64_t             valid;       // Slots holding a message, one bit each
+  uint64_t             report;      // Slots not reported yet, one bit each
+};
+
 struct NFRClient;
 
 struct NFRClientChannel
@@ -37,6 +80,30 @@ struct NFRClientChannel
   uint32_t             writeSerial;
   uint32_t             channelSerial;
   uint32_t             memSerial;  // Used for RDMA write confirmations
+  // Rails the host can stripe writes over; rails[0] is the same as res
+  struct NFRResource * rails[NETFR_MAX_RAILS];
+  uint8_t              railCount;
+  // Receives compressed writes, if compression was negotiated
+  struct NFRMemory   * staging;
+  struct NFRThreadPool * decompressPool;
+  // Messages waiting for credits or send contexts
+  struct NFRSendQueue  sendq;
+  // Small messages packed before they are queued
+  struct NFRCoalescer  coalesce;
+  // Large message being sent and received in fragments
+  struct NFRFragmenter fragment;
+  struct NFRReassembler reassemble;
+  // Ring the host writes small messages into, if negotiated
+  struct NFREagerRing  eager;
+  // Latest value registers the host writes, if negotiated
+  struct NFRMemory   * registers;
+  uint32_t             registerSeq[NETFR_MAX_REGISTERS];  // Last read
+  // Regions the host exposed for client writes
+  struct NFRRemoteMemory hostRegions[NETFR_MAX_MEM_REGIONS];
+  // Frame being pulled, if negotiated
+  struct NFRClientPull pull;
+  // Messages cached for the host, if negotiated
+  struct NFRClientCache cache;
 };
 
 struct NFRClient
@@ -45,5 +112,34 @@ struct NFRClient
   struct NFRInitOpts peerInfo;
 };
 
+/**
+ * @brief Allocate the content cache, which is announced to the host along with
+ *        the other buffers.
+ */
+void nfr_ClientCacheOpen(struct NFRClientChannel * ch);
+
+/**
+ * @brief Report the cache slots stored since the last report to the host.
+ *
+ * @return 0 on success, negative error code on failure
+ */
+int nfr_ClientCacheReport(struct NFRClientChannel * ch);
+
+/**
+ * @brief Process a fragment of a large message from the host, storing or
+ *        resolving cached messages.
+ *
+ * @param ch    Channel
+ *
+ * @param msg   Data message carrying the fragment
+ *
+ * @param evt   Event filled in once the message is complete
+ *
+ * @return 1 if the message is complete, 0 otherwise
+ */
+int nfr_ClientReadFragment(struct NFRClientChannel * ch,
+                           const struct NFRMsgHostData * msg,
+                           struct NFRClientEvent * evt);
+
 
 #endif
\ No newline at end of file
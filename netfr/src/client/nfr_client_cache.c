@@ -0,0 +1,161 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+/* Large messages and the content cache */
+
+#include <string.h>
+#include <errno.h>
+
+#include "netfr/netfr_client.h"
+#include "client/nfr_client.h"
+#include "client/nfr_client_callback.h"
+
+#include "common/nfr.h"
+#include "common/nfr_hash.h"
+#include "common/nfr_log.h"
+#include "common/nfr_mem.h"
+
+void nfr_ClientCacheOpen(struct NFRClientChannel * ch)
+{
+  struct NFRResource * res = ch->res;
+  uint64_t size = (uint64_t) res->cacheSlots * NETFR_CACHE_SLOT_SIZE;
+  ch->cache.mem = nfr_RdmaAttach(res, 0, size, FI_READ | FI_WRITE,
+                                 NFR_MEM_TYPE_SYSTEM_MANAGED,
+                                 MEM_STATE_AVAILABLE_UNSYNCED);
+  if (!ch->cache.mem)
+  {
+    NFR_LOG_WARNING("Failed to allocate %u cache slots, disabling the cache",
+                    res->cacheSlots);
+    res->features &= ~NFR_FEATURE_CACHE;
+    return;
+  }
+
+  ch->cache.valid  = 0;
+  ch->cache.report = 0;
+  NFR_LOG_DEBUG("Allocated %u cache slots", res->cacheSlots);
+}
+
+int nfr_ClientCacheReport(struct NFRClientChannel * ch)
+{
+  struct NFRClientCache * cache = &ch->cache;
+  while (cache->report)
+  {
+    int slot = __builtin_ctzll(cache->report);
+
+    struct NFRMsgCacheState msg;
+    memset(&msg, 0, sizeof(msg));
+    nfr_SetHeader(&msg.header, NFR_MSG_CACHE_STATE);
+    msg.hash = cache->hash[slot];
+    msg.slot = (uint8_t) slot;
+
+    struct NFR_CallbackInfo cbInfo = {0};
+    cbInfo.callback = nfr_ClientProcessInternalTx;
+
+    struct NFR_TransferInfo ti = {0};
+    ti.opType = NFR_OP_SEND_COPY;
+    ti.data   = &msg;
+    ti.cbInfo = &cbInfo;
+    ti.length = sizeof(msg);
+
+    ssize_t ret = nfr_PostTransfer(ch->res, &ti);
+    if (ret < 0)
+      return ret == -EAGAIN ? 0 : (int) ret;
+
+    cache->report &= ~(1ULL << slot);
+  }
+  return 0;
+}
+
+/**
+ * @brief Store a complete message in the slot chosen by the host, to be
+ *        reported once posting is possible.
+ */
+static void nfr_ClientCacheStore(struct NFRClientChannel * ch,
+                                 const uint8_t * data, uint32_t length,
+                                 uint8_t slot)
+{
+  struct NFRClientCache * cache = &ch->cache;
+  if (!cache->mem || slot >= ch->res->cacheSlots)
+  {
+    NFR_LOG_WARNING("Message for invalid cache slot %u", slot);
+    return;
+  }
+
+  uint8_t * dst = (uint8_t *) cache->mem->addr
+                  + (uint64_t) slot * NETFR_CACHE_SLOT_SIZE;
+  memcpy(dst, data, length);
+  cache->hash[slot]   = nfr_Hash64(dst, length);
+  cache->length[slot] = length;
+  cache->valid       |= 1ULL << slot;
+  cache->report      |= 1ULL << slot;
+}
+
+int nfr_ClientReadFragment(struct NFRClientChannel * ch,
+                           const struct NFRMsgHostData * msg,
+                           struct NFRClientEvent * evt)
+{
+  int index = (int) (ch - ch->parent->channels);
+  struct NFRMsgFragment frag;
+  memcpy(&frag, msg->data, sizeof(frag));
+
+  // A message the host knows is in the cache
+  if (frag.flags & NFR_FRAGMENT_FLAG_CACHE_REF)
+  {
+    struct NFRClientCache * cache = &ch->cache;
+    uint64_t hash;
+    memcpy(&hash, msg->data + sizeof(frag), sizeof(hash));
+    if (!cache->mem || !(cache->valid & (1ULL << frag.cacheSlot))
+        || cache->hash[frag.cacheSlot] != hash
+        || cache->length[frag.cacheSlot] != frag.total)
+    {
+      assert(!"Host referred to a message not in the cache");
+      NFR_LOG_WARNING("Discarded message of unknown cache slot %u on "
+                      "channel %d", frag.cacheSlot, index);
+      return 0;
+    }
+
+    uint64_t offset = (uint64_t) frag.cacheSlot * NETFR_CACHE_SLOT_SIZE;
+    evt->type          = NFR_CLIENT_EVENT_LARGE_DATA;
+    evt->memRegion     = cache->mem;
+    evt->largeData     = (const uint8_t *) cache->mem->addr + offset;
+    evt->payloadOffset = (uint32_t) offset;
+    evt->payloadLength = frag.total;
+    evt->udata         = msg->udata;
+    return 1;
+  }
+
+  struct NFRReassembler * r = &ch->reassemble;
+  int ret = nfr_ReassembleAdd(r, msg->data, msg->length, msg->udata);
+  if (ret < 0)
+    NFR_LOG_WARNING("Discarded large message on channel %d: %s (%d)", index,
+                    fi_strerror(-ret), ret);
+  if (ret != 1)
+    return 0;
+
+  if (r->flags & NFR_FRAGMENT_FLAG_CACHE)
+    nfr_ClientCacheStore(ch, r->buf, r->total, r->cacheSlot);
+
+  evt->type          = NFR_CLIENT_EVENT_LARGE_DATA;
+  evt->largeData     = r->buf;
+  evt->payloadLength = r->total;
+  evt->udata         = r->udata;
+  return 1;
+}
@@ -18,21 +18,71 @@
  * Place, Suite 330, Boston, MA 02111-1307 USA
  */
 
+#include <inttypes.h>
+
 #include "client/nfr_client_callback.h"
 
 #include "common/nfr_protocol.h"
+#include "common/nfr_compress.h"
+#include "common/nfr_credit.h"
+#include "common/nfr_coalesce.h"
+#include "common/nfr_fragment.h"
 
 void nfr_ClientProcessInternalTx(struct NFRFabricContext * ctx)
 {
   ASSERT_CONTEXT_VALID(ctx);
   
-  struct NFRHeader * hdr = (struct NFRHeader *) ctx->slot->data;
+  struct NFRHeader * hdr = (struct NFRHeader *) nfr_ContextData(ctx);
   NFR_LOG_DEBUG("Processing txctx %p -> type %d", ctx, hdr->type);
   
   assert(ctx->state == CTX_STATE_WAITING || ctx->state == CTX_STATE_ACK_ONLY);
   NFR_RESET_CONTEXT(ctx);
 }
 
+/**
+ * @brief Decompress a compressed write from the staging buffer into its target
+ *        buffer, and return the staging buffer to the host.
+ *
+ * @return 0 on success, negative error code on failure
+ */
+static int nfr_ClientDecompress(struct NFRClientChannel * chan,
+                                struct NFRMemory * mem,
+                                const struct NFRMsgBufferUpdate * update)
+{
+  if (!chan->staging || update->sliceCount > NFR_COMPRESS_MAX_SLICES)
+  {
+    NFR_LOG_ERROR("Received unexpected compressed write to buffer %d",
+                  update->bufferIndex);
+    return -EINVAL;
+  }
+
+  const struct NFRMsgSlice * msgSlices = (const struct NFRMsgSlice *) \
+    (update->ranges + update->rangeCount);
+  struct NFRCompressSlice slices[NFR_COMPRESS_MAX_SLICES];
+  for (int i = 0; i < update->sliceCount; ++i)
+  {
+    slices[i].offset    = msgSlices[i].offset;
+    slices[i].length    = msgSlices[i].length;
+    slices[i].rawOffset = msgSlices[i].rawOffset;
+    slices[i].rawLength = msgSlices[i].rawLength;
+  }
+
+  int ret = nfr_Decompress(chan->decompressPool, chan->staging->addr,
+                           chan->staging->size, mem->addr, mem->size, slices,
+                           update->sliceCount);
+
+  // The staging buffer can be reused as soon as its contents are consumed
+  chan->staging->state = MEM_STATE_AVAILABLE_UNSYNCED;
+  if (ret < 0)
+  {
+    NFR_LOG_ERROR("Failed to decompress write to buffer %d: %s (%d)",
+                  update->bufferIndex, fi_strerror(-ret), ret);
+    return ret;
+  }
+
+  return 0;
+}
+
 void nfr_ClientProcessInternalRx(struct NFRFabricContext * ctx)
 {
   NFR_LOG_DEBUG("Processing rxctx %p", ctx);
@@ -44,7 +94,7 @@ void nfr_ClientProcessInternalRx(struct NFRFabricContext * ctx)
   assert(client);
   assert(chan);
 
-  struct NFRHeader * hdr = (struct NFRHeader *) ctx->slot->data;
+  struct NFRHeader * hdr = (struct NFRHeader *) nfr_ContextData(ctx);
   if (memcmp(hdr->magic, NETFR_MAGIC, 8) != 0 || hdr->version != NETFR_VERSION)
   {
     assert(!"Invalid message header");
@@ -52,51 +102,172 @@ void nfr_ClientProcessInternalRx(struct NFRFabricContext * ctx)
     return;
   }
 
+  // Receives from a shared pool may belong to any of the sharing channels
+  if (chan->res->rxPool)
+  {
+    if (hdr->channel >= NETFR_NUM_CHANNELS)
+    {
+      assert(!"Invalid channel index");
+      NFR_RESET_CONTEXT(ctx);
+      return;
+    }
+    chan = client->channels + hdr->channel;
+  }
+  ctx->slot->channel = hdr->channel;
+
   switch (hdr->type)
   {
     case NFR_MSG_BUFFER_UPDATE:
     {
       struct NFRMsgBufferUpdate * update = (struct NFRMsgBufferUpdate *) hdr;
-      if (update->bufferIndex >= NETFR_MAX_MEM_REGIONS)
+      if (update->bufferIndex >= nfr_ResourceMemRegionCount(chan->res))
       {
         assert(!"Invalid buffer index");
         NFR_RESET_CONTEXT(ctx);
         return;
       }
       struct NFRMemory * mem = chan->res->memRegions + update->bufferIndex;
-      if (update->payloadOffset + update->payloadSize > mem->size)
+      if ((uint64_t) update->payloadOffset + update->payloadSize > mem->size
+          || update->rangeCount > NETFR_MAX_WRITE_RANGES
+          || update->sliceCount > NFR_MSG_MAX_SLICES
+          || update->metaLength > NETFR_WRITE_METADATA_MAX_SIZE)
       {
         assert(!"Invalid buffer update");
         NFR_RESET_CONTEXT(ctx);
         return;
       }
+      for (int i = 0; i < update->rangeCount; ++i)
+      {
+        const struct NFRMsgRange * r = update->ranges + i;
+        uint32_t rows = r->rows ? r->rows : 1;
+        if (r->offset + (uint64_t) r->pitch * (rows - 1) + r->length
+            > mem->size)
+        {
+          assert(!"Invalid buffer update range");
+          NFR_RESET_CONTEXT(ctx);
+          return;
+        }
+        mem->ranges[i].offset = r->offset;
+        mem->ranges[i].length = r->length;
+        mem->ranges[i].pitch  = r->pitch;
+        mem->ranges[i].rows   = rows;
+      }
+      if (update->sliceCount 
+          && nfr_ClientDecompress(chan, mem, update) < 0)
+      {
+        // The host still gets the buffer back, but the write is lost
+        mem->state = MEM_STATE_AVAILABLE_UNSYNCED;
+        NFR_RESET_CONTEXT(ctx);
+        return;
+      }
+      mem->rangeCount    = update->rangeCount;
       mem->state         = MEM_STATE_HAS_DATA;
       mem->payloadOffset = update->payloadOffset;
       mem->payloadLength = update->payloadSize;
       mem->writeSerial   = update->writeSerial;
       mem->channelSerial = update->channelSerial;
       mem->udata         = update->udata;
+      mem->metaLength    = update->metaLength;
+      memcpy(mem->meta, (const uint8_t *) (update->ranges + update->rangeCount)
+             + update->sliceCount * sizeof(struct NFRMsgSlice),
+             update->metaLength);
       NFR_RESET_CONTEXT(ctx);
       return;
     }
     case NFR_MSG_HOST_DATA:
     {
       struct NFRMsgHostData * msg = (struct NFRMsgHostData *) hdr;
-      if (msg->length > NETFR_MESSAGE_MAX_PAYLOAD_SIZE || msg->length == 0)
+      if (msg->length > NETFR_MESSAGE_MAX_PAYLOAD_SIZE || msg->length == 0
+          || msg->length + offsetof(struct NFRMsgHostData, data)
+             > ctx->parentResource->commBuf.info.slotSize)
       {
         assert(!"Invalid message length");
         NFR_RESET_CONTEXT(ctx);
         return;
       }
+      int valid = msg->records == NFR_MSG_FRAGMENT
+                  ? nfr_FragmentValidate(msg->data, msg->length)
+                  : nfr_CoalesceValidate(msg->data, msg->length, msg->records);
+      if (valid < 0)
+      {
+        assert(!"Packed records or fragment are invalid");
+        NFR_RESET_CONTEXT(ctx);
+        return;
+      }
       ctx->state               = CTX_STATE_HAS_DATA;
+      nfr_CreditReceived(chan->res);
       ctx->slot->msgSerial     = msg->msgSerial;
       ctx->slot->channelSerial = msg->channelSerial;
+      ctx->slot->record        = 0;
+      return;
+    }
+    case NFR_MSG_BUFFER_STATE:
+    {
+      struct NFRMsgBufferState * state = (struct NFRMsgBufferState *) hdr;
+      if (state->flags & NFR_BUFFER_FLAG_EAGER_COUNTER)
+      {
+        if (!chan->eager.mem || state->size < sizeof(uint64_t))
+        {
+          assert(!"Invalid eager ring counter");
+          NFR_RESET_CONTEXT(ctx);
+          return;
+        }
+        chan->eager.remoteAddr = state->addr;
+        chan->eager.remoteKey  = state->rkey;
+        chan->eager.ready      = 1;
+        NFR_RESET_CONTEXT(ctx);
+        return;
+      }
+
+      // A region the host exposed, or released after a client write
+      if (state->index >= NETFR_MAX_MEM_REGIONS || state->flags)
+      {
+        assert(!"Invalid buffer state");
+        NFR_RESET_CONTEXT(ctx);
+        return;
+      }
+      struct NFRRemoteMemory * rmem = chan->hostRegions + state->index;
+      if (rmem->state == NFR_RMEM_BUSY_LOCAL)
+      {
+        assert(!"Host caused invalid state transition");
+        NFR_RESET_CONTEXT(ctx);
+        return;
+      }
+      if (rmem->addr != state->addr || rmem->size != state->size
+          || rmem->rkey != state->rkey)
+        rmem->writeSerial = 0;
+      rmem->addr          = state->addr;
+      rmem->size          = state->size;
+      rmem->rkey          = state->rkey;
+      rmem->align         = state->pageSize;
+      rmem->priority      = state->priority;
+      rmem->railKeys[0]   = state->rkey;
+      rmem->railCount     = 1;
+      rmem->activeContext = 0;
+      rmem->state         = state->size ? NFR_RMEM_AVAILABLE : NFR_RMEM_NONE;
+      NFR_RESET_CONTEXT(ctx);
+      return;
+    }
+    case NFR_MSG_FRAME_DESC:
+    {
+      // Only the newest frame is of interest, and descriptors arrive in order
+      struct NFRMsgFrameDesc * desc = (struct NFRMsgFrameDesc *) hdr;
+      if (!(chan->res->features & NFR_FEATURE_PULL) || !desc->length
+          || !desc->generation)
+      {
+        assert(!"Invalid frame descriptor");
+        NFR_RESET_CONTEXT(ctx);
+        return;
+      }
+      chan->pull.desc = *desc;
+      NFR_RESET_CONTEXT(ctx);
       return;
     }
     case NFR_MSG_CLIENT_DATA_ACK:
     {
+      struct NFRMsgClientDataAck * ack = (struct NFRMsgClientDataAck *) hdr;
+      nfr_CreditAcked(chan->res, ack->credits);
       NFR_RESET_CONTEXT(ctx);
-      ++chan->res->txCredits;
       return;
     }
     default:
@@ -105,4 +276,87 @@ void nfr_ClientProcessInternalRx(struct NFRFabricContext * ctx)
       return;
     }
   }
-}
\ No newline at end of file
+}
+
+// Process a completed write into a host region
+// udata: (NFRClientChannel * ch, NFRRemoteMemory * remoteMem,
+//         NFRCallback userCb)
+void nfr_ClientProcessInternalWrite(struct NFRFabricContext * ctx)
+{
+  NFR_LOG_TRACE("Processing wrctx %p", ctx);
+  ASSERT_CONTEXT_VALID(ctx);
+
+  NFR_CAST_UDATA(struct NFRClientChannel *, ch, ctx, 0);
+  NFR_CAST_UDATA(struct NFRRemoteMemory *, rmem, ctx, 1);
+  NFRCallback userCb = (NFRCallback) ctx->cbInfo.uData[2];
+  assert(ch);
+
+  if (ctx->state == CTX_STATE_CANCELED)
+  {
+    NFR_LOG_DEBUG("Write to host buffer %d canceled", rmem->index);
+    rmem->state       = NFR_RMEM_AVAILABLE;
+    rmem->writeSerial = 0;
+    NFR_RESET_CONTEXT(ctx);
+    return;
+  }
+
+  // The host releases the region once it has consumed the write
+  if (rmem->state == NFR_RMEM_BUSY_LOCAL)
+    rmem->state = NFR_RMEM_BUSY_REMOTE;
+
+  if (userCb)
+  {
+    const void ** uudata = (const void **)(ctx->cbInfo.uData + NFR_USER_CB_INDEX);
+    userCb(uudata);
+  }
+
+  NFR_RESET_CONTEXT(ctx);
+}
+
+// Process a completed read of a pulled frame or its generation
+// udata: (NFRClientChannel * ch)
+void nfr_ClientProcessInternalRead(struct NFRFabricContext * ctx)
+{
+  NFR_LOG_TRACE("Processing rdctx %p", ctx);
+  ASSERT_CONTEXT_VALID(ctx);
+
+  NFR_CAST_UDATA(struct NFRClientChannel *, ch, ctx, 0);
+  struct NFRClientPull * pull = &ch->pull;
+
+  // The read is retried with the newest frame
+  if (ctx->state == CTX_STATE_CANCELED)
+  {
+    NFR_LOG_DEBUG("Read of frame %" PRIu64 " canceled",
+                  pull->reading.generation);
+    pull->state = NFR_PULL_WANTED;
+    return;
+  }
+
+  switch (pull->state)
+  {
+    case NFR_PULL_READING:
+      pull->state = NFR_PULL_READ;
+      return;
+    case NFR_PULL_CHECKING:
+    {
+      /* The host changes the generation before overwriting the frame, so the
+         frame is intact if the generation read after it still matches */
+      uint64_t generation;
+      memcpy(&generation, ctx->slot->data, sizeof(generation));
+      if (generation == pull->reading.generation)
+      {
+        pull->state = NFR_PULL_DONE;
+        return;
+      }
+      NFR_LOG_DEBUG("Read of frame %" PRIu64 " torn by an overwrite",
+                    pull->reading.generation);
+      ++pull->torn;
+      pull->lastGeneration = pull->reading.generation;
+      pull->state          = NFR_PULL_WANTED;
+      return;
+    }
+    default:
+      assert(!"Invalid pull state");
+      return;
+  }
+}
@@ -34,4 +34,8 @@ void nfr_ClientProcessInternalTx(struct NFRFabricContext * ctx);
 
 void nfr_ClientProcessInternalRx(struct NFRFabricContext * ctx);
 
+void nfr_ClientProcessInternalWrite(struct NFRFabricContext * ctx);
+
+void nfr_ClientProcessInternalRead(struct NFRFabricContext * ctx);
+
 #endif
\ No newline at end of file
@@ -23,6 +23,449 @@
 #include "common/nfr_constants.h"
 #include "common/nfr_protocol.h"
 #include "common/nfr_log.h"
+#include "common/nfr_compress.h"
+
+static_assert(NFR_COMPRESS_MAX_SLICES <= NFR_MSG_MAX_SLICES
+              && NFR_COMPRESS_MAX_SLICES <= NETFR_MAX_WRITE_RANGES,
+              "Compressed slices do not fit in a buffer update");
+
+/**
+ * @brief Post a send, or defer it until the batch of the resource is flushed.
+ *
+ * The send is the last operation of a batch, so FI_MORE is never set. The
+ * callback info of the context must already be set.
+ */
+static ssize_t nfr_PostSend(struct NFRResource * res,
+                            struct NFRFabricContext * ctx, size_t length)
+{
+  /* Deferred sends are posted on the resource owning the context, so a
+     receive slot from a shared pool is always sent immediately */
+  if (res->batching && ctx->parentResource == res)
+  {
+    ctx->slot->length = (uint32_t) length;
+    nfr_ResourceDefer(ctx);
+    return 0;
+  }
+  return nfr_ResourceSend(res, ctx, length, 0);
+}
+
+/**
+ * @brief Split a write into stripes over several rails.
+ *
+ * Every stripe references the same write context, so its callback is invoked
+ * only once, after all stripes have completed. Stripes which could not be
+ * posted on their own rail are retried on the first rail.
+ *
+ * @param ti    Transfer info, with the rails set in ``ti->writeOpts``
+ *
+ * @param wctx  Write context, with its callback info already set
+ *
+ * @return      0 on success, negative error code on failure. If the write
+ *              failed after some of the stripes were posted, the context is
+ *              marked as canceled and ``wctx->pending`` is nonzero; the context
+ *              is then released once the posted stripes complete.
+ */
+static ssize_t nfr_PostStripedWrite(struct NFR_TransferInfo * ti,
+                                    struct NFRFabricContext * wctx)
+{
+  struct NFR_TransferWrite * tiw = &ti->writeOpts;
+  assert(tiw->railCount > 1 && tiw->railCount <= NETFR_MAX_RAILS);
+  assert(tiw->railIndex[0] == 0);
+
+  uint64_t stripe = ti->length / tiw->railCount;
+  stripe = (stripe + NETFR_RAIL_STRIPE_ALIGN - 1) 
+           & ~((uint64_t) NETFR_RAIL_STRIPE_ALIGN - 1);
+  
+  uint64_t done   = 0;
+  uint32_t posted = 0;
+  ssize_t  ret    = 0;
+  for (int i = 0; i < tiw->railCount && done < ti->length; ++i)
+  {
+    uint64_t len = ti->length - done;
+    if (len > stripe && i < tiw->railCount - 1)
+      len = stripe;
+
+    void * lbuf = (uint8_t *) tiw->localMem->addr + tiw->localOffset + done;
+    uint64_t rbuf = tiw->remoteMem->addr + tiw->remoteOffset + done;
+
+    int r = tiw->railIndex[i];
+    struct NFRResource * rail = tiw->rails[i];
+    ret = fi_write(rail->ep, lbuf, len,
+                   fi_mr_desc(nfr_MemRailMr(tiw->localMem, r)), 0,
+                   rbuf, tiw->remoteMem->railKeys[r], wctx);
+    if (ret < 0 && i > 0)
+    {
+      NFR_LOG_DEBUG("Stripe post on rail %d failed: %s (%d), using rail 0",
+                    r, fi_strerror((int) -ret), (int) ret);
+      rail = tiw->rails[0];
+      ret  = fi_write(rail->ep, lbuf, len,
+                      fi_mr_desc(tiw->localMem->mr), 0, rbuf,
+                      tiw->remoteMem->rkey, wctx);
+    }
+    if (ret < 0)
+    {
+      NFR_LOG_DEBUG("Failed to post stripe: %s (%d)", fi_strerror((int) -ret),
+                    (int) ret);
+      break;
+    }
+
+    ++rail->stats.writesPosted;
+    rail->stats.bytesWritten += len;
+    done += len;
+    ++posted;
+  }
+
+  wctx->pending = posted;
+  if (ret < 0)
+  {
+    if (posted)
+      wctx->state = CTX_STATE_CANCELED;
+    return ret;
+  }
+
+  wctx->state = CTX_STATE_WAITING;
+  return 0;
+}
+
+/**
+ * @brief Get the number of segments a range is written as.
+ *
+ * Ranges whose rows are contiguous, or which have more rows than fit into a
+ * single write operation, are written as a single segment spanning all rows
+ * when the pitches match. This rewrites the unchanged data between the rows,
+ * but keeps the number of work requests low on providers such as verbs, where
+ * each remote segment requires its own work request.
+ *
+ * @param r      The range
+ *
+ * @param limit  Maximum number of segments per write operation
+ *
+ * @param span   Set to the length of the segments
+ *
+ * @return       The number of segments
+ */
+static uint32_t nfr_RangeSegments(const struct NFRWriteRange * r, size_t limit,
+                                  uint64_t * span)
+{
+  uint32_t rows = r->rows ? r->rows : 1;
+  if (rows == 1
+      || (r->localPitch == r->remotePitch
+          && (r->length == r->localPitch || rows > limit)))
+  {
+    *span = (uint64_t) r->localPitch * (rows - 1) + r->length;
+    return 1;
+  }
+  *span = r->length;
+  return rows;
+}
+
+/**
+ * @brief Cancel a write whose data could not be posted completely.
+ *
+ * The reference held by the caller is dropped, so the write callback is
+ * invoked with the context in the canceled state once the work requests
+ * already posted have completed, or right away if there are none.
+ */
+static void nfr_CancelWrite(struct NFRFabricContext * wctx)
+{
+  wctx->state = CTX_STATE_CANCELED;
+  if (wctx->pending > 1)
+  {
+    --wctx->pending;
+    return;
+  }
+
+  if (wctx->cbInfo.callback)
+    wctx->cbInfo.callback(wctx);
+  memset(&wctx->cbInfo, 0, sizeof(wctx->cbInfo));
+  NFR_RESET_CONTEXT(wctx);
+}
+
+/**
+ * @brief Post as many work requests of a partial write as the transmit queue
+ *        and the reserved transmit CQ entries allow.
+ *
+ * Segments are combined into as few work requests as the provider's iov
+ * limits allow. All work requests reference the same write context. Each one
+ * but the last of the write takes a reference on the context and a reserved
+ * CQ entry, while the last one takes over the reference held by the caller.
+ *
+ * @param rw  Partial write, whose context holds a reference
+ *
+ * @return    The number of work requests posted, or a negative error code if
+ *            a work request could not be posted for a reason other than a
+ *            full queue
+ */
+static ssize_t nfr_RangePost(struct NFR_RangeWrite * rw)
+{
+  struct NFRFabricContext * wctx = rw->wctx;
+  struct NFRResource * res = wctx->parentResource;
+  struct fi_tx_attr * txAttr = res->info->tx_attr;
+  if (!res->ep)
+    return -ENOTCONN;
+
+  uint32_t maxOps = NFR_WRITE_MAX_OPS;
+  if (txAttr->size && txAttr->size / 2 < maxOps)
+    maxOps = (uint32_t) (txAttr->size / 2);
+
+  // The last work request of the write needs no reserved entry
+  uint32_t ops   = (rw->segments + rw->limit - 1) / rw->limit;
+  uint32_t room  = NFR_TX_CQ_EXTRA - res->txCqExtra;
+  uint32_t batch = ops <= room + 1 ? ops : room;
+  if (batch > maxOps)
+    batch = maxOps;
+
+  struct iovec       iov[NFR_WRITE_IOV_MAX];
+  void             * desc[NFR_WRITE_IOV_MAX];
+  struct fi_rma_iov  rmaIov[NFR_WRITE_IOV_MAX];
+  struct fi_msg_rma  msg = {0};
+  msg.msg_iov = iov;
+  msg.desc    = desc;
+  msg.rma_iov = rmaIov;
+  msg.context = wctx;
+
+  uint32_t posted = 0;
+  for (; posted < batch; ++posted)
+  {
+    uint32_t n = rw->segments < rw->limit ? rw->segments : rw->limit;
+    int last = n == rw->segments;
+    if (!last && !nfr_ResourceReserveTxCq(wctx))
+      break;
+
+    uint32_t range = rw->range;
+    uint32_t row   = rw->row;
+    for (uint32_t i = 0; i < n; ++i)
+    {
+      const struct NFRWriteRange * r = rw->ranges + range;
+      PNFRMemory lmem = rw->mems ? rw->mems[range] : rw->localMem;
+      uint64_t span;
+      uint32_t count = nfr_RangeSegments(r, rw->limit, &span);
+      iov[i].iov_base = (uint8_t *) lmem->addr + r->localOffset
+                        + (uint64_t) row * r->localPitch;
+      iov[i].iov_len  = span;
+      desc[i]         = fi_mr_desc(lmem->mr);
+      rmaIov[i].addr  = rw->remoteMem->addr + r->remoteOffset
+                        + (uint64_t) row * r->remotePitch;
+      rmaIov[i].len   = span;
+      rmaIov[i].key   = rw->remoteMem->rkey;
+      if (++row == count)
+      {
+        row = 0;
+        ++range;
+      }
+    }
+
+    /* The notification follows the last work request of the write and
+       flushes the batch. A batch continued later is flushed right away. */
+    uint64_t flags = FI_COMPLETION;
+    if (last || posted + 1 < batch)
+      flags |= FI_MORE;
+    msg.iov_count     = n;
+    msg.rma_iov_count = n;
+    ssize_t ret = fi_writemsg(res->ep, &msg, flags);
+    if (ret < 0)
+    {
+      if (!last)
+        nfr_ResourceReleaseTxCq(wctx);
+      if (ret == -FI_EAGAIN)
+        break;
+      NFR_LOG_DEBUG("Failed to post partial write: %s (%d)",
+                    fi_strerror((int) -ret), (int) ret);
+      return ret;
+    }
+
+    if (!last)
+      ++wctx->pending;
+    ++res->stats.writesPosted;
+    rw->range     = range;
+    rw->row       = row;
+    rw->segments -= n;
+  }
+
+  return posted;
+}
+
+/**
+ * @brief Post the ranges of a partial write using fi_writemsg.
+ *
+ * If the write needs more work requests than can be posted at once and
+ * ``ti->writeOpts.rangeWrite`` is set, the ranges are copied there and the
+ * remaining work requests must be posted using nfr_PostRangeContinue.
+ *
+ * @param ti    Transfer info, with the ranges set in ``ti->writeOpts``
+ *
+ * @param wctx  Write context, with its callback info already set
+ *
+ * @return      0 if every work request was posted, 1 if the remainder is left
+ *              in ``ti->writeOpts.rangeWrite``, or a negative error code on
+ *              failure. If the write failed after some of the work requests
+ *              were posted, the context is marked as canceled and
+ *              ``wctx->pending`` is nonzero.
+ */
+static ssize_t nfr_PostRangeWrite(struct NFR_TransferInfo * ti,
+                                  struct NFRFabricContext * wctx)
+{
+  struct NFR_TransferWrite * tiw = &ti->writeOpts;
+  struct fi_tx_attr * txAttr = wctx->parentResource->info->tx_attr;
+  assert(tiw->rangeCount && tiw->rangeCount <= NETFR_MAX_WRITE_RANGES);
+
+  struct NFR_RangeWrite   tmp;
+  struct NFR_RangeWrite * rw = tiw->rangeWrite ? tiw->rangeWrite : &tmp;
+  assert(!rw->wctx);
+
+  rw->limit = NFR_WRITE_IOV_MAX;
+  if (txAttr->iov_limit && txAttr->iov_limit < rw->limit)
+    rw->limit = (uint32_t) txAttr->iov_limit;
+  if (txAttr->rma_iov_limit && txAttr->rma_iov_limit < rw->limit)
+    rw->limit = (uint32_t) txAttr->rma_iov_limit;
+
+  uint64_t span;
+  rw->segments = 0;
+  for (uint32_t i = 0; i < tiw->rangeCount; ++i)
+    rw->segments += nfr_RangeSegments(tiw->ranges + i, rw->limit, &span);
+
+  // Without a place to keep the remainder, the write must fit at once
+  if (!tiw->rangeWrite)
+  {
+    size_t maxOps = NFR_WRITE_MAX_OPS;
+    if (txAttr->size && txAttr->size / 2 < maxOps)
+      maxOps = txAttr->size / 2;
+
+    uint32_t ops = (rw->segments + rw->limit - 1) / rw->limit;
+    if (ops > maxOps)
+    {
+      NFR_LOG_DEBUG("Partial write of %u segments exceeds operation limit",
+                    rw->segments);
+      return -E2BIG;
+    }
+    if (ops - 1 > NFR_TX_CQ_EXTRA - wctx->parentResource->txCqExtra)
+      return -EAGAIN;
+  }
+
+  rw->wctx      = wctx;
+  rw->nctx      = 0;
+  rw->remoteMem = tiw->stagingMem ? tiw->stagingMem : tiw->remoteMem;
+  rw->localMem  = tiw->localMem;
+  rw->ranges    = tiw->ranges;
+  rw->mems      = tiw->rangeMems;
+  rw->range     = 0;
+  rw->row       = 0;
+
+  wctx->state   = CTX_STATE_WAITING;
+  wctx->pending = 1;
+
+  uint32_t total = rw->segments;
+  ssize_t ret = nfr_RangePost(rw);
+  if (ret >= 0 && !rw->segments)
+  {
+    rw->wctx = 0;
+    return 0;
+  }
+
+  if (rw->segments == total)
+  {
+    rw->wctx      = 0;
+    wctx->pending = 0;
+    return ret < 0 ? ret : -EAGAIN;
+  }
+
+  if (ret < 0 || !tiw->rangeWrite)
+  {
+    rw->wctx = 0;
+    nfr_CancelWrite(wctx);
+    return ret < 0 ? ret : -EAGAIN;
+  }
+
+  // The caller's ranges are only valid for the duration of the call
+  memcpy(rw->rangeCopy, tiw->ranges, tiw->rangeCount * sizeof(*tiw->ranges));
+  rw->ranges = rw->rangeCopy;
+  if (tiw->rangeMems)
+  {
+    memcpy(rw->memCopy, tiw->rangeMems,
+           tiw->rangeCount * sizeof(*tiw->rangeMems));
+    rw->mems = rw->memCopy;
+  }
+  return 1;
+}
+
+/* Fill the BufferUpdate notification for a write in a send context */
+static void nfr_PrepareBufferUpdate(struct NFRFabricContext * ctx,
+                                    const struct NFR_TransferInfo * ti)
+{
+  const struct NFR_TransferWrite * tiw = &ti->writeOpts;
+  struct NFRMsgBufferUpdate * bu = (struct NFRMsgBufferUpdate *) \
+    ctx->slot->data;
+  nfr_SetHeader(&bu->header, NFR_MSG_BUFFER_UPDATE);
+  bu->bufferIndex   = tiw->remoteMem->index;
+  bu->writeSerial   = tiw->writeSerial;
+  bu->channelSerial = tiw->channelSerial;
+  bu->udata         = ti->udata;
+
+  bu->sliceCount    = 0;
+
+  // Compressed writes update the target buffer like a full write
+  if (!tiw->ranges || tiw->slices)
+  {
+    bu->rangeCount        = 1;
+    bu->payloadSize       = ti->length;
+    bu->payloadOffset     = tiw->remoteOffset;
+    bu->ranges[0].offset  = tiw->remoteOffset;
+    bu->ranges[0].length  = ti->length;
+    bu->ranges[0].pitch   = ti->length;
+    bu->ranges[0].rows    = 1;
+  }
+  else
+  {
+    uint64_t start = tiw->rangeCount ? (uint64_t) -1 : 0;
+    uint64_t end   = 0;
+    bu->rangeCount = tiw->rangeCount;
+    for (uint32_t i = 0; i < tiw->rangeCount; ++i)
+    {
+      const struct NFRWriteRange * r = tiw->ranges + i;
+      uint32_t rows = r->rows ? r->rows : 1;
+      uint64_t rEnd = r->remoteOffset + (uint64_t) r->remotePitch * (rows - 1)
+                      + r->length;
+      bu->ranges[i].offset = r->remoteOffset;
+      bu->ranges[i].length = r->length;
+      bu->ranges[i].pitch  = r->remotePitch;
+      bu->ranges[i].rows   = rows;
+      if (r->remoteOffset < start)
+        start = r->remoteOffset;
+      if (rEnd > end)
+        end = rEnd;
+    }
+    bu->payloadOffset = start;
+    bu->payloadSize   = end - start;
+  }
+  ctx->slot->length = sizeof(*bu) + bu->rangeCount * sizeof(bu->ranges[0]);
+
+  if (tiw->slices)
+  {
+    struct NFRMsgSlice * slices = (struct NFRMsgSlice *) \
+      (bu->ranges + bu->rangeCount);
+    bu->sliceCount = tiw->sliceCount;
+    for (uint32_t i = 0; i < tiw->sliceCount; ++i)
+    {
+      slices[i].offset    = tiw->slices[i].offset;
+      slices[i].length    = tiw->slices[i].length;
+      slices[i].rawOffset = tiw->remoteOffset + tiw->slices[i].rawOffset;
+      slices[i].rawLength = tiw->slices[i].rawLength;
+    }
+    ctx->slot->length += bu->sliceCount * sizeof(*slices);
+  }
+
+  assert(tiw->metaLength <= NETFR_WRITE_METADATA_MAX_SIZE);
+  bu->metaLength = tiw->meta ? tiw->metaLength : 0;
+  if (bu->metaLength)
+  {
+    memcpy((uint8_t *) bu + ctx->slot->length, tiw->meta, bu->metaLength);
+    ctx->slot->length += bu->metaLength;
+  }
+
+  assert(bu->bufferIndex < NETFR_MAX_MEM_REGIONS);
+  assert(bu->rangeCount <= NETFR_MAX_WRITE_RANGES);
+  assert(bu->sliceCount <= NFR_MSG_MAX_SLICES);
+}
 
 ssize_t nfr_PostTransfer(struct NFRResource * res, struct NFR_TransferInfo * ti)
 {
@@ -43,7 +486,7 @@ ssize_t nfr_PostTransfer(struct NFRResource * res, struct NFR_TransferInfo * ti)
        write operation by the hardware, reducing latency. */
     case NFR_OP_WRITE:
     { 
-      uint8_t ctxIdx, wctxIdx;
+      int ctxIdx, wctxIdx;
 
       ctx = nfr_ContextGet(res, NFR_OP_SEND, &ctxIdx);
       if (!ctx)
@@ -62,42 +505,162 @@ ssize_t nfr_PostTransfer(struct NFRResource * res, struct NFR_TransferInfo * ti)
 
       NFR_LOG_TRACE("Using contexts %p and %p for write operation", ctx, wctx);
 
-      assert(ti->length);
-
       struct NFR_TransferWrite * tiw = &ti->writeOpts;
       assert(tiw->localMem);
       assert(tiw->remoteMem);
-      assert(tiw->localOffset + ti->length <= tiw->localMem->size);
-      assert(tiw->remoteOffset + ti->length <= tiw->remoteMem->size);
-      
-      struct NFRMsgBufferUpdate * bu = (struct NFRMsgBufferUpdate *) \
-        ctx->slot->data;
-      nfr_SetHeader(&bu->header, NFR_MSG_BUFFER_UPDATE);
-      bu->bufferIndex   = tiw->remoteMem->index;
-      bu->payloadSize   = ti->length;
-      bu->payloadOffset = tiw->remoteOffset;
-      bu->udata         = ti->udata;
-
-      assert(bu->bufferIndex < NETFR_MAX_MEM_REGIONS);
-
-      void * lbuf = (void *) (uint8_t *) tiw->localMem->addr + tiw->localOffset;
-      uint64_t rbuf = tiw->remoteMem->addr + tiw->remoteOffset;
+      assert(tiw->ranges || ti->length);
+      assert(tiw->ranges
+             || tiw->localOffset + ti->length <= tiw->localMem->size);
+      assert(tiw->ranges
+             || tiw->remoteOffset + ti->length <= tiw->remoteMem->size);
       
-      ret = fi_write(ep, lbuf, ti->length, fi_mr_desc(tiw->localMem->mr), 0,
-                      rbuf, tiw->remoteMem->rkey, wctx);
-      if (ret < 0)
+      nfr_PrepareBufferUpdate(ctx, ti);
+
+      /* Nothing to write, so the notification itself completes the write */
+      if (tiw->ranges && !tiw->rangeCount)
       {
-        NFR_LOG_DEBUG("Failed to post write: %s (%d)", fi_strerror(-ret), ret);
-        NFR_RESET_CONTEXT(ctx);
         NFR_RESET_CONTEXT(wctx);
-        return ret;
+        nfr_MemCpyOptional(&ctx->cbInfo, tiw->writeCbInfo,
+                           sizeof(*tiw->writeCbInfo));
+        ret = nfr_PostSend(res, ctx, ctx->slot->length);
+        if (ret < 0)
+        {
+          NFR_LOG_DEBUG("Failed to post send: %s (%d)", fi_strerror(-ret), ret);
+          NFR_RESET_CONTEXT(ctx);
+          return ret;
+        }
+
+        tiw->remoteMem->state = NFR_RMEM_BUSY_LOCAL;
+        ctx = 0;
+        break;
+      }
+
+      /* Writes on different rails are not ordered relative to each other, so
+         the notification can only be sent once all stripes have completed */
+      if (tiw->railCount > 1)
+      {
+        nfr_MemCpyOptional(&wctx->cbInfo, tiw->writeCbInfo,
+                           sizeof(*tiw->writeCbInfo));
+        wctx->cbInfo.uData[NFR_WRITE_NOTIFY_INDEX] = ctx;
+        wctx->txSeq = 0;
+        ret = nfr_PostStripedWrite(ti, wctx);
+        if (ret < 0)
+        {
+          NFR_RESET_CONTEXT(ctx);
+          if (!wctx->pending)
+            NFR_RESET_CONTEXT(wctx);
+          else
+            tiw->remoteMem->state = NFR_RMEM_BUSY_LOCAL;
+          return ret;
+        }
+
+        nfr_MemCpyOptional(&ctx->cbInfo, ti->cbInfo, sizeof(*ti->cbInfo));
+        NFR_LOG_TRACE("Striped write op posted, ctx %p, wctx %p", ctx, wctx);
+        tiw->remoteMem->state = NFR_RMEM_BUSY_LOCAL;
+        ctx = 0;
+        break;
+      }
+
+      /* Paced writes are posted in segments by the caller, followed by the
+         notification once the last segment has been posted */
+      if (tiw->paced)
+      {
+        assert(!tiw->ranges && tiw->railCount <= 1);
+        nfr_MemCpyOptional(&wctx->cbInfo, tiw->writeCbInfo,
+                           sizeof(*tiw->writeCbInfo));
+        nfr_MemCpyOptional(&ctx->cbInfo, ti->cbInfo, sizeof(*ti->cbInfo));
+        wctx->state   = CTX_STATE_WAITING;
+        wctx->pending = 1;
+        wctx->txSeq   = 0;
+
+        struct NFR_PacedWrite * pw = tiw->paced;
+        pw->wctx         = wctx;
+        pw->nctx         = ctx;
+        pw->localMem     = tiw->localMem;
+        pw->remoteMem    = tiw->remoteMem;
+        pw->localOffset  = tiw->localOffset;
+        pw->remoteOffset = tiw->remoteOffset;
+        pw->length       = ti->length;
+        pw->done         = 0;
+
+        NFR_LOG_TRACE("Paced write prepared, ctx %p, wctx %p", ctx, wctx);
+        tiw->remoteMem->state = NFR_RMEM_BUSY_LOCAL;
+        ctx = 0;
+        break;
       }
 
       nfr_MemCpyOptional(&wctx->cbInfo, tiw->writeCbInfo, sizeof(*tiw->writeCbInfo));
-      wctx->state = CTX_STATE_WAITING;
+      nfr_MemCpyOptional(&ctx->cbInfo, ti->cbInfo, sizeof(*ti->cbInfo));
+      wctx->txSeq = nfr_ResourceNextTxSeq(res);
 
-      ret = fi_send(ep, ctx->slot->data, sizeof(*bu),
-                    fi_mr_desc(res->commBuf.memRegion->mr), 0, ctx);
+      if (tiw->ranges)
+      {
+        ret = nfr_PostRangeWrite(ti, wctx);
+        if (ret < 0)
+        {
+          NFR_RESET_CONTEXT(ctx);
+          if (!wctx->pending)
+            NFR_RESET_CONTEXT(wctx);
+          else
+            tiw->remoteMem->state = NFR_RMEM_BUSY_LOCAL;
+          return ret;
+        }
+      }
+      else
+      {
+        struct iovec iov;
+        iov.iov_base = (uint8_t *) tiw->localMem->addr + tiw->localOffset;
+        iov.iov_len  = ti->length;
+
+        struct fi_rma_iov rmaIov;
+        rmaIov.addr = tiw->remoteMem->addr + tiw->remoteOffset;
+        rmaIov.len  = ti->length;
+        rmaIov.key  = tiw->remoteMem->rkey;
+
+        void * desc = fi_mr_desc(tiw->localMem->mr);
+        struct fi_msg_rma msg = {0};
+        msg.msg_iov       = &iov;
+        msg.desc          = &desc;
+        msg.iov_count     = 1;
+        msg.rma_iov       = &rmaIov;
+        msg.rma_iov_count = 1;
+        msg.context       = wctx;
+
+        // The notification follows right away and rings the doorbell for both
+        ret = fi_writemsg(ep, &msg, FI_MORE | FI_COMPLETION);
+        if (ret < 0)
+        {
+          NFR_LOG_DEBUG("Failed to post write: %s (%d)", fi_strerror(-ret), ret);
+          NFR_RESET_CONTEXT(ctx);
+          NFR_RESET_CONTEXT(wctx);
+          return ret;
+        }
+        wctx->state   = CTX_STATE_WAITING;
+        wctx->pending = 1;
+        ++res->stats.writesPosted;
+      }
+      if (tiw->slices)
+      {
+        for (uint32_t i = 0; i < tiw->sliceCount; ++i)
+          res->stats.bytesWritten += tiw->slices[i].length;
+      }
+      else
+      {
+        res->stats.bytesWritten += ti->length;
+      }
+
+      // The rest of the write is posted later, followed by the notification
+      if (ret > 0)
+      {
+        tiw->rangeWrite->nctx = ctx;
+        NFR_LOG_TRACE("Partial write op posted in part, ctx %p, wctx %p", ctx,
+                      wctx);
+        tiw->remoteMem->state = NFR_RMEM_BUSY_LOCAL;
+        ctx = 0;
+        break;
+      }
+
+      ret = nfr_PostSend(res, ctx, ctx->slot->length);
       if (ret < 0)
       {
         NFR_LOG_DEBUG("Failed to post send: %s (%d)", fi_strerror(-ret), ret);
@@ -111,6 +674,7 @@ ssize_t nfr_PostTransfer(struct NFRResource * res, struct NFR_TransferInfo * ti)
 
       NFR_LOG_TRACE("Write op posted, ctx %p, wctx %p", ctx, wctx);
       tiw->remoteMem->state = NFR_RMEM_BUSY_LOCAL;
+      ctx = 0;
       break;
     }
     case NFR_OP_RECV:
@@ -119,7 +683,7 @@ ssize_t nfr_PostTransfer(struct NFRResource * res, struct NFR_TransferInfo * ti)
       if (!ctx)
         return -EAGAIN;
 
-      ret = fi_recv(ep, ctx->slot->data, NETFR_MESSAGE_MAX_SIZE,
+      ret = fi_recv(ep, ctx->slot->data, res->commBuf.info.slotSize,
                     fi_mr_desc(res->commBuf.memRegion->mr), 0, ctx);
       if (ret < 0)
       {
@@ -136,11 +700,11 @@ ssize_t nfr_PostTransfer(struct NFRResource * res, struct NFR_TransferInfo * ti)
     {
       assert(ti->length);
       assert(ti->context);
-      assert(ti->length <= NETFR_MESSAGE_MAX_SIZE);
+      assert(ti->length <= nfr_ResourceMaxMessage(res));
       assert(ti->context->slot);
 
-      ret = fi_send(ep, ti->context->slot->data, ti->length,
-                    fi_mr_desc(res->commBuf.memRegion->mr), 0, ti->context);
+      nfr_MemCpyOptional(&ti->context->cbInfo, ti->cbInfo, sizeof(*ti->cbInfo));
+      ret = nfr_PostSend(res, ti->context, ti->length);
       if (ret < 0)
       {
         NFR_RESET_CONTEXT(ti->context);
@@ -159,24 +723,25 @@ ssize_t nfr_PostTransfer(struct NFRResource * res, struct NFR_TransferInfo * ti)
 
       assert(ti->data);
       assert(ti->length);
-      assert(ti->length <= NETFR_MESSAGE_MAX_SIZE);
+      assert(ti->length <= nfr_ResourceMaxMessage(res));
       memcpy(ctx->slot->data, ti->data, ti->length);
 
-      ret = fi_send(ep, ctx->slot->data, ti->length,
-                    fi_mr_desc(res->commBuf.memRegion->mr), 0, ctx);
+      nfr_MemCpyOptional(&ctx->cbInfo, ti->cbInfo, sizeof(*ti->cbInfo));
+      ret = nfr_PostSend(res, ctx, ti->length);
       if (ret < 0)
       {
         NFR_LOG_DEBUG("Failed to post send: %s (%d)", fi_strerror(-ret), ret);
         NFR_RESET_CONTEXT(ctx);
         return ret;
       }
+      ctx = 0;
       break;
     }
     case NFR_OP_INJECT:
     {
       assert(ti->data);
       assert(ti->length);
-      assert(ti->length <= NETFR_MESSAGE_MAX_SIZE);
+      assert(ti->length <= nfr_ResourceMaxMessage(res));
       assert(ti->length <= res->info->tx_attr->inject_size);
 
       ret = fi_inject(ep, ti->data, ti->length, 0);
@@ -206,6 +771,7 @@ ssize_t nfr_PostTransfer(struct NFRResource * res, struct NFR_TransferInfo * ti)
     }
   }
 
+  // Sends set the state of their context when posted
   if (ctx)
   {
     nfr_MemCpyOptional(&ctx->cbInfo, ti->cbInfo, sizeof(*ti->cbInfo));
@@ -214,6 +780,102 @@ ssize_t nfr_PostTransfer(struct NFRResource * res, struct NFR_TransferInfo * ti)
   return 0;
 }
 
+ssize_t nfr_PostWriteSegment(struct NFR_PacedWrite * pw, uint64_t length)
+{
+  assert(pw);
+  assert(pw->wctx);
+  assert(pw->nctx);
+  assert(pw->done < pw->length);
+
+  struct NFRFabricContext * wctx = pw->wctx;
+  struct NFRResource * res = wctx->parentResource;
+
+  if (length > pw->length - pw->done)
+    length = pw->length - pw->done;
+  int last = pw->done + length == pw->length;
+
+  void * lbuf = (uint8_t *) pw->localMem->addr + pw->localOffset + pw->done;
+  uint64_t rbuf = pw->remoteMem->addr + pw->remoteOffset + pw->done;
+
+  // Every segment but the last needs a transmit CQ entry of its own
+  if (res->ep && !last && !nfr_ResourceReserveTxCq(wctx))
+    return -EAGAIN;
+
+  ssize_t ret = -ENOTCONN;
+  if (res->ep)
+    ret = fi_write(res->ep, lbuf, length, fi_mr_desc(pw->localMem->mr), 0,
+                   rbuf, pw->remoteMem->rkey, wctx);
+  if (ret < 0 && res->ep && !last)
+    nfr_ResourceReleaseTxCq(wctx);
+  if (ret == -FI_EAGAIN)
+    return -EAGAIN;
+  if (ret < 0)
+  {
+    NFR_LOG_DEBUG("Failed to post write segment: %s (%d)", 
+                  fi_strerror((int) -ret), (int) ret);
+    NFR_RESET_CONTEXT(pw->nctx);
+    pw->nctx = 0;
+    nfr_CancelWrite(wctx);
+    return ret;
+  }
+
+  // The extra reference is taken over by the last segment
+  if (!last)
+    ++wctx->pending;
+  ++res->stats.writesPosted;
+  res->stats.bytesWritten += length;
+  pw->done += length;
+  if (!last)
+    return 0;
+
+  struct NFRFabricContext * nctx = pw->nctx;
+  pw->nctx = 0;
+  ret = nfr_ResourcePostPrepared(nctx);
+  if (ret < 0)
+  {
+    // The client will never release the buffer, so it is reused right away
+    NFR_LOG_ERROR("Failed to notify client of paced write: %s (%d)",
+                  fi_strerror((int) -ret), (int) ret);
+    wctx->state = CTX_STATE_CANCELED;
+  }
+  return 1;
+}
+
+ssize_t nfr_PostRangeContinue(struct NFR_RangeWrite * rw)
+{
+  assert(rw);
+  struct NFRFabricContext * wctx = rw->wctx;
+  if (!wctx)
+    return 0;
+
+  assert(rw->nctx);
+  ssize_t ret = nfr_RangePost(rw);
+  if (ret < 0)
+  {
+    NFR_RESET_CONTEXT(rw->nctx);
+    rw->nctx = 0;
+    rw->wctx = 0;
+    nfr_CancelWrite(wctx);
+    return ret;
+  }
+
+  if (rw->segments)
+    return 0;
+
+  struct NFRFabricContext * nctx = rw->nctx;
+  rw->nctx = 0;
+  rw->wctx = 0;
+  ret = nfr_ResourcePostPrepared(nctx);
+  if (ret < 0)
+  {
+    // The client will never release the buffer, so it is reused right away
+    NFR_LOG_ERROR("Failed to notify client of partial write: %s (%d)",
+                  fi_strerror((int) -ret), (int) ret);
+    wctx->state = CTX_STATE_CANCELED;
+  }
+  return 1;
+}
+
 /**
  * @brief Free supporting resources associated with an RDMA memory region, and
  *        if the memory region is internal, free the memory buffer.
@@ -236,6 +898,11 @@ void nfrFreeMemory(PNFRMemory * mem)
 
   if ((*mem)->mr)
     fi_close(&(*mem)->mr->fid);
+  for (int r = 1; r < NETFR_MAX_RAILS; ++r)
+  {
+    if ((*mem)->railMr[r])
+      fi_close(&(*mem)->railMr[r]->fid);
+  }
   if (!((*mem)->memType > NFR_MEM_INDEX_EXTERNAL_TYPES) && (*mem)->addr)
     nfr_MemFreeAlign((*mem)->addr);
   
@@ -247,5 +914,11 @@ void nfrFreeMemory(PNFRMemory * mem)
     NFR_LOG_DEBUG("Freeing external memory region %p", *mem);
     free((*mem));
   }
+  else
+  {
+    // Make the slot available for reuse
+    memset(*mem, 0, sizeof(**mem));
+    (*mem)->state = MEM_STATE_EMPTY;
+  }
   *mem = 0;
 }
\ No newline at end of file
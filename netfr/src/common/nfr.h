@@ -22,6 +22,7 @@
 #define NETFR_PRIVATE_H
 
 #include <stdio.h>
+#include <time.h>
 
 #include "netfr/netfr.h"
 #include "common/nfr_constants.h"
@@ -44,6 +45,69 @@ inline static int nfr_SetEnv(const char * name, const char * value, int overwrit
 #endif
 }
 
+/**
+ * @brief Get the time of a monotonic clock in nanoseconds.
+ */
+inline static uint64_t nfr_GetTimeNs(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER count, freq;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&freq);
+  return (uint64_t) ((double) count.QuadPart * 1e9 / (double) freq.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+struct NFRCompressSlice;
+
+/* A contiguous write which is posted in segments over time by
+   nfr_PostWriteSegment, instead of all at once by nfr_PostTransfer */
+struct NFR_PacedWrite
+{
+  /* The write context holds an extra reference in ``pending`` until the last
+     segment is posted, so that the write callback is not invoked early */
+  struct NFRFabricContext * wctx;
+  /* Prepared notification, sent after the last segment. Null once the last
+     segment has been posted, or the write was canceled. */
+  struct NFRFabricContext * nctx;
+  PNFRMemory                localMem;
+  PNFRRemoteMemory          remoteMem;
+  uint64_t                  localOffset;
+  uint64_t                  remoteOffset;
+  uint64_t                  length;
+  uint64_t                  done;       // Bytes posted so far
+};
+
+/* A partial write with more work requests than could be posted at once. The
+   remaining work requests are posted by nfr_PostRangeContinue. */
+struct NFR_RangeWrite
+{
+  /* The write context holds an extra reference in ``pending`` until the last
+     work request is posted, as with NFR_PacedWrite. Null if no write is in
+     progress. */
+  struct NFRFabricContext * wctx;
+  /* Prepared notification, sent after the last work request. Null once sent,
+     or if the write was canceled. */
+  struct NFRFabricContext * nctx;
+  PNFRRemoteMemory          remoteMem;
+  PNFRMemory                localMem;
+  /* Ranges and their local regions as in NFR_TransferWrite, pointing to the
+     copies below while the write is in progress */
+  const struct NFRWriteRange * ranges;
+  const PNFRMemory        * mems;
+  uint32_t                  limit;     // Segments per work request
+  // Position of the next segment, and the number not posted yet
+  uint32_t                  range;
+  uint32_t                  row;
+  uint32_t                  segments;
+  struct NFRWriteRange      rangeCopy[NETFR_MAX_WRITE_RANGES];
+  PNFRMemory                memCopy[NETFR_MAX_WRITE_RANGES];
+};
+
 struct NFR_TransferWrite
 {
   PNFRMemory                localMem;
@@ -51,8 +115,62 @@ struct NFR_TransferWrite
   PNFRRemoteMemory          remoteMem;
   uint64_t                  remoteOffset;
   const struct NFR_CallbackInfo * writeCbInfo;
+  /* Partial writes only. If ranges is set, the write consists of these
+     ranges instead of a single contiguous region, and localOffset and
+     remoteOffset are ignored. A range count of 0 only sends the notification.
+     Partial writes are never striped. */
+  const struct NFRWriteRange * ranges;
+  uint32_t                  rangeCount;
+  /* If set, the local memory region of each range, otherwise all ranges use
+     localMem. All regions must belong to the same resource. */
+  const PNFRMemory        * rangeMems;
+  /* If set, and more work requests are needed than the transmit queue and CQ
+     currently have room for, the write is posted in several batches and the
+     remainder is stored here, to be posted using nfr_PostRangeContinue. The
+     notification is then sent after the last batch. Must not be in use by
+     another write. */
+  struct NFR_RangeWrite   * rangeWrite;
+  uint32_t                  writeSerial;
+  uint32_t                  channelSerial;
+  /* Compressed writes only. The ranges hold the compressed slices, which are
+     written to stagingMem instead of remoteMem. The notification lists the
+     slices, which the peer decompresses into remoteMem at remoteOffset, and
+     the length of the transfer is the decompressed length. */
+  PNFRRemoteMemory          stagingMem;
+  const struct NFRCompressSlice * slices;
+  uint32_t                  sliceCount;
+  /* Striped writes only. The write is split over these rails, with
+     railIndex holding the index of each rail within its channel. The
+     notification is not sent; instead, its prepared context is stored in
+     uData[NFR_WRITE_NOTIFY_INDEX] of the write context, and must be posted
+     by the write callback once every stripe has completed. */
+  struct NFRResource      * rails[NETFR_MAX_RAILS];
+  uint8_t                   railIndex[NETFR_MAX_RAILS];
+  uint8_t                   railCount;
+  /* Paced contiguous writes only. No data is written; the contexts are
+     prepared and stored in paced, and the data must then be posted using
+     nfr_PostWriteSegment. Paced writes are never striped. */
+  struct NFR_PacedWrite   * paced;
+  /* Optional user metadata copied into the notification, at most
+     NETFR_WRITE_METADATA_MAX_SIZE bytes */
+  const void              * meta;
+  uint16_t                  metaLength;
 };
 
+/* Internal callback data index holding the deferred notification context of a
+   striped write */
+#define NFR_WRITE_NOTIFY_INDEX (NFR_USER_CB_INDEX - 1)
+
+/* The maximum number of segments combined into a single fi_writemsg call,
+   further limited by the provider's iov_limit and rma_iov_limit */
+#define NFR_WRITE_IOV_MAX 8
+
+/* The maximum number of write operations of a partial write posted at once,
+   further limited to half of the provider's transmit queue size. Writes which
+   need more are posted in batches if rangeWrite is set, and rejected
+   otherwise. */
+#define NFR_WRITE_MAX_OPS 256
+
 struct NFR_TransferInfo
 {
   /*
@@ -88,4 +206,39 @@ inline static void * nfr_MemCpyOptional(void * dest, const void * src, size_t n)
 
 ssize_t nfr_PostTransfer(struct NFRResource * res, struct NFR_TransferInfo * ti);
 
+/**
+ * @brief Post the next segment of a paced write.
+ *
+ * The notification is sent after the last segment. If a segment cannot be
+ * posted, the write is canceled: no further segments are posted, and the write
+ * callback is invoked with the context in the canceled state, either right
+ * away or once the segments already posted have completed. If only the
+ * notification fails, the write also completes in the canceled state.
+ *
+ * @param pw      Paced write prepared by nfr_PostTransfer
+ *
+ * @param length  Maximum length of the segment
+ *
+ * @return        1 if the last segment was posted, 0 if more data remains,
+ *                -EAGAIN if the segment should be retried later, or another
+ *                negative error code if the write was canceled
+ */
+ssize_t nfr_PostWriteSegment(struct NFR_PacedWrite * pw, uint64_t length);
+
+/**
+ * @brief Post the next batch of a partial write which did not fit into the
+ *        transmit queue at once.
+ *
+ * The notification is sent after the last batch. If a work request cannot be
+ * posted for any reason but a full queue, the write is canceled as with
+ * nfr_PostWriteSegment.
+ *
+ * @param rw  Partial write, which may be idle
+ *
+ * @return    1 if the last batch was posted, 0 if work requests remain or no
+ *            write is in progress, or a negative error code if the write was
+ *            canceled
+ */
+ssize_t nfr_PostRangeContinue(struct NFR_RangeWrite * rw);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,174 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <errno.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/nfr.h"
+#include "common/nfr_coalesce.h"
+#include "common/nfr_log.h"
+
+int nfr_CoalesceInit(struct NFRCoalescer * c, uint32_t threshold,
+                     uint32_t deadlineUs)
+{
+  assert(c);
+  if (threshold > NETFR_MESSAGE_MAX_PAYLOAD_SIZE
+      || (threshold && threshold <= sizeof(struct NFRMsgRecord)))
+    return -EINVAL;
+  if (c->count)
+    return -EBUSY;
+
+  if (threshold && !c->buf)
+  {
+    c->buf = malloc(NETFR_MESSAGE_MAX_PAYLOAD_SIZE);
+    if (!c->buf)
+      return -ENOMEM;
+  }
+  else if (!threshold)
+  {
+    free(c->buf);
+    c->buf = 0;
+  }
+
+  c->threshold = threshold;
+  c->deadline  = (uint64_t) deadlineUs * 1000;
+  c->used      = 0;
+  return 0;
+}
+
+void nfr_CoalesceFree(struct NFRCoalescer * c)
+{
+  if (!c)
+    return;
+  free(c->buf);
+  memset(c, 0, sizeof(*c));
+}
+
+int nfr_CoalesceFlush(struct NFRCoalescer * c, struct NFRSendQueue * q,
+                      void * owner, NFR_SendQPostFn post)
+{
+  assert(c);
+  if (!c->count)
+    return 0;
+
+  int ret;
+  struct NFRMsgRecord rec;
+  memcpy(&rec, c->buf, sizeof(rec));
+  if (c->count == 1)
+    ret = nfr_SendQSubmit(q, owner, post, c->buf + sizeof(rec), rec.length,
+                          rec.udata, 0, c->priority, 0);
+  else
+    ret = nfr_SendQSubmit(q, owner, post, c->buf, c->used, 0, c->count,
+                          c->priority, 0);
+  // Records which can be sent later stay packed, the others are dropped
+  if (ret == -ENOSPC || ret == -EAGAIN)
+    return ret;
+  if (ret < 0)
+    NFR_LOG_WARNING("Dropped %d packed records: %s (%d)", c->count,
+                    strerror(-ret), ret);
+
+  c->count = 0;
+  c->used  = 0;
+  return ret;
+}
+
+int nfr_CoalesceSubmit(struct NFRCoalescer * c, struct NFRSendQueue * q,
+                       void * owner, NFR_SendQPostFn post, const void * data,
+                       uint32_t length, uint64_t udata, uint8_t priority,
+                       uint64_t key, uint32_t maxPayload)
+{
+  assert(c);
+  uint32_t size = sizeof(struct NFRMsgRecord) + length;
+  int ret;
+
+  /* The threshold is set without knowing the peer, whose slots may be
+     smaller, and a packed message it cannot receive would be dropped */
+  uint32_t limit = c->threshold < maxPayload ? c->threshold : maxPayload;
+
+  // Records already packed must go out first, so the order is preserved
+  if (!c->threshold || key || size > limit)
+  {
+    ret = nfr_CoalesceFlush(c, q, owner, post);
+    if (ret < 0)
+      return ret;
+    return nfr_SendQSubmit(q, owner, post, data, length, udata, 0, priority,
+                           key);
+  }
+
+  if (c->count && (c->priority != priority || c->used + size > limit
+                   || c->count == NFR_COALESCE_MAX_RECORDS))
+  {
+    ret = nfr_CoalesceFlush(c, q, owner, post);
+    if (ret < 0)
+      return ret;
+  }
+
+  if (!c->count)
+  {
+    c->firstTime = nfr_GetTimeNs();
+    c->priority  = priority;
+  }
+
+  struct NFRMsgRecord rec;
+  rec.udata  = udata;
+  rec.length = length;
+  memcpy(c->buf + c->used, &rec, sizeof(rec));
+  memcpy(c->buf + c->used + sizeof(rec), data, length);
+  c->used += size;
+  ++c->count;
+
+  // Flush once not even an empty record fits anymore
+  if (c->used + sizeof(rec) >= limit)
+    return nfr_CoalesceFlush(c, q, owner, post);
+  return 0;
+}
+
+int nfr_CoalesceRecord(const uint8_t * data, uint32_t length, uint8_t index,
+                       struct NFRMsgRecord * record, const uint8_t ** payload)
+{
+  uint32_t offset = 0;
+  for (uint8_t i = 0; ; ++i)
+  {
+    if (length - offset < sizeof(*record))
+      return -EBADMSG;
+    // Records follow each other without padding, so the header is copied out
+    memcpy(record, data + offset, sizeof(*record));
+    if (record->length > length - offset - sizeof(*record))
+      return -EBADMSG;
+    if (i == index)
+    {
+      if (payload)
+        *payload = data + offset + sizeof(*record);
+      return 0;
+    }
+    offset += sizeof(*record) + record->length;
+  }
+}
+
+int nfr_CoalesceValidate(const uint8_t * data, uint32_t length,
+                         uint8_t records)
+{
+  if (!records)
+    return 0;
+  struct NFRMsgRecord rec;
+  return nfr_CoalesceRecord(data, length, records - 1, &rec, 0);
+}
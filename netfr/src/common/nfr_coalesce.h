@@ -0,0 +1,124 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef NETFR_PRIVATE_COALESCE_H
+#define NETFR_PRIVATE_COALESCE_H
+
+#include <stdint.h>
+
+#include "common/nfr_protocol.h"
+#include "common/nfr_sendq.h"
+
+/* Maximum number of records packed into a single message, see
+   NFR_MSG_FRAGMENT */
+#define NFR_COALESCE_MAX_RECORDS 254
+
+/* Packs small data messages into a single message of records until the packed
+   size reaches the threshold, the deadline passes, or it is flushed */
+struct NFRCoalescer
+{
+  uint32_t                  threshold;  // Bytes, 0 if coalescing is disabled
+  uint64_t                  deadline;   // Nanoseconds
+  uint64_t                  firstTime;  // Time the first record was packed
+  uint32_t                  used;
+  uint8_t                   count;
+  uint8_t                   priority;   // Priority class of the records
+  uint8_t                 * buf;
+};
+
+/**
+ * @brief Enable, reconfigure or disable coalescing. Packed records must have
+ *        been flushed before.
+ *
+ * @param c          Coalescer
+ *
+ * @param threshold  Packed size in bytes which triggers a flush, at most
+ *                   NETFR_MESSAGE_MAX_PAYLOAD_SIZE, or 0 to disable
+ *
+ * @param deadlineUs Longest time a record is held back in microseconds
+ *
+ * @return 0 on success, negative error code on failure
+ */
+int nfr_CoalesceInit(struct NFRCoalescer * c, uint32_t threshold,
+                     uint32_t deadlineUs);
+
+void nfr_CoalesceFree(struct NFRCoalescer * c);
+
+/**
+ * @brief Pack a message, or submit it to the send queue directly if it cannot
+ *        be packed. Messages with a coalescing key are never packed, so that
+ *        the send queue can replace them.
+ *
+ * @param maxPayload Largest data message payload the peer accepts, which
+ *                   bounds the packed size along with the threshold
+ *
+ * @return 0 on success, negative error code on failure
+ */
+int nfr_CoalesceSubmit(struct NFRCoalescer * c, struct NFRSendQueue * q,
+                       void * owner, NFR_SendQPostFn post, const void * data,
+                       uint32_t length, uint64_t udata, uint8_t priority,
+                       uint64_t key, uint32_t maxPayload);
+
+/**
+ * @brief Submit the packed records to the send queue. A single record is sent
+ *        as a regular message.
+ *
+ * @return 0 on success, or a negative error code. The records stay packed
+ *         on -ENOSPC and -EAGAIN and are dropped on other errors.
+ */
+int nfr_CoalesceFlush(struct NFRCoalescer * c, struct NFRSendQueue * q,
+                      void * owner, NFR_SendQPostFn post);
+
+/**
+ * @brief Check whether the oldest packed record has reached the deadline.
+ */
+inline static int nfr_CoalesceExpired(struct NFRCoalescer * c, uint64_t now)
+{
+  return c->count && now - c->firstTime >= c->deadline;
+}
+
+/**
+ * @brief Find a record of a packed message, validating the records before it.
+ *
+ * @param data     Message data
+ *
+ * @param length   Length of the message data
+ *
+ * @param index    Index of the record
+ *
+ * @param record   Output copy of the record header, as headers within the
+ *                 message are not aligned
+ *
+ * @param payload  Output pointer to the record data, may be null
+ *
+ * @return 0 on success, -EBADMSG if the message is malformed
+ */
+int nfr_CoalesceRecord(const uint8_t * data, uint32_t length, uint8_t index,
+                       struct NFRMsgRecord * record, const uint8_t ** payload);
+
+/**
+ * @brief Validate all records of a packed message.
+ *
+ * @return 0 on success, -EBADMSG if the message is malformed
+ */
+int nfr_CoalesceValidate(const uint8_t * data, uint32_t length,
+                         uint8_t records);
+
+#endif
@@ -0,0 +1,192 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+
+#ifdef NETFR_ENABLE_LZ4
+  #include <lz4.h>
+#endif
+
+#include "common/nfr_compress.h"
+#include "common/nfr_log.h"
+#include "netfr/netfr_constants.h"
+
+#ifdef NETFR_ENABLE_LZ4
+
+struct NFR_CompressTask
+{
+  const uint8_t           * src;
+  uint8_t                 * dst;
+  struct NFRCompressSlice * slices;
+  const struct NFRCompressSlice * cslices;
+  uint64_t                  srcSize;
+  uint64_t                  dstSize;
+  _Atomic(int)              error;
+};
+
+// Get the slice size and count for a buffer
+static uint64_t nfr_CompressSliceSize(uint64_t length, uint32_t * count)
+{
+  uint64_t size = (length + NFR_COMPRESS_MAX_SLICES - 1) 
+                  / NFR_COMPRESS_MAX_SLICES;
+  if (size < NFR_COMPRESS_SLICE_MIN)
+    size = NFR_COMPRESS_SLICE_MIN;
+  *count = (length + size - 1) / size;
+  return size;
+}
+
+int nfr_CompressAvailable(void)
+{
+  return 1;
+}
+
+uint64_t nfr_CompressBound(uint64_t length)
+{
+  uint32_t count;
+  uint64_t size = nfr_CompressSliceSize(length, &count);
+  return (uint64_t) LZ4_compressBound((int) size) * count;
+}
+
+static void nfr_CompressSliceTask(void * arg, uint32_t index)
+{
+  struct NFR_CompressTask * task = arg;
+  struct NFRCompressSlice * s = task->slices + index;
+  int ret = LZ4_compress_default((const char *) task->src + s->rawOffset,
+                                 (char *) task->dst + s->offset,
+                                 (int) s->rawLength,
+                                 LZ4_compressBound((int) s->rawLength));
+  if (ret <= 0)
+    atomic_store(&task->error, 1);
+  s->length = ret > 0 ? (uint32_t) ret : 0;
+}
+
+int nfr_Compress(struct NFRThreadPool * pool, const void * src, uint64_t length,
+                 void * dst, uint64_t dstSize, struct NFRCompressSlice * slices)
+{
+  assert(src);
+  assert(dst);
+  assert(slices);
+  if (!length || length > NETFR_MAX_BUFFER_SIZE
+      || dstSize < nfr_CompressBound(length))
+    return -EINVAL;
+
+  uint32_t count;
+  uint64_t size  = nfr_CompressSliceSize(length, &count);
+  uint64_t bound = LZ4_compressBound((int) size);
+  assert(count <= NFR_COMPRESS_MAX_SLICES);
+
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    slices[i].rawOffset = i * size;
+    slices[i].rawLength = i < count - 1 ? size : length - i * size;
+    slices[i].offset    = i * bound;
+    slices[i].length    = 0;
+  }
+
+  struct NFR_CompressTask task = {0};
+  task.src    = src;
+  task.dst    = dst;
+  task.slices = slices;
+  atomic_init(&task.error, 0);
+  nfr_ThreadPoolRun(pool, nfr_CompressSliceTask, &task, count);
+
+  if (atomic_load(&task.error))
+  {
+    NFR_LOG_DEBUG("Compression of %" PRIu64 " bytes failed", length);
+    return -EIO;
+  }
+  return count;
+}
+
+static void nfr_DecompressSliceTask(void * arg, uint32_t index)
+{
+  struct NFR_CompressTask * task = arg;
+  const struct NFRCompressSlice * s = task->cslices + index;
+  if ((uint64_t) s->offset + s->length > task->srcSize
+      || (uint64_t) s->rawOffset + s->rawLength > task->dstSize)
+  {
+    atomic_store(&task->error, 1);
+    return;
+  }
+
+  int ret = LZ4_decompress_safe((const char *) task->src + s->offset,
+                                (char *) task->dst + s->rawOffset,
+                                (int) s->length, (int) s->rawLength);
+  if (ret != (int) s->rawLength)
+    atomic_store(&task->error, 1);
+}
+
+int nfr_Decompress(struct NFRThreadPool * pool, const void * src,
+                   uint64_t srcSize, void * dst, uint64_t dstSize,
+                   const struct NFRCompressSlice * slices, uint32_t count)
+{
+  assert(src);
+  assert(dst);
+  assert(slices || !count);
+  if (count > NFR_COMPRESS_MAX_SLICES)
+    return -EINVAL;
+
+  struct NFR_CompressTask task = {0};
+  task.src     = src;
+  task.dst     = dst;
+  task.cslices = slices;
+  task.srcSize = srcSize;
+  task.dstSize = dstSize;
+  atomic_init(&task.error, 0);
+  nfr_ThreadPoolRun(pool, nfr_DecompressSliceTask, &task, count);
+
+  if (atomic_load(&task.error))
+  {
+    NFR_LOG_DEBUG("Decompression of %u slices failed", count);
+    return -EBADMSG;
+  }
+  return 0;
+}
+
+#else
+
+int nfr_CompressAvailable(void)
+{
+  return 0;
+}
+
+uint64_t nfr_CompressBound(uint64_t length)
+{
+  (void) length;
+  return 0;
+}
+
+int nfr_Compress(struct NFRThreadPool * pool, const void * src, uint64_t length,
+                 void * dst, uint64_t dstSize, struct NFRCompressSlice * slices)
+{
+  return -ENOSYS;
+}
+
+int nfr_Decompress(struct NFRThreadPool * pool, const void * src,
+                   uint64_t srcSize, void * dst, uint64_t dstSize,
+                   const struct NFRCompressSlice * slices, uint32_t count)
+{
+  return -ENOSYS;
+}
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef NETFR_PRIVATE_COMPRESS_H
+#define NETFR_PRIVATE_COMPRESS_H
+
+#include <stdint.h>
+
+#include "common/nfr_thread.h"
+
+/* Maximum number of independently compressed slices per buffer */
+#define NFR_COMPRESS_MAX_SLICES 32
+
+/* Minimum size of a slice. Smaller slices compress worse and are not worth
+   distributing over threads. */
+#define NFR_COMPRESS_SLICE_MIN (256 << 10)
+
+/* Buffers smaller than this are never compressed */
+#define NFR_COMPRESS_MIN_SIZE (64 << 10)
+
+/* Compressed data is only sent if it saves at least this percentage of the
+   original size */
+#define NFR_COMPRESS_MIN_SAVING 5
+
+struct NFRCompressSlice
+{
+  uint32_t offset;      // Offset of the compressed data
+  uint32_t length;      // Length of the compressed data
+  uint32_t rawOffset;   // Offset of the original data
+  uint32_t rawLength;   // Length of the original data
+};
+
+/**
+ * @brief Check whether NetFR was built with compression support.
+ */
+int nfr_CompressAvailable(void);
+
+/**
+ * @brief Get the size of the output buffer needed by nfr_Compress.
+ *
+ * @param length  Length of the data to compress
+ *
+ * @return        The output buffer size, or 0 if compression is unavailable
+ */
+uint64_t nfr_CompressBound(uint64_t length);
+
+/**
+ * @brief Compress a buffer as a set of independent slices.
+ *
+ * The slices are compressed in parallel and stored at fixed offsets in the
+ * output buffer, so they are generally not contiguous.
+ *
+ * @param pool       Thread pool, or null to compress on the calling thread
+ *
+ * @param src        Data to compress
+ *
+ * @param length     Length of the data
+ *
+ * @param dst        Output buffer
+ *
+ * @param dstSize    Size of the output buffer, at least nfr_CompressBound
+ *
+ * @param slices     Output slice table, with NFR_COMPRESS_MAX_SLICES entries.
+ *                   Raw offsets are relative to src, compressed offsets to dst.
+ *
+ * @return           The number of slices, or a negative error code
+ */
+int nfr_Compress(struct NFRThreadPool * pool, const void * src, uint64_t length,
+                 void * dst, uint64_t dstSize, struct NFRCompressSlice * slices);
+
+/**
+ * @brief Decompress a set of slices.
+ *
+ * @param pool       Thread pool, or null to decompress on the calling thread
+ *
+ * @param src        Compressed data
+ *
+ * @param srcSize    Size of the compressed data buffer
+ *
+ * @param dst        Output buffer
+ *
+ * @param dstSize    Size of the output buffer
+ *
+ * @param slices     Slice table. Compressed offsets are relative to src, raw
+ *                   offsets to dst.
+ *
+ * @param count      Number of slices
+ *
+ * @return           0 on success, negative error code on failure. ``-EBADMSG``
+ *                   if the data is corrupt or does not match the slice table.
+ */
+int nfr_Decompress(struct NFRThreadPool * pool, const void * src,
+                   uint64_t srcSize, void * dst, uint64_t dstSize,
+                   const struct NFRCompressSlice * slices, uint32_t count);
+
+#endif
@@ -53,6 +53,19 @@ enum ContextState
 
   /* The operation associated with the context has been canceled. */
   CTX_STATE_CANCELED,
+
+  /* A send was prepared in the data slot of this context, but could not be
+     posted yet. It is retried the next time the resource is processed. */
+  CTX_STATE_DEFERRED,
+
+  /* A send was posted without requesting a completion. The context is
+     reclaimed once a transmit operation posted after it completes. */
+  CTX_STATE_UNSIGNALED,
+
+  /* A multi-receive buffer is posted with this context. Each message received
+     into it is handed to a receive context, which refers to the message in
+     place, and the buffer is reposted once all of them are released. */
+  CTX_STATE_MULTI_RECV,
  
   CTX_STATE_MAX
 };
@@ -0,0 +1,253 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* Parallel non-temporal copy engine */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  #define NFR_COPY_X86 1
+  #include <immintrin.h>
+#else
+  #define NFR_COPY_X86 0
+#endif
+
+#include "netfr/netfr.h"
+
+#include "common/nfr_log.h"
+#include "common/nfr_thread.h"
+
+/* Size of the chunks a copy is split into for the worker threads */
+#define NFR_COPY_CHUNK_SIZE (1 << 20)
+
+/* Copies smaller than this are made on the calling thread only */
+#define NFR_COPY_MT_MIN_SIZE (4 << 20)
+
+/* Size from which NFR_COPY_SIMD_AUTO streams on the calling thread if the
+   cache size is unknown */
+#define NFR_COPY_NT_AUTO_SIZE (32 << 20)
+
+/* Distance in bytes the source is prefetched ahead of the loads */
+#define NFR_COPY_PREFETCH 512
+
+/* Copy function; the stores of non-temporal variants are fenced on return */
+typedef void (*NFR_CopyFn)(uint8_t * dst, const uint8_t * src, size_t len);
+
+struct NFRCopyEngine
+{
+  NFR_CopyFn             copy;
+  uint64_t               ntMinSize;  // Smallest copy streamed on one thread
+  struct NFRThreadPool * pool;
+  // Copy in progress
+  uint8_t              * dst;
+  const uint8_t        * src;
+  uint64_t               length;
+};
+
+static void nfr_CopyScalar(uint8_t * dst, const uint8_t * src, size_t len)
+{
+  memcpy(dst, src, len);
+}
+
+#if NFR_COPY_X86
+
+__attribute__((target("avx2")))
+static void nfr_CopyAVX2(uint8_t * dst, const uint8_t * src, size_t len)
+{
+  // Streaming stores must be aligned, so the head is copied normally
+  size_t head = (32 - ((uintptr_t) dst & 31)) & 31;
+  if (head > len)
+    head = len;
+  memcpy(dst, src, head);
+
+  size_t i = head;
+  for (; i + 128 <= len; i += 128)
+  {
+    _mm_prefetch((const char *) (src + i + NFR_COPY_PREFETCH), _MM_HINT_NTA);
+    _mm_prefetch((const char *) (src + i + NFR_COPY_PREFETCH + 64),
+                 _MM_HINT_NTA);
+    __m256i x0 = _mm256_loadu_si256((const __m256i *) (src + i));
+    __m256i x1 = _mm256_loadu_si256((const __m256i *) (src + i + 32));
+    __m256i x2 = _mm256_loadu_si256((const __m256i *) (src + i + 64));
+    __m256i x3 = _mm256_loadu_si256((const __m256i *) (src + i + 96));
+    _mm256_stream_si256((__m256i *) (dst + i), x0);
+    _mm256_stream_si256((__m256i *) (dst + i + 32), x1);
+    _mm256_stream_si256((__m256i *) (dst + i + 64), x2);
+    _mm256_stream_si256((__m256i *) (dst + i + 96), x3);
+  }
+  for (; i + 32 <= len; i += 32)
+    _mm256_stream_si256((__m256i *) (dst + i),
+                        _mm256_loadu_si256((const __m256i *) (src + i)));
+
+  // Streaming stores are weakly ordered, even against later releases
+  _mm_sfence();
+  memcpy(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx512f")))
+static void nfr_CopyAVX512(uint8_t * dst, const uint8_t * src, size_t len)
+{
+  size_t head = (64 - ((uintptr_t) dst & 63)) & 63;
+  if (head > len)
+    head = len;
+  memcpy(dst, src, head);
+
+  size_t i = head;
+  for (; i + 256 <= len; i += 256)
+  {
+    _mm_prefetch((const char *) (src + i + NFR_COPY_PREFETCH), _MM_HINT_NTA);
+    _mm_prefetch((const char *) (src + i + NFR_COPY_PREFETCH + 64),
+                 _MM_HINT_NTA);
+    _mm_prefetch((const char *) (src + i + NFR_COPY_PREFETCH + 128),
+                 _MM_HINT_NTA);
+    _mm_prefetch((const char *) (src + i + NFR_COPY_PREFETCH + 192),
+                 _MM_HINT_NTA);
+    __m512i x0 = _mm512_loadu_si512(src + i);
+    __m512i x1 = _mm512_loadu_si512(src + i + 64);
+    __m512i x2 = _mm512_loadu_si512(src + i + 128);
+    __m512i x3 = _mm512_loadu_si512(src + i + 192);
+    _mm512_stream_si512((void *) (dst + i), x0);
+    _mm512_stream_si512((void *) (dst + i + 64), x1);
+    _mm512_stream_si512((void *) (dst + i + 128), x2);
+    _mm512_stream_si512((void *) (dst + i + 192), x3);
+  }
+  for (; i + 64 <= len; i += 64)
+    _mm512_stream_si512((void *) (dst + i), _mm512_loadu_si512(src + i));
+
+  _mm_sfence();
+  memcpy(dst + i, src + i, len - i);
+}
+
+#endif
+
+/**
+ * @brief Select the copy function for the requested instruction set.
+ */
+static NFR_CopyFn nfr_CopySelect(uint8_t simd)
+{
+#if NFR_COPY_X86
+  __builtin_cpu_init();
+  if (simd == NFR_COPY_SIMD_AUTO)
+    simd = NFR_COPY_SIMD_AVX512;
+  if (simd >= NFR_COPY_SIMD_AVX512 && __builtin_cpu_supports("avx512f"))
+    return nfr_CopyAVX512;
+  if (simd >= NFR_COPY_SIMD_AVX2 && __builtin_cpu_supports("avx2"))
+    return nfr_CopyAVX2;
+#endif
+  (void) simd;
+  return nfr_CopyScalar;
+}
+
+// Copy one chunk; task function for the thread pool
+static void nfr_CopyChunk(void * arg, uint32_t index)
+{
+  struct NFRCopyEngine * engine = arg;
+  uint64_t offset = (uint64_t) index * NFR_COPY_CHUNK_SIZE;
+  uint64_t length = engine->length - offset;
+  if (length > NFR_COPY_CHUNK_SIZE)
+    length = NFR_COPY_CHUNK_SIZE;
+  engine->copy(engine->dst + offset, engine->src + offset, length);
+}
+
+int nfrCopyEngineCreate(const struct NFRCopyOpts * opts,
+                        PNFRCopyEngine * result)
+{
+  assert(result);
+  if (!result || (opts && opts->simd >= NFR_COPY_SIMD_MAX))
+    return -EINVAL;
+
+  struct NFRCopyEngine * engine = calloc(1, sizeof(*engine));
+  if (!engine)
+    return -ENOMEM;
+
+  uint8_t simd = opts ? opts->simd : NFR_COPY_SIMD_AUTO;
+  engine->copy      = nfr_CopySelect(simd);
+  engine->ntMinSize = NETFR_COPY_NT_MIN_SIZE;
+
+  /* On a single thread, streaming stores are slower than memcpy as long as
+     the destination fits in the cache, so AUTO only streams copies which
+     would evict it anyway */
+  if (simd == NFR_COPY_SIMD_AUTO)
+  {
+    engine->ntMinSize = nfr_GetCacheSize();
+    if (!engine->ntMinSize)
+      engine->ntMinSize = NFR_COPY_NT_AUTO_SIZE;
+    if (engine->ntMinSize < NETFR_COPY_NT_MIN_SIZE)
+      engine->ntMinSize = NETFR_COPY_NT_MIN_SIZE;
+  }
+
+  /* A few threads saturate the memory bandwidth, and more only compete with
+     the application for it */
+  uint32_t threads = opts ? opts->threads : 0;
+  if (!threads)
+  {
+    threads = nfr_GetCpuCount() / 2;
+    if (threads > 4)
+      threads = 4;
+  }
+
+  if (threads > 1)
+  {
+    int ret = nfr_ThreadPoolCreate(threads, &engine->pool);
+    if (ret < 0)
+      NFR_LOG_DEBUG("Thread pool unavailable (%d), copying on one thread", ret);
+  }
+
+  *result = engine;
+  return 0;
+}
+
+void nfrCopy(PNFRCopyEngine engine, void * dst, const void * src,
+             uint64_t length)
+{
+  assert(!length || (dst && src));
+  if (!engine || length < NETFR_COPY_NT_MIN_SIZE)
+  {
+    memcpy(dst, src, length);
+    return;
+  }
+
+  if (!engine->pool || length < NFR_COPY_MT_MIN_SIZE)
+  {
+    if (length < engine->ntMinSize)
+      memcpy(dst, src, length);
+    else
+      engine->copy(dst, src, length);
+    return;
+  }
+
+  engine->dst    = dst;
+  engine->src    = src;
+  engine->length = length;
+  nfr_ThreadPoolRun(engine->pool, nfr_CopyChunk, engine,
+                    (length + NFR_COPY_CHUNK_SIZE - 1) / NFR_COPY_CHUNK_SIZE);
+}
+
+void nfrCopyEngineFree(PNFRCopyEngine * engine)
+{
+  if (!engine || !*engine)
+    return;
+
+  nfr_ThreadPoolFree(&(*engine)->pool);
+  free(*engine);
+  *engine = 0;
+}
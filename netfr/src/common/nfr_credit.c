@@ -0,0 +1,168 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "common/nfr.h"
+#include "common/nfr_credit.h"
+#include "common/nfr_resource.h"
+
+/* Receive slots available to the messages of a channel, which bounds the
+   window that can be granted without overrunning them */
+static uint32_t nfr_CreditCapacity(struct NFRResource * res)
+{
+  struct NFRResource * pool = nfr_ResourceRxPool(res);
+  uint32_t slots = pool->commBuf.info.rxSlots;
+  if (pool->rxShareCount > 1)
+    slots /= pool->rxShareCount;
+  return slots < NETFR_MAX_CREDIT_COUNT ? slots : NETFR_MAX_CREDIT_COUNT;
+}
+
+static void nfr_CreditUpdate(struct NFRResource * res, uint64_t now)
+{
+  struct NFRCreditState * cs = &res->credit;
+  res->txCredits = cs->window > cs->outstanding
+                   ? cs->window - cs->outstanding : 0;
+  if (cs->starvedSince && res->txCredits >= NETFR_RESERVED_CREDIT_COUNT)
+  {
+    cs->starvedTime += now - cs->starvedSince;
+    cs->starvedSince = 0;
+  }
+}
+
+void nfr_CreditReset(struct NFRResource * res, uint32_t window)
+{
+  assert(res);
+  struct NFRCreditState * cs = &res->credit;
+  uint64_t starvedTime  = cs->starvedTime;
+  uint64_t starvedCount = cs->starvedCount;
+  memset(cs, 0, sizeof(*cs));
+  cs->starvedTime  = starvedTime;
+  cs->starvedCount = starvedCount;
+  cs->window       = window;
+  cs->granted      = nfr_ResourceRxCredits(res);
+  res->txCredits   = window;
+}
+
+void nfr_CreditSent(struct NFRResource * res)
+{
+  struct NFRCreditState * cs = &res->credit;
+  assert(res->txCredits);
+  --res->txCredits;
+  ++cs->outstanding;
+  if (cs->sendTail - cs->sendHead < NETFR_MAX_CREDIT_COUNT)
+    cs->sendTime[cs->sendTail++ % NETFR_MAX_CREDIT_COUNT] = nfr_GetTimeNs();
+}
+
+void nfr_CreditStarved(struct NFRResource * res)
+{
+  struct NFRCreditState * cs = &res->credit;
+  if (cs->starvedSince)
+    return;
+  cs->starvedSince = nfr_GetTimeNs();
+  ++cs->starvedCount;
+}
+
+uint64_t nfr_CreditAcked(struct NFRResource * res, uint8_t window)
+{
+  struct NFRCreditState * cs = &res->credit;
+  uint64_t now = nfr_GetTimeNs();
+  uint64_t rtt = 0;
+
+  /* Messages are acknowledged once read, mostly in order, so the round trip
+     includes the time the peer took to read them */
+  if (cs->sendHead != cs->sendTail)
+  {
+    uint64_t sent = cs->sendTime[cs->sendHead++ % NETFR_MAX_CREDIT_COUNT];
+    if (now > sent)
+    {
+      rtt = now - sent;
+      cs->srtt = cs->srtt ? (cs->srtt * 7 + rtt) / 8 : rtt;
+      if (!cs->minRtt || rtt < cs->minRtt)
+        cs->minRtt = rtt;
+    }
+  }
+
+  if (cs->outstanding)
+    --cs->outstanding;
+  if (window)
+    cs->window = window;
+  nfr_CreditUpdate(res, now);
+  return rtt;
+}
+
+void nfr_CreditReceived(struct NFRResource * res)
+{
+  ++res->credit.pending;
+}
+
+uint8_t nfr_CreditRead(struct NFRResource * res)
+{
+  struct NFRCreditState * cs = &res->credit;
+  uint64_t now = nfr_GetTimeNs();
+  if (cs->pending)
+    --cs->pending;
+
+  if (cs->lastRead && now > cs->lastRead)
+  {
+    uint64_t interval = now - cs->lastRead;
+    cs->readInterval = cs->readInterval
+                       ? (cs->readInterval * 7 + interval) / 8 : interval;
+  }
+  cs->lastRead = now;
+
+  /* The reader is allowed to fall behind by what it reads within a round
+     trip. Anything beyond that is taken off the window, so the sender slows
+     down before the receive slots run out. */
+  uint64_t delay = cs->minRtt > NFR_CREDIT_MIN_DELAY_NS
+                   ? cs->minRtt : NFR_CREDIT_MIN_DELAY_NS;
+  uint64_t allowed = cs->readInterval ? delay / cs->readInterval : 0;
+  if (allowed < NFR_CREDIT_MIN_BACKLOG)
+    allowed = NFR_CREDIT_MIN_BACKLOG;
+
+  uint32_t capacity = nfr_CreditCapacity(res);
+  uint64_t excess   = cs->pending > allowed ? cs->pending - allowed : 0;
+  uint32_t window   = excess < capacity ? capacity - (uint32_t) excess : 0;
+  if (window < NFR_CREDIT_MIN_WINDOW)
+    window = NFR_CREDIT_MIN_WINDOW;
+  if (window > capacity)
+    window = capacity;
+
+  cs->granted = window;
+  return (uint8_t) window;
+}
+
+void nfr_CreditGetStats(struct NFRResource * res,
+                        struct NFRCreditStats * stats)
+{
+  struct NFRCreditState * cs = &res->credit;
+  memset(stats, 0, sizeof(*stats));
+  stats->window       = cs->window;
+  stats->outstanding  = cs->outstanding;
+  stats->granted      = cs->granted;
+  stats->pending      = cs->pending;
+  stats->rtt          = cs->srtt;
+  stats->minRtt       = cs->minRtt;
+  stats->starvedTime  = cs->starvedTime;
+  stats->starvedCount = cs->starvedCount;
+  if (cs->starvedSince)
+    stats->starvedTime += nfr_GetTimeNs() - cs->starvedSince;
+}
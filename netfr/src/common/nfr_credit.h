@@ -0,0 +1,99 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef NETFR_PRIVATE_CREDIT_H
+#define NETFR_PRIVATE_CREDIT_H
+
+/*
+  Adaptive credit window.
+
+  The credits advertised in the hello messages only set the initial window.
+  Every acknowledgement carries the window the receiver currently grants,
+  which is bounded by the receive slots available to the channel and reduced
+  by the messages waiting to be read beyond what the reader consumes within a
+  round trip. A reader which keeps up therefore grants all of its slots, while
+  a slow reader pushes back before its slots run out.
+*/
+
+#include <stdint.h>
+
+#include "netfr/netfr.h"
+#include "common/nfr_resource_types.h"
+
+/* Messages a reader may fall behind by before the window is reduced */
+#define NFR_CREDIT_MIN_BACKLOG 4
+
+/* Lower bound of the round trip time used to size the tolerated backlog */
+#define NFR_CREDIT_MIN_DELAY_NS 100000
+
+/* Smallest window granted, which leaves one message beyond the reserve */
+#define NFR_CREDIT_MIN_WINDOW (NETFR_RESERVED_CREDIT_COUNT + 1)
+
+/**
+ * @brief Reset the credit state of a resource for a new connection.
+ *
+ * @param res     Resource
+ *
+ * @param window  Initial window advertised by the peer
+ */
+void nfr_CreditReset(struct NFRResource * res, uint32_t window);
+
+/**
+ * @brief Record a data message sent, consuming a credit.
+ */
+void nfr_CreditSent(struct NFRResource * res);
+
+/**
+ * @brief Record a send refused for lack of credits.
+ */
+void nfr_CreditStarved(struct NFRResource * res);
+
+/**
+ * @brief Process an acknowledgement returning a credit.
+ *
+ * @param res     Resource
+ *
+ * @param window  Window granted by the peer, 0 to keep the current one
+ *
+ * @return        Round trip time of the acknowledged message in nanoseconds,
+ *                or 0 if unknown
+ */
+uint64_t nfr_CreditAcked(struct NFRResource * res, uint8_t window);
+
+/**
+ * @brief Record a data message received and waiting to be read.
+ */
+void nfr_CreditReceived(struct NFRResource * res);
+
+/**
+ * @brief Record a data message read by the application, and compute the
+ *        window to grant in its acknowledgement.
+ *
+ * @return  The window to grant to the peer
+ */
+uint8_t nfr_CreditRead(struct NFRResource * res);
+
+/**
+ * @brief Get the credit statistics of a resource.
+ */
+void nfr_CreditGetStats(struct NFRResource * res,
+                        struct NFRCreditStats * stats);
+
+#endif
@@ -0,0 +1,198 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <errno.h>
+#include <assert.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+
+#include "common/nfr.h"
+#include "common/nfr_eager.h"
+#include "common/nfr_log.h"
+
+void nfr_EagerReset(struct NFREagerRing * ring)
+{
+  assert(ring);
+  ring->remoteAddr = 0;
+  ring->remoteKey  = 0;
+  ring->produced   = 0;
+  ring->consumed   = 0;
+  ring->reported   = 0;
+  ring->record     = 0;
+  ring->ready      = 0;
+}
+
+void nfr_EagerFree(struct NFREagerRing * ring)
+{
+  if (!ring)
+    return;
+  if (ring->mem)
+    nfrFreeMemory(&ring->mem);
+  memset(ring, 0, sizeof(*ring));
+}
+
+int nfr_EagerWrite(struct NFREagerRing * ring, struct NFRResource * res,
+                   const void * data, uint32_t length, uint64_t udata,
+                   uint8_t records, uint32_t msgSerial,
+                   uint32_t channelSerial)
+{
+  assert(ring);
+  assert(ring->ready);
+  assert(ring->mem);
+
+  if (length > NFR_EAGER_MAX_PAYLOAD)
+    return -ENOBUFS;
+  if (!res->ep)
+    return -ENOTCONN;
+
+  // The client writes the number of entries it has consumed into the counter
+  uint64_t consumed = atomic_load_explicit(
+    (_Atomic(uint64_t) *) ring->mem->addr, memory_order_acquire);
+  if (consumed > ring->produced)
+  {
+    // The client cannot have consumed entries which were never written
+    NFR_LOG_ERROR("Invalid eager ring position %" PRIu64 " of %" PRIu64
+                  ", disabling the ring", consumed, ring->produced);
+    nfr_EagerReset(ring);
+    return -EAGAIN;
+  }
+  if (ring->produced - consumed >= ring->slots)
+    return -EAGAIN;
+
+  struct NFRFabricContext * ctx = nfr_ContextGet(res, NFR_OP_SEND, 0);
+  if (!ctx)
+    return -EAGAIN;
+
+  struct NFREagerEntry * entry = (struct NFREagerEntry *) ctx->slot->data;
+  uint8_t seq = nfr_EagerSeq(ring, ring->produced);
+  memset(entry, 0, sizeof(*entry));
+  entry->seq           = seq;
+  entry->records       = records;
+  entry->length        = length;
+  entry->msgSerial     = msgSerial;
+  entry->channelSerial = channelSerial;
+  entry->udata         = udata;
+  memcpy(entry->data, data, length);
+  entry->data[length] = seq;
+
+  struct iovec iov;
+  iov.iov_base = entry;
+  iov.iov_len  = sizeof(*entry) + length + 1;
+
+  struct fi_rma_iov rmaIov;
+  rmaIov.addr = ring->remoteAddr
+                + (ring->produced % ring->slots) * NETFR_EAGER_SLOT_SIZE;
+  rmaIov.len  = iov.iov_len;
+  rmaIov.key  = ring->remoteKey;
+
+  void * desc = fi_mr_desc(res->commBuf.memRegion->mr);
+  struct fi_msg_rma msg = {0};
+  msg.msg_iov       = &iov;
+  msg.desc          = &desc;
+  msg.iov_count     = 1;
+  msg.rma_iov       = &rmaIov;
+  msg.rma_iov_count = 1;
+  msg.context       = ctx;
+
+  // The context is released once the write completes, as it has no callback
+  memset(&ctx->cbInfo, 0, sizeof(ctx->cbInfo));
+  ctx->txSeq = nfr_ResourceNextTxSeq(res);
+  ssize_t ret = fi_writemsg(res->ep, &msg, FI_COMPLETION);
+  if (ret < 0)
+  {
+    if (ret != -FI_EAGAIN)
+      NFR_LOG_DEBUG("Failed to post eager write: %s (%d)",
+                    fi_strerror((int) -ret), (int) ret);
+    NFR_RESET_CONTEXT(ctx);
+    return ret == -FI_EAGAIN ? -EAGAIN : (int) ret;
+  }
+
+  ctx->state   = CTX_STATE_WAITING;
+  ctx->pending = 1;
+  ++res->stats.writesPosted;
+  res->stats.bytesWritten += iov.iov_len;
+  ++ring->produced;
+  return 0;
+}
+
+const struct NFREagerEntry * nfr_EagerPeek(struct NFREagerRing * ring)
+{
+  assert(ring);
+  if (!ring->mem || !ring->slots)
+    return 0;
+
+  const uint8_t * slot = (const uint8_t *) ring->mem->addr
+    + (ring->consumed % ring->slots) * NETFR_EAGER_SLOT_SIZE;
+  const struct NFREagerEntry * entry = (const struct NFREagerEntry *) slot;
+  uint8_t seq = nfr_EagerSeq(ring, ring->consumed);
+
+  /* The slot is written by the NIC in order, so the entry has arrived once
+     the copy of the sequence number after the data matches */
+  if (*(const volatile uint8_t *) &entry->seq != seq)
+    return 0;
+  uint32_t length = *(const volatile uint32_t *) &entry->length;
+  if (length > NFR_EAGER_MAX_PAYLOAD)
+  {
+    NFR_LOG_ERROR("Invalid eager ring entry length %u", length);
+    return 0;
+  }
+  if (*(const volatile uint8_t *) (entry->data + length) != seq)
+    return 0;
+
+  atomic_thread_fence(memory_order_acquire);
+  return entry;
+}
+
+void nfr_EagerConsume(struct NFREagerRing * ring, struct NFRResource * res)
+{
+  assert(ring);
+  ++ring->consumed;
+  ring->record = 0;
+  nfr_EagerReport(ring, res);
+}
+
+int nfr_EagerReport(struct NFREagerRing * ring, struct NFRResource * res)
+{
+  assert(ring);
+  assert(res);
+
+  /* Reporting every entry would double the traffic. As the interval is less
+     than the ring size, the host never waits for an unreported entry. */
+  uint32_t interval = ring->slots / 4 ? ring->slots / 4 : 1;
+  if (!ring->ready || ring->consumed - ring->reported < interval)
+    return 0;
+  if (!res->ep)
+    return -ENOTCONN;
+
+  ssize_t ret = fi_inject_write(res->ep, &ring->consumed,
+                                sizeof(ring->consumed), 0, ring->remoteAddr,
+                                ring->remoteKey);
+  if (ret < 0)
+  {
+    if (ret != -FI_EAGAIN)
+      NFR_LOG_WARNING("Failed to report eager ring position: %s (%d)",
+                      fi_strerror((int) -ret), (int) ret);
+    return (int) ret;
+  }
+
+  ring->reported = ring->consumed;
+  return 0;
+}
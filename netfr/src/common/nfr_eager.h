@@ -0,0 +1,118 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef NETFR_PRIVATE_EAGER_H
+#define NETFR_PRIVATE_EAGER_H
+
+#include <stdint.h>
+
+#include "netfr/netfr.h"
+#include "common/nfr_protocol.h"
+
+/* Largest message written into the eager ring */
+#define NFR_EAGER_MAX_PAYLOAD \
+  (NETFR_EAGER_SLOT_SIZE - sizeof(struct NFREagerEntry) - 1)
+
+/* Eager message ring of a channel. The client owns the ring and the host
+   writes into it; the client in turn writes the number of entries it has
+   consumed into a counter owned by the host, which bounds how far the host
+   may write ahead. */
+struct NFREagerRing
+{
+  /* Client: the ring. Host: the counter of consumed entries. */
+  struct NFRMemory        * mem;
+  /* Host: the ring. Client: the counter. Valid if rkey or addr is set. */
+  uint64_t                  remoteAddr;
+  uint64_t                  remoteKey;
+  uint32_t                  slots;
+  uint64_t                  produced;   // Host: entries written
+  uint64_t                  consumed;   // Client: entries consumed
+  uint64_t                  reported;   // Client: last count written to host
+  uint8_t                   record;     // Client: next record of an entry
+  uint8_t                   ready;      // Both sides know the remote memory
+};
+
+/**
+ * @brief Sequence number of the entries written in the lap of a ring position.
+ *        Never 0, so a zeroed slot is never mistaken for an entry.
+ */
+inline static uint8_t nfr_EagerSeq(const struct NFREagerRing * ring,
+                                   uint64_t pos)
+{
+  return (uint8_t) ((pos / ring->slots) % 255 + 1);
+}
+
+/**
+ * @brief Forget the remote memory and positions, e.g. on disconnection. Local
+ *        memory is kept for the next connection.
+ */
+void nfr_EagerReset(struct NFREagerRing * ring);
+
+void nfr_EagerFree(struct NFREagerRing * ring);
+
+/**
+ * @brief Write a data message into the next slot of the ring.
+ *
+ * The entry is composed in a send context and written with a single RDMA
+ * write, so no credits are used and no acknowledgement is sent.
+ *
+ * @param ring           Host side of the ring, which must be ready
+ *
+ * @param res            Channel resource
+ *
+ * @return 0 on success, -ENOBUFS if the message does not fit in a slot,
+ *         -EAGAIN if the ring is full or no context is available, or another
+ *         negative error code. A consumed position beyond the produced one
+ *         disables the ring until it is announced again.
+ */
+int nfr_EagerWrite(struct NFREagerRing * ring, struct NFRResource * res,
+                   const void * data, uint32_t length, uint64_t udata,
+                   uint8_t records, uint32_t msgSerial,
+                   uint32_t channelSerial);
+
+/**
+ * @brief Get the oldest entry of the ring which has fully arrived.
+ *
+ * @param ring           Client side of the ring
+ *
+ * @return The entry, or 0 if there is none
+ */
+const struct NFREagerEntry * nfr_EagerPeek(struct NFREagerRing * ring);
+
+/**
+ * @brief Release the oldest entry of the ring, and let the host know once a
+ *        quarter of the ring has been consumed.
+ *
+ * @param ring           Client side of the ring
+ *
+ * @param res            Channel resource
+ */
+void nfr_EagerConsume(struct NFREagerRing * ring, struct NFRResource * res);
+
+/**
+ * @brief Write the number of consumed entries to the host, once a quarter of
+ *        the ring has been consumed since the last time. Failed writes are
+ *        retried on the next call.
+ *
+ * @return 0 on success, negative error code on failure
+ */
+int nfr_EagerReport(struct NFREagerRing * ring, struct NFRResource * res);
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <errno.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/nfr_fragment.h"
+#include "common/nfr_log.h"
+
+int nfr_FragmentSubmit(struct NFRFragmenter * f, const void * data,
+                       uint32_t length, uint64_t udata, uint32_t maxPayload,
+                       uint8_t flags, uint8_t cacheSlot)
+{
+  assert(f);
+  assert(data);
+  if (!length || length > NETFR_LARGE_MESSAGE_MAX_SIZE)
+    return -EINVAL;
+  if (nfr_FragmentBusy(f))
+    return -EBUSY;
+
+  // Each fragment is stored with its header, so that it is posted as is
+  if (maxPayload > NETFR_MESSAGE_MAX_PAYLOAD_SIZE)
+    maxPayload = NETFR_MESSAGE_MAX_PAYLOAD_SIZE;
+  uint32_t stride = maxPayload & ~15u;
+  if (stride <= sizeof(struct NFRMsgFragment))
+    return -ENOBUFS;
+
+  uint32_t chunk = stride - sizeof(struct NFRMsgFragment);
+  uint32_t count = (length + chunk - 1) / chunk;
+  uint64_t size  = (uint64_t) count * stride;
+  if (size > f->capacity)
+  {
+    uint8_t * buf = realloc(f->buf, size);
+    if (!buf)
+      return -ENOMEM;
+    f->buf      = buf;
+    f->capacity = size;
+  }
+
+  if (!++f->id)
+    ++f->id;
+
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    struct NFRMsgFragment frag;
+    memset(&frag, 0, sizeof(frag));
+    frag.id        = f->id;
+    frag.total     = length;
+    frag.offset    = i * chunk;
+    frag.flags     = flags;
+    frag.cacheSlot = cacheSlot;
+
+    uint8_t * dst = f->buf + (uint64_t) i * stride;
+    uint32_t  len = length - frag.offset < chunk ? length - frag.offset : chunk;
+    memcpy(dst, &frag, sizeof(frag));
+    memcpy(dst + sizeof(frag), (const uint8_t *) data + frag.offset, len);
+  }
+
+  f->stride = stride;
+  f->count  = count;
+  f->next   = 0;
+  f->length = sizeof(struct NFRMsgFragment) + length - (count - 1) * chunk;
+  f->udata  = udata;
+  return 0;
+}
+
+int nfr_FragmentSubmitRef(struct NFRFragmenter * f, uint32_t length,
+                          uint64_t hash, uint8_t cacheSlot, uint64_t udata)
+{
+  assert(f);
+  if (nfr_FragmentBusy(f))
+    return -EBUSY;
+
+  if (!++f->id)
+    ++f->id;
+
+  struct NFRMsgFragment frag;
+  memset(&frag, 0, sizeof(frag));
+  frag.id        = f->id;
+  frag.total     = length;
+  frag.flags     = NFR_FRAGMENT_FLAG_CACHE_REF;
+  frag.cacheSlot = cacheSlot;
+  memcpy(f->ref, &frag, sizeof(frag));
+  memcpy(f->ref + sizeof(frag), &hash, sizeof(hash));
+
+  // A reference is always a single fragment, stored apart from the buffer
+  f->stride = 0;
+  f->count  = 1;
+  f->next   = 0;
+  f->length = sizeof(f->ref);
+  f->udata  = udata;
+  return 0;
+}
+
+int nfr_FragmentFlush(struct NFRFragmenter * f, void * owner,
+                      NFR_SendQPostFn post)
+{
+  assert(f);
+  int nPosted = 0;
+  while (nfr_FragmentBusy(f))
+  {
+    uint32_t length = f->next == f->count - 1 ? f->length : f->stride;
+    const uint8_t * data = f->stride ? f->buf + (uint64_t) f->next * f->stride
+                                     : f->ref;
+    int ret = post(owner, data, length, f->udata, NFR_MSG_FRAGMENT);
+    if (ret == -EAGAIN || ret == -ENOSPC)
+      return nPosted;
+    if (ret < 0)
+    {
+      // The receiver discards the fragments it got once the next message starts
+      NFR_LOG_WARNING("Dropped large message %u after %u of %u fragments: "
+                      "%s (%d)", f->id, f->next, f->count, strerror(-ret),
+                      ret);
+      nfr_FragmentReset(f);
+      return ret;
+    }
+    ++f->next;
+    ++nPosted;
+  }
+  return nPosted;
+}
+
+void nfr_FragmentReset(struct NFRFragmenter * f)
+{
+  assert(f);
+  f->count = 0;
+  f->next  = 0;
+}
+
+void nfr_FragmentFree(struct NFRFragmenter * f)
+{
+  if (!f)
+    return;
+  free(f->buf);
+  memset(f, 0, sizeof(*f));
+}
+
+int nfr_FragmentValidate(const uint8_t * data, uint32_t length)
+{
+  struct NFRMsgFragment frag;
+  if (length <= sizeof(frag))
+    return -EBADMSG;
+
+  memcpy(&frag, data, sizeof(frag));
+  uint32_t len = length - sizeof(frag);
+  if (!frag.id || frag.total > NETFR_LARGE_MESSAGE_MAX_SIZE
+      || frag.offset >= frag.total)
+    return -EBADMSG;
+
+  // Cached messages fit into a slot, and a reference only carries the hash
+  if ((frag.flags & (NFR_FRAGMENT_FLAG_CACHE | NFR_FRAGMENT_FLAG_CACHE_REF))
+      && (frag.cacheSlot >= NETFR_MAX_CACHE_SLOTS
+          || frag.total > NETFR_CACHE_SLOT_SIZE))
+    return -EBADMSG;
+  if (frag.flags & NFR_FRAGMENT_FLAG_CACHE_REF)
+    return frag.offset == 0 && len == sizeof(uint64_t) ? 0 : -EBADMSG;
+
+  if (len > frag.total - frag.offset)
+    return -EBADMSG;
+  return 0;
+}
+
+int nfr_ReassembleSetBuffer(struct NFRReassembler * r, void * buf,
+                            uint32_t size)
+{
+  assert(r);
+  if (r->id && r->received < r->total && !r->drop)
+    return -EBUSY;
+
+  if (!r->userBuf)
+    free(r->buf);
+  r->buf      = buf;
+  r->capacity = buf ? size : 0;
+  r->userBuf  = buf != 0;
+  r->id       = 0;
+  return 0;
+}
+
+int nfr_ReassembleAdd(struct NFRReassembler * r, const uint8_t * data,
+                      uint32_t length, uint64_t udata)
+{
+  assert(r);
+  struct NFRMsgFragment frag;
+  memcpy(&frag, data, sizeof(frag));
+  uint32_t len = length - sizeof(frag);
+  if (frag.flags & NFR_FRAGMENT_FLAG_CACHE_REF)
+    return -EBADMSG;
+
+  if (frag.id != r->id)
+  {
+    if (r->id && r->received < r->total && !r->drop)
+      NFR_LOG_WARNING("Discarding incomplete large message %u (%u of %u "
+                      "bytes)", r->id, r->received, r->total);
+
+    r->id        = frag.id;
+    r->total     = frag.total;
+    r->received  = 0;
+    r->udata     = udata;
+    r->drop      = 0;
+    r->flags     = frag.flags;
+    r->cacheSlot = frag.cacheSlot;
+
+    if (frag.total > r->capacity)
+    {
+      if (r->userBuf)
+      {
+        r->drop = 1;
+        return -ENOBUFS;
+      }
+      uint8_t * buf = realloc(r->buf, frag.total);
+      if (!buf)
+      {
+        r->drop = 1;
+        return -ENOMEM;
+      }
+      r->buf      = buf;
+      r->capacity = frag.total;
+    }
+  }
+
+  if (r->drop)
+    return 0;
+  if (frag.total != r->total || len > r->total - r->received)
+    return -EBADMSG;
+
+  // Fragments may be read out of order, so only the byte count is tracked
+  memcpy(r->buf + frag.offset, data + sizeof(frag), len);
+  r->received += len;
+  return r->received == r->total;
+}
+
+void nfr_ReassembleReset(struct NFRReassembler * r)
+{
+  assert(r);
+  r->id       = 0;
+  r->total    = 0;
+  r->received = 0;
+  r->drop     = 0;
+}
+
+void nfr_ReassembleFree(struct NFRReassembler * r)
+{
+  if (!r)
+    return;
+  if (!r->userBuf)
+    free(r->buf);
+  memset(r, 0, sizeof(*r));
+}
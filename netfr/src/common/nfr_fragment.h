@@ -0,0 +1,179 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+#ifndef NETFR_PRIVATE_FRAGMENT_H
+#define NETFR_PRIVATE_FRAGMENT_H
+
+#include <stdint.h>
+
+#include "common/nfr_protocol.h"
+#include "common/nfr_sendq.h"
+
+/* Splits a large message into fragments, which are posted as the credits
+   allow. One large message is sent at a time. */
+struct NFRFragmenter
+{
+  uint8_t                 * buf;       // Fragments including their headers
+  uint64_t                  capacity;
+  uint32_t                  stride;    // Bytes per fragment in buf
+  uint32_t                  count;     // Fragments of the message
+  uint32_t                  next;      // Next fragment to post
+  uint32_t                  length;    // Length of the last fragment
+  uint32_t                  id;        // Last message id assigned
+  uint64_t                  udata;
+  // Single fragment referring to a cached message, see nfr_FragmentSubmitRef
+  uint8_t                   ref[sizeof(struct NFRMsgFragment) + sizeof(uint64_t)];
+};
+
+/* Reassembles the fragments of a large message, into a buffer provided by the
+   user or one that is allocated and reused for later messages */
+struct NFRReassembler
+{
+  uint8_t                 * buf;
+  uint32_t                  capacity;
+  uint8_t                   userBuf;   // buf was provided by the user
+  uint8_t                   drop;      // Fragments of id are discarded
+  uint32_t                  id;        // Message being reassembled, 0 if none
+  uint32_t                  total;
+  uint32_t                  received;
+  uint64_t                  udata;
+  uint8_t                   flags;     // See NFRFragmentFlags
+  uint8_t                   cacheSlot;
+};
+
+/**
+ * @brief Check whether a large message is still being sent.
+ */
+inline static int nfr_FragmentBusy(struct NFRFragmenter * f)
+{
+  return f->next < f->count;
+}
+
+/**
+ * @brief Split a large message into fragments to be posted by
+ *        nfr_FragmentFlush. The data is copied.
+ *
+ * @param f          Fragmenter
+ *
+ * @param data       Message data
+ *
+ * @param length     Length of the message, at most
+ *                   NETFR_LARGE_MESSAGE_MAX_SIZE
+ *
+ * @param udata      User data sent along with every fragment
+ *
+ * @param maxPayload Largest data message payload the peer accepts
+ *
+ * @param flags      Fragment flags, see NFRFragmentFlags
+ *
+ * @param cacheSlot  Client cache slot to store the message in, if flagged
+ *
+ * @return 0 on success, -EBUSY if the previous message is still being sent,
+ *         or another negative error code
+ */
+int nfr_FragmentSubmit(struct NFRFragmenter * f, const void * data,
+                       uint32_t length, uint64_t udata, uint32_t maxPayload,
+                       uint8_t flags, uint8_t cacheSlot);
+
+/**
+ * @brief Send a reference to a message cached by the client instead of the
+ *        message, as a single fragment posted by nfr_FragmentFlush.
+ *
+ * @param f          Fragmenter
+ *
+ * @param length     Length of the cached message
+ *
+ * @param hash       Hash of the cached message
+ *
+ * @param cacheSlot  Client cache slot holding the message
+ *
+ * @param udata      User data of the message
+ *
+ * @return 0 on success, -EBUSY if the previous message is still being sent
+ */
+int nfr_FragmentSubmitRef(struct NFRFragmenter * f, uint32_t length,
+                          uint64_t hash, uint8_t cacheSlot, uint64_t udata);
+
+/**
+ * @brief Post the remaining fragments until one cannot be sent yet.
+ *
+ * @return The number of fragments posted, or a negative error code if the
+ *         message can never be sent, in which case it is dropped
+ */
+int nfr_FragmentFlush(struct NFRFragmenter * f, void * owner,
+                      NFR_SendQPostFn post);
+
+/**
+ * @brief Drop the fragments of the current message which were not posted.
+ */
+void nfr_FragmentReset(struct NFRFragmenter * f);
+
+void nfr_FragmentFree(struct NFRFragmenter * f);
+
+/**
+ * @brief Validate the header of a received fragment.
+ *
+ * @return 0 on success, -EBADMSG if the fragment is malformed
+ */
+int nfr_FragmentValidate(const uint8_t * data, uint32_t length);
+
+/**
+ * @brief Set the buffer large messages are reassembled into.
+ *
+ * @param r          Reassembler
+ *
+ * @param buf        Buffer, or null to allocate one as needed
+ *
+ * @param size       Size of the buffer
+ *
+ * @return 0 on success, -EBUSY if a message is being reassembled
+ */
+int nfr_ReassembleSetBuffer(struct NFRReassembler * r, void * buf,
+                            uint32_t size);
+
+/**
+ * @brief Add a validated fragment to the message it belongs to. A fragment of
+ *        a new message discards the incomplete one.
+ *
+ * @param r          Reassembler
+ *
+ * @param data       Fragment, starting with its NFRMsgFragment header
+ *
+ * @param length     Length of the fragment including the header
+ *
+ * @param udata      User data of the fragment
+ *
+ * @return 1 if the message is complete, 0 if fragments are missing, -ENOBUFS
+ *         if the message does not fit into the user buffer and is discarded,
+ *         or another negative error code. References to cached messages are
+ *         resolved by the caller and rejected with -EBADMSG.
+ */
+int nfr_ReassembleAdd(struct NFRReassembler * r, const uint8_t * data,
+                      uint32_t length, uint64_t udata);
+
+/**
+ * @brief Discard the message being reassembled.
+ */
+void nfr_ReassembleReset(struct NFRReassembler * r);
+
+void nfr_ReassembleFree(struct NFRReassembler * r);
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  #define NFR_HASH_X86 1
+  #include <immintrin.h>
+#else
+  #define NFR_HASH_X86 0
+#endif
+
+#include "common/nfr_hash.h"
+
+#define NFR_HASH_LANES 8
+#define NFR_HASH_STRIPE 64
+#define NFR_HASH_BLOCK_STRIPES 16
+
+#define NFR_HASH_PRIME32 0x9E3779B1U
+#define NFR_HASH_PRIME64 0x9E3779B185EBCA87ULL
+
+/* Keys of the lanes; stripe s of a block uses the 8 keys starting at s, and
+   the scramble the 8 keys starting at NFR_HASH_BLOCK_STRIPES */
+static const uint64_t nfr_HashSecret[NFR_HASH_BLOCK_STRIPES + NFR_HASH_LANES] =
+{
+  0x7bb04cea6e50c73cULL, 0xdaac8ec8b6bd383eULL, 0xdea73658e388d697ULL,
+  0x468c4e0854331465ULL, 0x1856bf74594af730ULL, 0x0481b8ee83684f44ULL,
+  0x3eb0de0229655598ULL, 0x5765158ee0690936ULL, 0x150a5c091c345723ULL,
+  0x553203b8d85bc484ULL, 0x9677a2294547d7e9ULL, 0x02cf45f3606bd253ULL,
+  0xc142a94a6c25b4cfULL, 0x2bfd6327b8393a91ULL, 0xd2168c3e71ae29c5ULL,
+  0x8d009c3ecfa6df69ULL, 0xac08dd948a887fddULL, 0x43eff01b77bf0f77ULL,
+  0x0b8fdeabededebc0ULL, 0x40ba68e8f9e81c6dULL, 0x86fcc587d7f8af47ULL,
+  0x792caebabdd924a6ULL, 0x6308c61b8fda29e0ULL, 0xf245ff8cb268d515ULL,
+};
+
+/* Accumulate stripes starting at key index first */
+typedef void (*NFR_HashStripesFn)(uint64_t * acc, const uint8_t * data,
+                                  uint32_t stripes, uint32_t first);
+
+/* Scramble the lanes at the end of a block */
+typedef void (*NFR_HashScrambleFn)(uint64_t * acc);
+
+static void nfr_HashStripesScalar(uint64_t * acc, const uint8_t * data,
+                                  uint32_t stripes, uint32_t first)
+{
+  for (uint32_t s = 0; s < stripes; ++s)
+  {
+    const uint64_t * key = nfr_HashSecret + first + s;
+    for (int i = 0; i < NFR_HASH_LANES; ++i)
+    {
+      uint64_t d;
+      memcpy(&d, data + (uint64_t) s * NFR_HASH_STRIPE + i * 8, sizeof(d));
+      uint64_t dk = d ^ key[i];
+      acc[i ^ 1] += d;
+      acc[i]     += (dk & 0xFFFFFFFFULL) * (dk >> 32);
+    }
+  }
+}
+
+static void nfr_HashScrambleScalar(uint64_t * acc)
+{
+  const uint64_t * key = nfr_HashSecret + NFR_HASH_BLOCK_STRIPES;
+  for (int i = 0; i < NFR_HASH_LANES; ++i)
+  {
+    uint64_t a = acc[i];
+    a ^= a >> 47;
+    a ^= key[i];
+    acc[i] = a * NFR_HASH_PRIME32;
+  }
+}
+
+#if NFR_HASH_X86
+
+__attribute__((target("avx2")))
+static void nfr_HashStripesAVX2(uint64_t * acc, const uint8_t * data,
+                                uint32_t stripes, uint32_t first)
+{
+  __m256i a0 = _mm256_loadu_si256((const __m256i *) acc);
+  __m256i a1 = _mm256_loadu_si256((const __m256i *) (acc + 4));
+  for (uint32_t s = 0; s < stripes; ++s)
+  {
+    const uint8_t  * p   = data + (uint64_t) s * NFR_HASH_STRIPE;
+    const uint64_t * key = nfr_HashSecret + first + s;
+    __m256i d0  = _mm256_loadu_si256((const __m256i *) p);
+    __m256i d1  = _mm256_loadu_si256((const __m256i *) (p + 32));
+    __m256i dk0 = _mm256_xor_si256(d0, _mm256_loadu_si256((const __m256i *) key));
+    __m256i dk1 = _mm256_xor_si256(d1, 
+                    _mm256_loadu_si256((const __m256i *) (key + 4)));
+    // Low half times high half of each lane
+    a0 = _mm256_add_epi64(a0, _mm256_mul_epu32(dk0, _mm256_srli_epi64(dk0, 32)));
+    a1 = _mm256_add_epi64(a1, _mm256_mul_epu32(dk1, _mm256_srli_epi64(dk1, 32)));
+    // Swap the lanes of each pair for the neighbour's input
+    a0 = _mm256_add_epi64(a0, _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2)));
+    a1 = _mm256_add_epi64(a1, _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2)));
+  }
+  _mm256_storeu_si256((__m256i *) acc, a0);
+  _mm256_storeu_si256((__m256i *) (acc + 4), a1);
+}
+
+__attribute__((target("avx2")))
+static void nfr_HashScrambleAVX2(uint64_t * acc)
+{
+  const uint64_t * key   = nfr_HashSecret + NFR_HASH_BLOCK_STRIPES;
+  const __m256i    prime = _mm256_set1_epi32((int) NFR_HASH_PRIME32);
+  for (int i = 0; i < NFR_HASH_LANES; i += 4)
+  {
+    __m256i a = _mm256_loadu_si256((const __m256i *) (acc + i));
+    a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+    a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i *) (key + i)));
+    // 64 by 32-bit multiplication from the products of both halves
+    __m256i lo = _mm256_mul_epu32(a, prime);
+    __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime);
+    a = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+    _mm256_storeu_si256((__m256i *) (acc + i), a);
+  }
+}
+
+#endif
+
+/**
+ * @brief Fold the 128-bit product of two values to 64 bits.
+ */
+inline static uint64_t nfr_HashMulFold(uint64_t a, uint64_t b)
+{
+  __uint128_t p = (__uint128_t) a * b;
+  return (uint64_t) p ^ (uint64_t) (p >> 64);
+}
+
+uint64_t nfr_Hash64(const void * data, uint64_t length)
+{
+  NFR_HashStripesFn  stripesFn  = nfr_HashStripesScalar;
+  NFR_HashScrambleFn scrambleFn = nfr_HashScrambleScalar;
+#if NFR_HASH_X86
+  if (__builtin_cpu_supports("avx2"))
+  {
+    stripesFn  = nfr_HashStripesAVX2;
+    scrambleFn = nfr_HashScrambleAVX2;
+  }
+#endif
+
+  uint64_t acc[NFR_HASH_LANES];
+  for (int i = 0; i < NFR_HASH_LANES; ++i)
+    acc[i] = nfr_HashSecret[i] ^ length;
+
+  const uint8_t * p = data;
+  uint64_t block = (uint64_t) NFR_HASH_STRIPE * NFR_HASH_BLOCK_STRIPES;
+  uint64_t left  = length;
+  for (; left >= block; left -= block, p += block)
+  {
+    stripesFn(acc, p, NFR_HASH_BLOCK_STRIPES, 0);
+    scrambleFn(acc);
+  }
+
+  // The remaining full stripes, then the last partial one padded with zeros
+  uint32_t stripes = (uint32_t) (left / NFR_HASH_STRIPE);
+  stripesFn(acc, p, stripes, 0);
+  left -= (uint64_t) stripes * NFR_HASH_STRIPE;
+  if (left)
+  {
+    uint8_t last[NFR_HASH_STRIPE] = {0};
+    memcpy(last, p + (uint64_t) stripes * NFR_HASH_STRIPE, left);
+    stripesFn(acc, last, 1, stripes);
+  }
+  scrambleFn(acc);
+
+  uint64_t h = length * NFR_HASH_PRIME64;
+  for (int i = 0; i < NFR_HASH_LANES; i += 2)
+    h += nfr_HashMulFold(acc[i] ^ nfr_HashSecret[i + 8],
+                         acc[i + 1] ^ nfr_HashSecret[i + 9]);
+
+  // Final avalanche
+  h ^= h >> 37;
+  h *= 0x165667919E3779F9ULL;
+  h ^= h >> 32;
+  return h;
+}
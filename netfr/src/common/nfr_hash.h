@@ -0,0 +1,44 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+#ifndef NETFR_PRIVATE_HASH_H
+#define NETFR_PRIVATE_HASH_H
+
+#include <stdint.h>
+
+/*
+  Content hash of cached payloads.
+
+  The data is processed in 64-byte stripes by eight 64-bit lanes, in the style
+  of XXH3: each lane multiplies the low and high halves of its input mixed
+  with a key and adds the raw input to its neighbour, and the lanes are
+  scrambled after every block of 16 stripes so that the order of the stripes
+  matters. The lanes are independent, so the stripes are processed with AVX2
+  where available. Both implementations produce the same value, as host and
+  client compare the hashes they computed separately.
+*/
+
+/**
+ * @brief Compute the 64-bit content hash of a buffer.
+ */
+uint64_t nfr_Hash64(const void * data, uint64_t length);
+
+#endif
@@ -18,6 +18,8 @@
  * Place, Suite 330, Boston, MA 02111-1307 USA
  */
 
+#include <inttypes.h>
+
 #include "common/nfr_mem.h"
 
 void * nfr_MemAllocAlign(uint64_t size, uint64_t alignment)
@@ -47,7 +49,8 @@ PNFRMemory nfr_RdmaAttach(struct NFRResource * res, void * addr, uint64_t size,
 
   struct NFRMemory * mem = 0;
 
-  for (int i = 0; i < NETFR_MAX_MEM_REGIONS; ++i)
+  int regionCount = nfr_ResourceMemRegionCount(res);
+  for (int i = 0; i < regionCount; ++i)
   {
     if (res->memRegions[i].state == MEM_STATE_EMPTY)
     {
@@ -118,6 +121,43 @@ free_mem_struct:
   return NULL;
 }
 
+int nfr_RdmaAttachRails(PNFRMemory mem, struct NFRResource ** rails,
+                        int railCount, uint64_t acs)
+{
+  assert(mem);
+  assert(rails);
+  assert(railCount <= NETFR_MAX_RAILS);
+
+  int r;
+  for (r = 1; r < railCount; ++r)
+  {
+    struct NFRResource * rail = rails[r];
+    assert(rail);
+    assert(!mem->railMr[r]);
+
+    ssize_t ret = fi_mr_reg(rail->domain, mem->addr, mem->size, acs, 0, 0, 0,
+                            &mem->railMr[r], mem);
+    for (int i = 0; ret == -FI_ENOKEY && i < 8; ++i)
+    {
+      ret = fi_mr_reg(rail->domain, mem->addr, mem->size, acs, 0,
+                      ++rail->rkeyCounter, 0, &mem->railMr[r], mem);
+    }
+
+    if (ret < 0)
+    {
+      NFR_LOG_WARNING("Failed to register memory %p on rail %d: %s (%d)",
+                      mem->addr, r, fi_strerror((int) -ret), (int) ret);
+      mem->railMr[r] = 0;
+      break;
+    }
+
+    NFR_LOG_DEBUG("Registered memory %p on rail %d with key %" PRIu64, mem->addr,
+                  r, fi_mr_key(mem->railMr[r]));
+  }
+
+  return r;
+}
+
 #ifdef __linux__
 
 /* This is to support externally allocated DMABUFs in the future, but it's not
@@ -186,7 +226,8 @@ PNFRMemory nfr_RdmaAllocDMABUF(struct NFRResource * res, uint64_t size,
                                uint64_t acs)
 {
   PNFRMemory mem = 0;
-  for (int i = 0; i < NETFR_MAX_MEM_REGIONS; ++i)
+  int regionCount = nfr_ResourceMemRegionCount(res);
+  for (int i = 0; i < regionCount; ++i)
   {
     if (res->memRegions[i].state == MEM_STATE_EMPTY)
     {
@@ -94,6 +94,44 @@ PNFRMemory nfr_RdmaAttach(struct NFRResource * res, void * addr, uint64_t size,
                           uint8_t initialState);
                            
 
+/**
+ * @brief Register an attached memory region against the domains of a channel's
+ *        additional rails, so that it can be used for striped writes.
+ *
+ * Rails which fail to register the memory are skipped; the memory can still
+ * be used on the remaining rails.
+ *
+ * @param mem        Memory region, already registered against rail 0
+ * @param rails      Rail array of the channel, including rail 0
+ * @param railCount  Number of rails in the array
+ * @param acs        Access control flags
+ *
+ * @return The number of rails the memory is registered on, including rail 0
+ */
+int nfr_RdmaAttachRails(PNFRMemory mem, struct NFRResource ** rails,
+                        int railCount, uint64_t acs);
+
+/**
+ * @brief Get the number of consecutive rails, starting from rail 0, that a
+ *        memory region is registered on.
+ */
+inline static int nfr_MemRailCount(PNFRMemory mem)
+{
+  int r = 1;
+  while (r < NETFR_MAX_RAILS && mem->railMr[r])
+    ++r;
+  return r;
+}
+
+/**
+ * @brief Get the memory registration of a memory region for a specific rail.
+ */
+inline static struct fid_mr * nfr_MemRailMr(PNFRMemory mem, int rail)
+{
+  assert(rail >= 0 && rail < NETFR_MAX_RAILS);
+  return rail ? mem->railMr[rail] : mem->mr;
+}
+
 /**
  * @brief Allocate a pinned memory region for use with DMABUF and RDMA.
  * 
@@ -22,6 +22,7 @@
 #define NETFR_PROTOCOL_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <assert.h>
 #include <string.h>
 
@@ -38,6 +39,8 @@ enum NFRMessageType
   NFR_MSG_CLIENT_DATA_ACK,
   NFR_MSG_HOST_DATA,
   NFR_MSG_HOST_DATA_ACK,
+  NFR_MSG_FRAME_DESC,
+  NFR_MSG_CACHE_STATE,
   NFR_MSG_MAX
 };
 
@@ -50,6 +53,9 @@ enum NFRMessageStatus
   NFR_MSG_STATUS_MAX
 };
 
+/* The maximum number of compressed slices in a buffer update */
+#define NFR_MSG_MAX_SLICES 32
+
 #pragma pack(push, 1)
 
 struct NFRHeader
@@ -57,6 +63,7 @@ struct NFRHeader
   char     magic[8];
   uint8_t  version;
   uint8_t  type;
+  uint8_t  channel;  // Channel index, used to route shared receives
 };
 
 /* The size of the message padding needed to reach a 16-byte alignment. NetFR
@@ -71,6 +78,7 @@ inline static void nfr_SetHeader(struct NFRHeader * hdr, uint8_t mType)
   memcpy(hdr->magic, NETFR_MAGIC, 8);
   hdr->version = NETFR_VERSION;
   hdr->type    = mType;
+  hdr->channel = 0;
 }
 
 /*
@@ -79,11 +87,26 @@ inline static void nfr_SetHeader(struct NFRHeader * hdr, uint8_t mType)
   buffer). They should not be sent over the fabric itself.
 */
 
+/* Optional protocol features, offered by the client in its hello message. The
+   server replies with the subset that is enabled for the connection. */
+enum NFRFeatureFlags
+{
+  NFR_FEATURE_LZ4 = 1 << 0,   // LZ4 compressed buffer writes
+  NFR_FEATURE_EAGER_RING = 1 << 1,  // Host data written into a client ring
+  NFR_FEATURE_REGISTERS = 1 << 2,   // Latest value registers, see NFRRegister
+  NFR_FEATURE_PULL = 1 << 3,        // Client reads of published frames
+  NFR_FEATURE_CACHE = 1 << 4,       // Client content cache, see NFRMsgCacheState
+};
+
 // NFRMsgClientHello: no payload
 
 struct NFRMsgClientHello
 {
   struct NFRHeader header;
+  uint8_t          features;
+  uint8_t          credits;   // Messages the client can receive, 0 = default
+  uint16_t         maxMessage;  // Largest message the client can receive
+  uint8_t          memRegions;  // Memory regions the client can announce
 };
 
 // NFRMsgServerHello: no payload
@@ -92,32 +115,85 @@ struct NFRMsgServerHello
 {
   struct NFRHeader header;
   uint8_t          status;
+  uint8_t          features;
+  uint8_t          credits;   // Messages the server can receive, 0 = default
+  uint16_t         maxMessage;  // Largest message the server can receive
+  uint8_t          memRegions;  // Memory regions the server can announce
 };
 
 // NFRMsgBufferUpdate, server -> client
 
+struct NFRMsgRange
+{
+  uint32_t         offset;
+  uint32_t         length;
+  uint32_t         pitch;
+  uint32_t         rows;
+};
+
+/* A compressed slice of a buffer write. offset and length locate the
+   compressed data in the staging buffer, rawOffset and rawLength the
+   decompressed data in the target buffer. */
+struct NFRMsgSlice
+{
+  uint32_t         offset;
+  uint32_t         length;
+  uint32_t         rawOffset;
+  uint32_t         rawLength;
+};
+
+/* payloadOffset and payloadSize describe the extent of all updated ranges. If
+   rangeCount is 0, no data was written and the buffer contents are the same as
+   after the previous write into it. If sliceCount is nonzero, the data was
+   written compressed into the staging buffer instead, and sliceCount slices
+   follow the ranges. metaLength bytes of user metadata follow the ranges and
+   slices. */
 struct NFRMsgBufferUpdate
 {
   struct NFRHeader header;
   uint8_t          bufferIndex;
-  uint8_t          padding[NETFR_MESSAGE_PAD_SIZE - 1];
+  uint8_t          rangeCount;
+  uint8_t          sliceCount;
+  uint16_t         metaLength;
   uint32_t         payloadSize;
   uint32_t         payloadOffset;
   uint32_t         writeSerial;
   uint32_t         channelSerial;
   uint64_t         udata;
+  struct NFRMsgRange ranges[];
 };
 
-// NFRMsgBufferState, client -> server
+// NFRMsgBufferState, client -> server, or server -> client for the eager
+// ring counter
+
+enum NFRBufferFlags
+{
+  /* The buffer receives compressed data only and is not a write target */
+  NFR_BUFFER_FLAG_STAGING = 1 << 0,
+  /* The buffer is the eager message ring, see NFREagerEntry */
+  NFR_BUFFER_FLAG_EAGER_RING = 1 << 1,
+  /* Sent by the host: the buffer receives the number of eager ring entries
+     the client has consumed, as a uint64_t */
+  NFR_BUFFER_FLAG_EAGER_COUNTER = 1 << 2,
+  /* The buffer holds the client's registers, see NFRRegister */
+  NFR_BUFFER_FLAG_REGISTERS = 1 << 3,
+  /* The buffer holds the client's content cache, NETFR_CACHE_SLOT_SIZE bytes
+     per slot */
+  NFR_BUFFER_FLAG_CACHE = 1 << 4,
+};
 
 struct NFRMsgBufferState
 {
   struct NFRHeader header;
+  uint8_t          flags;
+  uint8_t          priority;  // Placement preference, higher is preferred
   uint32_t         pageSize;
   uint64_t         addr;
   uint64_t         size;
   uint64_t         rkey;
   uint8_t          index;
+  uint8_t          railCount;
+  uint64_t         railKeys[NETFR_MAX_RAILS - 1]; // Keys for rails 1 onwards
 };
 
 // NFRMsgClientData, client -> server
@@ -129,6 +205,7 @@ struct NFR__MsgClientData
   uint64_t         udata;
   uint32_t         msgSerial;
   uint32_t         channelSerial;
+  uint8_t          records;
 };
 
 struct NFRMsgClientData
@@ -138,15 +215,52 @@ struct NFRMsgClientData
   uint64_t         udata;
   uint32_t         msgSerial;
   uint32_t         channelSerial;
-  uint8_t          padding[32 - sizeof(struct NFR__MsgClientData) % 32];
+  /* Number of packed records in the data, 0 for a single message. Record i
+     takes the serials of the message plus i. */
+  uint8_t          records;
+  uint8_t          padding[(32 - sizeof(struct NFR__MsgClientData) % 32) % 32];
   uint8_t          data[NETFR_MESSAGE_MAX_PAYLOAD_SIZE];
 };
 
+/* Value of records marking a data message which carries a fragment of a large
+   message instead of packed records. A fragment takes a single serial. */
+#define NFR_MSG_FRAGMENT 255
+
+enum NFRFragmentFlags
+{
+  /* The client stores the message in cacheSlot once it is complete */
+  NFR_FRAGMENT_FLAG_CACHE = 1 << 0,
+  /* The message is the one in cacheSlot, and the fragment data is its hash
+     as computed by nfr_Hash64. Sent as a single fragment. */
+  NFR_FRAGMENT_FLAG_CACHE_REF = 1 << 1,
+};
+
+/* Header of a fragment, followed by its part of the large message. The
+   fragments of a message carry the same id, flags and udata. */
+struct NFRMsgFragment
+{
+  uint32_t         id;        // Large message the fragment belongs to, not 0
+  uint32_t         total;     // Length of the large message
+  uint32_t         offset;    // Offset of the fragment in the large message
+  uint8_t          flags;     // See NFRFragmentFlags
+  uint8_t          cacheSlot; // Client cache slot, if flagged
+  uint8_t          padding[2];  // Keeps the fragment data 16-byte aligned
+};
+
+/* Record of a packed data message, followed by its data. The records are
+   stored back to back in the data of the message. */
+struct NFRMsgRecord
+{
+  uint64_t         udata;
+  uint32_t         length;
+};
+
 // NFRMsgClientDataAck, server -> client
 
 struct NFRMsgClientDataAck
 {
   struct NFRHeader header;
+  uint8_t          credits;   // Credit window granted to the client
 };
 
 // NFRMsgHostData, server -> client
@@ -158,6 +272,7 @@ struct NFR__MsgHostData
   uint64_t         udata;
   uint32_t         msgSerial;
   uint32_t         channelSerial;
+  uint8_t          records;
 };
 
 struct NFRMsgHostData
@@ -167,17 +282,130 @@ struct NFRMsgHostData
   uint64_t         udata;
   uint32_t         msgSerial;
   uint32_t         channelSerial;
-  uint8_t          padding[32 - sizeof(struct NFR__MsgHostData) % 32];
+  uint8_t          records;   // See NFRMsgClientData
+  uint8_t          padding[(32 - sizeof(struct NFR__MsgHostData) % 32) % 32];
   uint8_t          data[NETFR_MESSAGE_MAX_PAYLOAD_SIZE];
 };
 
+/* Entry of the eager message ring, written by the host with a single RDMA
+   write into the next slot of NETFR_EAGER_SLOT_SIZE bytes. The data is
+   followed by a copy of seq, so that the client can tell when the whole
+   entry has arrived by polling the ring. seq is the lap of the ring the entry
+   was written in, see nfr_EagerSeq. The header fits within the first cache
+   line of the slot. */
+struct NFREagerEntry
+{
+  uint8_t          seq;
+  uint8_t          records;   // See NFRMsgClientData
+  uint8_t          padding[2];
+  uint32_t         length;
+  uint32_t         msgSerial;
+  uint32_t         channelSerial;
+  uint64_t         udata;
+  uint8_t          data[];
+};
+
+/* Latest value register, written by the host with a single RDMA write. A
+   reader reads seqEnd, then the value, then seq, and has a consistent snapshot
+   if both match. This assumes the provider and NIC place the write in
+   ascending address order, so seq lands first and seqEnd last; RDMA does not
+   guarantee it. A mismatch is retried, but a placement order which fools the
+   check is not detected. 0 if the register was never written. */
+struct NFRRegister
+{
+  uint32_t         seq;
+  uint32_t         length;
+  uint8_t          data[NETFR_REGISTER_MAX_PAYLOAD];
+  uint32_t         seqEnd;
+};
+
+// NFRMsgFrameDesc, server -> client
+
+/* Newest frame published by the host for the client to read. The frame is
+   intact if the generation at genAddr still matches after it was read. */
+struct NFRMsgFrameDesc
+{
+  struct NFRHeader header;
+  uint64_t         addr;
+  uint64_t         rkey;
+  uint64_t         length;
+  uint64_t         genAddr;
+  uint64_t         genKey;
+  uint64_t         generation;
+  uint64_t         udata;
+};
+
+// NFRMsgCacheState, client -> server
+
+/* Reports that a cache slot holds the message with the given hash. The host
+   only refers to a slot once the client has reported the hash it expects. */
+struct NFRMsgCacheState
+{
+  struct NFRHeader header;
+  uint64_t         hash;
+  uint8_t          slot;
+};
+
 // NFRMsgHostDataAck, client -> server
 
 struct NFRMsgHostDataAck
 {
   struct NFRHeader header;
+  uint8_t          credits;   // Credit window granted to the server
 };
 
 #pragma pack(pop)
 
+static_assert(sizeof(struct NFRMsgBufferUpdate)
+              + NETFR_MAX_WRITE_RANGES * sizeof(struct NFRMsgRange)
+              + NFR_MSG_MAX_SLICES * sizeof(struct NFRMsgSlice)
+              + NETFR_WRITE_METADATA_MAX_SIZE
+              <= NETFR_MESSAGE_MIN_SIZE,
+              "Buffer update with the maximum range count exceeds message size");
+
+static_assert(offsetof(struct NFRMsgBufferUpdate, payloadSize) % 16 == 0,
+              "Buffer update fields are not aligned");
+
+static_assert(sizeof(struct NFREagerEntry) == 24
+              && NETFR_EAGER_SLOT_SIZE % 64 == 0,
+              "Eager ring entry header does not fit in a cache line");
+
+static_assert(sizeof(struct NFRRegister) == NETFR_REGISTER_SIZE,
+              "Register layout does not match its size");
+
+static_assert(sizeof(struct NFRMsgBufferState) <= NETFR_MESSAGE_MIN_SIZE,
+              "Buffer state exceeds message size");
+
+static_assert(sizeof(struct NFRMsgFrameDesc) <= NETFR_MESSAGE_MIN_SIZE,
+              "Frame descriptor exceeds message size");
+
+static_assert(offsetof(struct NFRMsgClientData, data) % 32 == 0
+              && offsetof(struct NFRMsgHostData, data) % 32 == 0,
+              "Data message payload is not aligned");
+
+static_assert(sizeof(struct NFRMsgFragment) % 16 == 0,
+              "Fragment data is not aligned");
+
+static_assert(sizeof(struct NFRMsgClientHello) <= NETFR_CM_MESSAGE_MAX_SIZE
+              && sizeof(struct NFRMsgServerHello) <= NETFR_CM_MESSAGE_MAX_SIZE,
+              "Hello message exceeds connection manager data size");
+
+/**
+ * @brief Get the number of serials a data message takes, one for each packed
+ *        record and one otherwise.
+ */
+inline static uint8_t nfr_MsgSerials(uint8_t records)
+{
+  return records && records != NFR_MSG_FRAGMENT ? records : 1;
+}
+
+/**
+ * @brief Check whether a serial was assigned before another, accounting for
+ *        wraparound.
+ */
+inline static int nfr_SerialBefore(uint32_t a, uint32_t b)
+{
+  return (int32_t) (a - b) < 0;
+}
+
 #endif
\ No newline at end of file
@@ -22,6 +22,7 @@
 #include "common/nfr_resource.h"
 #include "common/nfr.h"
 #include "common/nfr_log.h"
+#include "common/nfr_compress.h"
 
 inline static int nfr_GetSlotBase(struct NFRCommBufInfo info, uint8_t type,
                                   int * slotCount)
@@ -51,7 +52,7 @@ inline static int nfr_GetSlotBase(struct NFRCommBufInfo info, uint8_t type,
 }
 
 struct NFRFabricContext * nfr_ContextGet(struct NFRResource * res,
-                                         uint8_t opType, uint8_t * index)
+                                         uint8_t opType, int * index)
 {
   assert(res);
   int endIndex;
@@ -60,10 +61,20 @@ struct NFRFabricContext * nfr_ContextGet(struct NFRResource * res,
   assert(i >= 0);
   assert(endIndex <= NFR_TOTAL_SLOTS(res->commBuf.info));
   
+  /* Contexts are allocated first-fit, so reaching the last quarter of a
+     transmit class means it is running low and its completions should be
+     reaped on the next processing call. The ack and write classes only have
+     a few contexts, so their completions are always reaped. */
+  int lowIndex = endIndex - (endIndex - i) / 4;
+  if (opType == NFR_OP_ACK || opType == NFR_OP_WRITE)
+    lowIndex = i;
+
   for (; i < endIndex; ++i)
   {
     if (res->commBuf.ctx[i].state == CTX_STATE_AVAILABLE)
     {
+      if (opType != NFR_OP_RECV && i >= lowIndex)
+        res->txLow = 1;
       NFR_LOG_TRACE("Allocating context %d for operation %d", i, opType);
       res->commBuf.ctx[i].state = CTX_STATE_ALLOCATED;
       if (index)
@@ -71,6 +82,8 @@ struct NFRFabricContext * nfr_ContextGet(struct NFRResource * res,
       return res->commBuf.ctx + i;
     }
   }
+  if (opType != NFR_OP_RECV)
+    res->txLow = 1;
   return 0;
 }
 
@@ -104,12 +117,14 @@ int nfr_GetContextLocation(void * op_context, struct NFRResource * res,
 }
 
 int nfr_PrintCQError(int logLevel, const char * func, const char * file, int line, int channel,
-                     struct NFRResource * res, struct fi_cq_err_entry * err)
+                     struct NFRResource * res, struct fid_cq * cq,
+                     struct fi_cq_err_entry * err)
 {
   assert(res);
+  assert(cq);
   assert(err);
 
-  if (!res || !err)
+  if (!res || !cq || !err)
     return -EINVAL;
 
   if (nfr_LogLevel > logLevel)
@@ -149,7 +164,7 @@ int nfr_PrintCQError(int logLevel, const char * func, const char * file, int lin
            channel, ctxPos, slotType,
            fi_strerror(-err->err),
            err->err,
-           fi_cq_strerror(res->cq, err->prov_errno, 
+           fi_cq_strerror(cq, err->prov_errno, 
                           err->err_data,
                           errStr, sizeof(errStr)),
            err->prov_errno);
@@ -157,28 +172,50 @@ int nfr_PrintCQError(int logLevel, const char * func, const char * file, int lin
 }
 
 /**
- * @brief Flush the completion queue for a fabric resource.
- *
- * This function will continually read completions from the CQ until there are
- * no more to process. The callbacks associated with the operation will also be
- * called from within this function when they complete.
- *
- * @param res   Fabric resource
+ * @brief Hand a message received into a multi-receive buffer to a receive
+ *        context, and invoke the receive callback on it.
  *
- * @param cqe   Completion queue entry. If an error occurs, the error will be
- *              stored in this structure, ``cqe->isError`` will be set to 1, and
- *              the function will return ``-FI_EAVAIL``.
+ * @param mctx    Context the multi-receive buffer was posted with
  *
- * @return      0 upon success, ``-FI_EAVAIL`` for fabric errors, or a negative
- *              value for other errors. 
- *
- *              When ``-FI_EAVAIL`` is returned, the error will have already
- *              been read and stored in ``cqe->entry.err``.
+ * @param entry   Completion entry, locating the message within the buffer
  */
-int nfr_ResourceCQProcess(struct NFRResource * res,
-                          struct NFRCompQueueEntry * cqe)
+static void nfr_ResourceMultiRecvComplete(struct NFRFabricContext * mctx,
+                                          const struct fi_cq_data_entry * entry)
+{
+  struct NFRResource * pool = mctx->parentResource;
+  if (entry->len)
+  {
+    struct NFRFabricContext * ctx = nfr_ContextGet(pool, NFR_OP_RECV, 0);
+    if (ctx)
+    {
+      ctx->rxData = entry->buf;
+      ctx->state  = CTX_STATE_WAITING;
+      memcpy(&ctx->cbInfo, &mctx->cbInfo, sizeof(ctx->cbInfo));
+      ctx->cbInfo.callback(ctx);
+      memset(&ctx->cbInfo, 0, sizeof(ctx->cbInfo));
+      if (ctx->state != CTX_STATE_HAS_DATA)
+        NFR_RESET_CONTEXT(ctx);
+    }
+    else
+    {
+      NFR_LOG_ERROR("No receive context for message at %p, dropping it",
+                    entry->buf);
+    }
+  }
+
+  // The provider is done with the buffer once its remaining space is too small
+  if (entry->flags & FI_MULTI_RECV)
+    mctx->state = CTX_STATE_AVAILABLE;
+}
+
+/**
+ * @brief Read and process all entries of one completion queue of a resource.
+ */
+static int nfr_ResourceCQDrain(struct NFRResource * res, struct fid_cq * cq,
+                               struct NFRCompQueueEntry * cqe)
 {
   assert(res);
+  assert(cq);
   assert(cqe);
 
   int ret = 0;
@@ -190,18 +227,21 @@ int nfr_ResourceCQProcess(struct NFRResource * res,
   do
   {
     cqe->entry.data.op_context = 0;
-    nComp = (int) fi_cq_read(res->cq, &cqe->entry.data, 1);
+    nComp = (int) fi_cq_read(cq, &cqe->entry.data, 1);
     if (nComp == 0 || nComp == -FI_EAGAIN)
     {
       return 0;
     }
     if (nComp < 0 && nComp != -FI_EAGAIN)
     {
-      if (nComp == -FI_EAVAIL)
+      if (nComp != -FI_EAVAIL)
+        return nComp;
+      else
       {
-        ret = (int) fi_cq_readerr(res->cq, &cqe->entry.err, 0);
+        ret = (int) fi_cq_readerr(cq, &cqe->entry.err, 0);
         if (ret < 0)
           return ret;
+        cqe->cq = cq;
         
         // For canceled ops, we still want to call the callback; callbacks need
         // to use ctx->state to determine whether the operation was canceled
@@ -210,6 +250,18 @@ int nfr_ResourceCQProcess(struct NFRResource * res,
         {
           ctx = cqe->entry.err.op_context;
           ASSERT_CONTEXT_VALID(ctx);
+          if (ctx->state == CTX_STATE_MULTI_RECV)
+          {
+            ctx->state = CTX_STATE_AVAILABLE;
+            ++totalComp;
+            continue;
+          }
+          if (ctx && ctx->state == CTX_STATE_UNSIGNALED)
+            --ctx->parentResource->txUnsignaled;
+          if (cqe->entry.err.flags & FI_WRITE)
+            ++res->stats.writesCompleted;
+          if (cqe->entry.err.flags & FI_READ)
+            ++res->stats.readsCompleted;
           if (ctx)
             ctx->state = CTX_STATE_CANCELED;
         }
@@ -225,6 +277,34 @@ int nfr_ResourceCQProcess(struct NFRResource * res,
       ctx = cqe->entry.data.op_context;
       ASSERT_CONTEXT_VALID(ctx);
       assert(ctx->state > CTX_STATE_AVAILABLE);
+      if (ctx->state == CTX_STATE_MULTI_RECV)
+      {
+        nfr_ResourceMultiRecvComplete(ctx, &cqe->entry.data);
+        ++totalComp;
+        continue;
+      }
+      if (cqe->entry.data.flags & FI_WRITE)
+        ++res->stats.writesCompleted;
+      if (cqe->entry.data.flags & FI_READ)
+        ++res->stats.readsCompleted;
+      if (ctx->txSeq && ctx->parentResource == res)
+        nfr_ResourceReclaimTx(res, ctx->txSeq);
+    }
+
+    /* The context may be shared by several work requests, possibly posted on
+       other rails, in which case only the last completion is processed. The
+       context does not necessarily belong to this resource. */
+    if (ctx->pending > 1)
+    {
+      NFR_LOG_TRACE("Context %p has %u pending ops", ctx, ctx->pending - 1);
+      --ctx->pending;
+      if (ctx->cqExtra)
+      {
+        --ctx->cqExtra;
+        --ctx->parentResource->txCqExtra;
+      }
+      ++totalComp;
+      continue;
     }
 
     // This goes to a specific handler for each operation type
@@ -251,6 +331,217 @@ int nfr_ResourceCQProcess(struct NFRResource * res,
   return totalComp;
 }
 
+/**
+ * @brief Flush the completion queues for a fabric resource.
+ *
+ * This function will continually read completions from the CQs until there are
+ * no more to process. The callbacks associated with the operation will also be
+ * called from within this function when they complete.
+ *
+ * The receive CQ is drained on every call. The transmit CQ only carries
+ * bookkeeping, so it is drained lazily: when a transmit context class is
+ * running low, while RDMA writes or reads are outstanding, as their
+ * completions drive the buffer state, or at least every
+ * NFR_TX_POLL_INTERVAL_NS. The small ack and write classes count as running
+ * low as soon as one of their contexts is taken.
+ *
+ * @param res   Fabric resource
+ *
+ * @param cqe   Completion queue entry. If an error occurs, the error will be
+ *              stored in this structure, ``cqe->isError`` will be set to 1, and
+ *              the function will return ``-FI_EAVAIL``.
+ *
+ * @return      The number of completions processed upon success, 
+ *              ``-FI_EAVAIL`` for fabric errors, or a negative value for other
+ *              errors. 
+ *
+ *              When ``-FI_EAVAIL`` is returned, the error will have already
+ *              been read and stored in ``cqe->entry.err``.
+ */
+int nfr_ResourceCQProcess(struct NFRResource * res,
+                          struct NFRCompQueueEntry * cqe)
+{
+  assert(res);
+  assert(cqe);
+
+  int rxComp = nfr_ResourceCQDrain(res, res->rxCq, cqe);
+  if (rxComp < 0)
+    return rxComp;
+
+  uint64_t now = nfr_GetTimeNs();
+  if (!res->txLow
+      && res->stats.writesPosted == res->stats.writesCompleted
+      && res->stats.readsPosted == res->stats.readsCompleted
+      && now - res->lastTxPoll < NFR_TX_POLL_INTERVAL_NS)
+    return rxComp;
+
+  res->txLow      = 0;
+  res->lastTxPoll = now;
+  int txComp = nfr_ResourceCQDrain(res, res->txCq, cqe);
+  if (txComp < 0)
+    return txComp;
+
+  return rxComp + txComp;
+}
+
+int nfr_ResourceCreateEndpoint(struct NFRResource * res, struct fi_info * info)
+{
+  assert(res);
+  assert(info);
+  assert(!res->ep);
+
+  // Operations other than nfr_ResourceSend request a completion by default
+  info->tx_attr->op_flags |= FI_COMPLETION;
+  info->rx_attr->op_flags |= FI_COMPLETION;
+  if (res->rxPool)
+    info->ep_attr->rx_ctx_cnt = FI_SHARED_CONTEXT;
+
+  int ret = fi_endpoint(res->domain, info, &res->ep, res);
+  if (ret < 0)
+  {
+    NFR_LOG_DEBUG("Failed to create EP: %s (%d)", fi_strerror(-ret), ret);
+    res->ep = 0;
+    return ret;
+  }
+
+  if (res->rxPool)
+  {
+    ret = fi_ep_bind(res->ep, &res->rxPool->srx->fid, 0);
+    if (ret < 0)
+    {
+      NFR_LOG_DEBUG("Failed to bind EP to shared receive context: %s (%d)",
+                    fi_strerror(-ret), ret);
+      goto close_ep;
+    }
+  }
+
+  ret = fi_ep_bind(res->ep, &res->eq->fid, 0);
+  if (ret < 0)
+  {
+    NFR_LOG_DEBUG("Failed to bind EP to EQ: %s (%d)", fi_strerror(-ret), ret);
+    goto close_ep;
+  }
+
+  ret = fi_ep_bind(res->ep, &res->txCq->fid, 
+                   FI_TRANSMIT | FI_SELECTIVE_COMPLETION);
+  res->selectiveComp = ret == 0;
+  if (ret < 0)
+  {
+    NFR_LOG_DEBUG("Selective completion unavailable: %s (%d)", 
+                  fi_strerror(-ret), ret);
+    ret = fi_ep_bind(res->ep, &res->txCq->fid, FI_TRANSMIT);
+    if (ret < 0)
+    {
+      NFR_LOG_DEBUG("Failed to bind EP to tx CQ: %s (%d)", fi_strerror(-ret),
+                    ret);
+      goto close_ep;
+    }
+  }
+
+  ret = fi_ep_bind(res->ep, &res->rxCq->fid, FI_RECV);
+  if (ret < 0)
+  {
+    NFR_LOG_DEBUG("Failed to bind EP to rx CQ: %s (%d)", fi_strerror(-ret),
+                  ret);
+    goto close_ep;
+  }
+
+  /* Multi-receive buffers are released once a message of the maximum size
+     no longer fits, so that no message is truncated */
+  struct NFRResource * pool = nfr_ResourceRxPool(res);
+  if (pool->commBuf.ctx && pool->commBuf.info.multiRecvBufs)
+  {
+    size_t minSize = pool->commBuf.info.slotSize;
+    struct fid_ep * rxEp = pool->srx ? pool->srx : res->ep;
+    ret = fi_setopt(&rxEp->fid, FI_OPT_ENDPOINT, FI_OPT_MIN_MULTI_RECV,
+                    &minSize, sizeof(minSize));
+    if (ret < 0)
+    {
+      NFR_LOG_DEBUG("Failed to set minimum multi-receive size: %s (%d)",
+                    fi_strerror(-ret), ret);
+      goto close_ep;
+    }
+  }
+
+  ret = fi_enable(res->ep);
+  if (ret < 0)
+  {
+    NFR_LOG_DEBUG("Failed to enable EP: %s (%d)", fi_strerror(-ret), ret);
+    goto close_ep;
+  }
+
+  res->txSinceSignal = 0;
+  return 0;
+
+close_ep:
+  fi_close(&res->ep->fid);
+  res->ep = 0;
+  return ret;
+}
+
+/**
+ * @brief Check whether any receive context still refers to a message within a
+ *        multi-receive buffer.
+ */
+static int nfr_MultiRecvInUse(struct NFRResource * res,
+                              struct NFRFabricContext * mctx)
+{
+  int base = NFR_RX_SLOT_BASE(res->commBuf.info);
+  for (int i = base; i < base + res->commBuf.info.rxSlots; ++i)
+  {
+    struct NFRFabricContext * c = res->commBuf.ctx + i;
+    if (c->state != CTX_STATE_AVAILABLE && c->rxData >= mctx->rxData
+        && c->rxData < mctx->rxData + res->commBuf.info.multiRecvSize)
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Post the multi-receive buffers released by the provider, once none
+ *        of their messages are referenced anymore.
+ *
+ * @return  The number of buffers posted, or a negative error code
+ */
+static int nfr_ResourcePostMultiRecv(struct NFRResource * res,
+                                     struct NFR_CallbackInfo * cbInfo)
+{
+  void * desc = fi_mr_desc(res->commBuf.memRegion->mr);
+  int count = 0;
+  for (uint32_t b = 0; b < res->commBuf.info.multiRecvBufs; ++b)
+  {
+    struct NFRFabricContext * mctx = res->commBuf.multiRecv + b;
+    if (mctx->state != CTX_STATE_AVAILABLE || nfr_MultiRecvInUse(res, mctx))
+      continue;
+
+    struct iovec iov;
+    iov.iov_base = mctx->rxData;
+    iov.iov_len  = res->commBuf.info.multiRecvSize;
+
+    struct fi_msg msg = {0};
+    msg.msg_iov   = &iov;
+    msg.desc      = &desc;
+    msg.iov_count = 1;
+    msg.context   = mctx;
+
+    ssize_t ret = fi_recvmsg(res->srx ? res->srx : res->ep, &msg, 
+                             FI_MULTI_RECV | FI_COMPLETION);
+    if (ret < 0)
+    {
+      if (ret != -FI_EAGAIN)
+        NFR_LOG_DEBUG("Failed to post multi-receive buffer: %s (%d)", 
+                      fi_strerror((int) -ret), (int) ret);
+      return ret == -FI_EAGAIN ? count : (int) ret;
+    }
+
+    nfr_MemCpyOptional(&mctx->cbInfo, cbInfo, sizeof(*cbInfo));
+    mctx->state = CTX_STATE_MULTI_RECV;
+    ++count;
+  }
+
+  return count;
+}
+
 /**
  * @brief Post receive operations for all available receive buffers.
  * 
@@ -266,23 +557,50 @@ int nfr_ResourceCQProcess(struct NFRResource * res,
 int nfr_ResourceConsumeRxSlots(struct NFRResource * res,
                                struct NFR_CallbackInfo * cbInfo)
 {
-  ASSERT_COMM_BUF_READY(res->commBuf);
-  int totalRx = 0;
-  do
+  // Shared receives are routed to their channel by the message header
+  res = nfr_ResourceRxPool(res);
+  ASSERT_COMM_BUF_READY(res);
+  if (res->commBuf.info.multiRecvBufs)
+    return nfr_ResourcePostMultiRecv(res, cbInfo);
+
+  struct NFRFabricContext * ctx[NETFR_TOTAL_CONTEXT_COUNT];
+  int count = 0;
+  while (count < NETFR_TOTAL_CONTEXT_COUNT
+         && (ctx[count] = nfr_ContextGet(res, NFR_OP_RECV, 0)))
+    ++count;
+
+  /* The receives are posted as a single batch. If a post fails, the receives
+     already posted are flushed by the next post without FI_MORE. */
+  void * desc = fi_mr_desc(res->commBuf.memRegion->mr);
+  for (int i = 0; i < count; ++i)
   {
-    struct NFR_TransferInfo ti = {0};
-    ti.opType = NFR_OP_RECV;
-    ti.cbInfo = cbInfo;
+    struct iovec iov;
+    iov.iov_base = ctx[i]->slot->data;
+    iov.iov_len  = res->commBuf.info.slotSize;
+
+    struct fi_msg msg = {0};
+    msg.msg_iov   = &iov;
+    msg.desc      = &desc;
+    msg.iov_count = 1;
+    msg.context   = ctx[i];
 
-    ssize_t ret = nfr_PostTransfer(res, &ti);
+    ssize_t ret = fi_recvmsg(res->srx ? res->srx : res->ep, &msg, 
+                             FI_COMPLETION | (i < count - 1 ? FI_MORE : 0));
     if (ret < 0)
     {
-      if (ret == -EAGAIN)
-        return totalRx;
-      return ret;
+      if (ret != -FI_EAGAIN)
+        NFR_LOG_DEBUG("Failed to post receive: %s (%d)", 
+                      fi_strerror((int) -ret), (int) ret);
+      for (int j = i; j < count; ++j)
+        NFR_RESET_CONTEXT(ctx[j]);
+      return ret == -FI_EAGAIN ? i : (int) ret;
     }
+
+    nfr_MemCpyOptional(&ctx[i]->cbInfo, cbInfo, sizeof(*cbInfo));
+    ctx[i]->state = CTX_STATE_WAITING;
   }
-  while (1);
+
+  return count;
 }
 
 /**
@@ -298,17 +616,19 @@ int nfr_ResourceConsumeRxSlots(struct NFRResource * res,
 int nfr_ContextGetOldestMessage(struct NFRResource * res,
                                 struct NFRFabricContext ** ctx)
 {
-  ASSERT_COMM_BUF_READY(res->commBuf);
-  int base = NFR_RX_SLOT_BASE(res->commBuf.info);
+  struct NFRResource * pool = nfr_ResourceRxPool(res);
+  ASSERT_COMM_BUF_READY(pool);
+  int base = NFR_RX_SLOT_BASE(pool->commBuf.info);
 
   int haveData = 0;
   uint32_t limSerial = 0;
   uint32_t sub = 0;
 
-  for (int i = base; i < base + res->commBuf.info.rxSlots; ++i)
+  for (int i = base; i < base + pool->commBuf.info.rxSlots; ++i)
   {
-    struct NFRFabricContext * c = res->commBuf.ctx + i;
-    if (c->state == CTX_STATE_HAS_DATA && c->slot->channelSerial > limSerial)
+    struct NFRFabricContext * c = pool->commBuf.ctx + i;
+    if (c->state == CTX_STATE_HAS_DATA && nfr_ResourceOwnsMessage(res, c)
+        && c->slot->channelSerial > limSerial)
       limSerial = c->slot->channelSerial;
   }
 
@@ -317,15 +637,15 @@ int nfr_ContextGetOldestMessage(struct NFRResource * res,
   
   limSerial = (uint32_t) -1;
 
-  for (int i = base; i < base + res->commBuf.info.rxSlots; ++i)
+  for (int i = base; i < base + pool->commBuf.info.rxSlots; ++i)
   {
-    struct NFRFabricContext * c = res->commBuf.ctx + i;
-    if (c->state == CTX_STATE_HAS_DATA)
+    struct NFRFabricContext * c = pool->commBuf.ctx + i;
+    if (c->state == CTX_STATE_HAS_DATA && nfr_ResourceOwnsMessage(res, c))
     {
       if (!haveData || c->slot->channelSerial - sub < limSerial - sub)
       {
         limSerial = c->slot->channelSerial;
-        *ctx = res->commBuf.ctx + i;
+        *ctx = c;
         haveData = 1;
       }
     }
@@ -334,9 +654,215 @@ int nfr_ContextGetOldestMessage(struct NFRResource * res,
   return haveData;
 }
 
+/**
+ * @brief Post the message in the data slot of a send context.
+ *
+ * With selective completion, sends whose callback only releases the context
+ * are posted without a completion, and set to CTX_STATE_UNSIGNALED until a
+ * later transmit operation completes. Otherwise, the context is set to
+ * CTX_STATE_WAITING. The callback info must already be set.
+ *
+ * @param res     Fabric resource
+ *
+ * @param ctx     Send context
+ *
+ * @param length  Length of the message
+ *
+ * @param flags   Operation flags, such as FI_MORE if more operations are
+ *                posted right after this one
+ *
+ * @return        0 on success, negative error code on failure
+ */
+ssize_t nfr_ResourceSend(struct NFRResource * res,
+                         struct NFRFabricContext * ctx, size_t length,
+                         uint64_t flags)
+{
+  struct iovec iov;
+  iov.iov_base = nfr_ContextData(ctx);
+  iov.iov_len  = length;
+
+  // Acks may reuse a receive slot from a shared pool owned by another channel
+  struct NFRHeader * hdr = (struct NFRHeader *) nfr_ContextData(ctx);
+  hdr->channel = res->channelIndex;
+
+  void * desc = fi_mr_desc(ctx->parentResource->commBuf.memRegion->mr);
+  struct fi_msg msg = {0};
+  msg.msg_iov   = &iov;
+  msg.desc      = &desc;
+  msg.iov_count = 1;
+  msg.context   = ctx;
+
+  /* Every NFR_TX_SIGNAL_INTERVAL-th send is still signaled, so that the
+     unsignaled ones are reclaimed and the provider can free its queue entries.
+     Sends from other slots, such as acks reusing a receive slot, are always
+     signaled, as there are too few of these slots to hold them back. */
+  int slot = (int) (ctx - res->commBuf.ctx);
+  int signaled = !res->selectiveComp 
+                 || ctx->parentResource != res
+                 || slot < NFR_TX_SLOT_BASE(res->commBuf.info)
+                 || slot >= NFR_TX_SLOT_BASE(res->commBuf.info) 
+                            + res->commBuf.info.txSlots
+                 || (ctx->cbInfo.callback 
+                     && ctx->cbInfo.callback != res->txCallback)
+                 || res->txSinceSignal + 1 >= NFR_TX_SIGNAL_INTERVAL;
+  if (signaled)
+    flags |= FI_COMPLETION;
+
+  ctx->txSeq = nfr_ResourceNextTxSeq(res);
+  ssize_t ret = fi_sendmsg(res->ep, &msg, flags);
+  if (ret < 0)
+    return ret;
+
+  if (signaled)
+  {
+    res->txSinceSignal = 0;
+    ctx->state = CTX_STATE_WAITING;
+  }
+  else
+  {
+    ++res->txSinceSignal;
+    ++res->txUnsignaled;
+    ctx->cbInfo.callback = 0;
+    ctx->state = CTX_STATE_UNSIGNALED;
+  }
+  return 0;
+}
+
+/**
+ * @brief Reclaim the contexts of unsignaled sends which have completed.
+ *
+ * @param res   Fabric resource
+ *
+ * @param seq   Sequence number of a completed transmit operation. As the
+ *              completion order is strict, every send posted before it has
+ *              also completed. If 0, all unsignaled sends are reclaimed, e.g.
+ *              after a disconnection.
+ */
+void nfr_ResourceReclaimTx(struct NFRResource * res, uint32_t seq)
+{
+  if (!res->txUnsignaled)
+    return;
+
+  ASSERT_COMM_BUF_READY(res);
+  int base = NFR_TX_SLOT_BASE(res->commBuf.info);
+  for (int i = base; res->txUnsignaled && i < base + res->commBuf.info.txSlots;
+       ++i)
+  {
+    struct NFRFabricContext * ctx = res->commBuf.ctx + i;
+    if (ctx->state != CTX_STATE_UNSIGNALED
+        || (seq && (int32_t) (seq - ctx->txSeq) <= 0))
+      continue;
+
+    NFR_RESET_CONTEXT(ctx);
+    --res->txUnsignaled;
+  }
+}
+
+/**
+ * @brief Post a send that was prepared in the data slot of a context, with
+ *        its length stored in ``ctx->slot->length``.
+ *
+ * If the provider cannot accept the send right now, or the resource is
+ * batching sends, the context is deferred and posted later by
+ * ``nfr_ResourcePostDeferred``.
+ *
+ * @param ctx   Send context
+ *
+ * @return      0 if the send was posted or deferred, negative error code on
+ *              failure, in which case the context is released.
+ */
+int nfr_ResourcePostPrepared(struct NFRFabricContext * ctx)
+{
+  ASSERT_CONTEXT_VALID(ctx);
+  struct NFRResource * res = ctx->parentResource;
+  if (!res->ep)
+  {
+    NFR_RESET_CONTEXT(ctx);
+    return -ENOTCONN;
+  }
+
+  if (res->batching)
+  {
+    nfr_ResourceDefer(ctx);
+    return 0;
+  }
+
+  ssize_t ret = nfr_ResourceSend(res, ctx, ctx->slot->length, 0);
+  if (ret == -FI_EAGAIN)
+  {
+    NFR_LOG_TRACE("Deferring send on context %p", ctx);
+    nfr_ResourceDefer(ctx);
+    return 0;
+  }
+  if (ret < 0)
+  {
+    NFR_LOG_DEBUG("Failed to post send: %s (%d)", fi_strerror((int) -ret),
+                  (int) ret);
+    NFR_RESET_CONTEXT(ctx);
+    return (int) ret;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Post sends that were prepared earlier but could not be posted at the
+ *        time, e.g. because the provider queue was full or the resource was
+ *        batching sends.
+ *
+ * The sends are posted as a single batch in the order they were deferred, with
+ * FI_MORE set on all but the last. Nothing is posted while the resource is
+ * batching.
+ *
+ * @param res   Fabric resource
+ *
+ * @return      The number of sends posted, or a negative error code. Sends
+ *              that still cannot be posted remain deferred.
+ */
+int nfr_ResourcePostDeferred(struct NFRResource * res)
+{
+  ASSERT_COMM_BUF_READY(res);
+  if (res->batching)
+    return 0;
+
+  /* Acks may be sent from receive slots, so every slot is checked. Deferred
+     sends are few and mostly in order already, so they are insertion sorted
+     by the order they were deferred in. */
+  struct NFRFabricContext * deferred[NETFR_MAX_CONTEXT_COUNT];
+  int total = 0;
+  for (int i = 0; i < NFR_TOTAL_SLOTS(res->commBuf.info); ++i)
+  {
+    struct NFRFabricContext * ctx = res->commBuf.ctx + i;
+    if (ctx->state != CTX_STATE_DEFERRED)
+      continue;
+
+    int j = total++;
+    for (; j > 0 && (int32_t) (deferred[j - 1]->deferSeq - ctx->deferSeq) > 0;
+         --j)
+      deferred[j] = deferred[j - 1];
+    deferred[j] = ctx;
+  }
+
+  for (int i = 0; i < total; ++i)
+  {
+    struct NFRFabricContext * ctx = deferred[i];
+    ssize_t ret = nfr_ResourceSend(res, ctx, ctx->slot->length,
+                                   i + 1 < total ? FI_MORE : 0);
+    if (ret == -FI_EAGAIN)
+      return i;
+    if (ret < 0)
+    {
+      NFR_LOG_DEBUG("Failed to post deferred send: %s (%d)", 
+                    fi_strerror((int) -ret), (int) ret);
+      return (int) ret;
+    }
+  }
+  return total;
+}
+
 int nfr_ContextDebugCheck(struct NFRResource * res)
 {
-  ASSERT_COMM_BUF_READY(res->commBuf);
+  ASSERT_COMM_BUF_READY(res);
   int base = NFR_RX_SLOT_BASE(res->commBuf.info);
   int count = 0;
   for (int i = base; i < base + res->commBuf.info.rxSlots; ++i)
@@ -350,6 +876,70 @@ int nfr_ContextDebugCheck(struct NFRResource * res)
   return count;
 }
 
+int nfr_GetCommBufInfo(const struct NFRInitOpts * opts, int index,
+                       struct NFRCommBufInfo * info)
+{
+  assert(opts);
+  assert(info);
+  assert(index >= 0 && index < NETFR_NUM_CHANNELS);
+
+  const struct NFRChannelGeometry * geo = opts->geometry + index;
+  *info = nfr_GetDefaultCommBufInfo();
+  if (geo->txSlots)
+    info->txSlots = geo->txSlots;
+  if (geo->rxSlots)
+    info->rxSlots = geo->rxSlots;
+  if (geo->writeSlots)
+    info->writeSlots = geo->writeSlots;
+  if (geo->ackSlots)
+    info->ackSlots = geo->ackSlots;
+  if (geo->slotSize)
+    info->slotSize = geo->slotSize;
+  if (geo->memRegions)
+    info->memRegions = geo->memRegions;
+  if (geo->credits)
+    info->credits = geo->credits;
+  else if (info->credits > info->rxSlots)
+    info->credits = info->rxSlots;
+
+  if (info->slotSize < NETFR_MESSAGE_MIN_SIZE
+      || info->slotSize > NETFR_MESSAGE_MAX_SIZE
+      || (info->slotSize & (info->slotSize - 1)))
+  {
+    NFR_LOG_ERROR("Channel %d slot size %u must be a power of 2 within "
+                  "[%d, %d]", index, info->slotSize, NETFR_MESSAGE_MIN_SIZE,
+                  NETFR_MESSAGE_MAX_SIZE);
+    return -EINVAL;
+  }
+
+  if (info->credits <= NETFR_RESERVED_CREDIT_COUNT
+      || info->credits > info->rxSlots
+      || info->credits > NETFR_MAX_CREDIT_COUNT)
+  {
+    NFR_LOG_ERROR("Channel %d credit count %u must be within [%d, %u]", index,
+                  info->credits, NETFR_RESERVED_CREDIT_COUNT + 1,
+                  info->rxSlots < NETFR_MAX_CREDIT_COUNT 
+                    ? info->rxSlots : NETFR_MAX_CREDIT_COUNT);
+    return -EINVAL;
+  }
+
+  if (info->memRegions > NETFR_MAX_MEM_REGIONS)
+  {
+    NFR_LOG_ERROR("Channel %d memory region count %u exceeds the limit of %d",
+                  index, info->memRegions, NETFR_MAX_MEM_REGIONS);
+    return -EINVAL;
+  }
+
+  if (NFR_TOTAL_SLOTS(*info) > NETFR_MAX_CONTEXT_COUNT)
+  {
+    NFR_LOG_ERROR("Channel %d slot count %u exceeds the limit of %d", index,
+                  NFR_TOTAL_SLOTS(*info), NETFR_MAX_CONTEXT_COUNT);
+    return -EINVAL;
+  }
+
+  return 0;
+}
+
 /**
  * @brief Open a single fabric resource at a specific index.
  * 
@@ -359,12 +949,18 @@ int nfr_ContextDebugCheck(struct NFRResource * res)
  * 
  * @param index    Index of the resource to open
  * 
+ * @param rail     Rail of the channel to open, 0 for the channel itself
+ * 
+ * @param share    Resource owning a shared receive pool, whose fabric, domain
+ *                 and receive CQ are used instead of opening new ones, or 0
+ * 
  * @param result   Resulting fabric resource
  * 
  * @return int 
  */
 int nfr_ResourceOpenSingle(const struct NFRInitOpts * opts,
-                           int index, struct NFRResource ** result)
+                           int index, int rail, struct NFRResource * share,
+                           struct NFRResource ** result)
 {
   struct NFRResource * res = calloc(1, sizeof(*res));
   if (!res)
@@ -373,7 +969,13 @@ int nfr_ResourceOpenSingle(const struct NFRInitOpts * opts,
     return -ENOMEM;
   }
   
-  int ret = 0;
+  int ret = nfr_GetCommBufInfo(opts, index, &res->commBuf.info);
+  if (ret < 0)
+  {
+    free(res);
+    return ret;
+  }
+
   struct fi_info * info = 0, * hints = fi_allocinfo();
   if (!hints)
   {
@@ -398,6 +1000,70 @@ int nfr_ResourceOpenSingle(const struct NFRInitOpts * opts,
 
   NFR_LOG_DEBUG("Selecting transport %s", hints->fabric_attr->prov_name);
 
+  switch (opts->compression[index])
+  {
+    case NFR_COMPRESSION_DEFAULT:
+      if (opts->transportTypes[index] == NFR_TRANSPORT_TCP
+          && nfr_CompressAvailable())
+        res->offeredFeatures |= NFR_FEATURE_LZ4;
+      break;
+    case NFR_COMPRESSION_NONE:
+      break;
+    case NFR_COMPRESSION_LZ4:
+      if (!nfr_CompressAvailable())
+      {
+        NFR_LOG_ERROR("LZ4 compression requested, but NetFR was built "
+                      "without LZ4 support");
+        ret = -ENOSYS;
+        goto free_info;
+      }
+      res->offeredFeatures |= NFR_FEATURE_LZ4;
+      break;
+    default:
+      assert(!"Invalid compression type");
+      ret = -EINVAL;
+      goto free_info;
+  }
+
+  // The eager ring and registers are only set up on the channel's own endpoint
+  if (opts->eagerSlots[index] > NETFR_EAGER_MAX_SLOTS)
+  {
+    NFR_LOG_ERROR("Invalid eager ring size %u", opts->eagerSlots[index]);
+    ret = -EINVAL;
+    goto free_info;
+  }
+  if (opts->eagerSlots[index] && rail == 0)
+  {
+    res->offeredFeatures |= NFR_FEATURE_EAGER_RING;
+    res->eagerSlots       = opts->eagerSlots[index];
+  }
+
+  if (opts->registers[index] > NETFR_MAX_REGISTERS)
+  {
+    NFR_LOG_ERROR("Invalid register count %u", opts->registers[index]);
+    ret = -EINVAL;
+    goto free_info;
+  }
+  if (opts->registers[index] && rail == 0)
+  {
+    res->offeredFeatures |= NFR_FEATURE_REGISTERS;
+    res->registerCount    = opts->registers[index];
+  }
+  if (opts->pull[index] && rail == 0)
+    res->offeredFeatures |= NFR_FEATURE_PULL;
+
+  if (opts->cacheSlots[index] > NETFR_MAX_CACHE_SLOTS)
+  {
+    NFR_LOG_ERROR("Invalid cache slot count %u", opts->cacheSlots[index]);
+    ret = -EINVAL;
+    goto free_info;
+  }
+  if (opts->cacheSlots[index] && rail == 0)
+  {
+    res->offeredFeatures |= NFR_FEATURE_CACHE;
+    res->cacheSlots       = opts->cacheSlots[index];
+  }
+
   hints->ep_attr->type          = FI_EP_MSG;
   // "equivalent to FI_MR_BASIC" except that it doesn't work
   // hints->domain_attr->mr_mode   = FI_MR_VIRT_ADDR | FI_MR_ALLOCATED 
@@ -420,8 +1086,9 @@ int nfr_ResourceOpenSingle(const struct NFRInitOpts * opts,
   // Placing the destination address in the hints structure doesn't work
   // reliably and I don't think it's supposed to.
   char service[8];
-  const char * node = inet_ntoa(opts->addrs[index].sin_addr);
-  snprintf(service, 6, "%d", ntohs(opts->addrs[index].sin_port));
+  struct sockaddr_in addr = nfr_GetRailAddr(opts, index, rail);
+  const char * node = inet_ntoa(addr.sin_addr);
+  snprintf(service, 6, "%d", ntohs(addr.sin_port));
 
   uint64_t flags = opts->flags;
   if (!flags)
@@ -439,9 +1106,13 @@ int nfr_ResourceOpenSingle(const struct NFRInitOpts * opts,
     flags |= FI_HMEM;
   }
 
+  // Rails only carry RDMA writes, so they never receive into these
+  if (opts->multiRecv && rail == 0)
+    hints->caps |= FI_MULTI_RECV;
+
   NFR_LOG_DEBUG("Finding fabric for address %s:%s", node, service);
   
-  for (int i = 0; i < 2; ++i)
+  for (int i = 0; i < 3; ++i)
   {
     ret = fi_getinfo(opts->apiVersion, node, service, 
                      flags, hints, &info);
@@ -453,6 +1124,13 @@ int nfr_ResourceOpenSingle(const struct NFRInitOpts * opts,
         flags &= ~FI_HMEM;
         continue;
       }
+      if (hints->caps & FI_MULTI_RECV)
+      {
+        NFR_LOG_DEBUG("Multi-receive capable fabric not found, retrying "
+                      "without");
+        hints->caps &= ~FI_MULTI_RECV;
+        continue;
+      }
 
       NFR_LOG_DEBUG("Unable to find suitable fabric: %s (%d)",
                     fi_strerror(-ret), ret);
@@ -467,11 +1145,34 @@ int nfr_ResourceOpenSingle(const struct NFRInitOpts * opts,
   }
   
   assert(info);
+  res->multiRecv = !!(hints->caps & FI_MULTI_RECV);
 
   // Try all of the available fabrics
   int flag = 0;
   for (struct fi_info * tmp = info; tmp; tmp = tmp->next)
   {
+    // Only the shared fabric and domain are usable by a shared resource
+    if (share)
+    {
+      if (strcmp(tmp->fabric_attr->name, share->info->fabric_attr->name) != 0
+          || strcmp(tmp->domain_attr->name, 
+                    share->info->domain_attr->name) != 0)
+        continue;
+
+      res->info = fi_dupinfo(tmp);
+      if (!res->info)
+      {
+        ret = -ENOMEM;
+        fi_freeinfo(info);
+        goto free_struct;
+      }
+      res->fabric = share->fabric;
+      res->domain = share->domain;
+      res->rxPool = share;
+      flag = 1;
+      break;
+    }
+
     ret = fi_fabric(tmp->fabric_attr, &res->fabric, &res);
     if (ret < 0)
       continue;
@@ -498,6 +1199,8 @@ int nfr_ResourceOpenSingle(const struct NFRInitOpts * opts,
   if (!flag)
   {
     ret = -ENOENT;
+    if (share)
+      goto free_struct;
     goto free_fabric_domain;
   }
 
@@ -511,14 +1214,31 @@ int nfr_ResourceOpenSingle(const struct NFRInitOpts * opts,
   if (ret < 0)
     goto free_res_info;
 
+  /* The receive CQ only needs room for the receive slots. Any slot can carry
+     a transmit operation, as acks may reuse receive slots, so the transmit
+     CQ is sized for all of them, plus the entries reserved for writes posted
+     as several work requests. */
+  struct NFRCommBufInfo slots = res->commBuf.info;
   struct fi_cq_attr cqAttr;
   memset(&cqAttr, 0, sizeof(cqAttr));
   cqAttr.format = FI_CQ_FORMAT_DATA;
-  cqAttr.size   = NETFR_TOTAL_CONTEXT_COUNT;
-  ret = fi_cq_open(res->domain, &cqAttr, &res->cq, &res);
+  cqAttr.size   = NFR_TOTAL_SLOTS(slots) + NFR_TX_CQ_EXTRA;
+  ret = fi_cq_open(res->domain, &cqAttr, &res->txCq, &res);
   if (ret < 0)
     goto free_eq;
 
+  cqAttr.size = slots.rxSlots;
+  if (share)
+    res->rxCq = share->rxCq;
+  else
+    ret = fi_cq_open(res->domain, &cqAttr, &res->rxCq, &res);
+  if (ret < 0)
+    goto free_tx_cq;
+
+  res->channelIndex = (uint8_t) index;
+
+  res->peerMaxMessage = NETFR_MESSAGE_MAX_SIZE;
+  res->peerMemRegions = NETFR_MAX_MEM_REGIONS;
   for (int i = 0; i < NETFR_MAX_MEM_REGIONS; ++i)
   {
     res->memRegions[i].state = MEM_STATE_EMPTY;
@@ -527,12 +1247,16 @@ int nfr_ResourceOpenSingle(const struct NFRInitOpts * opts,
   *result = res;
   return 0;
   
-// free_cq:
-  fi_close(&res->cq->fid);
+// free_rx_cq:
+  fi_close(&res->rxCq->fid);
+free_tx_cq:
+  fi_close(&res->txCq->fid);
 free_eq:
   fi_close(&res->eq->fid);
 free_res_info:
   fi_freeinfo(res->info);
+  if (share)
+    goto free_struct;
 free_fabric_domain:
   fi_close(&res->domain->fid);
   fi_close(&res->fabric->fid);
@@ -543,6 +1267,33 @@ free_struct:
   return ret;
 }
 
+/**
+ * @brief Open a shared receive context on a resource, making it the owner of
+ *        the receive pool used by the resources opened on its domain.
+ *
+ * @param res   Fabric resource, without an endpoint
+ *
+ * @return      0 on success, negative error code if the provider does not
+ *              support shared receive contexts
+ */
+static int nfr_ResourceOpenSharedRx(struct NFRResource * res)
+{
+  struct fi_rx_attr rxAttr = *res->info->rx_attr;
+  rxAttr.op_flags |= FI_COMPLETION;
+  int ret = fi_srx_context(res->domain, &rxAttr, &res->srx, res);
+  if (ret < 0)
+  {
+    NFR_LOG_WARNING("Shared receive context unavailable: %s (%d)",
+                    fi_strerror(-ret), ret);
+    res->srx = 0;
+    return ret;
+  }
+
+  res->rxPool       = res;
+  res->rxShareCount = 1;
+  return 0;
+}
+
 /* Common init function. Sets up the local resources but no active endpoints
    here. */
 int nfr_ResourceOpen(const struct NFRInitOpts * opts,
@@ -551,22 +1302,89 @@ int nfr_ResourceOpen(const struct NFRInitOpts * opts,
   nfr_SetEnv("FI_UNIVERSE_SIZE", "2", 0);
   
   NFR_LOG_DEBUG("Opening resources");
+  int shared = opts->sharedRx;
+  for (int i = 1; i < NETFR_NUM_CHANNELS; ++i)
+  {
+    if (opts->transportTypes[i] != opts->transportTypes[0])
+    {
+      NFR_LOG_WARNING("Channels use different transports, receive pool will "
+                      "not be shared");
+      shared = 0;
+    }
+  }
+
   for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
   {
-    int ret = nfr_ResourceOpenSingle(opts, i, result + i);
+    struct NFRResource * share = (shared && i > 0) ? result[0] : 0;
+    int ret = nfr_ResourceOpenSingle(opts, i, 0, share, result + i);
     if (ret < 0)
     {
       NFR_LOG_DEBUG("Failed to open resource %d: %s (%d)", i, fi_strerror(-ret),
                     ret);
-      for (int j = 0; j < i; ++j)
+      // Resources sharing the first one's domain must be closed before it
+      for (int j = i - 1; j >= 0; --j)
         nfr_ResourceClose(result[j]);
       return ret;
     }
+
+    if (i == 0 && shared)
+      shared = nfr_ResourceOpenSharedRx(result[0]) == 0;
+    if (share)
+      ++share->rxShareCount;
   }
 
   return 0;
 }
 
+/**
+ * @brief Open the additional rails of a channel.
+ *
+ * Rails only carry RDMA writes, so they do not have communication buffers of
+ * their own; the contexts used for their operations belong to rail 0.
+ *
+ * @param opts    Initialization/addressing options
+ *
+ * @param index   Channel index
+ *
+ * @param rails   Rail array of the channel. rails[0] must already be open, and
+ *                the remaining rails are stored at their respective index.
+ *
+ * @return        The total number of rails including rail 0, or a negative
+ *                error code. On failure, no additional rails are left open.
+ */
+int nfr_ResourceOpenRails(const struct NFRInitOpts * opts, int index,
+                          struct NFRResource ** rails)
+{
+  assert(rails[0]);
+  int railCount = nfr_GetRailCount(opts, index);
+  if (railCount < 0)
+  {
+    NFR_LOG_ERROR("Channel %d rail count %d exceeds the limit of %d", index,
+                  opts->railCounts[index], NETFR_MAX_RAILS);
+    return railCount;
+  }
+
+  for (int r = 1; r < railCount; ++r)
+  {
+    int ret = nfr_ResourceOpenSingle(opts, index, r, 0, rails + r);
+    if (ret < 0)
+    {
+      NFR_LOG_DEBUG("Failed to open channel %d rail %d: %s (%d)", index, r,
+                    fi_strerror(-ret), ret);
+      for (int j = 1; j < r; ++j)
+      {
+        nfr_ResourceClose(rails[j]);
+        rails[j] = 0;
+      }
+      return ret;
+    }
+    rails[r]->parentTopLevel = rails[0]->parentTopLevel;
+    rails[r]->connState      = rails[0]->connState;
+  }
+
+  return railCount;
+}
+
 void nfr_ResourceClose(struct NFRResource * t)
 {
   if (!t)
@@ -578,13 +1396,19 @@ void nfr_ResourceClose(struct NFRResource * t)
     fi_close(&t->ep->fid);
   if (t->pep)
     fi_close(&t->pep->fid);
-  if (t->cq)
-    fi_close(&t->cq->fid);
+  if (t->srx)
+    fi_close(&t->srx->fid);
+  if (t->txCq)
+    fi_close(&t->txCq->fid);
+  // A resource sharing another's receive pool does not own these
+  int owner = !t->rxPool || t->rxPool == t;
+  if (t->rxCq && owner)
+    fi_close(&t->rxCq->fid);
   if (t->eq)
     fi_close(&t->eq->fid);
-  if (t->domain)
+  if (t->domain && owner)
     fi_close(&t->domain->fid);
-  if (t->fabric)
+  if (t->fabric && owner)
     fi_close(&t->fabric->fid);
   free(t);
 }
@@ -594,7 +1418,7 @@ int nfr_CommBufOpen(struct NFRResource * res,
 {
   assert(res);
   assert(hints->txSlots);
-  assert(hints->rxSlots);
+  assert(hints->rxSlots || nfr_ResourceRxPool(res) != res);
   assert(hints->writeSlots);
   assert(hints->ackSlots);
   assert(hints->slotSize);
@@ -612,9 +1436,19 @@ int nfr_CommBufOpen(struct NFRResource * res,
   memcpy(&res->commBuf.info, hints, sizeof(*hints));
   uint32_t msgSlotCount = hints->txSlots + hints->rxSlots + hints->writeSlots
                         + hints->ackSlots;
-  uint64_t totalSize = NETFR_MESSAGE_MAX_SIZE
-                     * (hints->txSlots + hints->rxSlots + hints->ackSlots 
-                        + hints->writeSlots);
+
+  /* Each slot holds its metadata followed by a message of up to slotSize
+     bytes. With multi-receive buffers, the receive slots only hold the
+     metadata of the messages, which stay in place in the buffers. */
+  uint64_t slotStride = sizeof(struct NFRDataSlot) + hints->slotSize;
+  uint64_t rxSlotSize = hints->multiRecvBufs ? sizeof(struct NFRDataSlot)
+                                             : slotStride;
+  uint64_t slotsSize = slotStride
+                     * (hints->txSlots + hints->ackSlots + hints->writeSlots)
+                     + rxSlotSize * hints->rxSlots;
+  slotsSize = (slotsSize + 63) & ~(uint64_t) 63;
+  uint64_t totalSize = slotsSize + (uint64_t) hints->multiRecvBufs 
+                                   * hints->multiRecvSize;
   
   res->commBuf.memRegion = nfr_RdmaAlloc(res, totalSize, FI_READ | FI_WRITE,
                                          MEM_STATE_RESERVED);
@@ -631,15 +1465,36 @@ int nfr_CommBufOpen(struct NFRResource * res,
     return -ENOMEM;
   }
 
-  struct NFRDataSlot * slots = res->commBuf.memRegion->addr;
+  uint8_t * addr = res->commBuf.memRegion->addr;
   for (int i = 0; i < NFR_TOTAL_SLOTS(*hints); ++i)
   {
-    slots[i].channelSerial   = 0;
-    slots[i].msgSerial       = 0;
-    res->commBuf.ctx[i].slot = (struct NFRDataSlot *) \
-                         ((uint8_t *) slots + i * NETFR_MESSAGE_MAX_SIZE);
+    int rx = i >= NFR_RX_SLOT_BASE(*hints) 
+             && i < NFR_RX_SLOT_BASE(*hints) + (int) hints->rxSlots;
+    res->commBuf.ctx[i].slot = (struct NFRDataSlot *) addr;
+    res->commBuf.ctx[i].slot->channelSerial = 0;
+    res->commBuf.ctx[i].slot->msgSerial     = 0;
     res->commBuf.ctx[i].parentResource = res;
     res->commBuf.ctx[i].state = CTX_STATE_AVAILABLE;
+    addr += rx ? rxSlotSize : slotStride;
+  }
+
+  if (hints->multiRecvBufs)
+  {
+    res->commBuf.multiRecv = calloc(hints->multiRecvBufs, 
+                                    sizeof(*res->commBuf.multiRecv));
+    if (!res->commBuf.multiRecv)
+    {
+      nfr_CommBufClose(&res->commBuf);
+      return -ENOMEM;
+    }
+
+    addr = (uint8_t *) res->commBuf.memRegion->addr + slotsSize;
+    for (uint32_t b = 0; b < hints->multiRecvBufs; ++b)
+    {
+      res->commBuf.multiRecv[b].parentResource = res;
+      res->commBuf.multiRecv[b].state  = CTX_STATE_AVAILABLE;
+      res->commBuf.multiRecv[b].rxData = addr + b * hints->multiRecvSize;
+    }
   }
 
   return 0;
@@ -653,6 +1508,8 @@ void nfr_CommBufClose(struct NFRCommBuf * buf)
 
   free((buf)->ctx);
   buf->ctx = 0;
+  free(buf->multiRecv);
+  buf->multiRecv = 0;
   if ((buf)->memRegion)
   {
     nfrFreeMemory(&((buf)->memRegion));
@@ -38,34 +38,236 @@
 #define NFR_ACK_SLOT_BASE(info)   (NFR_WRITE_SLOT_BASE(info) + (info).writeSlots)
 #define NFR_TOTAL_SLOTS(info)     (NFR_ACK_SLOT_BASE(info) + (info).ackSlots)
 
+/* With selective completion, at most this many sends in a row are posted
+   without requesting a completion */
+#define NFR_TX_SIGNAL_INTERVAL 16
+
+/* Entries of the transmit CQ beyond one per context. Writes posted as several
+   work requests sharing one context need a CQ entry for each of them, which
+   are reserved from these using nfr_ResourceReserveTxCq. */
+#define NFR_TX_CQ_EXTRA 256
+
 #define GET_DATA_SLOT_OFFSET(resource, slot) \
   ((uintptr_t) slot->data - (uintptr_t) resource->commBuf->memRegion->addr)
 
 #define NFR_RESET_CONTEXT(ctx) \
   do { \
     assert(ctx); \
+    (ctx)->parentResource->txCqExtra -= (ctx)->cqExtra; \
+    (ctx)->cqExtra = 0; \
+    (ctx)->txSeq   = 0; \
     if ((ctx)->state != CTX_STATE_ACK_ONLY) \
       (ctx)->state = CTX_STATE_AVAILABLE; \
   } while (0)
 
-#define NFR_PRINT_CQ_ERROR(logLevel, ch, err) \
+#define NFR_PRINT_CQ_ERROR(logLevel, ch, cqe) \
     nfr_PrintCQError(logLevel, __func__, __FILE__, __LINE__, \
-                     (int)(ch - ch->parent->channels), res, err) \
+                     (int)(ch - ch->parent->channels), res, (cqe)->cq, \
+                     &(cqe)->entry.err) \
 
 static_assert(NFR_INTERNAL_CB_UDATA_COUNT - NETFR_CALLBACK_USER_DATA_COUNT >= 8,
               "At least 8 user data slots must be available for internal use");
 
+/* Minimum number and size of the multi-receive buffers. A buffer holds at
+   least 15 messages of the maximum size. */
+#define NFR_MULTI_RECV_BUFS 4
+#define NFR_MULTI_RECV_SIZE (1 << 16)
+
+/**
+ * @brief Get the number of multi-receive buffers needed so that a full credit
+ *        window always fits, counting the buffer being released.
+ */
+inline static uint32_t nfr_MultiRecvBufCount(const struct NFRCommBufInfo * info)
+{
+  uint32_t count = info->credits * info->slotSize / NFR_MULTI_RECV_SIZE + 1;
+  return count > NFR_MULTI_RECV_BUFS ? count : NFR_MULTI_RECV_BUFS;
+}
+
+/* Maximum interval between polls of the transmit CQ, in nanoseconds */
+#define NFR_TX_POLL_INTERVAL_NS 500000
+
 int nfr_ResourceCQProcess(struct NFRResource * res,
                           struct NFRCompQueueEntry * cqe);
 
+/**
+ * @brief Create and enable the endpoint of a resource, bound to its event and
+ *        completion queues.
+ *
+ * Transmit operations are bound with selective completion if the provider
+ * supports it. Operations request a completion by default, except for sends
+ * posted with nfr_ResourceSend.
+ *
+ * @param res   Fabric resource without an endpoint
+ *
+ * @param info  Endpoint info, e.g. from a connection request
+ *
+ * @return      0 on success, negative error code on failure
+ */
+int nfr_ResourceCreateEndpoint(struct NFRResource * res, struct fi_info * info);
+
 int nfr_ResourceConsumeRxSlots(struct NFRResource * res,
                                struct NFR_CallbackInfo * cbInfo);
 
 int nfr_ContextGetOldestMessage(struct NFRResource * res,
                                 struct NFRFabricContext ** ctx);
 
+ssize_t nfr_ResourceSend(struct NFRResource * res,
+                         struct NFRFabricContext * ctx, size_t length,
+                         uint64_t flags);
+
+void nfr_ResourceReclaimTx(struct NFRResource * res, uint32_t seq);
+
+/**
+ * @brief Assign the next transmit sequence number of a resource. 0 is skipped,
+ *        as it marks operations which do not reclaim unsignaled sends.
+ */
+inline static uint32_t nfr_ResourceNextTxSeq(struct NFRResource * res)
+{
+  if (!++res->txSeq)
+    ++res->txSeq;
+  return res->txSeq;
+}
+
+/**
+ * @brief Reserve a transmit CQ entry for an additional work request sharing a
+ *        context. The entry is released when one of the work requests of the
+ *        context completes, or when the context is reset.
+ *
+ * @return 1 if the entry was reserved, 0 if the CQ has no room left
+ */
+inline static int nfr_ResourceReserveTxCq(struct NFRFabricContext * ctx)
+{
+  struct NFRResource * res = ctx->parentResource;
+  if (res->txCqExtra >= NFR_TX_CQ_EXTRA)
+    return 0;
+  ++res->txCqExtra;
+  ++ctx->cqExtra;
+  return 1;
+}
+
+/**
+ * @brief Release a transmit CQ entry reserved for a work request which could
+ *        not be posted.
+ */
+inline static void nfr_ResourceReleaseTxCq(struct NFRFabricContext * ctx)
+{
+  assert(ctx->cqExtra);
+  --ctx->cqExtra;
+  --ctx->parentResource->txCqExtra;
+}
+
+/**
+ * @brief Get the message data of a context, which is either in its data slot
+ *        or in place in a multi-receive buffer.
+ */
+inline static void * nfr_ContextData(struct NFRFabricContext * ctx)
+{
+  return ctx->rxData ? (void *) ctx->rxData : (void *) ctx->slot->data;
+}
+
+/**
+ * @brief Get the resource whose communication buffer holds the receive slots
+ *        of a resource, which differs when the receive pool is shared.
+ */
+inline static struct NFRResource * nfr_ResourceRxPool(struct NFRResource * res)
+{
+  return res->rxPool ? res->rxPool : res;
+}
+
+/**
+ * @brief Check whether a received message belongs to the channel of a
+ *        resource. Always true unless the receive pool is shared.
+ */
+inline static int nfr_ResourceOwnsMessage(struct NFRResource * res,
+                                          struct NFRFabricContext * ctx)
+{
+  return !res->rxPool || ctx->slot->channel == res->channelIndex;
+}
+
+/**
+ * @brief Get the number of messages the peer may send to a resource without
+ *        waiting for an acknowledgement, as advertised in the hello messages.
+ */
+inline static uint8_t nfr_ResourceRxCredits(struct NFRResource * res)
+{
+  struct NFRResource * pool = nfr_ResourceRxPool(res);
+  uint32_t credits = pool->commBuf.info.rxSlots;
+  if (pool->rxShareCount > 1)
+    credits /= pool->rxShareCount;
+  if (credits > pool->commBuf.info.credits)
+    credits = pool->commBuf.info.credits;
+  return (uint8_t) (credits < NETFR_MAX_CREDIT_COUNT ? credits 
+                                                     : NETFR_MAX_CREDIT_COUNT);
+}
+
+/**
+ * @brief Convert the credits advertised by the peer to the transmit credit
+ *        count. Peers which do not advertise credits get the default.
+ */
+inline static uint32_t nfr_ResourcePeerCredits(uint8_t advertised)
+{
+  if (!advertised)
+    return NETFR_CREDIT_COUNT;
+  return advertised;
+}
+
+/**
+ * @brief Apply the receive limits advertised by the peer in its hello message.
+ *        Peers which do not advertise a limit get the default.
+ */
+inline static void nfr_ResourceSetPeerLimits(struct NFRResource * res,
+                                             uint16_t maxMessage,
+                                             uint8_t memRegions)
+{
+  res->peerMaxMessage = maxMessage ? maxMessage : NETFR_MESSAGE_MAX_SIZE;
+  res->peerMemRegions = memRegions && memRegions < NETFR_MAX_MEM_REGIONS 
+                        ? memRegions : NETFR_MAX_MEM_REGIONS;
+}
+
+/**
+ * @brief Get the largest message, header included, that can be sent on a
+ *        resource. Bounded by the local slot size and the receive slot size
+ *        advertised by the peer.
+ */
+inline static uint32_t nfr_ResourceMaxMessage(struct NFRResource * res)
+{
+  uint32_t size = res->commBuf.info.slotSize;
+  if (res->peerMaxMessage && res->peerMaxMessage < size)
+    size = res->peerMaxMessage;
+  return size;
+}
+
+/**
+ * @brief Get the number of memory regions that can be attached to a resource.
+ */
+inline static int nfr_ResourceMemRegionCount(struct NFRResource * res)
+{
+  uint32_t count = res->commBuf.info.memRegions;
+  return count && count < NETFR_MAX_MEM_REGIONS ? (int) count 
+                                                : NETFR_MAX_MEM_REGIONS;
+}
+
+/**
+ * @brief Defer a prepared send, with its length stored in
+ *        ``ctx->slot->length``. Deferred sends are posted by
+ *        nfr_ResourcePostDeferred in the order they were deferred.
+ */
+inline static void nfr_ResourceDefer(struct NFRFabricContext * ctx)
+{
+  ctx->state    = CTX_STATE_DEFERRED;
+  ctx->deferSeq = ++ctx->parentResource->deferSeq;
+}
+
+int nfr_ResourcePostPrepared(struct NFRFabricContext * ctx);
+
+int nfr_ResourcePostDeferred(struct NFRResource * res);
+
 int nfr_ResourceOpenSingle(const struct NFRInitOpts * opts, int index,
+                           int rail, struct NFRResource * share,
                            struct NFRResource ** result);
+
+int nfr_ResourceOpenRails(const struct NFRInitOpts * opts, int index,
+                          struct NFRResource ** rails);
                            
 int nfr_ResourceOpen(const struct NFRInitOpts * opts,
                      struct NFRResource ** result);
@@ -73,7 +275,7 @@ int nfr_ResourceOpen(const struct NFRInitOpts * opts,
 void nfr_ResourceClose(struct NFRResource * t);
 
 struct NFRFabricContext * nfr_ContextGet(struct NFRResource * res,
-                                         uint8_t opType, uint8_t * index);
+                                         uint8_t opType, int * index);
 
 int nfr_CommBufOpen(struct NFRResource * res, 
                     const struct NFRCommBufInfo * hints);
@@ -86,7 +288,37 @@ int nfr_GetContextLocation(void * op_context, struct NFRResource * res,
                            uint8_t * typeOut);
 
 int nfr_PrintCQError(int logLevel, const char * func, const char * file, int line, int channel,
-                     struct NFRResource * res, struct fi_cq_err_entry * err);
+                     struct NFRResource * res, struct fid_cq * cq,
+                     struct fi_cq_err_entry * err);
+
+/**
+ * @brief Get the number of rails configured for a channel.
+ *
+ * @return  The rail count, or -EINVAL if the configured count is too large
+ */
+inline static int nfr_GetRailCount(const struct NFRInitOpts * opts, int index)
+{
+  assert(index >= 0 && index < NETFR_NUM_CHANNELS);
+  if (opts->railCounts[index] > NETFR_MAX_RAILS)
+    return -EINVAL;
+  return opts->railCounts[index] ? opts->railCounts[index] : 1;
+}
+
+/**
+ * @brief Get the address of a rail. Rail 0 is the channel address itself.
+ */
+inline static struct sockaddr_in nfr_GetRailAddr(const struct NFRInitOpts * opts,
+                                                 int index, int rail)
+{
+  assert(index >= 0 && index < NETFR_NUM_CHANNELS);
+  assert(rail >= 0 && rail < NETFR_MAX_RAILS);
+  if (rail > 0 && opts->railAddrs[index][rail - 1].sin_family)
+    return opts->railAddrs[index][rail - 1];
+
+  struct sockaddr_in addr = opts->addrs[index];
+  addr.sin_port = htons(ntohs(addr.sin_port) + rail * NETFR_NUM_CHANNELS);
+  return addr;
+}
 
 inline static struct NFRCommBufInfo nfr_GetDefaultCommBufInfo(void)
 {
@@ -96,8 +328,23 @@ inline static struct NFRCommBufInfo nfr_GetDefaultCommBufInfo(void)
   info.writeSlots  = 6;
   info.ackSlots    = 2;
   info.slotSize    = NETFR_MESSAGE_MAX_SIZE;
+  info.credits     = NETFR_CREDIT_COUNT;
+  info.memRegions  = NETFR_MAX_MEM_REGIONS;
   assert(NFR_TOTAL_SLOTS(info) == NETFR_TOTAL_CONTEXT_COUNT);
   return info;
 }
 
+/**
+ * @brief Get the communication buffer geometry of a channel, filling fields
+ *        not set in the options with their defaults.
+ *
+ * @param opts   Initialization options
+ * @param index  Channel index
+ * @param info   Output geometry
+ *
+ * @return 0 on success, -EINVAL if the configured geometry is invalid
+ */
+int nfr_GetCommBufInfo(const struct NFRInitOpts * opts, int index,
+                       struct NFRCommBufInfo * info);
+
 #endif
\ No newline at end of file
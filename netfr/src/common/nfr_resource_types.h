@@ -25,6 +25,7 @@
 #include <rdma/fabric.h>
 #include <rdma/fi_eq.h>
 
+#include "netfr/netfr.h"
 #include "common/nfr_constants.h"
 
 struct NFRFabricContext;
@@ -58,8 +59,23 @@ struct NFRFabricContext
 {
   struct NFRResource     * parentResource;
   uint8_t                  state;
+  /* Number of outstanding work requests sharing this context, such as the
+     stripes of a multi-rail write. The callback is only invoked once the last
+     of them completes. 0 and 1 both mean a single work request. */
+  uint32_t                 pending;
+  /* Position of a transmit operation in the send queue of its resource, or 0.
+     Used to reclaim unsignaled sends posted before it once it completes. */
+  uint32_t                 txSeq;
+  /* Transmit CQ entries reserved for the work requests sharing this context
+     beyond the first, see nfr_ResourceReserveTxCq */
+  uint32_t                 cqExtra;
+  // Order in which a deferred send was deferred, see nfr_ResourceDefer
+  uint32_t                 deferSeq;
   struct NFR_CallbackInfo  cbInfo;
   struct NFRDataSlot     * slot;
+  /* Message data within a multi-receive buffer, or the buffer itself for the
+     context it is posted with. 0 if the data is held in the slot. */
+  uint8_t                * rxData;
 };
 
 struct NFRCompQueueEntry
@@ -69,6 +85,7 @@ struct NFRCompQueueEntry
     struct fi_cq_data_entry data;
     struct fi_cq_err_entry  err;
   } entry;
+  struct fid_cq * cq;       // CQ an error was read from
   uint8_t isError;
 };
 
@@ -76,6 +93,9 @@ struct NFRDataSlot
 {
   uint32_t         msgSerial;
   uint32_t         channelSerial;
+  uint32_t         length;         // Length of a deferred send
+  uint8_t          channel;        // Channel of a received message
+  uint8_t          record;         // Next record of a packed message to read
   alignas(16) char data[0];
 };
 
@@ -108,32 +128,69 @@ struct NFRMemory
   struct NFRResource * parentResource;
   void               * addr;
   struct fid_mr      * mr;
+  /* Registrations of this memory against the domains of additional rails.
+     railMr[0] is unused, as rail 0 uses mr. */
+  struct fid_mr      * railMr[NETFR_MAX_RAILS];
   uint64_t             udata;
   uint64_t             size;
   uint32_t             writeSerial;    // Message id relative to other writes
   uint32_t             channelSerial;  // Message id relative to all messages
   uint32_t             payloadOffset;
   uint32_t             payloadLength;
+  uint32_t             rangeCount;     // Number of valid entries in ranges
+  struct NFRUpdateRange ranges[NETFR_MAX_WRITE_RANGES]; // Last update received
+  uint32_t             metaLength;     // Number of valid bytes in meta
+  uint8_t              meta[NETFR_WRITE_METADATA_MAX_SIZE]; // Of the last update
   uint8_t              index;
   uint8_t              memType;       // Memory allocation type
   uint8_t              state;
   uint8_t              refCount;
+  uint8_t              priority;       // Placement preference sent to the host
   int                  dmaFd;          // DMABUF fd if enabled
 };
 
+/* Adaptive credit window of a channel, see common/nfr_credit.h */
+struct NFRCreditState
+{
+  // Sending side
+  uint32_t window;        // Messages the peer allows to be unacknowledged
+  uint32_t outstanding;   // Data messages sent and not yet acknowledged
+  uint64_t sendTime[NETFR_MAX_CREDIT_COUNT];  // Unacknowledged, in order
+  uint32_t sendHead;
+  uint32_t sendTail;
+  uint64_t srtt;
+  uint64_t minRtt;
+  uint64_t starvedSince;  // Start of the current starvation period, or 0
+  uint64_t starvedTime;
+  uint64_t starvedCount;
+  // Receiving side
+  uint32_t pending;       // Data messages received and not yet read
+  uint32_t granted;       // Window last granted to the peer
+  uint64_t lastRead;
+  uint64_t readInterval;  // Smoothed interval between reads
+};
+
 struct NFRCommBufInfo
 {
   uint32_t txSlots;
   uint32_t rxSlots;
   uint32_t writeSlots;
   uint32_t ackSlots;
-  uint32_t slotSize; // Size of a single data slot
+  uint32_t slotSize;   // Size of a single data slot, the largest message
+  uint32_t credits;    // Receive credits offered to the peer
+  uint32_t memRegions; // Attachable memory regions
+  /* Number and size of the multi-receive buffers. If nonzero, messages are
+     received into these instead of the receive slots, whose data area is
+     then omitted. */
+  uint32_t multiRecvBufs;
+  uint32_t multiRecvSize;
 };
 
 struct NFRCommBuf
 {
   struct NFRMemory        * memRegion;
   struct NFRFabricContext * ctx;
+  struct NFRFabricContext * multiRecv;  // Contexts of the multi-recv buffers
   struct NFRCommBufInfo     info;
 };
 
@@ -143,30 +200,67 @@ struct NFRResource
   struct fi_info          * info;
   struct fid_fabric       * fabric;
   struct fid_domain       * domain;
-  struct fid_cq           * cq;
+  struct fid_cq           * txCq;  // Sends, writes and acks
+  struct fid_cq           * rxCq;  // Receives only
   struct fid_pep          * pep; 
   struct fid_eq           * eq;
   struct fid_ep           * ep;
+  struct fid_ep           * srx;     // Shared receive context, pool owner only
+  /* Owner of the shared receive pool, or 0 if the resource receives into its
+     own communication buffer. The owner points to itself. */
+  struct NFRResource      * rxPool;
+  uint8_t                   rxShareCount;  // Channels sharing the pool
+  uint8_t                   multiRecv;     // FI_MULTI_RECV is available
+  uint8_t                   channelIndex;
   struct NFRCommBuf         commBuf;
   struct NFRMemory          memRegions[NETFR_MAX_MEM_REGIONS];
   uint64_t                  rkeyCounter;
   uint64_t                  lastPing;
-  uint32_t                  txCredits;
+  struct NFRRailStats       stats;
+  uint32_t                  txCredits;       // Window less outstanding
+  struct NFRCreditState     credit;
+  uint32_t                  peerMaxMessage;  // Largest message the peer takes
+  uint8_t                   peerMemRegions;  // Regions the peer can announce
   uint8_t                   connState;
+  uint8_t                   offeredFeatures; // NFR_FEATURE_* enabled locally
+  uint8_t                   features;        // NFR_FEATURE_* of the connection
+  uint16_t                  eagerSlots;      // Eager ring slots to allocate
+  uint8_t                   registerCount;   // Registers to allocate
+  uint8_t                   cacheSlots;      // Cache slots to allocate
+  // While set, sends are deferred until the batch is flushed
+  uint8_t                   batching;
+  /* Selective completion. Sends whose callback is null or txCallback only
+     release their context, so most are posted without a completion and
+     reclaimed once a later transmit operation completes. */
+  NFR_Callback              txCallback;
+  uint32_t                  txSeq;
+  uint32_t                  txUnsignaled;   // Unsignaled sends not reclaimed
+  uint32_t                  txSinceSignal;  // Sends since the last signaled
+  uint32_t                  deferSeq;       // Last deferral order assigned
+  uint8_t                   selectiveComp;
+  // Transmit CQ entries reserved beyond one per context, see NFR_TX_CQ_EXTRA
+  uint32_t                  txCqExtra;
+  /* The transmit CQ is polled lazily, see nfr_ResourceCQProcess. Set when a
+     transmit context class is running low. */
+  uint8_t                   txLow;
+  uint64_t                  lastTxPoll;
 };
 
-#define ASSERT_COMM_BUF_READY(cb) \
-  assert(cb.memRegion); \
-  assert(cb.ctx); \
-  assert(cb.info.txSlots); \
-  assert(cb.info.rxSlots); \
-  assert(cb.info.writeSlots); \
-  assert(cb.info.ackSlots); \
-  assert(cb.info.slotSize); 
+/* Resources drawing from another resource's receive pool have no receive
+   slots of their own, see nfr_CommBufOpen */
+#define ASSERT_COMM_BUF_READY(res) \
+  assert((res)->commBuf.memRegion); \
+  assert((res)->commBuf.ctx); \
+  assert((res)->commBuf.info.txSlots); \
+  assert((res)->commBuf.info.rxSlots \
+         || ((res)->rxPool && (res)->rxPool != (res))); \
+  assert((res)->commBuf.info.writeSlots); \
+  assert((res)->commBuf.info.ackSlots); \
+  assert((res)->commBuf.info.slotSize); 
 
 #define ASSERT_CONTEXT_VALID(fctx) \
   assert(fctx); \
   assert(fctx->parentResource); \
-  ASSERT_COMM_BUF_READY(fctx->parentResource->commBuf)
+  ASSERT_COMM_BUF_READY(fctx->parentResource)
 
 #endif
\ No newline at end of file
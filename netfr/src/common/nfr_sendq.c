@@ -0,0 +1,212 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <errno.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/nfr_sendq.h"
+#include "common/nfr_log.h"
+
+inline static uint8_t * nfr_SendQData(struct NFRSendQueue * q, int32_t index)
+{
+  return q->data + (uint64_t) index * NETFR_MESSAGE_MAX_PAYLOAD_SIZE;
+}
+
+static int32_t nfr_SendQPop(struct NFRSendQueue * q, int prio)
+{
+  int32_t e = q->head[prio];
+  if (e < 0)
+    return -1;
+  q->head[prio] = q->entries[e].next;
+  if (q->head[prio] < 0)
+    q->tail[prio] = -1;
+  q->entries[e].next = q->freeList;
+  q->freeList = e;
+  --q->stats.queued;
+  return e;
+}
+
+int nfr_SendQInit(struct NFRSendQueue * q, uint32_t depth, uint8_t policy)
+{
+  assert(q);
+  if (depth > NETFR_SEND_QUEUE_MAX_DEPTH || policy >= NFR_SEND_QUEUE_POLICY_MAX)
+    return -EINVAL;
+  if (q->stats.queued)
+    return -EBUSY;
+
+  struct NFRSendQEntry * entries = 0;
+  uint8_t * data = 0;
+  if (depth)
+  {
+    entries = calloc(depth, sizeof(*entries));
+    data    = malloc((uint64_t) depth * NETFR_MESSAGE_MAX_PAYLOAD_SIZE);
+    if (!entries || !data)
+    {
+      free(entries);
+      free(data);
+      return -ENOMEM;
+    }
+  }
+
+  free(q->entries);
+  free(q->data);
+  q->entries  = entries;
+  q->data     = data;
+  q->depth    = depth;
+  q->policy   = policy;
+  q->freeList = depth ? 0 : -1;
+  for (uint32_t i = 0; i < depth; ++i)
+    q->entries[i].next = i + 1 < depth ? (int32_t) i + 1 : -1;
+  for (int p = 0; p < NFR_SEND_PRIORITY_MAX; ++p)
+  {
+    q->head[p] = -1;
+    q->tail[p] = -1;
+  }
+  return 0;
+}
+
+void nfr_SendQFree(struct NFRSendQueue * q)
+{
+  if (!q)
+    return;
+  free(q->entries);
+  free(q->data);
+  memset(q, 0, sizeof(*q));
+}
+
+/* Make room for a message of the given priority according to the overflow
+   policy. Returns the free entry, or -1 if the message is rejected. */
+static int32_t nfr_SendQAlloc(struct NFRSendQueue * q, uint8_t priority)
+{
+  if (q->freeList < 0 && q->policy == NFR_SEND_QUEUE_DROP_OLDEST)
+  {
+    for (int p = NFR_SEND_PRIORITY_MAX - 1; p >= priority; --p)
+    {
+      int32_t e = nfr_SendQPop(q, p);
+      if (e >= 0)
+      {
+        NFR_LOG_DEBUG("Send queue full, dropped message %" PRIu64
+                      " of priority %d",
+                      q->entries[e].udata, p);
+        ++q->stats.dropped;
+        break;
+      }
+    }
+  }
+
+  int32_t e = q->freeList;
+  if (e >= 0)
+    q->freeList = q->entries[e].next;
+  return e;
+}
+
+int nfr_SendQSubmit(struct NFRSendQueue * q, void * owner, NFR_SendQPostFn post,
+                    const void * data, uint32_t length, uint64_t udata,
+                    uint8_t records, uint8_t priority, uint64_t key)
+{
+  assert(q);
+  assert(post);
+  assert(priority < NFR_SEND_PRIORITY_MAX);
+  assert(length <= NETFR_MESSAGE_MAX_PAYLOAD_SIZE);
+
+  if (!q->depth)
+    return post(owner, data, length, udata, records);
+
+  // A newer message with the same key supersedes the queued one
+  if (q->policy == NFR_SEND_QUEUE_COALESCE && key)
+  {
+    for (int32_t e = q->head[priority]; e >= 0; e = q->entries[e].next)
+    {
+      if (q->entries[e].key != key)
+        continue;
+      memcpy(nfr_SendQData(q, e), data, length);
+      q->entries[e].length  = length;
+      q->entries[e].udata   = udata;
+      q->entries[e].records = records;
+      ++q->stats.coalesced;
+      return 0;
+    }
+  }
+
+  // Messages of the same or a higher priority must be sent first
+  int blocked = 0;
+  for (int p = 0; p <= priority; ++p)
+    blocked |= q->head[p] >= 0;
+
+  if (!blocked)
+  {
+    int ret = post(owner, data, length, udata, records);
+    if (ret != -EAGAIN)
+      return ret;
+  }
+
+  int32_t e = nfr_SendQAlloc(q, priority);
+  if (e < 0)
+  {
+    ++q->stats.rejected;
+    return -ENOSPC;
+  }
+
+  memcpy(nfr_SendQData(q, e), data, length);
+  q->entries[e].udata   = udata;
+  q->entries[e].key     = key;
+  q->entries[e].length  = length;
+  q->entries[e].records = records;
+  q->entries[e].next    = -1;
+  if (q->tail[priority] >= 0)
+    q->entries[q->tail[priority]].next = e;
+  else
+    q->head[priority] = e;
+  q->tail[priority] = e;
+  ++q->stats.queued;
+  ++q->stats.deferred;
+  return 0;
+}
+
+int nfr_SendQFlush(struct NFRSendQueue * q, void * owner, NFR_SendQPostFn post)
+{
+  assert(q);
+  int posted = 0;
+  for (int p = 0; p < NFR_SEND_PRIORITY_MAX; ++p)
+  {
+    while (q->head[p] >= 0)
+    {
+      int32_t e = q->head[p];
+      int ret = post(owner, nfr_SendQData(q, e), q->entries[e].length,
+                     q->entries[e].udata, q->entries[e].records);
+      if (ret == -EAGAIN)
+        return posted;
+
+      nfr_SendQPop(q, p);
+      if (ret < 0)
+      {
+        NFR_LOG_WARNING("Dropped queued message %" PRIu64 ": %s (%d)",
+                        q->entries[e].udata, strerror(-ret), ret);
+        ++q->stats.dropped;
+        continue;
+      }
+      ++posted;
+    }
+  }
+  return posted;
+}
@@ -0,0 +1,101 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef NETFR_PRIVATE_SENDQ_H
+#define NETFR_PRIVATE_SENDQ_H
+
+#include <stdint.h>
+
+#include "netfr/netfr.h"
+
+/**
+ * @brief Post a message directly to the channel owning a send queue.
+ *
+ * @param records  Number of records packed into the data, or 0 for a single
+ *                 message, see NFRMsgRecord
+ *
+ * @return 0 on success, -EAGAIN if the message cannot be sent yet, or another
+ *         negative error code if it can never be sent
+ */
+typedef int (*NFR_SendQPostFn)(void * owner, const void * data,
+                               uint32_t length, uint64_t udata,
+                               uint8_t records);
+
+struct NFRSendQEntry
+{
+  uint64_t udata;
+  uint64_t key;
+  uint32_t length;
+  int32_t  next;        // Next entry in the class or free list, -1 if none
+  uint8_t  records;     // Packed records, see NFR_SendQPostFn
+};
+
+/* Bounded per-channel queue of messages waiting for credits or contexts. The
+   entries are kept in one FIFO list per priority class. */
+struct NFRSendQueue
+{
+  struct NFRSendQEntry    * entries;
+  uint8_t                 * data;       // NETFR_MESSAGE_MAX_PAYLOAD_SIZE each
+  int32_t                   head[NFR_SEND_PRIORITY_MAX];
+  int32_t                   tail[NFR_SEND_PRIORITY_MAX];
+  int32_t                   freeList;
+  uint32_t                  depth;
+  uint8_t                   policy;
+  struct NFRSendQueueStats  stats;
+};
+
+/**
+ * @brief Allocate or resize a send queue. The queue must be empty.
+ *
+ * @param q       Send queue
+ *
+ * @param depth   Number of messages the queue holds, 0 to disable queueing
+ *
+ * @param policy  Overflow policy, see NFRSendQueuePolicy
+ *
+ * @return 0 on success, -EBUSY if messages are queued, or another negative
+ *         error code
+ */
+int nfr_SendQInit(struct NFRSendQueue * q, uint32_t depth, uint8_t policy);
+
+void nfr_SendQFree(struct NFRSendQueue * q);
+
+/**
+ * @brief Send a message, or queue it if it cannot be sent yet.
+ *
+ * The message is posted directly if no message of the same or a higher
+ * priority is queued, so the order within a class is preserved.
+ *
+ * @return 0 if the message was sent or queued, -ENOSPC if the queue is full,
+ *         or the error returned by the post function
+ */
+int nfr_SendQSubmit(struct NFRSendQueue * q, void * owner, NFR_SendQPostFn post,
+                    const void * data, uint32_t length, uint64_t udata,
+                    uint8_t records, uint8_t priority, uint64_t key);
+
+/**
+ * @brief Post queued messages, highest priority first, until one cannot be
+ *        sent yet. Messages which can never be sent are dropped.
+ *
+ * @return The number of messages posted
+ */
+int nfr_SendQFlush(struct NFRSendQueue * q, void * owner, NFR_SendQPostFn post);
+
+#endif
@@ -0,0 +1,233 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+
+#ifdef _WIN32
+  #include <sysinfoapi.h>
+#else
+  #include <unistd.h>
+  #include <pthread.h>
+#endif
+
+#include "common/nfr_thread.h"
+#include "common/nfr_log.h"
+#include "netfr/netfr_constants.h"
+
+uint32_t nfr_GetCpuCount(void)
+{
+#ifdef _WIN32
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  return si.dwNumberOfProcessors;
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (uint32_t) n : 1;
+#endif
+}
+
+uint64_t nfr_GetCacheSize(void)
+{
+#if !defined(_WIN32) && defined(_SC_LEVEL3_CACHE_SIZE)
+  long n = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (n <= 0)
+    n = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  return n > 0 ? (uint64_t) n : 0;
+#else
+  return 0;
+#endif
+}
+
+static void nfr_ThreadPoolInline(NFR_TaskFn fn, void * arg, uint32_t count)
+{
+  for (uint32_t i = 0; i < count; ++i)
+    fn(arg, i);
+}
+
+#ifdef _WIN32
+
+int nfr_ThreadPoolCreate(uint32_t threads, struct NFRThreadPool ** result)
+{
+  (void) threads;
+  (void) result;
+  return -ENOSYS;
+}
+
+uint32_t nfr_ThreadPoolSize(const struct NFRThreadPool * pool)
+{
+  (void) pool;
+  return 1;
+}
+
+void nfr_ThreadPoolRun(struct NFRThreadPool * pool, NFR_TaskFn fn, void * arg,
+                       uint32_t count)
+{
+  assert(!pool);
+  nfr_ThreadPoolInline(fn, arg, count);
+}
+
+void nfr_ThreadPoolFree(struct NFRThreadPool ** pool)
+{
+  assert(pool && !*pool);
+}
+
+#else
+
+struct NFRThreadPool
+{
+  pthread_mutex_t     lock;
+  pthread_cond_t      start;      // Signaled when a new batch is available
+  pthread_cond_t      done;       // Signaled when all workers are idle
+  NFR_TaskFn          fn;
+  void              * arg;
+  uint32_t            count;
+  _Atomic(uint32_t)   next;       // Index of the next task to run
+  uint32_t            active;     // Workers still running the current batch
+  uint64_t            generation; // Incremented for every batch
+  uint8_t             stop;
+  uint32_t            workerCount;
+  pthread_t           workers[NFR_THREAD_MAX];
+};
+
+static void nfr_ThreadPoolWork(struct NFRThreadPool * pool)
+{
+  uint32_t i;
+  while ((i = atomic_fetch_add(&pool->next, 1)) < pool->count)
+    pool->fn(pool->arg, i);
+}
+
+static void * nfr_ThreadPoolWorker(void * arg)
+{
+  struct NFRThreadPool * pool = arg;
+  uint64_t seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (1)
+  {
+    while (pool->generation == seen && !pool->stop)
+      pthread_cond_wait(&pool->start, &pool->lock);
+    if (pool->stop)
+      break;
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    nfr_ThreadPoolWork(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->active == 0)
+      pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return 0;
+}
+
+int nfr_ThreadPoolCreate(uint32_t threads, struct NFRThreadPool ** result)
+{
+  assert(result);
+  if (!threads || !result)
+    return -EINVAL;
+  if (threads > NFR_THREAD_MAX)
+    threads = NFR_THREAD_MAX;
+
+  struct NFRThreadPool * pool = calloc(1, sizeof(*pool));
+  if (!pool)
+    return -ENOMEM;
+
+  pthread_mutex_init(&pool->lock, 0);
+  pthread_cond_init(&pool->start, 0);
+  pthread_cond_init(&pool->done, 0);
+  atomic_init(&pool->next, 0);
+
+  // The calling thread also runs tasks
+  for (uint32_t i = 0; i < threads - 1; ++i)
+  {
+    int ret = pthread_create(&pool->workers[i], 0, nfr_ThreadPoolWorker, pool);
+    if (ret)
+    {
+      NFR_LOG_DEBUG("Failed to create worker thread: %s", strerror(ret));
+      nfr_ThreadPoolFree(&pool);
+      return -ret;
+    }
+    ++pool->workerCount;
+  }
+
+  *result = pool;
+  return 0;
+}
+
+uint32_t nfr_ThreadPoolSize(const struct NFRThreadPool * pool)
+{
+  return pool ? pool->workerCount + 1 : 1;
+}
+
+void nfr_ThreadPoolRun(struct NFRThreadPool * pool, NFR_TaskFn fn, void * arg,
+                       uint32_t count)
+{
+  assert(fn);
+  if (!pool || !pool->workerCount || count <= 1)
+  {
+    nfr_ThreadPoolInline(fn, arg, count);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->fn     = fn;
+  pool->arg    = arg;
+  pool->count  = count;
+  pool->active = pool->workerCount;
+  atomic_store(&pool->next, 0);
+  ++pool->generation;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  nfr_ThreadPoolWork(pool);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->active)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void nfr_ThreadPoolFree(struct NFRThreadPool ** pool)
+{
+  assert(pool);
+  if (!*pool)
+    return;
+
+  struct NFRThreadPool * p = *pool;
+  pthread_mutex_lock(&p->lock);
+  p->stop = 1;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->lock);
+
+  for (uint32_t i = 0; i < p->workerCount; ++i)
+    pthread_join(p->workers[i], 0);
+
+  pthread_cond_destroy(&p->done);
+  pthread_cond_destroy(&p->start);
+  pthread_mutex_destroy(&p->lock);
+  free(p);
+  *pool = 0;
+}
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef NETFR_PRIVATE_THREAD_H
+#define NETFR_PRIVATE_THREAD_H
+
+#include <stdint.h>
+
+/* Maximum number of threads, including the calling thread, used for parallel
+   processing of a single buffer */
+#define NFR_THREAD_MAX 16
+
+struct NFRThreadPool;
+
+/**
+ * @brief Task function run by the thread pool.
+ *
+ * @param arg    Argument passed to nfr_ThreadPoolRun
+ *
+ * @param index  Index of the task, from 0 to the task count - 1
+ */
+typedef void (*NFR_TaskFn)(void * arg, uint32_t index);
+
+/**
+ * @brief Get the number of online CPUs.
+ */
+uint32_t nfr_GetCpuCount(void);
+
+/**
+ * @brief Get the size of the last level cache in bytes, or 0 if unknown.
+ */
+uint64_t nfr_GetCacheSize(void);
+
+/**
+ * @brief Create a thread pool.
+ *
+ * @param threads  Total number of threads to run tasks on, including the thread
+ *                 calling nfr_ThreadPoolRun. Limited to NFR_THREAD_MAX.
+ *
+ * @param result   Thread pool handle
+ *
+ * @return         0 on success, negative error code on failure. ``-ENOSYS`` if
+ *                 threads are not supported on this platform.
+ */
+int nfr_ThreadPoolCreate(uint32_t threads, struct NFRThreadPool ** result);
+
+/**
+ * @brief Get the total number of threads of a pool, including the caller.
+ *
+ * @param pool  Thread pool handle, or null
+ *
+ * @return      The thread count, 1 if the pool is null
+ */
+uint32_t nfr_ThreadPoolSize(const struct NFRThreadPool * pool);
+
+/**
+ * @brief Run a set of tasks and wait for all of them to complete.
+ *
+ * Tasks are distributed dynamically over the worker threads and the calling
+ * thread. A pool must not be used by multiple threads at the same time.
+ *
+ * @param pool   Thread pool handle. If null, the tasks are run on the calling
+ *               thread.
+ *
+ * @param fn     Task function
+ *
+ * @param arg    Argument passed to every task
+ *
+ * @param count  Number of tasks
+ */
+void nfr_ThreadPoolRun(struct NFRThreadPool * pool, NFR_TaskFn fn, void * arg,
+                       uint32_t count);
+
+/**
+ * @brief Stop the worker threads and free the thread pool.
+ *
+ * @param pool  Thread pool handle, set to null afterwards
+ */
+void nfr_ThreadPoolFree(struct NFRThreadPool ** pool);
+
+#endif
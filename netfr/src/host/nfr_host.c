@@ -18,11 +18,14 @@
  * Place, Suite 330, Boston, MA 02111-1307 USA
  */
 
+#include <inttypes.h>
+
 #include "host/nfr_host.h"
 #include "common/nfr_protocol.h"
 #include "common/nfr_constants.h"
 #include "host/nfr_host_callback.h"
 #include "common/nfr.h"
+#include "common/nfr_compress.h"
 
 int nfr_HostCreatePassiveEndpoint(struct NFRResource * tr)
 {
@@ -91,17 +94,28 @@ int nfr_HostChannelProcess(struct NFRHostChannel * ch,
   int totalComp = 0;
   struct NFRResource * res = ch->res;
 
-  // Process all completed operations
-  ret = nfr_ResourceCQProcess(res, cqe);
-  if (ret < 0)
+  // Process all completed operations, including the stripes on other rails
+  for (int r = 0; r < ch->railCount; ++r)
   {
-    if (ret == -FI_EAVAIL && cqe->isError)
+    if (!ch->rails[r]->ep)
+      continue;
+
+    ret = nfr_ResourceCQProcess(ch->rails[r], cqe);
+    if (ret < 0)
     {
-      return NFR_PRINT_CQ_ERROR(NFR_LOG_LEVEL_ERROR, ch, &cqe->entry.err);
+      if (ret == -FI_EAVAIL && cqe->isError)
+      {
+        return NFR_PRINT_CQ_ERROR(NFR_LOG_LEVEL_ERROR, ch, cqe);
+      }
+      return ret;
     }
-    return ret;
   }
 
+  // Retry notifications which could not be posted earlier
+  ret = nfr_ResourcePostDeferred(res);
+  if (ret < 0)
+    return ret;
+
   // Post receives if buffers available
   struct NFR_CallbackInfo cbInfo = {0};
   cbInfo.callback = nfr_HostProcessInternalRx;
@@ -113,6 +127,50 @@ int nfr_HostChannelProcess(struct NFRHostChannel * ch,
   return totalComp;
 }
 
+/**
+ * @brief Acknowledge a data message read from a receive slot, returning its
+ *        credit to the client.
+ *
+ * @param ctx  Acknowledgement context, taken before the message was consumed
+ *             so that the credit is never lost for lack of a context
+ *
+ * @return 0 on success, -EAGAIN if no context was available, or another
+ *         negative error code
+ */
+static int nfr_HostAckData(struct NFRResource * res,
+                           struct NFRFabricContext * ctx)
+{
+  if (!ctx)
+    return -EAGAIN;
+
+  uint8_t credits = nfr_CreditRead(res);
+
+  // Send the acknowledgement
+
+  struct NFRMsgClientDataAck * ack = (struct NFRMsgClientDataAck *) \
+    ctx->slot->data;
+
+  nfr_SetHeader(&ack->header, NFR_MSG_CLIENT_DATA_ACK);
+  ack->credits = credits;
+
+  struct NFR_CallbackInfo cbInfo = {0};
+  cbInfo.callback = nfr_HostProcessInternalTx;
+
+  struct NFR_TransferInfo ti = {0};
+  ti.opType           = NFR_OP_SEND;
+  ti.context          = ctx;
+  ti.length           = sizeof(*ack);
+  ti.cbInfo           = &cbInfo;
+
+  ssize_t ret = nfr_PostTransfer(res, &ti);
+  if (ret < 0)
+  {
+    NFR_RESET_CONTEXT(ctx);
+    return (int) ret;
+  }
+  return 0;
+}
+
 int nfrHostReadData(struct NFRHost * host, int channelID, void * data,
                     uint32_t * maxLength, uint64_t * udata)
 {
@@ -132,89 +190,139 @@ int nfrHostReadData(struct NFRHost * host, int channelID, void * data,
   
   struct NFRHostChannel * hc = host->channels + channelID;
   struct NFRResource * res = hc->res;
-  ASSERT_COMM_BUF_READY(res->commBuf);
-  struct NFRCommBuf * cb = &res->commBuf;
+  ASSERT_COMM_BUF_READY(nfr_ResourceRxPool(res));
+  struct NFRCommBuf * cb = &nfr_ResourceRxPool(res)->commBuf;
   
   for (int i = NFR_RX_SLOT_BASE(cb->info); 
        i < NFR_RX_SLOT_BASE(cb->info) + cb->info.rxSlots; ++i)
   {
-    if (cb->ctx[i].state == CTX_STATE_HAS_DATA)
+    if (cb->ctx[i].state == CTX_STATE_HAS_DATA
+        && nfr_ResourceOwnsMessage(res, cb->ctx + i))
     {
       struct NFRMsgClientData * msg = (struct NFRMsgClientData *) \
-        cb->ctx[i].slot->data;
+        nfr_ContextData(cb->ctx + i);
+
+      // Fragments are left for nfrHostReadLarge
+      if (msg->records == NFR_MSG_FRAGMENT)
+        continue;
+
+      /* The message is only consumed once its acknowledgement can be sent.
+         Acknowledgement contexts are few, and their completions are reaped
+         by nfrHostProcess. */
+      struct NFRFabricContext * ackCtx = 0;
+
       if (msg->length > NETFR_MESSAGE_MAX_PAYLOAD_SIZE)
       {
         assert(!"Invalid message length");
         NFR_RESET_CONTEXT(cb->ctx + i);
+        nfr_CreditRead(res);
         return -EBADMSG;
       }
       
-      if (msg->length > *maxLength)
+      // Packed records are returned one per call and acknowledged together
+      if (msg->records)
       {
-        NFR_RESET_CONTEXT(cb->ctx + i);
-        return -ENOBUFS;
-      }
-
-      memcpy(data, msg->data, msg->length);
-      *maxLength = msg->length;
-      *udata     = msg->udata;
-
-      NFR_RESET_CONTEXT(cb->ctx + i);
-
-      // Send the acknowledgement
-      struct NFRFabricContext * ctx = nfr_ContextGet(res, NFR_OP_ACK, 0);
-      assert(ctx);
-
-      struct NFRMsgClientDataAck * ack = (struct NFRMsgClientDataAck *) \
-        ctx->slot->data;
-
-      nfr_SetHeader(&ack->header, NFR_MSG_CLIENT_DATA_ACK);
-
-      struct NFR_CallbackInfo cbInfo = {0};
-      cbInfo.callback = nfr_HostProcessInternalTx;
+        struct NFRMsgRecord rec;
+        const uint8_t * recData;
+        struct NFRDataSlot * slot = cb->ctx[i].slot;
+        if (nfr_CoalesceRecord(msg->data, msg->length, slot->record, &rec,
+                               &recData) < 0)
+        {
+          assert(!"Invalid packed record");
+          NFR_RESET_CONTEXT(cb->ctx + i);
+          nfr_CreditRead(res);
+          return -EBADMSG;
+        }
 
-      struct NFR_TransferInfo ti = {0};
-      ti.opType           = NFR_OP_SEND;
-      ti.context          = ctx;
-      ti.length           = sizeof(*ack);
-      ti.cbInfo           = &cbInfo;
+        // A record which does not fit is dropped like an unpacked message
+        int fits = rec.length <= *maxLength;
+        if (fits && slot->record + 1 == msg->records)
+        {
+          ackCtx = nfr_ContextGet(res, NFR_OP_ACK, 0);
+          if (!ackCtx)
+            return -EAGAIN;
+        }
+        if (fits)
+        {
+          memcpy(data, recData, rec.length);
+          *udata = rec.udata;
+        }
+        *maxLength = rec.length;
+        if (++slot->record < msg->records)
+          return fits ? 0 : -ENOBUFS;
 
-      ssize_t ret = nfr_PostTransfer(res, &ti);
-      if (ret < 0)
+        if (!fits)
+        {
+          NFR_RESET_CONTEXT(cb->ctx + i);
+          nfr_CreditRead(res);
+          return -ENOBUFS;
+        }
+      }
+      else
       {
-        NFR_RESET_CONTEXT(ctx);
-        return ret;
+        if (msg->length > *maxLength)
+        {
+          *maxLength = msg->length;
+          NFR_RESET_CONTEXT(cb->ctx + i);
+          nfr_CreditRead(res);
+          return -ENOBUFS;
+        }
+
+        ackCtx = nfr_ContextGet(res, NFR_OP_ACK, 0);
+        if (!ackCtx)
+          return -EAGAIN;
+        memcpy(data, msg->data, msg->length);
+        *maxLength = msg->length;
+        *udata     = msg->udata;
       }
+
+      NFR_RESET_CONTEXT(cb->ctx + i);
+      return nfr_HostAckData(res, ackCtx);
     }
   }
 
   return -EAGAIN;
 }
 
-int nfrHostSendData(PNFRHost host, int channelID, const void * data, 
-                    uint32_t length, uint64_t udata)
+// Post a data message directly, see NFR_SendQPostFn
+static int nfr_HostPostData(void * owner, const void * data, uint32_t length,
+                            uint64_t udata, uint8_t records)
 {
-  assert(host);
-  assert(data);
-  assert(channelID >= 0 && channelID < NETFR_NUM_CHANNELS);
-  assert(length < NETFR_MESSAGE_MAX_PAYLOAD_SIZE);
+  struct NFRHostChannel * ch = owner;
+  if (length + offsetof(struct NFRMsgHostData, data) 
+      > nfr_ResourceMaxMessage(ch->res))
+  {
+    NFR_LOG_DEBUG("Data too large for channel %d: %u", 
+                  (int) (ch - ch->parent->channels), length);
+    return -ENOBUFS;
+  }
 
-  if (!host || !data || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
-    return -EINVAL;
+  // Small messages are written into the eager ring instead, if there is one
+  if (ch->eager.ready && length <= NFR_EAGER_MAX_PAYLOAD
+      && records != NFR_MSG_FRAGMENT)
+  {
+    int ret = nfr_EagerWrite(&ch->eager, ch->res, data, length, udata, records,
+                             ch->msgSerial + 1, ch->channelSerial + 1);
+    if (ret < 0)
+      return ret;
 
-  if (length > NETFR_MESSAGE_MAX_PAYLOAD_SIZE)
-    return -ENOBUFS;
+    // Each packed record takes a serial of its own
+    ch->msgSerial     += nfr_MsgSerials(records);
+    ch->channelSerial += nfr_MsgSerials(records);
+    return 0;
+  }
 
-  struct NFRHostChannel * ch = host->channels + channelID;
   if (ch->res->txCredits < NETFR_RESERVED_CREDIT_COUNT)
   {
     NFR_LOG_DEBUG("No%scredits on channel %d", 
-                  ch->res->txCredits ? " low-prio " : " ", channelID);
+                  ch->res->txCredits ? " low-prio " : " ",
+                  (int) (ch - ch->parent->channels));
+    nfr_CreditStarved(ch->res);
     return -EAGAIN;
   }
 
   struct NFRResource * res = ch->res;
-  ASSERT_COMM_BUF_READY(res->commBuf);
+  ASSERT_COMM_BUF_READY(res);
 
   struct NFRFabricContext * ctx = nfr_ContextGet(res, NFR_OP_SEND, 0);
   if (!ctx)
@@ -226,8 +334,14 @@ int nfrHostSendData(PNFRHost host, int channelID, const void * data,
   msg->channelSerial = ++ch->channelSerial;
   msg->msgSerial     = ++ch->msgSerial;
   msg->udata         = udata;
+  msg->records       = records;
   memcpy(msg->data, data, length);
 
+  // Each packed record takes a serial of its own
+  uint8_t extra = nfr_MsgSerials(records) - 1;
+  ch->channelSerial += extra;
+  ch->msgSerial     += extra;
+
   struct NFR_CallbackInfo cbInfo = {0};
   cbInfo.callback = nfr_HostProcessInternalTx;
 
@@ -241,332 +355,1346 @@ int nfrHostSendData(PNFRHost host, int channelID, const void * data,
   if (ret < 0)
   {
     NFR_RESET_CONTEXT(ctx);
-    --ch->msgSerial;
-    --ch->channelSerial;
-    return ret;
+    ch->msgSerial     -= extra + 1;
+    ch->channelSerial -= extra + 1;
+    return (int) ret;
   }
   
-  --ch->res->txCredits;
-  return ret;
+  nfr_CreditSent(ch->res);
+  return 0;
 }
 
-int nfrHostProcess(struct NFRHost * host)
+int nfrHostSendData(PNFRHost host, int channelID, const void * data, 
+                    uint32_t length, uint64_t udata)
+{
+  return nfrHostQueueData(host, channelID, data, length, udata, 
+                          NFR_SEND_PRIORITY_NORMAL, 0);
+}
+
+int nfrHostQueueData(PNFRHost host, int channelID, const void * data, 
+                     uint32_t length, uint64_t udata, uint8_t priority,
+                     uint64_t key)
 {
   assert(host);
-  int ret;
-  for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
-  {
-    struct NFRHostChannel * chan = host->channels + i;
-    if (!chan->res)
-      continue;
+  assert(data);
+  assert(channelID >= 0 && channelID < NETFR_NUM_CHANNELS);
+  assert(length < NETFR_MESSAGE_MAX_PAYLOAD_SIZE);
 
-    struct NFRResource * res = chan->res;
-    ASSERT_COMM_BUF_READY(res->commBuf);
-
-    // Check for connection state updates
-    assert(res->pep);
-    uint32_t event;
-    struct NFRExtCMEntry entry;
-    ret = (int) fi_eq_read(res->eq, &event, &entry, sizeof(entry), 0);
-    if (ret < 0 && ret != -FI_EAGAIN)
-    {
-      assert(!"Error in event queue");
-      return ret;
-    }
-    if (ret > 0)
-    {
-      if (event == FI_CONNREQ)
-      {
-        struct NFRMsgServerHello hello;
-        nfr_SetHeader(&hello.header, NFR_MSG_SERVER_HELLO);
-        if (nfrHostClientsConnected(host, i))
-        {
-          NFR_LOG_DEBUG("Other client already connected, rejecting new request");
-          hello.status = NFR_MSG_STATUS_REJECTED;
-          errno = 0;
-          int ret2 = fi_reject(res->pep, entry.info->handle, 
-                               &hello, sizeof(hello));
-          if (ret2 < 0)
-          {
-            NFR_LOG_ERROR("Failed to reject connection %d: %s (%d)",
-                          errno, fi_strerror(-ret2), ret2);
-            return ret2;
-          }
-          fi_freeinfo(entry.info);
-          continue;
-        }
-        else
-        {
-          ret = fi_endpoint(res->domain, entry.info, &res->ep, res);
-          if (ret < 0)
-          {
-            fi_freeinfo(entry.info);
-            assert(!"Failed to create endpoint");
-            return ret;
-          }
-
-          ret = fi_ep_bind(res->ep, &res->eq->fid, 0);
-          if (ret < 0)
-          {
-            fi_freeinfo(entry.info);
-            assert(!"Failed to bind endpoint");
-            return ret;
-          }
-
-          ret = fi_ep_bind(res->ep, &res->cq->fid, FI_SEND | FI_RECV);
-          if (ret < 0)
-          {
-            fi_freeinfo(entry.info);
-            assert(!"Failed to bind endpoint");
-            return ret;
-          }
-
-          ret = fi_enable(res->ep);
-          if (ret < 0)
-          {
-            fi_freeinfo(entry.info);
-            assert(!"Failed to enable endpoint");
-            return ret;
-          }
-
-          hello.status = NFR_MSG_STATUS_OK;
-          ret = fi_accept(res->ep, &hello, sizeof(hello));
-          fi_freeinfo(entry.info);
-          if (ret < 0)
-          {
-            fi_close(&res->ep->fid);
-            assert(!"Failed to accept connection");
-            return ret;
-          }
-        }
-      }
-      else if (event == FI_CONNECTED)
-      {
-        NFR_LOG_DEBUG("Client connected on channel %d", i);
-      }
-      else if (event == FI_SHUTDOWN)
-      {
-        NFR_LOG_DEBUG("Client disconnected on channel %d", i);
-        fi_close(&res->ep->fid);
-        res->ep = 0;
-      }
-      else
-      {
-        assert(!"Unexpected event");
-        return -EINVAL;
-      }
-    }
+  if (!host || !data || channelID < 0 || channelID >= NETFR_NUM_CHANNELS
+      || priority >= NFR_SEND_PRIORITY_MAX)
+    return -EINVAL;
 
-    // If there is no client, don't do anything
-    if (!res->ep)
-      return -FI_ENOTCONN;
+  if (length > NETFR_MESSAGE_MAX_PAYLOAD_SIZE)
+    return -ENOBUFS;
 
-    // Process all items in the queue
-    struct NFRCompQueueEntry cqe;
-    int ret = nfr_HostChannelProcess(host->channels + i, &cqe);
-    if (ret < 0)
-    {
-      if (cqe.isError)
-      {
-        assert(!"Error in completion queue");
-        return ret;
-      }
-    }
-  }
-  return 0;
+  struct NFRHostChannel * ch = host->channels + channelID;
+  uint32_t maxPayload = nfr_ResourceMaxMessage(ch->res)
+                        - offsetof(struct NFRMsgHostData, data);
+  return nfr_CoalesceSubmit(&ch->coalesce, &ch->sendq, ch, nfr_HostPostData,
+                            data, length, udata, priority, key, maxPayload);
 }
 
-int nfrHostInit(const struct NFRInitOpts * opts, struct NFRHost ** result)
+int nfrHostSetSendQueue(PNFRHost host, int channelID, uint32_t depth,
+                        uint8_t policy)
 {
-  if (!opts || !result)
+  assert(host);
+  if (!host || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
     return -EINVAL;
 
-  struct NFRResource * res[NETFR_NUM_CHANNELS];
-  memset(res, 0, sizeof(res));
-  int ret = nfr_ResourceOpen(opts, res);
-  if (ret < 0)
-    return ret;
+  return nfr_SendQInit(&host->channels[channelID].sendq, depth, policy);
+}
 
-  struct NFRHost * host = calloc(1, sizeof(*host));
-  if (!host)
-  {
-    ret = -ENOMEM;
-    goto closeResources;
-  }
+int nfrHostGetSendQueueStats(PNFRHost host, int channelID,
+                             struct NFRSendQueueStats * stats)
+{
+  assert(host);
+  assert(stats);
+  if (!host || !stats || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
 
-  for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
-  {
-    host->channels[i].res = res[i];
-    host->channels[i].res->txCredits = NETFR_CREDIT_COUNT;
-    host->channels[i].res->parentTopLevel = host;
-    host->channels[i].parent = host;
-    for (int j = 0; j < NETFR_MAX_MEM_REGIONS; ++j)
-    {
-      host->channels[i].clientRegions[j].parentResource = res[i];
-      host->channels[i].clientRegions[j].index = j;
-    }
-  }
+  *stats = host->channels[channelID].sendq.stats;
+  return 0;
+}
 
-  for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
-  {
-    ret = nfr_HostCreatePassiveEndpoint(res[i]);
-    if (ret < 0)
-    {
-      NFR_LOG_DEBUG("Passive endpoint creation failed on channel %d: %s (%d)\n",
-                    i, fi_strerror(-ret), ret);
-      goto closeResources;
-    }
+int nfrHostSetCoalescing(PNFRHost host, int channelID, uint32_t threshold,
+                         uint32_t deadlineUs)
+{
+  assert(host);
+  if (!host || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
 
-    struct NFRCommBufInfo info = nfr_GetDefaultCommBufInfo();
-    host->channels[i].res = res[i];
-    ret = nfr_CommBufOpen(res[i], &info);
-    if (ret < 0)
-    {
-      NFR_LOG_DEBUG("Failed to open comm. buffer on channel %d: %s (%d)\n",
-                    i, fi_strerror(-ret), ret);
-      goto closeResources;
-    }
-  }
+  struct NFRHostChannel * ch = host->channels + channelID;
+  int ret = nfr_CoalesceFlush(&ch->coalesce, &ch->sendq, ch, nfr_HostPostData);
+  if (ret < 0)
+    return ret;
+  return nfr_CoalesceInit(&ch->coalesce, threshold, deadlineUs);
+}
 
-  *result = host;
-  return 0;
+int nfrHostBeginBatch(PNFRHost host, int channelID)
+{
+  assert(host);
+  if (!host || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
 
-closeResources:
-  for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
-  {
-    nfr_ResourceClose(res[i]);
-  }
-  free(host);
-  return ret;
+  host->channels[channelID].res->batching = 1;
+  return 0;
 }
 
-int nfrHostClientsConnected(PNFRHost host, int index)
+int nfrHostFlush(PNFRHost host, int channelID)
 {
   assert(host);
-  if (!host)
+  if (!host || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
     return -EINVAL;
 
-  if (index >= 0 || index < NETFR_NUM_CHANNELS)
-  {
-    if (index >= NETFR_NUM_CHANNELS)
-      return -EINVAL;
-    return !!host->channels[index].res->ep;
-  }
+  struct NFRHostChannel * ch = host->channels + channelID;
+  struct NFRResource * res = ch->res;
+  res->batching = 0;
+  if (!res->ep)
+    return -ENOTCONN;
 
-  assert(!"Invalid index");
-  return -EINVAL;
+  int ret = nfr_CoalesceFlush(&ch->coalesce, &ch->sendq, ch, nfr_HostPostData);
+  if (ret < 0 && ret != -ENOSPC && ret != -EAGAIN)
+    return ret;
+
+  ret = nfr_ResourcePostDeferred(res);
+  return ret < 0 ? ret : 0;
 }
 
-PNFRMemory nfrHostAttachMemory(PNFRHost host, void * buffer,
-                               uint64_t size, uint8_t index)
+int nfrHostSendLarge(PNFRHost host, int channelID, const void * data,
+                     uint32_t length, uint64_t udata)
 {
   assert(host);
-  assert(buffer);
-  assert(size);
-  assert(index < NETFR_NUM_CHANNELS);
+  assert(data);
+  if (!host || !data || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
 
-  // We don't need to perform the sync as the host, so we immediately set the
-  // state to available
-  PNFRMemory mem = nfr_RdmaAttach(host->channels[index].res, buffer, size,
-                                  FI_READ | FI_WRITE | FI_REMOTE_WRITE,
-                                  NFR_MEM_TYPE_USER_MANAGED,
-                                  MEM_STATE_AVAILABLE);
-  if (mem)
-    mem->state = MEM_STATE_AVAILABLE;
+  struct NFRHostChannel * ch = host->channels + channelID;
+  struct NFRResource * res = ch->res;
+  if (!res->ep)
+    return -ENOTCONN;
 
-  return mem;
+  uint32_t maxPayload = nfr_ResourceMaxMessage(res)
+                        - offsetof(struct NFRMsgHostData, data);
+  int ret = nfr_FragmentSubmit(&ch->fragment, data, length, udata, maxPayload,
+                               0, 0);
+  if (ret < 0)
+    return ret;
+
+  // nfrHostProcess posts the fragments the credits do not cover yet
+  return nfr_HostLargeFlush(ch);
 }
 
-int nfrHostWriteBuffer(PNFRMemory localMem, uint64_t localOffset,
-                       uint64_t remoteOffset, uint64_t length,
-                       struct NFRCallbackInfo * cbInfo)
+int nfr_HostLargeFlush(struct NFRHostChannel * chan)
 {
-  assert(localMem);
-  assert(length);
-  assert(localOffset + length <= localMem->size);
-
-  struct NFRResource * res = localMem->parentResource;
-  ASSERT_COMM_BUF_READY(res->commBuf);
+  // Queued messages go first
+  nfr_SendQFlush(&chan->sendq, chan, nfr_HostPostData);
+  int ret = nfr_FragmentFlush(&chan->fragment, chan, nfr_HostPostData);
+  return ret < 0 ? ret : 0;
+}
 
-  struct NFRHost * host = (struct NFRHost *) res->parentTopLevel;
+int nfrHostReadLarge(PNFRHost host, int channelID, const void ** data,
+                     uint32_t * length, uint64_t * udata)
+{
   assert(host);
-
-  struct NFRHostChannel * chan = 0;
-  for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
+  assert(data);
+  assert(length);
+  if (!host || !data || !length || channelID < 0
+      || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
+
+  struct NFRHostChannel * hc = host->channels + channelID;
+  struct NFRResource * res = hc->res;
+  ASSERT_COMM_BUF_READY(nfr_ResourceRxPool(res));
+  struct NFRCommBuf * cb = &nfr_ResourceRxPool(res)->commBuf;
+
+  /* Receive slots are not filled in order, and fragments of the next message
+     may already have arrived, so they are added oldest first. Otherwise the
+     next message would replace the one being reassembled. */
+  for (;;)
   {
-    if ((host->channels + i)->res == res)
+    int i = -1;
+    uint32_t serial = 0;
+    for (int j = NFR_RX_SLOT_BASE(cb->info); 
+         j < NFR_RX_SLOT_BASE(cb->info) + cb->info.rxSlots; ++j)
     {
-      chan = host->channels + i;
+      if (cb->ctx[j].state != CTX_STATE_HAS_DATA
+          || !nfr_ResourceOwnsMessage(res, cb->ctx + j))
+        continue;
+
+      struct NFRMsgClientData * msg = (struct NFRMsgClientData *) \
+        nfr_ContextData(cb->ctx + j);
+      if (msg->records != NFR_MSG_FRAGMENT)
+        continue;
+      if (i < 0 || nfr_SerialBefore(msg->channelSerial, serial))
+      {
+        i      = j;
+        serial = msg->channelSerial;
+      }
+    }
+    if (i < 0)
       break;
+
+    struct NFRMsgClientData * msg = (struct NFRMsgClientData *) \
+      nfr_ContextData(cb->ctx + i);
+
+    /* Every fragment is acknowledged, but only a few acknowledgements can be
+       in flight. The remaining fragments are consumed once nfrHostProcess
+       has reaped their completions. */
+    struct NFRFabricContext * ackCtx = nfr_ContextGet(res, NFR_OP_ACK, 0);
+    if (!ackCtx)
+      return -EAGAIN;
+
+    // The fragment is copied out, so its slot is released right away
+    int ret = nfr_ReassembleAdd(&hc->reassemble, msg->data, msg->length,
+                                msg->udata);
+    NFR_RESET_CONTEXT(cb->ctx + i);
+    int ackRet = nfr_HostAckData(res, ackCtx);
+    if (ackRet < 0)
+      return ackRet;
+    if (ret < 0)
+      return ret;
+    if (ret == 1)
+    {
+      *data   = hc->reassemble.buf;
+      *length = hc->reassemble.total;
+      if (udata)
+        *udata = hc->reassemble.udata;
+      return 0;
     }
   }
 
-  if (!chan)
+  return -EAGAIN;
+}
+
+int nfrHostSetLargeBuffer(PNFRHost host, int channelID, void * buffer,
+                          uint32_t size)
+{
+  assert(host);
+  if (!host || channelID < 0 || channelID >= NETFR_NUM_CHANNELS
+      || (buffer && !size))
+    return -EINVAL;
+
+  return nfr_ReassembleSetBuffer(&host->channels[channelID].reassemble,
+                                 buffer, size);
+}
+
+/**
+ * @brief Announce the counter the client reports its eager ring position in,
+ *        once the client has announced its ring. The ring is used from then
+ *        on.
+ *
+ * @return 0 on success, negative error code on failure
+ */
+static int nfr_HostEagerAnnounce(struct NFRHostChannel * chan)
+{
+  struct NFREagerRing * ring = &chan->eager;
+  struct NFRResource * res = chan->res;
+  if (ring->ready || (!ring->remoteAddr && !ring->remoteKey))
+    return 0;
+
+  if (!ring->mem)
+  {
+    ring->mem = nfr_RdmaAlloc(res, sizeof(uint64_t),
+                              FI_READ | FI_WRITE | FI_REMOTE_WRITE,
+                              MEM_STATE_AVAILABLE);
+    if (!ring->mem)
+    {
+      NFR_LOG_WARNING("Failed to allocate eager ring counter, sending "
+                      "messages instead");
+      nfr_EagerReset(ring);
+      return -ENOMEM;
+    }
+  }
+  memset(ring->mem->addr, 0, sizeof(uint64_t));
+
+  struct NFRMsgBufferState msg;
+  memset(&msg, 0, sizeof(msg));
+  nfr_SetHeader(&msg.header, NFR_MSG_BUFFER_STATE);
+  msg.flags     = NFR_BUFFER_FLAG_EAGER_COUNTER;
+  msg.pageSize  = nfr_GetPageSize();
+  msg.addr      = (uintptr_t) ring->mem->addr;
+  msg.size      = ring->mem->size;
+  msg.rkey      = fi_mr_key(ring->mem->mr);
+  msg.index     = ring->mem->index;
+  msg.railCount = 1;
+
+  struct NFR_CallbackInfo cbInfo = {0};
+  cbInfo.callback = nfr_HostProcessInternalTx;
+
+  struct NFR_TransferInfo ti = {0};
+  ti.opType           = NFR_OP_SEND_COPY;
+  ti.data             = &msg;
+  ti.cbInfo           = &cbInfo;
+  ti.length           = sizeof(msg);
+
+  ssize_t ret = nfr_PostTransfer(res, &ti);
+  if (ret < 0)
+    return ret == -EAGAIN ? 0 : (int) ret;
+
+  NFR_LOG_DEBUG("Eager ring of %u slots ready", ring->slots);
+  ring->ready = 1;
+  return 0;
+}
+
+/**
+ * @brief Process connection management events for a single rail.
+ *
+ * @param res     Fabric resource of the rail
+ *
+ * @param index   Channel index
+ *
+ * @param rail    Rail index
+ *
+ * @return        0 on success, negative error code on failure
+ */
+static int nfr_HostProcessCM(struct NFRResource * res, int index, int rail)
+{
+  int ret;
+
+  // Check for connection state updates
+  assert(res->pep);
+  uint32_t event;
+  struct NFRExtCMEntry entry;
+  ret = (int) fi_eq_read(res->eq, &event, &entry, sizeof(entry), 0);
+  if (ret < 0 && ret != -FI_EAGAIN)
+  {
+    assert(!"Error in event queue");
+    return ret;
+  }
+  if (ret <= 0)
+    return 0;
+
+  if (event == FI_CONNREQ)
+  {
+    struct NFRMsgServerHello hello;
+    nfr_SetHeader(&hello.header, NFR_MSG_SERVER_HELLO);
+    hello.features = 0;
+    hello.credits  = nfr_ResourceRxCredits(res);
+    hello.maxMessage = (uint16_t) nfr_ResourceRxPool(res)->commBuf.info.slotSize;
+    hello.memRegions = (uint8_t) nfr_ResourceMemRegionCount(res);
+    uint8_t peerCredits = 0;
+    uint16_t peerMaxMessage = 0;
+    uint8_t peerMemRegions = 0;
+
+    // Enable the optional features offered by both sides
+    struct NFRMsgClientHello * clientHello = \
+      (struct NFRMsgClientHello *) entry.data;
+    if ((size_t) ret >= offsetof(struct NFRExtCMEntry, data) 
+                        + sizeof(*clientHello)
+        && memcmp(clientHello->header.magic, NETFR_MAGIC, 8) == 0
+        && clientHello->header.version == NETFR_VERSION
+        && clientHello->header.type == NFR_MSG_CLIENT_HELLO)
+    {
+      hello.features = clientHello->features & res->offeredFeatures;
+      peerCredits    = clientHello->credits;
+      peerMaxMessage = clientHello->maxMessage;
+      peerMemRegions = clientHello->memRegions;
+    }
+
+    if (res->ep)
+    {
+      NFR_LOG_DEBUG("Other client already connected, rejecting new request");
+      hello.status = NFR_MSG_STATUS_REJECTED;
+      errno = 0;
+      int ret2 = fi_reject(res->pep, entry.info->handle, 
+                           &hello, sizeof(hello));
+      if (ret2 < 0)
+      {
+        NFR_LOG_ERROR("Failed to reject connection %d: %s (%d)",
+                      errno, fi_strerror(-ret2), ret2);
+        return ret2;
+      }
+      fi_freeinfo(entry.info);
+      return 0;
+    }
+
+    ret = nfr_ResourceCreateEndpoint(res, entry.info);
+    if (ret < 0)
+    {
+      fi_freeinfo(entry.info);
+      assert(!"Failed to create endpoint");
+      return ret;
+    }
+
+    res->features  = hello.features;
+    nfr_CreditReset(res, nfr_ResourcePeerCredits(peerCredits));
+    nfr_ResourceSetPeerLimits(res, peerMaxMessage, peerMemRegions);
+    NFR_LOG_DEBUG("Accepting client on channel %d rail %d, features 0x%x, "
+                  "%u credits, %u byte messages", index, rail, res->features,
+                  res->txCredits, nfr_ResourceMaxMessage(res));
+
+    hello.status = NFR_MSG_STATUS_OK;
+    ret = fi_accept(res->ep, &hello, sizeof(hello));
+    fi_freeinfo(entry.info);
+    if (ret < 0)
+    {
+      fi_close(&res->ep->fid);
+      assert(!"Failed to accept connection");
+      return ret;
+    }
+  }
+  else if (event == FI_CONNECTED)
+  {
+    NFR_LOG_DEBUG("Client connected on channel %d rail %d", index, rail);
+  }
+  else if (event == FI_SHUTDOWN)
   {
-    assert(!"Resource not found in host");
+    NFR_LOG_DEBUG("Client disconnected on channel %d rail %d", index, rail);
+    fi_close(&res->ep->fid);
+    res->ep = 0;
+    res->features = 0;
+    nfr_ResourceReclaimTx(res, 0);
+  }
+  else
+  {
+    assert(!"Unexpected event");
     return -EINVAL;
   }
-  
-  // The first pass checks for the smallest buffer which can hold the data
-  uint32_t minBufSize = (uint32_t) -1;
-  int minBufIndex = -1;
-  for (int i = 0; i < NETFR_MAX_MEM_REGIONS; ++i)
+
+  return 0;
+}
+
+int nfrHostProcess(struct NFRHost * host)
+{
+  assert(host);
+  int ret;
+  for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
   {
-    if (chan->clientRegions[i].state == NFR_RMEM_AVAILABLE)
+    struct NFRHostChannel * chan = host->channels + i;
+    if (!chan->res)
+      continue;
+
+    struct NFRResource * res = chan->res;
+    ASSERT_COMM_BUF_READY(res);
+
+    for (int r = 0; r < chan->railCount; ++r)
     {
-      if (chan->clientRegions[i].size < length - remoteOffset)
-        continue;
-      if (chan->clientRegions[i].size < minBufSize)
+      ret = nfr_HostProcessCM(chan->rails[r], i, r);
+      if (ret < 0)
+        return ret;
+    }
+
+    // If there is no client, don't do anything apart from canceling the
+    // remainder of a paced or partial write
+    if (!res->ep)
+    {
+      nfr_HostPacingAdvance(chan);
+      nfr_PostRangeContinue(&chan->rangeWrite);
+      nfr_EagerReset(&chan->eager);
+      nfr_HostRegisterReset(chan);
+      nfr_HostUploadReset(chan);
+      nfr_HostPullReset(chan);
+      nfr_FragmentReset(&chan->fragment);
+      nfr_ReassembleReset(&chan->reassemble);
+      nfr_HostCacheReset(chan);
+      return -FI_ENOTCONN;
+    }
+
+    // Process all items in the queue
+    struct NFRCompQueueEntry cqe;
+    int ret = nfr_HostChannelProcess(host->channels + i, &cqe);
+    if (ret < 0)
+    {
+      if (cqe.isError)
+      {
+        assert(!"Error in completion queue");
+        return ret;
+      }
+    }
+
+    // Switch small messages to the eager ring once the client has set it up
+    nfr_HostEagerAnnounce(chan);
+
+    // Let the client know which exposed regions it may write into
+    ret = nfr_HostResyncBufs(chan);
+    if (ret < 0)
+      NFR_LOG_WARNING("Failed to sync exposed buffers on channel %d: %s (%d)",
+                      i, fi_strerror(-ret), ret);
+
+    // Send the newest published frame once the previous one has been sent
+    ret = nfr_HostPullFlush(chan);
+    if (ret < 0)
+      NFR_LOG_WARNING("Failed to publish frame on channel %d: %s (%d)", i,
+                      fi_strerror(-ret), ret);
+
+    // Write the register values set while the previous writes were in flight
+    ret = nfr_HostRegisterFlush(chan);
+    if (ret < 0 && ret != -EAGAIN)
+      NFR_LOG_WARNING("Failed to write registers on channel %d: %s (%d)", i,
+                      fi_strerror(-ret), ret);
+
+    // Send the packed records held back for too long
+    if (nfr_CoalesceExpired(&chan->coalesce, nfr_GetTimeNs()))
+      nfr_CoalesceFlush(&chan->coalesce, &chan->sendq, chan, nfr_HostPostData);
+
+    // Send the queued messages the returned credits allow, then the fragments
+    // of a large message within the same credit window
+    ret = nfr_HostLargeFlush(chan);
+    if (ret < 0)
+      NFR_LOG_WARNING("Large message on channel %d dropped: %s (%d)", i,
+                      fi_strerror(-ret), ret);
+
+    // Post the segments of a paced write as the pacing rate allows
+    ret = nfr_HostPacingAdvance(chan);
+    if (ret < 0)
+      NFR_LOG_WARNING("Paced write on channel %d canceled: %s (%d)", i,
+                      fi_strerror(-ret), ret);
+
+    // Post the next batch of a partial write once the queue has room
+    ret = (int) nfr_PostRangeContinue(&chan->rangeWrite);
+    if (ret < 0)
+      NFR_LOG_WARNING("Partial write on channel %d canceled: %s (%d)", i,
+                      fi_strerror(-ret), ret);
+  }
+  return 0;
+}
+
+int nfrHostInit(const struct NFRInitOpts * opts, struct NFRHost ** result)
+{
+  if (!opts || !result)
+    return -EINVAL;
+
+  struct NFRResource * res[NETFR_NUM_CHANNELS];
+  memset(res, 0, sizeof(res));
+  int ret = nfr_ResourceOpen(opts, res);
+  if (ret < 0)
+    return ret;
+
+  struct NFRHost * host = calloc(1, sizeof(*host));
+  if (!host)
+  {
+    ret = -ENOMEM;
+    goto closeResources;
+  }
+
+  for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
+  {
+    host->channels[i].res = res[i];
+    nfr_CreditReset(res[i], NETFR_CREDIT_COUNT);
+    host->channels[i].res->txCallback = nfr_HostProcessInternalTx;
+    host->channels[i].res->parentTopLevel = host;
+    host->channels[i].parent = host;
+    for (int j = 0; j < NETFR_MAX_MEM_REGIONS; ++j)
+    {
+      host->channels[i].clientRegions[j].parentResource = res[i];
+      host->channels[i].clientRegions[j].index = j;
+    }
+    host->channels[i].lastPlaced = -1;
+    ret = nfr_SendQInit(&host->channels[i].sendq, 
+                        NETFR_SEND_QUEUE_DEFAULT_DEPTH, NFR_SEND_QUEUE_REJECT);
+    if (ret < 0)
+      goto closeResources;
+  }
+
+  for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
+  {
+    host->channels[i].rails[0] = res[i];
+    ret = nfr_ResourceOpenRails(opts, i, host->channels[i].rails);
+    if (ret < 0)
+      goto closeResources;
+    host->channels[i].railCount = ret;
+
+    for (int r = 0; r < host->channels[i].railCount; ++r)
+    {
+      ret = nfr_HostCreatePassiveEndpoint(host->channels[i].rails[r]);
+      if (ret < 0)
       {
-        minBufSize = chan->clientRegions[i].size;
-        minBufIndex = i;
+        NFR_LOG_DEBUG("Passive endpoint creation failed on channel %d rail "
+                      "%d: %s (%d)\n", i, r, fi_strerror(-ret), ret);
+        goto closeResources;
       }
     }
+
+    // Channels sharing a receive pool only need their transmit slots
+    struct NFRCommBufInfo info = res[i]->commBuf.info;
+    if (nfr_ResourceRxPool(res[i]) != res[i])
+      info.rxSlots = 0;
+    else if (res[i]->multiRecv)
+    {
+      info.multiRecvBufs = nfr_MultiRecvBufCount(&info);
+      info.multiRecvSize = NFR_MULTI_RECV_SIZE;
+    }
+    host->channels[i].res = res[i];
+    ret = nfr_CommBufOpen(res[i], &info);
+    if (ret < 0)
+    {
+      NFR_LOG_DEBUG("Failed to open comm. buffer on channel %d: %s (%d)\n",
+                    i, fi_strerror(-ret), ret);
+      goto closeResources;
+    }
+  }
+
+  *result = host;
+  return 0;
+
+closeResources:
+  // Channels sharing the first channel's domain are closed before it
+  for (int i = NETFR_NUM_CHANNELS - 1; i >= 0; --i)
+  {
+    for (int r = 1; host && r < NETFR_MAX_RAILS; ++r)
+      nfr_ResourceClose(host->channels[i].rails[r]);
+    if (host)
+    {
+      nfr_CoalesceFree(&host->channels[i].coalesce);
+      nfr_SendQFree(&host->channels[i].sendq);
+      nfr_FragmentFree(&host->channels[i].fragment);
+      nfr_ReassembleFree(&host->channels[i].reassemble);
+    }
+    nfr_ResourceClose(res[i]);
+  }
+  free(host);
+  return ret;
+}
+
+int nfrHostClientsConnected(PNFRHost host, int index)
+{
+  assert(host);
+  if (!host)
+    return -EINVAL;
+
+  if (index >= 0 || index < NETFR_NUM_CHANNELS)
+  {
+    if (index >= NETFR_NUM_CHANNELS)
+      return -EINVAL;
+    return !!host->channels[index].res->ep;
+  }
+
+  assert(!"Invalid index");
+  return -EINVAL;
+}
+
+PNFRMemory nfrHostAttachMemory(PNFRHost host, void * buffer,
+                               uint64_t size, uint8_t index)
+{
+  assert(host);
+  assert(buffer);
+  assert(size);
+  assert(index < NETFR_NUM_CHANNELS);
+
+  // We don't need to perform the sync as the host, so we immediately set the
+  // state to available
+  struct NFRHostChannel * chan = host->channels + index;
+  // With pull mode, the client reads published frames from the memory
+  uint64_t acs = FI_READ | FI_WRITE | FI_REMOTE_WRITE;
+  if (chan->res->offeredFeatures & NFR_FEATURE_PULL)
+    acs |= FI_REMOTE_READ;
+  PNFRMemory mem = nfr_RdmaAttach(chan->res, buffer, size, acs,
+                                  NFR_MEM_TYPE_USER_MANAGED,
+                                  MEM_STATE_AVAILABLE);
+  if (!mem)
+    return 0;
+
+  mem->state = MEM_STATE_AVAILABLE;
+  nfr_RdmaAttachRails(mem, chan->rails, chan->railCount, acs);
+  return mem;
+}
+
+/**
+ * @brief Select the rails to stripe a write over.
+ *
+ * A rail is only usable if it is connected and both the local and remote
+ * memory are registered on it. Rail 0 is always selected first.
+ *
+ * @return The number of rails selected
+ */
+static uint8_t nfr_HostSelectRails(struct NFRHostChannel * chan,
+                                   PNFRMemory localMem,
+                                   struct NFRRemoteMemory * remoteMem,
+                                   struct NFR_TransferWrite * tiw)
+{
+  uint8_t count = 0;
+  for (int r = 0; r < chan->railCount && r < remoteMem->railCount; ++r)
+  {
+    if (!chan->rails[r]->ep || !nfr_MemRailMr(localMem, r))
+      continue;
+    tiw->rails[count]     = chan->rails[r];
+    tiw->railIndex[count] = r;
+    ++count;
+  }
+  return count;
+}
+
+/**
+ * @brief Find the channel a local memory region is attached to.
+ */
+static struct NFRHostChannel * nfr_HostMemChannel(PNFRMemory localMem)
+{
+  struct NFRResource * res = localMem->parentResource;
+  struct NFRHost * host = (struct NFRHost *) res->parentTopLevel;
+  assert(host);
+
+  for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
+  {
+    if ((host->channels + i)->res == res)
+      return host->channels + i;
+  }
+
+  assert(!"Resource not found in host");
+  return 0;
+}
+
+/**
+ * @brief Place a write in one of the available remote buffers using the
+ *        channel's placement policy.
+ *
+ * @param chan  Channel
+ *
+ * @param size  Minimum size of the buffer
+ *
+ * @return      The buffer index, or a negative error code
+ */
+static int nfr_HostPlaceBuffer(struct NFRHostChannel * chan, uint64_t size)
+{
+  // Swapchain order: only the next buffer large enough may be used
+  if (chan->placement == NFR_PLACEMENT_ROUND_ROBIN)
+  {
+    for (int n = 1; n <= NETFR_MAX_MEM_REGIONS; ++n)
+    {
+      int i = (chan->lastPlaced + n) % NETFR_MAX_MEM_REGIONS;
+      struct NFRRemoteMemory * rmem = chan->clientRegions + i;
+      if (rmem->state == NFR_RMEM_NONE || rmem->size < size)
+        continue;
+      return rmem->state == NFR_RMEM_AVAILABLE ? i : -EBUSY;
+    }
+    return -ENOBUFS;
+  }
+
+  const struct NFRRemoteMemory * candidates[NETFR_MAX_MEM_REGIONS];
+  uint32_t count = 0;
+  for (int i = 0; i < NETFR_MAX_MEM_REGIONS; ++i)
+  {
+    if (chan->clientRegions[i].state == NFR_RMEM_AVAILABLE
+        && chan->clientRegions[i].size >= size)
+      candidates[count++] = chan->clientRegions + i;
   }
 
-  if (minBufIndex < 0)
+  if (!count)
   {
     NFR_LOG_TRACE("Could not find suitable RDMA write buffer");
     return -ENOBUFS;
   }
 
-  chan->clientRegions[minBufIndex].state = NFR_RMEM_ALLOCATED;
-  
-  // Second pass sends the work request
-  struct NFRRemoteMemory * remoteMem = chan->clientRegions + minBufIndex;
-  
-  struct NFR_CallbackInfo icbInfo;
+  if (chan->placement == NFR_PLACEMENT_CUSTOM)
+  {
+    int ret = chan->placementHook(chan->placementData, candidates, count, size);
+    if (ret < 0)
+      return ret;
+    if ((uint32_t) ret >= count)
+    {
+      assert(!"Placement hook returned invalid candidate");
+      return -EINVAL;
+    }
+    return candidates[ret]->index;
+  }
+
+  const struct NFRRemoteMemory * best = candidates[0];
+  for (uint32_t i = 1; i < count; ++i)
+  {
+    const struct NFRRemoteMemory * c = candidates[i];
+    switch (chan->placement)
+    {
+      case NFR_PLACEMENT_MRU:
+        // Serials may wrap around, so compare relative to the newest
+        if (chan->releaseSerial - c->releaseSerial
+            < chan->releaseSerial - best->releaseSerial)
+          best = c;
+        break;
+      case NFR_PLACEMENT_CLIENT_HINT:
+        if (c->priority > best->priority
+            || (c->priority == best->priority && c->size < best->size))
+          best = c;
+        break;
+      default:
+        if (c->size < best->size)
+          best = c;
+        break;
+    }
+  }
+
+  return best->index;
+}
+
+/**
+ * @brief Select the remote buffer to write to.
+ *
+ * @param chan         Channel
+ *
+ * @param remoteIndex  Required buffer index, or -1 to select an available
+ *                     buffer of at least ``size`` bytes using the placement
+ *                     policy
+ *
+ * @param size         Minimum size of the buffer
+ *
+ * @param retained     Whether the buffer must still hold the data of a
+ *                     previous write
+ *
+ * @return             The buffer index, or a negative error code
+ */
+static int nfr_HostSelectBuffer(struct NFRHostChannel * chan, int remoteIndex,
+                                uint64_t size, int retained)
+{
+  if (remoteIndex >= 0)
+  {
+    if (remoteIndex >= NETFR_MAX_MEM_REGIONS)
+      return -EINVAL;
+
+    struct NFRRemoteMemory * rmem = chan->clientRegions + remoteIndex;
+    if (rmem->state == NFR_RMEM_NONE)
+      return -ESTALE;
+    if (rmem->state != NFR_RMEM_AVAILABLE)
+      return -EBUSY;
+    if (retained && !rmem->writeSerial)
+      return -ESTALE;
+    if (rmem->size < size)
+      return -ENOBUFS;
+    return remoteIndex;
+  }
+
+  return nfr_HostPlaceBuffer(chan, size);
+}
+
+/**
+ * @brief Post a write to a remote buffer and update the channel state.
+ *
+ * @param chan       Channel
+ *
+ * @param remoteMem  Remote buffer, which must be available
+ *
+ * @param ti         Write transfer info, with the write options apart from the
+ *                   remote memory and serials filled in
+ *
+ * @param cbInfo     User callback info, may be null
+ *
+ * @return           The index of the remote buffer, or a negative error code.
+ *                   Partial writes return -EAGAIN while the previous one is
+ *                   still being posted in batches.
+ */
+static int nfr_HostPostWrite(struct NFRHostChannel * chan,
+                             struct NFRRemoteMemory * remoteMem,
+                             struct NFR_TransferInfo * ti,
+                             const struct NFRCallbackInfo * cbInfo)
+{
+  assert(remoteMem->state == NFR_RMEM_AVAILABLE);
+  struct NFR_TransferWrite * tiw = &ti->writeOpts;
+  if (tiw->rangeCount)
+  {
+    if (chan->rangeWrite.wctx)
+      return -EAGAIN;
+    tiw->rangeWrite = &chan->rangeWrite;
+  }
+  remoteMem->state = NFR_RMEM_ALLOCATED;
+
+  struct NFR_CallbackInfo icbInfo = {0};
   icbInfo.callback = nfr_HostProcessInternalWrite;
   icbInfo.uData[0] = chan;
-  icbInfo.uData[1] = localMem;
+  icbInfo.uData[1] = tiw->localMem;
   icbInfo.uData[2] = remoteMem;
-  icbInfo.uData[3] = (void *) (uintptr_t) localOffset;
-  icbInfo.uData[4] = (void *) (uintptr_t) remoteOffset;
-  icbInfo.uData[5] = (void *) (uintptr_t) length;
-  icbInfo.uData[6] = cbInfo->callback;
-  memcpy(&icbInfo.uData[NFR_USER_CB_INDEX], cbInfo->uData,
-         sizeof(cbInfo->uData));
+  icbInfo.uData[3] = (void *) (uintptr_t) tiw->localOffset;
+  icbInfo.uData[4] = (void *) (uintptr_t) tiw->remoteOffset;
+  icbInfo.uData[5] = (void *) (uintptr_t) (tiw->ranges ? 0 : ti->length);
+  if (cbInfo)
+  {
+    icbInfo.uData[6] = cbInfo->callback;
+    memcpy(&icbInfo.uData[NFR_USER_CB_INDEX], cbInfo->uData,
+           sizeof(cbInfo->uData));
+  }
 
   struct NFR_CallbackInfo scbInfo = {0};
   scbInfo.callback = nfr_HostProcessInternalTx;
- 
+
+  ti->opType                 = NFR_OP_WRITE;
+  ti->cbInfo                 = &scbInfo;
+  tiw->remoteMem             = remoteMem;
+  tiw->writeCbInfo           = &icbInfo;
+  tiw->writeSerial           = ++chan->writeSerial;
+  tiw->channelSerial         = ++chan->channelSerial;
+  if (chan->writeMeta.pending)
+  {
+    ti->udata       = chan->writeMeta.udata;
+    tiw->meta       = chan->writeMeta.data;
+    tiw->metaLength = chan->writeMeta.length;
+  }
+
+  /* The serial is cleared while posting and set again once the write has been
+     posted, as the buffer then holds this write's data unless the write is
+     canceled, in which case the write callback clears it */
+  uint32_t prevSerial = remoteMem->writeSerial;
+  remoteMem->writeSerial = 0;
+
+  ssize_t ret = nfr_PostTransfer(chan->res, ti);
+  if (ret < 0)
+  {
+    --chan->writeSerial;
+    --chan->channelSerial;
+    // A partially posted write keeps the buffer until it completes
+    if (remoteMem->state == NFR_RMEM_ALLOCATED)
+    {
+      remoteMem->state = NFR_RMEM_AVAILABLE;
+      remoteMem->writeSerial = prevSerial;
+    }
+    else
+    {
+      nfr_HostLinkWritePosted(chan, remoteMem->index, 0, 0);
+    }
+    return ret;
+  }
+
+  uint64_t bytes = ti->length;
+  if (tiw->slices)
+  {
+    bytes = 0;
+    for (uint32_t i = 0; i < tiw->sliceCount; ++i)
+      bytes += tiw->slices[i].length;
+  }
+  nfr_HostLinkWritePosted(chan, remoteMem->index, bytes, !!tiw->paced);
+
+  // The notification holds its own copy of the metadata
+  chan->writeMeta.pending = 0;
+  remoteMem->writeSerial = tiw->writeSerial;
+  chan->lastPlaced       = remoteMem->index;
+  NFR_LOG_DEBUG("Posted RDMA write from %p -> %p", tiw->localMem->addr,
+                (void *) (uintptr_t) remoteMem->addr);
+  return remoteMem->index;
+}
+
+/**
+ * @brief Compress the data of a buffer write into the channel's scratch buffer.
+ *
+ * Compression is only used if it was negotiated, the client's staging buffer
+ * is available and large enough, and the data compresses well enough to be
+ * worth the client's decompression time.
+ *
+ * @param chan         Channel
+ *
+ * @param localMem     Local memory region holding the data
+ *
+ * @param localOffset  Offset of the data
+ *
+ * @param length       Length of the data
+ *
+ * @param ranges       Output write ranges from the scratch buffer to the
+ *                     staging buffer, NFR_COMPRESS_MAX_SLICES entries
+ *
+ * @param slices       Output slice table, NFR_COMPRESS_MAX_SLICES entries
+ *
+ * @return             The number of slices, or 0 if the data should be written
+ *                     uncompressed
+ */
+static int nfr_HostCompressWrite(struct NFRHostChannel * chan,
+                                 PNFRMemory localMem, uint64_t localOffset,
+                                 uint64_t length,
+                                 struct NFRWriteRange * ranges,
+                                 struct NFRCompressSlice * slices)
+{
+  if (!(chan->res->features & NFR_FEATURE_LZ4)
+      || length < NFR_COMPRESS_MIN_SIZE)
+    return 0;
+
+  uint64_t bound = nfr_CompressBound(length);
+  if (chan->compressBusy || chan->staging.state != NFR_RMEM_AVAILABLE
+      || chan->staging.size < bound)
+  {
+    ++chan->compressStats.writesSkipped;
+    return 0;
+  }
+
+  // The scratch buffer is sized to match the staging buffer
+  if (!chan->compressBuf || chan->compressBuf->size < chan->staging.size)
+  {
+    if (chan->compressBuf)
+      nfrFreeMemory(&chan->compressBuf);
+
+    uint64_t ps = nfr_GetPageSize();
+    uint64_t size = (chan->staging.size + ps - 1) / ps * ps;
+    chan->compressBuf = nfr_RdmaAlloc(chan->res, size, FI_READ | FI_WRITE,
+                                      MEM_STATE_AVAILABLE);
+    if (!chan->compressBuf)
+    {
+      NFR_LOG_WARNING("Failed to allocate %" PRIu64 " byte compression buffer",
+                      size);
+      ++chan->compressStats.writesSkipped;
+      return 0;
+    }
+  }
+
+  if (!chan->compressPool)
+  {
+    uint32_t threads = nfr_GetCpuCount() / 2;
+    if (threads > 4)
+      threads = 4;
+    if (threads > 1 && nfr_ThreadPoolCreate(threads, &chan->compressPool) < 0)
+      chan->compressPool = 0;
+  }
+
+  int count = nfr_Compress(chan->compressPool,
+                           (uint8_t *) localMem->addr + localOffset, length,
+                           chan->compressBuf->addr, chan->compressBuf->size,
+                           slices);
+  if (count <= 0)
+  {
+    ++chan->compressStats.writesSkipped;
+    return 0;
+  }
+
+  uint64_t total = 0;
+  for (int i = 0; i < count; ++i)
+  {
+    ranges[i].localOffset  = slices[i].offset;
+    ranges[i].remoteOffset = slices[i].offset;
+    ranges[i].length       = slices[i].length;
+    ranges[i].rows         = 1;
+    ranges[i].localPitch   = 0;
+    ranges[i].remotePitch  = 0;
+    total += slices[i].length;
+  }
+
+  if (total * 100 > length * (100 - NFR_COMPRESS_MIN_SAVING))
+  {
+    NFR_LOG_TRACE("Write of %" PRIu64 " bytes only compressed to %" PRIu64
+                  " bytes", length,
+                  total);
+    ++chan->compressStats.writesSkipped;
+    return 0;
+  }
+
+  chan->compressStats.bytesIn  += length;
+  chan->compressStats.bytesOut += total;
+  return count;
+}
+
+int nfrHostWriteBuffer(PNFRMemory localMem, uint64_t localOffset,
+                       uint64_t remoteOffset, uint64_t length,
+                       struct NFRCallbackInfo * cbInfo)
+{
+  assert(localMem);
+  assert(length);
+  assert(localOffset + length <= localMem->size);
+
+  ASSERT_COMM_BUF_READY(localMem->parentResource);
+
+  struct NFRHostChannel * chan = nfr_HostMemChannel(localMem);
+  if (!chan)
+    return -EINVAL;
+
+  int paced = nfr_HostPacingCheck(chan, length);
+  if (paced < 0)
+    return paced;
+
+  /* The buffer is selected using the offset within a local page. The remote
+     buffer's own alignment is applied afterwards, if the data still fits. */
+  int autoOffset = remoteOffset == NETFR_REMOTE_OFFSET_AUTO;
+  if (autoOffset)
+  {
+    uint64_t ps = nfr_GetPageSize();
+    remoteOffset = ((uintptr_t) localMem->addr + localOffset) % ps;
+  }
+  
+  int index = nfr_HostSelectBuffer(chan, -1, remoteOffset + length, 0);
+  if (index < 0)
+    return index;
+
+  struct NFRRemoteMemory * remoteMem = chan->clientRegions + index;
+  if (autoOffset && remoteMem->align)
+  {
+    uint64_t offset = ((uintptr_t) localMem->addr + localOffset) 
+                      % remoteMem->align;
+    if (offset + length <= remoteMem->size)
+      remoteOffset = offset;
+  }
+
   struct NFR_TransferInfo ti   = {0};
-  ti.opType                    = NFR_OP_WRITE;
   ti.length                    = length;
-  ti.cbInfo                    = &scbInfo;
   ti.writeOpts.localMem        = localMem;
   ti.writeOpts.localOffset     = localOffset;
-  ti.writeOpts.remoteMem       = remoteMem;
   ti.writeOpts.remoteOffset    = remoteOffset;
-  ti.writeOpts.writeCbInfo     = &icbInfo;
 
-  ssize_t ret = nfr_PostTransfer(res, &ti);
-  if (ret < 0)
-    chan->clientRegions[minBufIndex].state = NFR_RMEM_AVAILABLE;
+  struct NFRWriteRange    ranges[NFR_COMPRESS_MAX_SLICES];
+  struct NFRCompressSlice slices[NFR_COMPRESS_MAX_SLICES];
+  int sliceCount = nfr_HostCompressWrite(chan, localMem, localOffset, length,
+                                         ranges, slices);
+  if (sliceCount > 0)
+  {
+    ti.writeOpts.localMem   = chan->compressBuf;
+    ti.writeOpts.ranges     = ranges;
+    ti.writeOpts.rangeCount = sliceCount;
+    ti.writeOpts.stagingMem = &chan->staging;
+    ti.writeOpts.slices     = slices;
+    ti.writeOpts.sliceCount = sliceCount;
+
+    // Both are released by the write callback
+    chan->staging.state = NFR_RMEM_BUSY_LOCAL;
+    chan->compressBusy  = 1;
+
+    int ret = nfr_HostPostWrite(chan, remoteMem, &ti, cbInfo);
+    if (ret < 0)
+    {
+      // Nothing was posted, otherwise the write callback will still run
+      if (remoteMem->state == NFR_RMEM_AVAILABLE)
+      {
+        chan->staging.state = NFR_RMEM_AVAILABLE;
+        chan->compressBusy  = 0;
+      }
+      return ret;
+    }
 
-  NFR_LOG_DEBUG("Posted RDMA write from %p -> %p", localMem->addr,
-                (void *) (uintptr_t) remoteMem->addr);
-  return ret;
+    ++chan->compressStats.writesCompressed;
+    return ret;
+  }
+
+  if (paced)
+  {
+    ti.writeOpts.paced = &chan->pacing.write;
+    int ret = nfr_HostPostWrite(chan, remoteMem, &ti, cbInfo);
+    if (ret < 0)
+      return ret;
+
+    /* The write is posted, and its callback reports a segment which cannot
+       be posted, so the caller still gets the buffer the write went to */
+    int ret2 = nfr_HostPacingAdvance(chan);
+    if (ret2 < 0)
+      NFR_LOG_WARNING("Paced write canceled: %s (%d)", fi_strerror(-ret2),
+                      ret2);
+    return ret;
+  }
+
+  if (length >= NETFR_RAIL_STRIPE_MIN_SIZE && chan->railCount > 1)
+    ti.writeOpts.railCount = nfr_HostSelectRails(chan, localMem, remoteMem,
+                                                 &ti.writeOpts);
+
+  return nfr_HostPostWrite(chan, remoteMem, &ti, cbInfo);
+}
+
+int nfrHostCopyWriteBuffer(PNFRCopyEngine engine, PNFRMemory localMem,
+                           uint64_t localOffset, uint64_t remoteOffset,
+                           const void * src, uint64_t length,
+                           struct NFRCallbackInfo * cbInfo)
+{
+  assert(localMem);
+  assert(src);
+  if (!localMem || !src || !length || localOffset > localMem->size
+      || length > localMem->size - localOffset)
+    return -EINVAL;
+
+  nfrCopy(engine, (uint8_t *) localMem->addr + localOffset, src, length);
+  return nfrHostWriteBuffer(localMem, localOffset, remoteOffset, length,
+                            cbInfo);
+}
+
+/**
+ * @brief Validate and post a partial write.
+ *
+ * @param localMem     Local memory region holding the data of all ranges, or
+ *                     the region of the first range if ``mems`` is set
+ *
+ * @param mems         Local memory region of each range, or null
+ *
+ * @param ranges       Ranges to write
+ *
+ * @param count        Number of ranges
+ *
+ * @param remoteIndex  Remote buffer index, or -1 to select one
+ *
+ * @param cbInfo       User callback info, may be null
+ *
+ * @return             The index of the remote buffer, or a negative error code
+ */
+static int nfr_HostWriteRanges(PNFRMemory localMem, const PNFRMemory * mems,
+                               const struct NFRWriteRange * ranges,
+                               uint32_t count, int remoteIndex,
+                               struct NFRCallbackInfo * cbInfo)
+{
+  if (!localMem || (!ranges && count) || count > NETFR_MAX_WRITE_RANGES)
+    return -EINVAL;
+
+  // A repeated buffer only makes sense if the buffer is known
+  if (!count && remoteIndex < 0)
+    return -EINVAL;
+
+  ASSERT_COMM_BUF_READY(localMem->parentResource);
+
+  struct NFRHostChannel * chan = nfr_HostMemChannel(localMem);
+  if (!chan)
+    return -EINVAL;
+
+  uint64_t total     = 0;
+  uint64_t remoteEnd = 0;
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    const struct NFRWriteRange * r = ranges + i;
+    PNFRMemory mem = mems ? mems[i] : localMem;
+    if (!mem || (mem != localMem 
+                 && mem->parentResource != localMem->parentResource))
+    {
+      NFR_LOG_DEBUG("Write range %u is not on the same channel", i);
+      return -EINVAL;
+    }
+
+    uint32_t rows = r->rows ? r->rows : 1;
+    if (!r->length 
+        || (rows > 1 && (r->localPitch < r->length 
+                         || r->remotePitch < r->length)))
+    {
+      NFR_LOG_DEBUG("Invalid write range %u", i);
+      return -EINVAL;
+    }
+
+    uint64_t lEnd = r->localOffset + (uint64_t) r->localPitch * (rows - 1)
+                    + r->length;
+    uint64_t rEnd = r->remoteOffset + (uint64_t) r->remotePitch * (rows - 1)
+                    + r->length;
+    if (lEnd > mem->size || rEnd > UINT32_MAX)
+    {
+      NFR_LOG_DEBUG("Write range %u out of bounds", i);
+      return -EINVAL;
+    }
+
+    if (rEnd > remoteEnd)
+      remoteEnd = rEnd;
+    total += (uint64_t) r->length * rows;
+  }
+
+  /* Damage is applied on top of a previous frame, so the buffer must still hold
+     the data of the previous write. If the buffer was chosen freely, it is
+     the caller's responsibility to write all of it. */
+  int index = nfr_HostSelectBuffer(chan, remoteIndex, remoteEnd, 
+                                   remoteIndex >= 0);
+  if (index < 0)
+    return index;
+
+  struct NFR_TransferInfo ti   = {0};
+  ti.length                    = total;
+  ti.writeOpts.localMem        = localMem;
+  ti.writeOpts.rangeMems       = mems;
+  ti.writeOpts.ranges          = ranges;
+  ti.writeOpts.rangeCount      = count;
+
+  return nfr_HostPostWrite(chan, chan->clientRegions + index, &ti, cbInfo);
+}
+
+int nfrHostWriteBufferRanges(PNFRMemory localMem,
+                             const struct NFRWriteRange * ranges,
+                             uint32_t count, int remoteIndex,
+                             struct NFRCallbackInfo * cbInfo)
+{
+  assert(localMem);
+  assert(ranges || !count);
+  return nfr_HostWriteRanges(localMem, 0, ranges, count, remoteIndex, cbInfo);
+}
+
+int nfrHostWriteBufferSG(const struct NFRWriteSegment * segments,
+                         uint32_t count, int remoteIndex,
+                         struct NFRCallbackInfo * cbInfo)
+{
+  assert(segments);
+  assert(count);
+  if (!segments || !count || count > NETFR_MAX_WRITE_RANGES)
+    return -EINVAL;
+
+  PNFRMemory           mems[NETFR_MAX_WRITE_RANGES];
+  struct NFRWriteRange ranges[NETFR_MAX_WRITE_RANGES];
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    mems[i]   = segments[i].localMem;
+    ranges[i] = segments[i].range;
+  }
+
+  return nfr_HostWriteRanges(mems[0], mems, ranges, count, remoteIndex, 
+                             cbInfo);
+}
+
+int nfrHostWriteBuffer2D(PNFRMemory localMem, uint64_t localOffset,
+                         uint32_t localPitch, uint64_t remoteOffset,
+                         uint32_t remotePitch, uint32_t rowLength,
+                         uint32_t rows, struct NFRCallbackInfo * cbInfo)
+{
+  assert(localMem);
+  assert(rowLength && rows);
+  if (!rowLength || !rows)
+    return -EINVAL;
+
+  struct NFRWriteRange range;
+  range.localOffset  = localOffset;
+  range.remoteOffset = remoteOffset;
+  range.length       = rowLength;
+  range.rows         = rows;
+  range.localPitch   = localPitch;
+  range.remotePitch  = remotePitch;
+  return nfr_HostWriteRanges(localMem, 0, &range, 1, -1, cbInfo);
+}
+
+int nfrHostGetRailStats(PNFRHost host, int channelID, int rail,
+                        struct NFRRailStats * stats)
+{
+  assert(host);
+  assert(stats);
+  if (!host || !stats || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
+
+  struct NFRHostChannel * chan = host->channels + channelID;
+  if (rail < 0 || rail >= chan->railCount)
+    return -EINVAL;
+
+  *stats           = chan->rails[rail]->stats;
+  stats->connected = !!chan->rails[rail]->ep;
+  return 0;
+}
+
+int nfrHostSetPlacement(PNFRHost host, int channelID, uint8_t policy,
+                        NFRPlacementFn hook, void * uData)
+{
+  assert(host);
+  if (!host || channelID < 0 || channelID >= NETFR_NUM_CHANNELS
+      || policy >= NFR_PLACEMENT_MAX || (policy == NFR_PLACEMENT_CUSTOM && !hook))
+    return -EINVAL;
+
+  struct NFRHostChannel * chan = host->channels + channelID;
+  chan->placement     = policy;
+  chan->placementHook = policy == NFR_PLACEMENT_CUSTOM ? hook : 0;
+  chan->placementData = uData;
+  return 0;
+}
+
+int nfrHostSetWriteMetadata(PNFRHost host, int channelID, uint64_t udata,
+                            const void * meta, uint32_t length)
+{
+  assert(host);
+  if (!host || channelID < 0 || channelID >= NETFR_NUM_CHANNELS
+      || length > NETFR_WRITE_METADATA_MAX_SIZE || (length && !meta))
+    return -EINVAL;
+
+  struct NFRHostWriteMeta * wm = &host->channels[channelID].writeMeta;
+  if (length)
+    memcpy(wm->data, meta, length);
+  wm->udata   = udata;
+  wm->length  = length;
+  wm->pending = 1;
+  return 0;
+}
+
+int nfrHostGetCompressionStats(PNFRHost host, int channelID,
+                               struct NFRCompressionStats * stats)
+{
+  assert(host);
+  assert(stats);
+  if (!host || !stats || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
+
+  struct NFRHostChannel * chan = host->channels + channelID;
+  *stats         = chan->compressStats;
+  stats->enabled = !!(chan->res->features & NFR_FEATURE_LZ4);
+  return 0;
+}
+
+int nfrHostGetCreditStats(PNFRHost host, int channelID,
+                          struct NFRCreditStats * stats)
+{
+  assert(host);
+  assert(stats);
+  if (!host || !stats || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
+
+  nfr_CreditGetStats(host->channels[channelID].res, stats);
+  return 0;
 }
 
 void nfrHostFree(PNFRHost * res)
@@ -575,8 +1703,22 @@ void nfrHostFree(PNFRHost * res)
     return;
 
   struct NFRHost * host = *res;
-  for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
+  for (int i = NETFR_NUM_CHANNELS - 1; i >= 0; --i)
   {
+    for (int r = 1; r < host->channels[i].railCount; ++r)
+      nfr_ResourceClose(host->channels[i].rails[r]);
+
+    nfr_ThreadPoolFree(&host->channels[i].compressPool);
+    nfr_CoalesceFree(&host->channels[i].coalesce);
+    nfr_SendQFree(&host->channels[i].sendq);
+    nfr_FragmentFree(&host->channels[i].fragment);
+    nfr_ReassembleFree(&host->channels[i].reassemble);
+    nfr_EagerFree(&host->channels[i].eager);
+    if (host->channels[i].pull.gens)
+      nfrFreeMemory(&host->channels[i].pull.gens);
+    if (host->channels[i].compressBuf)
+      nfrFreeMemory(&host->channels[i].compressBuf);
+
     if (host->channels[i].res)
     {
       nfr_CommBufClose(&host->channels[i].res->commBuf);
@@ -28,6 +28,112 @@
 #include "netfr/netfr_host.h"
 #include "netfr/netfr_constants.h"
 #include "common/nfr_resource.h"
+#include "common/nfr_credit.h"
+#include "common/nfr_coalesce.h"
+#include "common/nfr_fragment.h"
+#include "common/nfr_eager.h"
+#include "common/nfr_protocol.h"
+#include "common/nfr_sendq.h"
+#include "common/nfr_thread.h"
+#include "common/nfr.h"
+
+/* Maximum size of a single segment of a paced write */
+#define NFR_PACING_SEGMENT_SIZE (256 << 10)
+
+/* Maximum number of outstanding segments of a paced write */
+#define NFR_PACING_MAX_SEGMENTS 64
+
+/* Number of recent delivery rate samples the bandwidth estimate is taken from */
+#define NFR_LINK_BW_WINDOW 8
+
+struct NFRHostPacing
+{
+  uint64_t                  rate;       // Bytes per second, 0 if not paced
+  uint64_t                  burst;      // Token bucket size
+  int64_t                   tokens;     // Negative after a write larger than
+                                        // the available tokens
+  uint64_t                  lastRefill;
+  // The write currently being posted in segments, if active is set
+  struct NFR_PacedWrite     write;
+  uint8_t                   active;
+  // Post time and length of the posted segments which have not completed
+  uint64_t                  segTime[NFR_PACING_MAX_SEGMENTS];
+  uint64_t                  segLength[NFR_PACING_MAX_SEGMENTS];
+  uint8_t                   segIdle[NFR_PACING_MAX_SEGMENTS];
+  uint32_t                  segHead;
+  uint32_t                  segTail;
+};
+
+struct NFRHostLinkEstimator
+{
+  uint64_t                  bwSamples[NFR_LINK_BW_WINDOW];
+  uint32_t                  bwIndex;
+  uint64_t                  srtt;
+  uint64_t                  minRtt;
+  uint64_t                  lastCompletion;
+  uint64_t                  queuedBytes;
+  uint32_t                  outstanding;  // Posted writes and segments
+  // Post times of the writes to each remote buffer
+  uint64_t                  postTime[NETFR_MAX_MEM_REGIONS];
+  uint64_t                  postBytes[NETFR_MAX_MEM_REGIONS];
+  uint8_t                   postIdle[NETFR_MAX_MEM_REGIONS];
+};
+
+/* Latest value of a register. Only the latest value is written, and only one
+   write per register is in flight, so values set while a write is in flight
+   replace each other. */
+struct NFRHostRegister
+{
+  uint8_t                   data[NETFR_REGISTER_MAX_PAYLOAD];
+  uint32_t                  length;
+  uint32_t                  seq;
+  uint8_t                   pending;    // Value not written yet
+  uint8_t                   inFlight;
+};
+
+struct NFRHostRegisters
+{
+  // The client's registers, valid if count is set
+  uint64_t                  remoteAddr;
+  uint64_t                  remoteKey;
+  uint8_t                   count;
+  struct NFRHostRegister    regs[NETFR_MAX_REGISTERS];
+};
+
+/* Frames published for the client to pull, see nfrHostPublishFrame */
+struct NFRHostPull
+{
+  // Generation of the frame in each local region, readable by the client
+  struct NFRMemory        * gens;
+  uint64_t                  generation;  // Last generation assigned
+  struct NFRMsgFrameDesc    desc;        // Newest frame, valid if generation
+  uint8_t                   region;      // Local region of the newest frame
+  uint8_t                   pending;     // Descriptor not sent yet
+  uint8_t                   inFlight;
+};
+
+/* Mirror of the client's content cache, see nfrHostSendCached. The host
+   decides which slot each message is stored in, so that the client only
+   follows, and refers to a slot once the client has reported holding it. */
+struct NFRHostCache
+{
+  uint64_t                  hash[NETFR_MAX_CACHE_SLOTS];
+  uint64_t                  lastUse[NETFR_MAX_CACHE_SLOTS];  // Tick of last send
+  uint32_t                  length[NETFR_MAX_CACHE_SLOTS];
+  uint64_t                  assigned;   // Slots with content, one bit each
+  uint64_t                  confirmed;  // Slots the client holds, one bit each
+  uint64_t                  tick;
+  uint8_t                   slots;      // Announced by the client, 0 until then
+};
+
+/* Metadata attached to the next buffer write, see nfrHostSetWriteMetadata */
+struct NFRHostWriteMeta
+{
+  uint64_t                  udata;
+  uint16_t                  length;
+  uint8_t                   pending;
+  uint8_t                   data[NETFR_WRITE_METADATA_MAX_SIZE];
+};
 
 struct NFRHostChannel
 {
@@ -40,6 +146,47 @@ struct NFRHostChannel
   struct NFRResource      * res;
   struct NFRMemory        * mem;
   struct NFRRemoteMemory    clientRegions[NETFR_MAX_MEM_REGIONS];
+  // Rails used for striped writes; rails[0] is the same as res
+  struct NFRResource      * rails[NETFR_MAX_RAILS];
+  uint8_t                   railCount;
+  // Compressed writes: the client's staging buffer and the local scratch
+  // buffer holding the compressed data until the write completes
+  struct NFRRemoteMemory    staging;
+  struct NFRMemory        * compressBuf;
+  struct NFRThreadPool    * compressPool;
+  struct NFRCompressionStats compressStats;
+  uint8_t                   compressBusy;
+  // Remote buffer placement, see NFRPlacementPolicy
+  NFRPlacementFn            placementHook;
+  void                    * placementData;
+  uint32_t                  releaseSerial;  // Serial of the last released buffer
+  int                       lastPlaced;     // Last buffer chosen by placement
+  uint8_t                   placement;
+  struct NFRHostPacing      pacing;
+  struct NFRHostLinkEstimator link;
+  // Partial write too large to be posted at once, posted in batches
+  struct NFR_RangeWrite     rangeWrite;
+  // Messages waiting for credits or send contexts
+  struct NFRSendQueue       sendq;
+  // Small messages packed before they are queued
+  struct NFRCoalescer       coalesce;
+  // Large message being sent and received in fragments
+  struct NFRFragmenter      fragment;
+  struct NFRReassembler     reassemble;
+  // Client ring small messages are written into, if negotiated
+  struct NFREagerRing       eager;
+  // Latest value registers of the client, if negotiated
+  struct NFRHostRegisters   registers;
+  // Local regions the client may write into, one bit per region index
+  uint32_t                  exposed;
+  // Frames the client can read, if negotiated
+  struct NFRHostPull        pull;
+  // Messages cached by the client, if negotiated
+  struct NFRHostCache       cache;
+  // Metadata carried by the notification of the next write
+  struct NFRHostWriteMeta   writeMeta;
+  // Staging buffers presented on the channel, if created
+  struct NFRHostSwapchain * swapchain;
 };
 
 struct NFRHost
@@ -47,4 +194,132 @@ struct NFRHost
   struct NFRHostChannel channels[NETFR_NUM_CHANNELS];
 };
 
+/**
+ * @brief Get the effective pacing rate of a channel.
+ *
+ * @return The rate in bytes per second, or 0 if writes are not paced
+ */
+uint64_t nfr_HostPacingRate(struct NFRHostChannel * chan);
+
+/**
+ * @brief Check whether a contiguous write must be paced, i.e., posted in
+ *        segments, because it is larger than a segment or than the available
+ *        tokens.
+ *
+ * @return 1 if the write must be paced, 0 if it can be posted directly, or
+ *         -EAGAIN if it must be paced and the previous paced write is still
+ *         in progress
+ */
+int nfr_HostPacingCheck(struct NFRHostChannel * chan, uint64_t length);
+
+/**
+ * @brief Post the segments of the active paced write allowed by the tokens
+ *        available, and sample the completions of earlier segments.
+ *
+ * @return 0 on success, or a negative error code if the write was canceled
+ */
+int nfr_HostPacingAdvance(struct NFRHostChannel * chan);
+
+/**
+ * @brief Record a posted buffer write, charging its bytes to the token bucket.
+ *
+ * @param index  Index of the remote buffer
+ *
+ * @param bytes  Bytes transferred by the write
+ *
+ * @param paced  Whether the write is posted in segments
+ */
+void nfr_HostLinkWritePosted(struct NFRHostChannel * chan, int index,
+                             uint64_t bytes, int paced);
+
+/**
+ * @brief Record the completion of a buffer write, and sample the link.
+ *
+ * @param ctx       Write context
+ *
+ * @param index     Index of the remote buffer
+ *
+ * @param canceled  Whether the write was canceled
+ */
+void nfr_HostLinkWriteDone(struct NFRHostChannel * chan,
+                           struct NFRFabricContext * ctx, int index,
+                           int canceled);
+
+/**
+ * @brief Record the arrival of a message acknowledgement.
+ *
+ * @param rtt   Round trip time of the message, see nfr_CreditAcked
+ */
+void nfr_HostLinkDataAck(struct NFRHostChannel * chan, uint64_t rtt);
+
+/**
+ * @brief Write the registers whose value changed and which have no write in
+ *        flight.
+ *
+ * @return 0 on success, negative error code on failure
+ */
+int nfr_HostRegisterFlush(struct NFRHostChannel * chan);
+
+/**
+ * @brief Announce the exposed regions which are not known to the client, i.e.
+ *        which were just exposed or released with nfrAckBuffer.
+ *
+ * @return The number of regions announced, or a negative error code
+ */
+int nfr_HostResyncBufs(struct NFRHostChannel * chan);
+
+/**
+ * @brief Mark the exposed regions known to the client as unknown, e.g. on
+ *        disconnection, so they are announced again to the next client.
+ */
+void nfr_HostUploadReset(struct NFRHostChannel * chan);
+
+/**
+ * @brief Send the descriptor of the newest published frame, if it was not
+ *        sent yet and the previous descriptor has been sent.
+ *
+ * @return 0 on success, negative error code on failure
+ */
+int nfr_HostPullFlush(struct NFRHostChannel * chan);
+
+/**
+ * @brief Resend the newest descriptor to the next client, e.g. on
+ *        disconnection.
+ */
+void nfr_HostPullReset(struct NFRHostChannel * chan);
+
+/**
+ * @brief Forget the client's registers, e.g. on disconnection. The latest
+ *        values are kept and written once the registers are announced again.
+ */
+void nfr_HostRegisterReset(struct NFRHostChannel * chan);
+
+/**
+ * @brief Post the queued messages, then the fragments of the large message
+ *        being sent, as far as the credits allow.
+ *
+ * @return 0 on success, or a negative error code if the large message was
+ *         dropped
+ */
+int nfr_HostLargeFlush(struct NFRHostChannel * chan);
+
+/**
+ * @brief Forget the contents of the client's cache, e.g. on disconnection.
+ *        The cache is used again once the client announces it.
+ */
+void nfr_HostCacheReset(struct NFRHostChannel * chan);
+
+/**
+ * @brief Mark a cache slot as held by the client, if it still holds the
+ *        message the hash was reported for.
+ */
+void nfr_HostCacheConfirm(struct NFRHostChannel * chan, uint8_t slot,
+                          uint64_t hash);
+
+/**
+ * @brief Return the swapchain image presented into a remote buffer to the
+ *        pool once the write has completed or was canceled.
+ */
+void nfr_HostSwapchainWriteDone(struct NFRHostChannel * chan, uint8_t index);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,130 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+/* Content cache of the client */
+
+#include <string.h>
+#include <errno.h>
+
+#include "netfr/netfr_host.h"
+#include "host/nfr_host.h"
+
+#include "common/nfr_hash.h"
+#include "common/nfr_log.h"
+
+void nfr_HostCacheReset(struct NFRHostChannel * chan)
+{
+  memset(&chan->cache, 0, sizeof(chan->cache));
+}
+
+void nfr_HostCacheConfirm(struct NFRHostChannel * chan, uint8_t slot,
+                          uint64_t hash)
+{
+  struct NFRHostCache * cache = &chan->cache;
+  // A report for content which was replaced in the meantime is stale
+  if (slot >= cache->slots || !(cache->assigned & (1ULL << slot))
+      || cache->hash[slot] != hash)
+    return;
+  cache->confirmed |= 1ULL << slot;
+}
+
+/**
+ * @brief Find the slot a message is stored in, confirmed or not, or the slot
+ *        to store it in, which is a free one or else the least recently used.
+ */
+static int nfr_HostCacheFind(struct NFRHostCache * cache, uint64_t hash,
+                             uint32_t length, int * found)
+{
+  int victim = -1;
+  for (int i = 0; i < cache->slots; ++i)
+  {
+    if (!(cache->assigned & (1ULL << i)))
+    {
+      if (victim < 0 || (cache->assigned & (1ULL << victim)))
+        victim = i;
+      continue;
+    }
+    if (cache->hash[i] == hash && cache->length[i] == length)
+    {
+      *found = 1;
+      return i;
+    }
+    if (victim < 0 || ((cache->assigned & (1ULL << victim))
+                       && cache->lastUse[i] < cache->lastUse[victim]))
+      victim = i;
+  }
+
+  *found = 0;
+  return victim;
+}
+
+int nfrHostSendCached(PNFRHost host, int channelID, const void * data,
+                      uint32_t length, uint64_t udata)
+{
+  assert(host);
+  assert(data);
+  if (!host || !data || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
+
+  struct NFRHostChannel * ch = host->channels + channelID;
+  struct NFRHostCache * cache = &ch->cache;
+  if (!cache->slots || length > NETFR_CACHE_SLOT_SIZE)
+    return nfrHostSendLarge(host, channelID, data, length, udata);
+
+  struct NFRResource * res = ch->res;
+  if (!res->ep)
+    return -ENOTCONN;
+  if (nfr_FragmentBusy(&ch->fragment))
+    return -EBUSY;
+
+  int found;
+  uint64_t hash = nfr_Hash64(data, length);
+  int slot = nfr_HostCacheFind(cache, hash, length, &found);
+  assert(slot >= 0);
+
+  int ret;
+  if (found && (cache->confirmed & (1ULL << slot)))
+  {
+    ret = nfr_FragmentSubmitRef(&ch->fragment, length, hash, (uint8_t) slot,
+                                udata);
+    NFR_LOG_TRACE("Cache hit in slot %d on channel %d", slot, channelID);
+  }
+  else
+  {
+    // Sent again in full if the client has not reported the previous copy
+    uint32_t maxPayload = nfr_ResourceMaxMessage(res)
+                          - offsetof(struct NFRMsgHostData, data);
+    ret = nfr_FragmentSubmit(&ch->fragment, data, length, udata, maxPayload,
+                             NFR_FRAGMENT_FLAG_CACHE, (uint8_t) slot);
+    if (ret == 0)
+    {
+      cache->hash[slot]   = hash;
+      cache->length[slot] = length;
+      cache->assigned    |= 1ULL << slot;
+      cache->confirmed   &= ~(1ULL << slot);
+    }
+  }
+  if (ret < 0)
+    return ret;
+
+  cache->lastUse[slot] = ++cache->tick;
+  return nfr_HostLargeFlush(ch);
+}
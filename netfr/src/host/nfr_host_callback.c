@@ -67,26 +67,94 @@ void nfr_HostProcessInternalRx(struct NFRFabricContext * ctx)
     return;
   }
   
-  struct NFRHeader * hdr = (struct NFRHeader *) ctx->slot->data;
+  struct NFRHeader * hdr = (struct NFRHeader *) nfr_ContextData(ctx);
   if (memcmp(hdr->magic, NETFR_MAGIC, 8) != 0 || hdr->version != NETFR_VERSION)
   {
     assert(!"Invalid message header");
     goto release_mbuf;
   }
 
+  // Receives from a shared pool may belong to any of the sharing channels
+  if (chan->res->rxPool)
+  {
+    if (hdr->channel >= NETFR_NUM_CHANNELS)
+    {
+      assert(!"Invalid channel index");
+      goto release_mbuf;
+    }
+    chan = host->channels + hdr->channel;
+  }
+  ctx->slot->channel = hdr->channel;
+
   switch (hdr->type)
   {
     case NFR_MSG_BUFFER_STATE:
     {
       struct NFRMsgBufferState * state = (struct NFRMsgBufferState *) hdr;
-      if (state->index >= NETFR_MAX_MEM_REGIONS)
+      if (state->flags & NFR_BUFFER_FLAG_EAGER_RING)
+      {
+        uint64_t slots = state->size / NETFR_EAGER_SLOT_SIZE;
+        if (!(chan->res->features & NFR_FEATURE_EAGER_RING) || !slots
+            || slots > NETFR_EAGER_MAX_SLOTS)
+        {
+          assert(!"Invalid eager ring");
+          goto release_mbuf;
+        }
+        // The counter is announced to the client by nfrHostProcess
+        nfr_EagerReset(&chan->eager);
+        chan->eager.remoteAddr = state->addr;
+        chan->eager.remoteKey  = state->rkey;
+        chan->eager.slots      = (uint32_t) slots;
+        NFR_LOG_DEBUG("Got eager ring with %u slots", chan->eager.slots);
+        goto release_mbuf;
+      }
+      if (state->flags & NFR_BUFFER_FLAG_REGISTERS)
+      {
+        uint64_t count = state->size / NETFR_REGISTER_SIZE;
+        if (!(chan->res->features & NFR_FEATURE_REGISTERS) || !count)
+        {
+          assert(!"Invalid registers");
+          goto release_mbuf;
+        }
+        // Values set before the registers were known are written now
+        nfr_HostRegisterReset(chan);
+        chan->registers.remoteAddr = state->addr;
+        chan->registers.remoteKey  = state->rkey;
+        chan->registers.count      = count > NETFR_MAX_REGISTERS
+                                     ? NETFR_MAX_REGISTERS : (uint8_t) count;
+        NFR_LOG_DEBUG("Got %u registers", chan->registers.count);
+        goto release_mbuf;
+      }
+      if (state->flags & NFR_BUFFER_FLAG_CACHE)
+      {
+        uint64_t count = state->size / NETFR_CACHE_SLOT_SIZE;
+        if (!(chan->res->features & NFR_FEATURE_CACHE) || !count)
+        {
+          assert(!"Invalid cache");
+          goto release_mbuf;
+        }
+        // The cache of a new client starts out empty
+        nfr_HostCacheReset(chan);
+        chan->cache.slots = count > NETFR_MAX_CACHE_SLOTS
+                            ? NETFR_MAX_CACHE_SLOTS : (uint8_t) count;
+        NFR_LOG_DEBUG("Got %u cache slots", chan->cache.slots);
+        goto release_mbuf;
+      }
+      // The client can only announce as many regions as it advertised
+      if (state->index >= NETFR_MAX_MEM_REGIONS
+          || state->index >= chan->res->peerMemRegions)
       {
         assert(!"Invalid memory region index");
         goto release_mbuf;
       }
 
-      struct NFRRemoteMemory * rmem = chan->clientRegions + state->index;
-      if (rmem->state == NFR_RMEM_BUSY_LOCAL)
+      /* The staging buffer is made available again once the client has
+         decompressed its contents, which may be before the local write
+         completion has been processed */
+      int staging = !!(state->flags & NFR_BUFFER_FLAG_STAGING);
+      struct NFRRemoteMemory * rmem = staging ? &chan->staging
+                                              : chan->clientRegions + state->index;
+      if (rmem->state == NFR_RMEM_BUSY_LOCAL && !staging)
       {
         assert(!"Client caused invalid state transition");
         // tbd: cancel the operation if it's outstanding by using ownerContext
@@ -95,19 +163,79 @@ void nfr_HostProcessInternalRx(struct NFRFabricContext * ctx)
       if (!state->size)
       {
         // Releases the memory region
+        struct NFRResource * parent = rmem->parentResource;
+        uint8_t index = rmem->index;
         memset(rmem, 0, sizeof(*rmem));
+        rmem->parentResource = parent;
+        rmem->index = index;
         rmem->state = NFR_RMEM_NONE;
         goto release_mbuf;
       }
       NFR_LOG_DEBUG("Got buf index %d / %p len %lu key %d st %d -> %d", state->index,
                     (uintptr_t) state->addr, state->size, state->rkey,
                     rmem->state, NFR_RMEM_AVAILABLE);
+      // Contents of a re-registered region are unrelated to previous writes
+      if (rmem->addr != state->addr || rmem->size != state->size
+          || rmem->rkey != state->rkey)
+        rmem->writeSerial = 0;
       rmem->addr         = state->addr;
       rmem->size         = state->size;
       rmem->rkey         = state->rkey;
       rmem->align        = state->pageSize;
+      rmem->priority     = state->priority;
+      if (!staging)
+        rmem->releaseSerial = ++chan->releaseSerial;
       rmem->state        = NFR_RMEM_AVAILABLE;
       rmem->activeContext = 0;
+      rmem->railKeys[0]  = state->rkey;
+      rmem->railCount    = 1;
+      for (int r = 1; r < state->railCount && r < NETFR_MAX_RAILS; ++r)
+      {
+        rmem->railKeys[r] = state->railKeys[r - 1];
+        rmem->railCount   = r + 1;
+      }
+      break;
+    }
+    case NFR_MSG_BUFFER_UPDATE:
+    {
+      // The client wrote into one of the exposed regions
+      struct NFRMsgBufferUpdate * update = (struct NFRMsgBufferUpdate *) hdr;
+      if (update->bufferIndex >= NETFR_MAX_MEM_REGIONS
+          || !(chan->exposed & (1u << update->bufferIndex)))
+      {
+        assert(!"Invalid buffer index");
+        goto release_mbuf;
+      }
+      struct NFRMemory * mem = chan->res->memRegions + update->bufferIndex;
+      if (mem->state != MEM_STATE_AVAILABLE || update->sliceCount
+          || (uint64_t) update->payloadOffset + update->payloadSize > mem->size
+          || update->rangeCount > NETFR_MAX_WRITE_RANGES)
+      {
+        assert(!"Invalid buffer update");
+        goto release_mbuf;
+      }
+      for (int i = 0; i < update->rangeCount; ++i)
+      {
+        const struct NFRMsgRange * r = update->ranges + i;
+        uint32_t rows = r->rows ? r->rows : 1;
+        if (r->offset + (uint64_t) r->pitch * (rows - 1) + r->length
+            > mem->size)
+        {
+          assert(!"Invalid buffer update range");
+          goto release_mbuf;
+        }
+        mem->ranges[i].offset = r->offset;
+        mem->ranges[i].length = r->length;
+        mem->ranges[i].pitch  = r->pitch;
+        mem->ranges[i].rows   = rows;
+      }
+      mem->rangeCount    = update->rangeCount;
+      mem->state         = MEM_STATE_HAS_DATA;
+      mem->payloadOffset = update->payloadOffset;
+      mem->payloadLength = update->payloadSize;
+      mem->writeSerial   = update->writeSerial;
+      mem->channelSerial = update->channelSerial;
+      mem->udata         = update->udata;
       break;
     }
     case NFR_MSG_CLIENT_DATA:
@@ -115,19 +243,40 @@ void nfr_HostProcessInternalRx(struct NFRFabricContext * ctx)
       // The host can call nfrHostReadData to read the message later. This must
       // be done regularly, since there is no alert mechanism yet.
       struct NFRMsgClientData * msg = (struct NFRMsgClientData *) hdr;
-      if (msg->length > NETFR_MESSAGE_MAX_PAYLOAD_SIZE)
+      if (msg->length > NETFR_MESSAGE_MAX_PAYLOAD_SIZE
+          || msg->length + offsetof(struct NFRMsgClientData, data)
+             > ctx->parentResource->commBuf.info.slotSize)
       {
         assert(!"Message size is invalid");
         goto release_mbuf;
       }
+      int valid = msg->records == NFR_MSG_FRAGMENT
+                  ? nfr_FragmentValidate(msg->data, msg->length)
+                  : nfr_CoalesceValidate(msg->data, msg->length, msg->records);
+      if (valid < 0)
+      {
+        assert(!"Packed records or fragment are invalid");
+        goto release_mbuf;
+      }
       ctx->state               = CTX_STATE_HAS_DATA;
+      nfr_CreditReceived(chan->res);
       ctx->slot->msgSerial     = msg->msgSerial;
       ctx->slot->channelSerial = msg->channelSerial;
+      ctx->slot->record        = 0;
       return;
     }
     case NFR_MSG_HOST_DATA_ACK:
-      ++chan->res->txCredits;
+    {
+      struct NFRMsgHostDataAck * ack = (struct NFRMsgHostDataAck *) hdr;
+      nfr_HostLinkDataAck(chan, nfr_CreditAcked(chan->res, ack->credits));
+      break;
+    }
+    case NFR_MSG_CACHE_STATE:
+    {
+      struct NFRMsgCacheState * state = (struct NFRMsgCacheState *) hdr;
+      nfr_HostCacheConfirm(chan, state->slot, state->hash);
       break;
+    }
     case NFR_MSG_CLIENT_HELLO:
       assert(!"Already connected client should not send hello message");
       break;
@@ -146,7 +295,9 @@ release_mbuf:
 
 // Process internal write completion 
 // udata: (NFRHostChannel * ch, NFRMemory * localMem, NFRRemoteMemory * remoteMem, 
-//         uint64_t localOffset, uint64_t remoteOffset, uint64_t length)
+//         uint64_t localOffset, uint64_t remoteOffset, uint64_t length,
+//         NFRCallback userCb, NFRFabricContext * notifyCtx)
+// The offsets and length are 0 for partial writes.
 void nfr_HostProcessInternalWrite(struct NFRFabricContext * ctx)
 {
   NFR_LOG_TRACE("Processing wrctx %p", ctx);
@@ -163,11 +314,34 @@ void nfr_HostProcessInternalWrite(struct NFRFabricContext * ctx)
   assert(ch);
   assert(lmem);
   assert(rmem);
-  assert(length);
   assert(length <= lmem->size - lOffset);
   assert(length <= rmem->size - rOffset);
   assert(length <= NETFR_MAX_BUFFER_SIZE);
 
+  // The compressed data has been written to the client's staging buffer
+  if (lmem == ch->compressBuf)
+  {
+    ch->compressBusy = 0;
+    if (ch->staging.state == NFR_RMEM_BUSY_LOCAL)
+      ch->staging.state = ctx->state == CTX_STATE_CANCELED 
+                          ? NFR_RMEM_AVAILABLE : NFR_RMEM_BUSY_REMOTE;
+  }
+
+  nfr_HostLinkWriteDone(ch, ctx, rmem->index, 
+                        ctx->state == CTX_STATE_CANCELED);
+  nfr_HostSwapchainWriteDone(ch, rmem->index);
+
+  /* A striped or paced write which could only be partially posted. The client
+     was never notified, so the buffer can be reused right away. */
+  if (ctx->state == CTX_STATE_CANCELED)
+  {
+    NFR_LOG_DEBUG("Write to buffer %d canceled", rmem->index);
+    rmem->state       = NFR_RMEM_AVAILABLE;
+    rmem->writeSerial = 0;
+    NFR_RESET_CONTEXT(ctx);
+    return;
+  }
+
   if (ctx->state != CTX_STATE_WAITING)
   {
     assert(!"Invalid buffer state");
@@ -181,6 +355,19 @@ void nfr_HostProcessInternalWrite(struct NFRFabricContext * ctx)
   }
   rmem->state = NFR_RMEM_BUSY_REMOTE;
 
+  // Striped writes are only confirmed once every stripe has completed
+  struct NFRFabricContext * nctx = ctx->cbInfo.uData[NFR_WRITE_NOTIFY_INDEX];
+  if (nctx)
+  {
+    int ret = nfr_ResourcePostPrepared(nctx);
+    if (ret < 0)
+    {
+      NFR_LOG_ERROR("Failed to notify client of write to buffer %d: %s (%d)",
+                    rmem->index, fi_strerror(-ret), ret);
+      rmem->state = NFR_RMEM_AVAILABLE;
+    }
+  }
+
   // Invoke the user callback
   // tbd: check if the access is valid
   if (userCb)
@@ -0,0 +1,617 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* Frame difference engine */
+
+#include <string.h>
+#include <errno.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  #define NFR_DIFF_X86 1
+  #include <immintrin.h>
+#else
+  #define NFR_DIFF_X86 0
+#endif
+
+#include "netfr/netfr_host.h"
+#include "host/nfr_host.h"
+
+#include "common/nfr_log.h"
+#include "common/nfr_mem.h"
+#include "common/nfr_thread.h"
+
+/* If at least this percentage of the tiles changed, the entire frame is sent as
+   a single contiguous write instead */
+#define NFR_DIFF_FULL_PERCENT 75
+
+/* Frames smaller than this are always compared on a single thread */
+#define NFR_DIFF_MT_MIN_SIZE (4 << 20)
+
+/* Comparison function; returns nonzero if the buffers differ */
+typedef int (*NFR_DiffFn)(const uint8_t * a, const uint8_t * b, size_t len);
+
+struct NFRHostDiff
+{
+  struct NFRHostChannel * chan;       // Null if not attached to a host
+  struct NFRDiffOpts      opts;
+  uint64_t                frameSize;
+  uint32_t                rowBytes;
+  uint32_t                tilesX;
+  uint32_t                tilesY;
+  uint8_t               * dirty;      // Per-tile flags of the last comparison
+  NFR_DiffFn              differs;
+  struct NFRThreadPool  * pool;
+  /* Shadow copies of the remote buffers. A shadow is valid if shadowValid is
+     set and, when attached to a host, shadowSerial matches the write serial of
+     the remote buffer. */
+  uint8_t               * shadow[NETFR_MAX_MEM_REGIONS];
+  uint32_t                shadowSerial[NETFR_MAX_MEM_REGIONS];
+  uint8_t                 shadowValid[NETFR_MAX_MEM_REGIONS];
+  // Comparison in progress
+  const uint8_t         * frame;
+  const uint8_t         * ref;
+};
+
+static int nfr_DiffScalar(const uint8_t * a, const uint8_t * b, size_t len)
+{
+  return memcmp(a, b, len) != 0;
+}
+
+#if NFR_DIFF_X86
+
+__attribute__((target("sse2")))
+static int nfr_DiffSSE2(const uint8_t * a, const uint8_t * b, size_t len)
+{
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64)
+  {
+    __m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (a + i)),
+                               _mm_loadu_si128((const __m128i *) (b + i)));
+    __m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (a + i + 16)),
+                               _mm_loadu_si128((const __m128i *) (b + i + 16)));
+    __m128i x2 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (a + i + 32)),
+                               _mm_loadu_si128((const __m128i *) (b + i + 32)));
+    __m128i x3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (a + i + 48)),
+                               _mm_loadu_si128((const __m128i *) (b + i + 48)));
+    __m128i o  = _mm_or_si128(_mm_or_si128(x0, x1), _mm_or_si128(x2, x3));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(o, _mm_setzero_si128())) != 0xFFFF)
+      return 1;
+  }
+  for (; i + 16 <= len; i += 16)
+  {
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (a + i)),
+                              _mm_loadu_si128((const __m128i *) (b + i)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128())) != 0xFFFF)
+      return 1;
+  }
+  return i < len ? memcmp(a + i, b + i, len - i) != 0 : 0;
+}
+
+__attribute__((target("avx2")))
+static int nfr_DiffAVX2(const uint8_t * a, const uint8_t * b, size_t len)
+{
+  size_t i = 0;
+  for (; i + 128 <= len; i += 128)
+  {
+    __m256i x0 = _mm256_xor_si256(
+      _mm256_loadu_si256((const __m256i *) (a + i)),
+      _mm256_loadu_si256((const __m256i *) (b + i)));
+    __m256i x1 = _mm256_xor_si256(
+      _mm256_loadu_si256((const __m256i *) (a + i + 32)),
+      _mm256_loadu_si256((const __m256i *) (b + i + 32)));
+    __m256i x2 = _mm256_xor_si256(
+      _mm256_loadu_si256((const __m256i *) (a + i + 64)),
+      _mm256_loadu_si256((const __m256i *) (b + i + 64)));
+    __m256i x3 = _mm256_xor_si256(
+      _mm256_loadu_si256((const __m256i *) (a + i + 96)),
+      _mm256_loadu_si256((const __m256i *) (b + i + 96)));
+    __m256i o  = _mm256_or_si256(_mm256_or_si256(x0, x1),
+                                 _mm256_or_si256(x2, x3));
+    if (!_mm256_testz_si256(o, o))
+      return 1;
+  }
+  for (; i + 32 <= len; i += 32)
+  {
+    __m256i x = _mm256_xor_si256(
+      _mm256_loadu_si256((const __m256i *) (a + i)),
+      _mm256_loadu_si256((const __m256i *) (b + i)));
+    if (!_mm256_testz_si256(x, x))
+      return 1;
+  }
+  return i < len ? nfr_DiffSSE2(a + i, b + i, len - i) : 0;
+}
+
+__attribute__((target("avx512f")))
+static int nfr_DiffAVX512(const uint8_t * a, const uint8_t * b, size_t len)
+{
+  size_t i = 0;
+  for (; i + 256 <= len; i += 256)
+  {
+    __m512i x0 = _mm512_xor_si512(_mm512_loadu_si512(a + i),
+                                  _mm512_loadu_si512(b + i));
+    __m512i x1 = _mm512_xor_si512(_mm512_loadu_si512(a + i + 64),
+                                  _mm512_loadu_si512(b + i + 64));
+    __m512i x2 = _mm512_xor_si512(_mm512_loadu_si512(a + i + 128),
+                                  _mm512_loadu_si512(b + i + 128));
+    __m512i x3 = _mm512_xor_si512(_mm512_loadu_si512(a + i + 192),
+                                  _mm512_loadu_si512(b + i + 192));
+    __m512i o  = _mm512_or_si512(_mm512_or_si512(x0, x1),
+                                 _mm512_or_si512(x2, x3));
+    if (_mm512_test_epi64_mask(o, o))
+      return 1;
+  }
+  for (; i + 64 <= len; i += 64)
+  {
+    __m512i x = _mm512_xor_si512(_mm512_loadu_si512(a + i),
+                                 _mm512_loadu_si512(b + i));
+    if (_mm512_test_epi64_mask(x, x))
+      return 1;
+  }
+  return i < len ? nfr_DiffAVX2(a + i, b + i, len - i) : 0;
+}
+
+#endif
+
+/**
+ * @brief Select the comparison function for the requested instruction set.
+ */
+static NFR_DiffFn nfr_DiffSelect(uint8_t simd)
+{
+#if NFR_DIFF_X86
+  __builtin_cpu_init();
+  if (simd == NFR_DIFF_SIMD_AUTO)
+    simd = NFR_DIFF_SIMD_AVX512;
+  if (simd >= NFR_DIFF_SIMD_AVX512 && __builtin_cpu_supports("avx512f"))
+    return nfr_DiffAVX512;
+  if (simd >= NFR_DIFF_SIMD_AVX2 && __builtin_cpu_supports("avx2"))
+    return nfr_DiffAVX2;
+  if (simd >= NFR_DIFF_SIMD_SSE2 && __builtin_cpu_supports("sse2"))
+    return nfr_DiffSSE2;
+#endif
+  (void) simd;
+  return nfr_DiffScalar;
+}
+
+// Compare one row of tiles; task function for the thread pool
+static void nfr_DiffTileRow(void * arg, uint32_t ty)
+{
+  struct NFRHostDiff * diff = arg;
+  const struct NFRDiffOpts * opts = &diff->opts;
+
+  uint32_t y0 = ty * opts->tileSize;
+  uint32_t y1 = y0 + opts->tileSize;
+  if (y1 > opts->height)
+    y1 = opts->height;
+
+  uint8_t * dirty     = diff->dirty + (size_t) ty * diff->tilesX;
+  uint32_t  tileBytes = opts->tileSize * opts->bpp;
+  uint32_t  remaining = diff->tilesX;
+  memset(dirty, 0, diff->tilesX);
+
+  for (uint32_t y = y0; y < y1 && remaining; ++y)
+  {
+    const uint8_t * a = diff->frame + (uint64_t) y * opts->pitch;
+    const uint8_t * b = diff->ref + (uint64_t) y * opts->pitch;
+    for (uint32_t tx = 0; tx < diff->tilesX; ++tx)
+    {
+      if (dirty[tx])
+        continue;
+      uint32_t x   = tx * tileBytes;
+      uint32_t len = diff->rowBytes - x < tileBytes ? diff->rowBytes - x
+                                                    : tileBytes;
+      if (diff->differs(a + x, b + x, len))
+      {
+        dirty[tx] = 1;
+        --remaining;
+      }
+    }
+  }
+}
+
+// Create a range covering tiles [tx0, tx1) of tile rows [ty0, ty1)
+static struct NFRWriteRange nfr_DiffTileRange(struct NFRHostDiff * diff,
+                                              uint32_t tx0, uint32_t tx1,
+                                              uint32_t ty0, uint32_t ty1)
+{
+  const struct NFRDiffOpts * opts = &diff->opts;
+  uint32_t x0 = tx0 * opts->tileSize;
+  uint32_t x1 = tx1 * opts->tileSize;
+  uint32_t y0 = ty0 * opts->tileSize;
+  uint32_t y1 = ty1 * opts->tileSize;
+  if (x1 > opts->width)
+    x1 = opts->width;
+  if (y1 > opts->height)
+    y1 = opts->height;
+
+  uint64_t offset = (uint64_t) y0 * opts->pitch + (uint64_t) x0 * opts->bpp;
+  struct NFRWriteRange r;
+  r.localOffset  = offset;
+  r.remoteOffset = offset;
+  r.length       = (x1 - x0) * opts->bpp;
+  r.rows         = y1 - y0;
+  r.localPitch   = opts->pitch;
+  r.remotePitch  = opts->pitch;
+  return r;
+}
+
+// Create a single range covering the entire frame
+static struct NFRWriteRange nfr_DiffFullRange(struct NFRHostDiff * diff)
+{
+  struct NFRWriteRange r = {0};
+  r.length      = diff->frameSize;
+  r.rows        = 1;
+  r.localPitch  = diff->frameSize;
+  r.remotePitch = diff->frameSize;
+  return r;
+}
+
+/**
+ * @brief Convert the dirty tiles into ranges.
+ *
+ * Horizontal runs of dirty tiles become one range each, and runs spanning the
+ * same columns in consecutive tile rows are merged. If this results in too
+ * many ranges, each tile row is reduced to a single run covering all of its
+ * dirty tiles. If there are still too many, -E2BIG is returned.
+ *
+ * @param coarse  Whether to use a single run per tile row
+ */
+static int nfr_DiffBuildRanges(struct NFRHostDiff * diff,
+                               struct NFRWriteRange * ranges,
+                               uint32_t maxRanges, int coarse)
+{
+  const struct NFRDiffOpts * opts = &diff->opts;
+  uint32_t count = 0;
+  for (uint32_t ty = 0; ty < diff->tilesY; ++ty)
+  {
+    const uint8_t * dirty = diff->dirty + (size_t) ty * diff->tilesX;
+    uint32_t tx = 0;
+    while (tx < diff->tilesX)
+    {
+      if (!dirty[tx])
+      {
+        ++tx;
+        continue;
+      }
+
+      uint32_t tx0 = tx, tx1 = tx;
+      while (tx1 < diff->tilesX && dirty[tx1])
+        ++tx1;
+      if (coarse)
+      {
+        for (uint32_t i = tx1; i < diff->tilesX; ++i)
+        {
+          if (dirty[i])
+            tx1 = i + 1;
+        }
+      }
+      tx = tx1;
+
+      // Extend a range ending right above with the same columns
+      struct NFRWriteRange r = nfr_DiffTileRange(diff, tx0, tx1, ty, ty + 1);
+      uint64_t y0 = r.localOffset / opts->pitch;
+      int merged = 0;
+      for (uint32_t i = 0; i < count && !merged; ++i)
+      {
+        if (ranges[i].length == r.length
+            && ranges[i].localOffset % opts->pitch 
+               == r.localOffset % opts->pitch
+            && ranges[i].localOffset / opts->pitch + ranges[i].rows == y0)
+        {
+          ranges[i].rows += r.rows;
+          merged = 1;
+        }
+      }
+      if (merged)
+        continue;
+
+      if (count == maxRanges)
+        return -E2BIG;
+      ranges[count++] = r;
+    }
+  }
+  return count;
+}
+
+/**
+ * @brief Compare a frame against a shadow copy and compute the changed ranges.
+ *
+ * @return The number of ranges, or a negative error code
+ */
+static int nfr_DiffCompute(struct NFRHostDiff * diff, int index,
+                           const uint8_t * frame, struct NFRWriteRange * ranges,
+                           uint32_t maxRanges)
+{
+  assert(diff->shadow[index]);
+  diff->frame = frame;
+  diff->ref   = diff->shadow[index];
+  nfr_ThreadPoolRun(diff->pool, nfr_DiffTileRow, diff, diff->tilesY);
+  diff->frame = 0;
+  diff->ref   = 0;
+
+  uint64_t dirtyTiles = 0;
+  uint64_t totalTiles = (uint64_t) diff->tilesX * diff->tilesY;
+  for (uint64_t i = 0; i < totalTiles; ++i)
+    dirtyTiles += diff->dirty[i];
+
+  if (!dirtyTiles)
+    return 0;
+
+  if (dirtyTiles * 100 >= totalTiles * NFR_DIFF_FULL_PERCENT)
+  {
+    ranges[0] = nfr_DiffFullRange(diff);
+    return 1;
+  }
+
+  int ret = nfr_DiffBuildRanges(diff, ranges, maxRanges, 0);
+  if (ret == -E2BIG)
+    ret = nfr_DiffBuildRanges(diff, ranges, maxRanges, 1);
+  if (ret == -E2BIG)
+  {
+    ranges[0] = nfr_DiffFullRange(diff);
+    ret = 1;
+  }
+  return ret;
+}
+
+// Copy the changed ranges of a frame into a shadow copy
+static void nfr_DiffApply(struct NFRHostDiff * diff, int index,
+                          const uint8_t * frame,
+                          const struct NFRWriteRange * ranges, uint32_t count)
+{
+  uint8_t * shadow = diff->shadow[index];
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    const struct NFRWriteRange * r = ranges + i;
+    for (uint32_t y = 0; y < r->rows; ++y)
+    {
+      uint64_t offset = r->remoteOffset + (uint64_t) y * r->remotePitch;
+      memcpy(shadow + offset, frame + offset, r->length);
+    }
+  }
+}
+
+// Check whether the shadow copy of a remote buffer matches its contents
+static int nfr_DiffShadowValid(struct NFRHostDiff * diff, int index)
+{
+  if (!diff->shadowValid[index])
+    return 0;
+  if (!diff->chan)
+    return 1;
+  struct NFRRemoteMemory * rmem = diff->chan->clientRegions + index;
+  return rmem->writeSerial && rmem->writeSerial == diff->shadowSerial[index];
+}
+
+// Allocate the shadow copy of a buffer if necessary
+static int nfr_DiffShadowAlloc(struct NFRHostDiff * diff, int index)
+{
+  if (diff->shadow[index])
+    return 0;
+  diff->shadow[index] = nfr_MemAllocAlign(diff->frameSize, 64);
+  if (!diff->shadow[index])
+    return -ENOMEM;
+  return 0;
+}
+
+// Record the frame as the contents of a shadow copy after a full write
+static void nfr_DiffStoreFull(struct NFRHostDiff * diff, int index,
+                              const uint8_t * frame)
+{
+  diff->shadowValid[index] = 0;
+  if (nfr_DiffShadowAlloc(diff, index) < 0)
+  {
+    NFR_LOG_WARNING("Failed to allocate shadow copy for buffer %d", index);
+    return;
+  }
+  memcpy(diff->shadow[index], frame, diff->frameSize);
+  diff->shadowValid[index] = 1;
+  if (diff->chan)
+    diff->shadowSerial[index] = diff->chan->clientRegions[index].writeSerial;
+}
+
+int nfrHostDiffCreate(PNFRHost host, int channelID,
+                      const struct NFRDiffOpts * opts, PNFRHostDiff * result)
+{
+  assert(opts);
+  assert(result);
+  if (!opts || !result || !opts->width || !opts->height || !opts->bpp
+      || opts->simd >= NFR_DIFF_SIMD_MAX)
+    return -EINVAL;
+  if (host && (channelID < 0 || channelID >= NETFR_NUM_CHANNELS))
+    return -EINVAL;
+
+  struct NFRHostDiff * diff = calloc(1, sizeof(*diff));
+  if (!diff)
+    return -ENOMEM;
+
+  diff->opts = *opts;
+  if (!diff->opts.pitch)
+    diff->opts.pitch = opts->width * opts->bpp;
+  if (!diff->opts.tileSize)
+    diff->opts.tileSize = NETFR_DIFF_DEFAULT_TILE_SIZE;
+
+  diff->rowBytes  = opts->width * opts->bpp;
+  diff->frameSize = (uint64_t) diff->opts.pitch * opts->height;
+  diff->tilesX    = (opts->width + diff->opts.tileSize - 1) / diff->opts.tileSize;
+  diff->tilesY    = (opts->height + diff->opts.tileSize - 1) 
+                    / diff->opts.tileSize;
+  diff->differs   = nfr_DiffSelect(opts->simd);
+  diff->chan      = host ? host->channels + channelID : 0;
+
+  int ret;
+  if (diff->opts.pitch < diff->rowBytes || diff->frameSize > UINT32_MAX)
+  {
+    ret = -EINVAL;
+    goto freeDiff;
+  }
+
+  diff->dirty = calloc((size_t) diff->tilesX * diff->tilesY, 1);
+  if (!diff->dirty)
+  {
+    ret = -ENOMEM;
+    goto freeDiff;
+  }
+
+  uint32_t threads = diff->opts.threads;
+  if (!threads)
+  {
+    threads = 1;
+    if (diff->frameSize >= NFR_DIFF_MT_MIN_SIZE)
+      threads = nfr_GetCpuCount() / 2;
+    if (threads > 4)
+      threads = 4;
+  }
+  if (threads > diff->tilesY)
+    threads = diff->tilesY;
+
+  if (threads > 1)
+  {
+    ret = nfr_ThreadPoolCreate(threads, &diff->pool);
+    if (ret < 0)
+      NFR_LOG_DEBUG("Thread pool unavailable (%d), comparing on one thread",
+                    ret);
+  }
+
+  *result = diff;
+  return 0;
+
+freeDiff:
+  nfrHostDiffFree(&diff);
+  return ret;
+}
+
+int nfrHostDiffUpdate(PNFRHostDiff diff, int index, const void * frame,
+                      struct NFRWriteRange * ranges, uint32_t maxRanges)
+{
+  assert(diff);
+  assert(frame);
+  assert(ranges);
+  if (!diff || !frame || !ranges || !maxRanges
+      || index < 0 || index >= NETFR_MAX_MEM_REGIONS)
+    return -EINVAL;
+
+  if (!nfr_DiffShadowValid(diff, index))
+  {
+    nfr_DiffStoreFull(diff, index, frame);
+    if (!diff->shadowValid[index])
+      return -ENOMEM;
+    ranges[0] = nfr_DiffFullRange(diff);
+    return 1;
+  }
+
+  int ret = nfr_DiffCompute(diff, index, frame, ranges, maxRanges);
+  if (ret > 0)
+    nfr_DiffApply(diff, index, frame, ranges, ret);
+  return ret;
+}
+
+int nfrHostDiffWrite(PNFRHostDiff diff, PNFRMemory localMem,
+                     uint64_t localOffset, struct NFRCallbackInfo * cbInfo)
+{
+  assert(diff);
+  assert(localMem);
+  if (!diff || !diff->chan || !localMem)
+    return -EINVAL;
+  if (localMem->parentResource != diff->chan->res
+      || localOffset + diff->frameSize > localMem->size)
+    return -EINVAL;
+
+  struct NFRHostChannel * chan = diff->chan;
+  const uint8_t * frame = (const uint8_t *) localMem->addr + localOffset;
+
+  // Update the available buffer holding the most recent frame
+  int best = -1;
+  for (int i = 0; i < NETFR_MAX_MEM_REGIONS; ++i)
+  {
+    struct NFRRemoteMemory * rmem = chan->clientRegions + i;
+    if (rmem->state != NFR_RMEM_AVAILABLE || rmem->size < diff->frameSize
+        || !nfr_DiffShadowValid(diff, i))
+      continue;
+    if (best < 0 
+        || (int32_t) (rmem->writeSerial 
+                      - chan->clientRegions[best].writeSerial) > 0)
+      best = i;
+  }
+
+  int ret;
+  if (best >= 0)
+  {
+    struct NFRWriteRange ranges[NETFR_MAX_WRITE_RANGES];
+    int count = nfr_DiffCompute(diff, best, frame, ranges,
+                                NETFR_MAX_WRITE_RANGES);
+    if (count < 0)
+      return count;
+
+    if (count != 1 || ranges[0].length != diff->frameSize)
+    {
+      for (int i = 0; i < count; ++i)
+        ranges[i].localOffset += localOffset;
+
+      ret = nfrHostWriteBufferRanges(localMem, ranges, count, best, cbInfo);
+      if (ret >= 0)
+      {
+        for (int i = 0; i < count; ++i)
+          ranges[i].localOffset -= localOffset;
+        nfr_DiffApply(diff, best, frame, ranges, count);
+        diff->shadowSerial[best] = chan->clientRegions[best].writeSerial;
+        return ret;
+      }
+      if (ret != -E2BIG && ret != -ESTALE)
+        return ret;
+      NFR_LOG_DEBUG("Partial write failed (%d), writing entire frame", ret);
+    }
+  }
+
+  ret = nfrHostWriteBuffer(localMem, localOffset, 0, diff->frameSize, cbInfo);
+  if (ret < 0)
+    return ret;
+
+  nfr_DiffStoreFull(diff, ret, frame);
+  return ret;
+}
+
+void nfrHostDiffInvalidate(PNFRHostDiff diff, int index)
+{
+  assert(diff);
+  assert(index >= -1 && index < NETFR_MAX_MEM_REGIONS);
+  if (!diff)
+    return;
+
+  if (index < 0)
+    memset(diff->shadowValid, 0, sizeof(diff->shadowValid));
+  else if (index < NETFR_MAX_MEM_REGIONS)
+    diff->shadowValid[index] = 0;
+}
+
+void nfrHostDiffFree(PNFRHostDiff * diff)
+{
+  if (!diff || !*diff)
+    return;
+
+  struct NFRHostDiff * d = *diff;
+  nfr_ThreadPoolFree(&d->pool);
+  for (int i = 0; i < NETFR_MAX_MEM_REGIONS; ++i)
+  {
+    if (d->shadow[i])
+      nfr_MemFreeAlign(d->shadow[i]);
+  }
+  free(d->dirty);
+  free(d);
+  *diff = 0;
+}
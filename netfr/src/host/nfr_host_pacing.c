@@ -0,0 +1,350 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* Write pacing and link estimation */
+
+#include <string.h>
+#include <errno.h>
+
+#include "netfr/netfr_host.h"
+#include "host/nfr_host.h"
+
+#include "common/nfr.h"
+#include "common/nfr_log.h"
+
+/* Pacing gain applied to the estimated bandwidth with NETFR_PACING_AUTO, in
+   percent. Pacing slightly above the estimate lets the estimate grow when more
+   bandwidth becomes available. */
+#define NFR_PACING_AUTO_GAIN 125
+
+static uint64_t nfr_HostLinkBandwidth(const struct NFRHostLinkEstimator * est)
+{
+  uint64_t bw = 0;
+  for (int i = 0; i < NFR_LINK_BW_WINDOW; ++i)
+  {
+    if (est->bwSamples[i] > bw)
+      bw = est->bwSamples[i];
+  }
+  return bw;
+}
+
+static void nfr_HostLinkRtt(struct NFRHostLinkEstimator * est, uint64_t rtt)
+{
+  est->srtt = est->srtt ? (est->srtt * 7 + rtt) / 8 : rtt;
+  if (!est->minRtt || rtt < est->minRtt)
+    est->minRtt = rtt;
+}
+
+/**
+ * @brief Sample the link using a completed write.
+ *
+ * The delivery rate is measured from the later of the post time and the
+ * previous completion, as the write could not have made progress while the
+ * link was busy with earlier writes. Writes posted to an idle link also
+ * provide an RTT sample, once their serialization time is subtracted.
+ *
+ * @param est       Estimator
+ *
+ * @param bytes     Bytes transferred
+ *
+ * @param postTime  Time the write was posted
+ *
+ * @param idle      Whether no other writes were in progress when posted
+ *
+ * @param now       Completion time
+ */
+static void nfr_HostLinkSample(struct NFRHostLinkEstimator * est,
+                               uint64_t bytes, uint64_t postTime, int idle,
+                               uint64_t now)
+{
+  uint64_t start = postTime > est->lastCompletion ? postTime
+                                                  : est->lastCompletion;
+  if (bytes && now > start)
+  {
+    est->bwSamples[est->bwIndex++ % NFR_LINK_BW_WINDOW] = \
+      (uint64_t) ((double) bytes * 1e9 / (double) (now - start));
+  }
+
+  uint64_t bw = nfr_HostLinkBandwidth(est);
+  if (idle && bw && now > postTime)
+  {
+    uint64_t latency = now - postTime;
+    uint64_t serial  = (uint64_t) ((double) bytes * 1e9 / (double) bw);
+    if (latency > serial)
+      nfr_HostLinkRtt(est, latency - serial);
+  }
+
+  est->lastCompletion = now;
+}
+
+static uint64_t nfr_HostPacingSegment(const struct NFRHostPacing * p)
+{
+  return p->burst < NFR_PACING_SEGMENT_SIZE ? p->burst
+                                            : NFR_PACING_SEGMENT_SIZE;
+}
+
+static void nfr_HostPacingRefill(struct NFRHostPacing * p, uint64_t rate,
+                                 uint64_t now)
+{
+  if (!rate || now <= p->lastRefill)
+  {
+    p->lastRefill = now;
+    return;
+  }
+
+  // Keep the remainder for the next refill at low rates
+  double add = (double) rate * (double) (now - p->lastRefill) / 1e9;
+  if (add < 1.0)
+    return;
+
+  if (add >= (double) p->burst || p->tokens + (int64_t) add > (int64_t) p->burst)
+    p->tokens = (int64_t) p->burst;
+  else
+    p->tokens += (int64_t) add;
+  p->lastRefill = now;
+}
+
+/**
+ * @brief Sample the segments of the paced write which have completed.
+ *
+ * The segments complete in order, and the number still outstanding is given by
+ * the references held on the write context.
+ *
+ * @param chan      Channel
+ *
+ * @param now       Current time
+ *
+ * @param all       Whether the write itself has completed, i.e., every
+ *                  segment posted has completed
+ *
+ * @param canceled  Whether the write was canceled, in which case the link is
+ *                  not sampled
+ */
+static void nfr_HostPacingReap(struct NFRHostChannel * chan, uint64_t now,
+                               int all, int canceled)
+{
+  struct NFRHostPacing * p = &chan->pacing;
+  struct NFRHostLinkEstimator * est = &chan->link;
+
+  uint32_t posted = p->segHead - p->segTail;
+  uint32_t outstanding = 0;
+  if (!all)
+  {
+    // The write context holds an extra reference until the last segment
+    outstanding = p->write.wctx->pending;
+    if (p->write.nctx && outstanding)
+      --outstanding;
+    if (outstanding > posted)
+      outstanding = posted;
+  }
+
+  uint32_t completed = posted - outstanding;
+  if (!completed)
+    return;
+
+  uint64_t bytes = 0;
+  uint64_t first = p->segTime[p->segTail % NFR_PACING_MAX_SEGMENTS];
+  int idle = p->segIdle[p->segTail % NFR_PACING_MAX_SEGMENTS];
+  for (uint32_t i = 0; i < completed; ++i, ++p->segTail)
+    bytes += p->segLength[p->segTail % NFR_PACING_MAX_SEGMENTS];
+
+  est->outstanding = est->outstanding > completed ? est->outstanding - completed
+                                                  : 0;
+  est->queuedBytes = est->queuedBytes > bytes ? est->queuedBytes - bytes : 0;
+  if (!canceled)
+    nfr_HostLinkSample(est, bytes, first, idle, now);
+}
+
+uint64_t nfr_HostPacingRate(struct NFRHostChannel * chan)
+{
+  const struct NFRHostPacing * p = &chan->pacing;
+  if (p->rate != NETFR_PACING_AUTO)
+    return p->rate;
+
+  uint64_t bw = nfr_HostLinkBandwidth(&chan->link);
+  return bw / 100 * NFR_PACING_AUTO_GAIN;
+}
+
+int nfr_HostPacingCheck(struct NFRHostChannel * chan, uint64_t length)
+{
+  struct NFRHostPacing * p = &chan->pacing;
+  uint64_t rate = nfr_HostPacingRate(chan);
+  if (!rate)
+    return 0;
+
+  nfr_HostPacingRefill(p, rate, nfr_GetTimeNs());
+  int paced = length > nfr_HostPacingSegment(p)
+              || p->tokens < (int64_t) length;
+
+  /* Only one write at a time is posted in segments. Writes which fit into the
+     tokens are posted alongside it and charged to the same bucket. */
+  if (paced && p->active)
+    return -EAGAIN;
+  return paced;
+}
+
+int nfr_HostPacingAdvance(struct NFRHostChannel * chan)
+{
+  struct NFRHostPacing * p = &chan->pacing;
+  if (!p->active)
+    return 0;
+
+  uint64_t now  = nfr_GetTimeNs();
+  uint64_t rate = nfr_HostPacingRate(chan);
+  nfr_HostPacingRefill(p, rate, now);
+  nfr_HostPacingReap(chan, now, 0, 0);
+
+  uint64_t segment = nfr_HostPacingSegment(p);
+  while (p->write.nctx && (!rate || p->tokens > 0)
+         && p->segHead - p->segTail < NFR_PACING_MAX_SEGMENTS)
+  {
+    uint64_t length = p->write.length - p->write.done;
+    if (length > segment)
+      length = segment;
+
+    int idle = !chan->link.outstanding;
+    ssize_t ret = nfr_PostWriteSegment(&p->write, length);
+    if (ret == -EAGAIN)
+      break;
+    if (ret < 0)
+      return (int) ret;
+
+    p->segTime[p->segHead % NFR_PACING_MAX_SEGMENTS]   = now;
+    p->segLength[p->segHead % NFR_PACING_MAX_SEGMENTS] = length;
+    p->segIdle[p->segHead % NFR_PACING_MAX_SEGMENTS]   = idle;
+    ++p->segHead;
+    ++chan->link.outstanding;
+    if (rate)
+      p->tokens -= (int64_t) length;
+  }
+
+  return 0;
+}
+
+void nfr_HostLinkWritePosted(struct NFRHostChannel * chan, int index,
+                             uint64_t bytes, int paced)
+{
+  assert(index >= 0 && index < NETFR_MAX_MEM_REGIONS);
+  struct NFRHostLinkEstimator * est = &chan->link;
+  uint64_t now = nfr_GetTimeNs();
+
+  est->postTime[index]  = now;
+  est->postBytes[index] = bytes;
+  est->postIdle[index]  = !est->outstanding;
+  est->queuedBytes     += bytes;
+
+  // The segments are recorded and charged as they are posted
+  if (paced)
+  {
+    chan->pacing.active  = 1;
+    chan->pacing.segHead = 0;
+    chan->pacing.segTail = 0;
+    return;
+  }
+
+  ++est->outstanding;
+  uint64_t rate = nfr_HostPacingRate(chan);
+  if (rate)
+  {
+    nfr_HostPacingRefill(&chan->pacing, rate, now);
+    chan->pacing.tokens -= (int64_t) bytes;
+  }
+}
+
+void nfr_HostLinkWriteDone(struct NFRHostChannel * chan,
+                           struct NFRFabricContext * ctx, int index,
+                           int canceled)
+{
+  assert(index >= 0 && index < NETFR_MAX_MEM_REGIONS);
+  struct NFRHostPacing * p = &chan->pacing;
+  struct NFRHostLinkEstimator * est = &chan->link;
+  uint64_t now = nfr_GetTimeNs();
+
+  if (p->active && p->write.wctx == ctx)
+  {
+    nfr_HostPacingReap(chan, now, 1, canceled);
+
+    // Segments which were never posted
+    uint64_t rest = p->write.length - p->write.done;
+    est->queuedBytes = est->queuedBytes > rest ? est->queuedBytes - rest : 0;
+    p->write.wctx = 0;
+    p->write.nctx = 0;
+    p->active     = 0;
+    return;
+  }
+
+  uint64_t bytes   = est->postBytes[index];
+  est->outstanding = est->outstanding ? est->outstanding - 1 : 0;
+  est->queuedBytes = est->queuedBytes > bytes ? est->queuedBytes - bytes : 0;
+  if (!canceled)
+    nfr_HostLinkSample(est, bytes, est->postTime[index], est->postIdle[index],
+                       now);
+}
+
+void nfr_HostLinkDataAck(struct NFRHostChannel * chan, uint64_t rtt)
+{
+  /* Messages are only acknowledged once the client application has read
+     them, so the round trip is an upper bound of the RTT and only used for
+     the minimum */
+  struct NFRHostLinkEstimator * est = &chan->link;
+  if (rtt && (!est->minRtt || rtt < est->minRtt))
+    est->minRtt = rtt;
+}
+
+int nfrHostSetPacing(PNFRHost host, int channelID, uint64_t rate,
+                     uint64_t burst)
+{
+  assert(host);
+  if (!host || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
+
+  if (!burst)
+    burst = NETFR_PACING_DEFAULT_BURST;
+  if (burst > INT64_MAX)
+    return -EINVAL;
+
+  struct NFRHostPacing * p = &host->channels[channelID].pacing;
+  p->rate       = rate;
+  p->burst      = burst;
+  p->tokens     = (int64_t) burst;
+  p->lastRefill = nfr_GetTimeNs();
+  return 0;
+}
+
+int nfrHostGetLinkEstimate(PNFRHost host, int channelID,
+                           struct NFRLinkEstimate * est)
+{
+  assert(host);
+  assert(est);
+  if (!host || !est || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
+
+  struct NFRHostChannel * chan = host->channels + channelID;
+  memset(est, 0, sizeof(*est));
+  est->bandwidth   = nfr_HostLinkBandwidth(&chan->link);
+  est->rtt         = chan->link.srtt;
+  est->minRtt      = chan->link.minRtt;
+  est->queuedBytes = chan->link.queuedBytes;
+  est->pacingRate  = nfr_HostPacingRate(chan);
+  if (est->bandwidth)
+    est->queueDelay = (uint64_t) ((double) est->queuedBytes * 1e9 
+                                  / (double) est->bandwidth);
+  return 0;
+}
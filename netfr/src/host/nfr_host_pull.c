@@ -0,0 +1,170 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* Frames pulled by the client */
+
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+#include "netfr/netfr_host.h"
+#include "host/nfr_host.h"
+
+#include "common/nfr.h"
+#include "common/nfr_log.h"
+#include "common/nfr_mem.h"
+
+/**
+ * @brief Completion of a descriptor send. A canceled descriptor is sent again
+ *        unless a newer one is pending anyway.
+ */
+static void nfr_HostPullSent(struct NFRFabricContext * ctx)
+{
+  ASSERT_CONTEXT_VALID(ctx);
+  NFR_CAST_UDATA(struct NFRHostChannel *, chan, ctx, 0);
+  chan->pull.inFlight = 0;
+  if (ctx->state == CTX_STATE_CANCELED)
+    chan->pull.pending = 1;
+}
+
+/**
+ * @brief Set the generation of a local region, which the client reads after
+ *        the frame to detect an overwrite.
+ */
+static void nfr_HostPullSetGeneration(struct NFRHostPull * pull, uint8_t index,
+                                      uint64_t generation)
+{
+  _Atomic(uint64_t) * gen = (_Atomic(uint64_t) *) pull->gens->addr + index;
+  atomic_store_explicit(gen, generation, memory_order_seq_cst);
+}
+
+int nfr_HostPullFlush(struct NFRHostChannel * chan)
+{
+  struct NFRHostPull * pull = &chan->pull;
+  if (!pull->pending || pull->inFlight
+      || !(chan->res->features & NFR_FEATURE_PULL))
+    return 0;
+
+  struct NFR_CallbackInfo cbInfo = {0};
+  cbInfo.callback = nfr_HostPullSent;
+  cbInfo.uData[0] = chan;
+
+  struct NFR_TransferInfo ti = {0};
+  ti.opType = NFR_OP_SEND_COPY;
+  ti.data   = &pull->desc;
+  ti.cbInfo = &cbInfo;
+  ti.length = sizeof(pull->desc);
+
+  ssize_t ret = nfr_PostTransfer(chan->res, &ti);
+  if (ret < 0)
+    return ret == -EAGAIN ? 0 : (int) ret;
+
+  pull->pending  = 0;
+  pull->inFlight = 1;
+  return 0;
+}
+
+void nfr_HostPullReset(struct NFRHostChannel * chan)
+{
+  struct NFRHostPull * pull = &chan->pull;
+  pull->inFlight = 0;
+  pull->pending  = pull->desc.generation != 0;
+}
+
+int nfrHostPublishFrame(PNFRMemory localMem, uint64_t offset, uint64_t length,
+                        uint64_t udata)
+{
+  assert(localMem);
+  if (!localMem || !length || offset + length > localMem->size)
+    return -EINVAL;
+
+  struct NFRResource * res = localMem->parentResource;
+  struct NFRHost * host = (struct NFRHost *) res->parentTopLevel;
+  struct NFRHostChannel * chan = 0;
+  for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
+  {
+    if (host->channels[i].res == res)
+      chan = host->channels + i;
+  }
+  if (!chan)
+    return -EINVAL;
+  if (!(res->offeredFeatures & NFR_FEATURE_PULL))
+    return -ENOTSUP;
+
+  struct NFRHostPull * pull = &chan->pull;
+  if (!pull->gens)
+  {
+    uint64_t size = NETFR_MAX_MEM_REGIONS * sizeof(uint64_t);
+    pull->gens = nfr_RdmaAlloc(res, size, FI_READ | FI_WRITE | FI_REMOTE_READ,
+                               MEM_STATE_AVAILABLE);
+    if (!pull->gens)
+      return -ENOMEM;
+    memset(pull->gens->addr, 0, size);
+  }
+
+  /* The replaced frame may be overwritten from now on, so reads of it which
+     are still in progress must fail the check */
+  if (pull->desc.generation && pull->region != localMem->index)
+    nfr_HostPullSetGeneration(pull, pull->region, ++pull->generation);
+
+  uint64_t generation = ++pull->generation;
+  nfr_HostPullSetGeneration(pull, localMem->index, generation);
+  pull->region = localMem->index;
+
+  struct NFRMsgFrameDesc * desc = &pull->desc;
+  memset(desc, 0, sizeof(*desc));
+  nfr_SetHeader(&desc->header, NFR_MSG_FRAME_DESC);
+  desc->addr       = (uintptr_t) localMem->addr + offset;
+  desc->rkey       = fi_mr_key(localMem->mr);
+  desc->length     = length;
+  desc->genAddr    = (uintptr_t) pull->gens->addr
+                     + localMem->index * sizeof(uint64_t);
+  desc->genKey     = fi_mr_key(pull->gens->mr);
+  desc->generation = generation;
+  desc->udata      = udata;
+  pull->pending    = 1;
+
+  // Only the newest descriptor matters, so it waits for the previous send
+  if (!res->ep)
+    return 0;
+  return nfr_HostPullFlush(chan);
+}
+
+int nfrHostInvalidateFrame(PNFRMemory localMem)
+{
+  assert(localMem);
+  if (!localMem)
+    return -EINVAL;
+
+  struct NFRResource * res = localMem->parentResource;
+  struct NFRHost * host = (struct NFRHost *) res->parentTopLevel;
+  for (int i = 0; i < NETFR_NUM_CHANNELS; ++i)
+  {
+    struct NFRHostPull * pull = &host->channels[i].pull;
+    if (host->channels[i].res != res)
+      continue;
+    // Reads of a frame in the region started before now fail the check
+    if (pull->gens)
+      nfr_HostPullSetGeneration(pull, localMem->index, ++pull->generation);
+    return 0;
+  }
+
+  return -EINVAL;
+}
@@ -0,0 +1,176 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* Latest value registers */
+
+#include <string.h>
+#include <errno.h>
+
+#include "netfr/netfr_host.h"
+#include "host/nfr_host.h"
+
+#include "common/nfr.h"
+#include "common/nfr_log.h"
+#include "common/nfr_protocol.h"
+
+/**
+ * @brief Completion of a register write. A canceled write is repeated with the
+ *        latest value, unless a newer value is pending anyway.
+ */
+static void nfr_HostRegisterWritten(struct NFRFabricContext * ctx)
+{
+  ASSERT_CONTEXT_VALID(ctx);
+  NFR_CAST_UDATA(struct NFRHostChannel *, chan, ctx, 0);
+  NFR_CAST_UDATA_NUM(uint8_t, index, ctx, 1);
+  assert(index < NETFR_MAX_REGISTERS);
+
+  struct NFRHostRegister * reg = chan->registers.regs + index;
+  reg->inFlight = 0;
+  if (ctx->state == CTX_STATE_CANCELED)
+    reg->pending = 1;
+}
+
+/**
+ * @brief Write the value of a register, seq and seqEnd included, with a single
+ *        RDMA write.
+ *
+ * @return 0 on success, -EAGAIN if no context is available, or another
+ *         negative error code
+ */
+static int nfr_HostRegisterPost(struct NFRHostChannel * chan, uint8_t index)
+{
+  struct NFRHostRegisters * regs = &chan->registers;
+  struct NFRHostRegister * reg = regs->regs + index;
+  struct NFRResource * res = chan->res;
+  if (!res->ep)
+    return -ENOTCONN;
+
+  struct NFRFabricContext * ctx = nfr_ContextGet(res, NFR_OP_SEND, 0);
+  if (!ctx)
+    return -EAGAIN;
+
+  // A register which was never written has a sequence number of 0
+  if (++reg->seq == 0)
+    ++reg->seq;
+
+  struct NFRRegister * slot = (struct NFRRegister *) ctx->slot->data;
+  memset(slot, 0, sizeof(*slot));
+  slot->seq    = reg->seq;
+  slot->length = reg->length;
+  memcpy(slot->data, reg->data, reg->length);
+  slot->seqEnd = reg->seq;
+
+  struct iovec iov;
+  iov.iov_base = slot;
+  iov.iov_len  = sizeof(*slot);
+
+  struct fi_rma_iov rmaIov;
+  rmaIov.addr = regs->remoteAddr + (uint64_t) index * NETFR_REGISTER_SIZE;
+  rmaIov.len  = sizeof(*slot);
+  rmaIov.key  = regs->remoteKey;
+
+  void * desc = fi_mr_desc(res->commBuf.memRegion->mr);
+  struct fi_msg_rma msg = {0};
+  msg.msg_iov       = &iov;
+  msg.desc          = &desc;
+  msg.iov_count     = 1;
+  msg.rma_iov       = &rmaIov;
+  msg.rma_iov_count = 1;
+  msg.context       = ctx;
+
+  memset(&ctx->cbInfo, 0, sizeof(ctx->cbInfo));
+  ctx->cbInfo.callback = nfr_HostRegisterWritten;
+  ctx->cbInfo.uData[0] = chan;
+  ctx->cbInfo.uData[1] = (void *) (uintptr_t) index;
+  ctx->txSeq = nfr_ResourceNextTxSeq(res);
+  ssize_t ret = fi_writemsg(res->ep, &msg, FI_COMPLETION);
+  if (ret < 0)
+  {
+    if (ret != -FI_EAGAIN)
+      NFR_LOG_DEBUG("Failed to post register write: %s (%d)",
+                    fi_strerror((int) -ret), (int) ret);
+    NFR_RESET_CONTEXT(ctx);
+    return ret == -FI_EAGAIN ? -EAGAIN : (int) ret;
+  }
+
+  ctx->state    = CTX_STATE_WAITING;
+  ctx->pending  = 1;
+  reg->pending  = 0;
+  reg->inFlight = 1;
+  ++res->stats.writesPosted;
+  res->stats.bytesWritten += iov.iov_len;
+  return 0;
+}
+
+int nfr_HostRegisterFlush(struct NFRHostChannel * chan)
+{
+  struct NFRHostRegisters * regs = &chan->registers;
+  for (uint8_t i = 0; i < regs->count; ++i)
+  {
+    struct NFRHostRegister * reg = regs->regs + i;
+    if (!reg->pending || reg->inFlight)
+      continue;
+    int ret = nfr_HostRegisterPost(chan, i);
+    if (ret < 0)
+      return ret;
+  }
+  return 0;
+}
+
+void nfr_HostRegisterReset(struct NFRHostChannel * chan)
+{
+  struct NFRHostRegisters * regs = &chan->registers;
+  regs->remoteAddr = 0;
+  regs->remoteKey  = 0;
+  regs->count      = 0;
+  for (int i = 0; i < NETFR_MAX_REGISTERS; ++i)
+  {
+    regs->regs[i].inFlight = 0;
+    if (regs->regs[i].seq)
+      regs->regs[i].pending = 1;
+  }
+}
+
+int nfrHostWriteRegister(PNFRHost host, int channelID, uint8_t index,
+                         const void * data, uint32_t length)
+{
+  assert(host);
+  if (!host || channelID < 0 || channelID >= NETFR_NUM_CHANNELS
+      || index >= NETFR_MAX_REGISTERS || (!data && length)
+      || length > NETFR_REGISTER_MAX_PAYLOAD)
+    return -EINVAL;
+
+  struct NFRHostChannel * chan = host->channels + channelID;
+  if (!chan->res || !(chan->res->offeredFeatures & NFR_FEATURE_REGISTERS))
+    return -ENOTSUP;
+
+  struct NFRHostRegister * reg = chan->registers.regs + index;
+  if (length)
+    memcpy(reg->data, data, length);
+  reg->length  = length;
+  reg->pending = 1;
+
+  /* The value is written once the client has announced its registers and the
+     previous write of the register has completed */
+  if (index >= chan->registers.count || reg->inFlight)
+    return 0;
+  int ret = nfr_HostRegisterPost(chan, index);
+  return ret == -EAGAIN || ret == -ENOTCONN ? 0 : ret;
+}
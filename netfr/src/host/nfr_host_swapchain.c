@@ -0,0 +1,201 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* Swapchain of staging buffers written to the client */
+
+#include <string.h>
+#include <errno.h>
+
+#include "netfr/netfr_host.h"
+#include "host/nfr_host.h"
+
+#include "common/nfr_log.h"
+#include "common/nfr_mem.h"
+
+enum NFRSwapchainState
+{
+  NFR_SWAPCHAIN_FREE,
+  NFR_SWAPCHAIN_ACQUIRED,
+  NFR_SWAPCHAIN_PRESENTING,  // Write being posted, see nfrHostSwapchainPresent
+  NFR_SWAPCHAIN_IN_FLIGHT
+};
+
+struct NFRHostSwapchain
+{
+  struct NFRHostChannel * chan;
+  PNFRMemory              images[NETFR_MAX_SWAPCHAIN_IMAGES];
+  /* Order in which the images became free, so that they are reused in
+     turn */
+  uint64_t                freeSince[NETFR_MAX_SWAPCHAIN_IMAGES];
+  uint64_t                tick;
+  // Remote buffer of each image in flight; one write per buffer at a time
+  uint8_t                 remoteIndex[NETFR_MAX_SWAPCHAIN_IMAGES];
+  uint8_t                 state[NETFR_MAX_SWAPCHAIN_IMAGES];
+  uint32_t                count;
+};
+
+void nfr_HostSwapchainWriteDone(struct NFRHostChannel * chan, uint8_t index)
+{
+  struct NFRHostSwapchain * sc = chan->swapchain;
+  if (!sc)
+    return;
+
+  /* Compressed writes are reported with the channel's scratch buffer as the
+     source, so the image is found through the remote buffer instead */
+  for (uint32_t i = 0; i < sc->count; ++i)
+  {
+    // A write canceled while it is posted completes before its index is known
+    int presenting = sc->state[i] == NFR_SWAPCHAIN_PRESENTING
+                     && chan->lastPlaced == index;
+    if (presenting 
+        || (sc->state[i] == NFR_SWAPCHAIN_IN_FLIGHT
+            && sc->remoteIndex[i] == index))
+    {
+      sc->state[i]     = NFR_SWAPCHAIN_FREE;
+      sc->freeSince[i] = ++sc->tick;
+      return;
+    }
+  }
+}
+
+int nfrHostSwapchainCreate(PNFRHost host, int channelID, uint32_t count,
+                           uint64_t size, PNFRHostSwapchain * result)
+{
+  assert(host);
+  assert(result);
+  if (!host || !result || channelID < 0 || channelID >= NETFR_NUM_CHANNELS
+      || !count || count > NETFR_MAX_SWAPCHAIN_IMAGES || !size
+      || size > NETFR_MAX_BUFFER_SIZE)
+    return -EINVAL;
+
+  struct NFRHostChannel * chan = host->channels + channelID;
+  if (!chan->res)
+    return -EINVAL;
+  if (chan->swapchain)
+    return -EBUSY;
+
+  struct NFRHostSwapchain * sc = calloc(1, sizeof(*sc));
+  if (!sc)
+    return -ENOMEM;
+
+  sc->chan = chan;
+  uint64_t acs = FI_READ | FI_WRITE | FI_REMOTE_WRITE;
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    sc->images[i] = nfr_RdmaAlloc(chan->res, size, acs, MEM_STATE_AVAILABLE);
+    if (!sc->images[i])
+    {
+      NFR_LOG_ERROR("Failed to allocate swapchain image %u of %u", i, count);
+      sc->count = i;
+      nfrHostSwapchainFree(&sc);
+      return -ENOMEM;
+    }
+    // Large images are striped like any other write
+    nfr_RdmaAttachRails(sc->images[i], chan->rails, chan->railCount, acs);
+    sc->freeSince[i] = ++sc->tick;
+  }
+
+  sc->count       = count;
+  chan->swapchain = sc;
+  *result         = sc;
+  return 0;
+}
+
+int nfrHostSwapchainAcquire(PNFRHostSwapchain sc, void ** data)
+{
+  assert(sc);
+  assert(data);
+  if (!sc || !data)
+    return -EINVAL;
+
+  int oldest = -1;
+  for (uint32_t i = 0; i < sc->count; ++i)
+  {
+    if (sc->state[i] != NFR_SWAPCHAIN_FREE)
+      continue;
+    if (oldest < 0 || sc->freeSince[i] < sc->freeSince[oldest])
+      oldest = i;
+  }
+
+  if (oldest < 0)
+    return -EAGAIN;
+
+  sc->state[oldest] = NFR_SWAPCHAIN_ACQUIRED;
+  *data = sc->images[oldest]->addr;
+  return oldest;
+}
+
+int nfrHostSwapchainPresent(PNFRHostSwapchain sc, int index, uint64_t length,
+                            struct NFRCallbackInfo * cbInfo)
+{
+  assert(sc);
+  if (!sc || index < 0 || (uint32_t) index >= sc->count
+      || sc->state[index] != NFR_SWAPCHAIN_ACQUIRED
+      || !length || length > sc->images[index]->size)
+    return -EINVAL;
+
+  /* Write callbacks normally run from nfrHostProcess, but a paced write whose
+     first segment fails is canceled before nfrHostWriteBuffer returns */
+  sc->state[index] = NFR_SWAPCHAIN_PRESENTING;
+  int ret = nfrHostWriteBuffer(sc->images[index], 0, 0, length, cbInfo);
+  if (ret < 0)
+  {
+    if (sc->state[index] == NFR_SWAPCHAIN_PRESENTING)
+      sc->state[index] = NFR_SWAPCHAIN_ACQUIRED;
+    return ret;
+  }
+
+  if (sc->state[index] == NFR_SWAPCHAIN_PRESENTING)
+  {
+    sc->state[index]       = NFR_SWAPCHAIN_IN_FLIGHT;
+    sc->remoteIndex[index] = (uint8_t) ret;
+  }
+  return ret;
+}
+
+int nfrHostSwapchainRelease(PNFRHostSwapchain sc, int index)
+{
+  assert(sc);
+  if (!sc || index < 0 || (uint32_t) index >= sc->count
+      || sc->state[index] != NFR_SWAPCHAIN_ACQUIRED)
+    return -EINVAL;
+
+  sc->state[index]     = NFR_SWAPCHAIN_FREE;
+  sc->freeSince[index] = ++sc->tick;
+  return 0;
+}
+
+void nfrHostSwapchainFree(PNFRHostSwapchain * sc)
+{
+  if (!sc || !*sc)
+    return;
+
+  struct NFRHostSwapchain * s = *sc;
+  for (uint32_t i = 0; i < s->count; ++i)
+  {
+    if (s->state[i] == NFR_SWAPCHAIN_IN_FLIGHT)
+      NFR_LOG_WARNING("Freeing swapchain image %u while it is in flight", i);
+    nfrFreeMemory(&s->images[i]);
+  }
+  if (s->chan->swapchain == s)
+    s->chan->swapchain = 0;
+  free(s);
+  *sc = 0;
+}
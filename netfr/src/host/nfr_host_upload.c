@@ -0,0 +1,159 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* Buffers written by the client */
+
+#include <string.h>
+#include <errno.h>
+
+#include "netfr/netfr_host.h"
+#include "host/nfr_host.h"
+#include "host/nfr_host_callback.h"
+
+#include "common/nfr.h"
+#include "common/nfr_log.h"
+#include "common/nfr_mem.h"
+#include "common/nfr_protocol.h"
+
+PNFRMemory nfrHostExposeMemory(PNFRHost host, void * buffer,
+                               uint64_t size, uint8_t index)
+{
+  assert(host);
+  assert(buffer);
+  assert(size);
+  assert(index < NETFR_NUM_CHANNELS);
+
+  if (!host || !buffer || !size || index >= NETFR_NUM_CHANNELS)
+    return 0;
+
+  // The region is announced to the client by nfrHostProcess
+  struct NFRHostChannel * chan = host->channels + index;
+  PNFRMemory mem = nfr_RdmaAttach(chan->res, buffer, size,
+                                  FI_READ | FI_WRITE | FI_REMOTE_WRITE,
+                                  NFR_MEM_TYPE_USER_MANAGED,
+                                  MEM_STATE_AVAILABLE_UNSYNCED);
+  if (!mem)
+    return 0;
+
+  chan->exposed |= 1u << mem->index;
+  return mem;
+}
+
+int nfr_HostResyncBufs(struct NFRHostChannel * chan)
+{
+  assert(chan);
+  struct NFRResource * res = chan->res;
+  int nUpdated = 0;
+
+  for (int i = 0; i < NETFR_MAX_MEM_REGIONS; ++i)
+  {
+    struct NFRMemory * mem = res->memRegions + i;
+    if (!(chan->exposed & (1u << i)))
+      continue;
+
+    // The region was freed by the user
+    if (mem->state == MEM_STATE_EMPTY)
+    {
+      chan->exposed &= ~(1u << i);
+      continue;
+    }
+    if (mem->state != MEM_STATE_AVAILABLE_UNSYNCED)
+      continue;
+
+    struct NFRMsgBufferState msg;
+    memset(&msg, 0, sizeof(msg));
+    nfr_SetHeader(&msg.header, NFR_MSG_BUFFER_STATE);
+    msg.priority  = mem->priority;
+    msg.pageSize  = nfr_GetPageSize();
+    msg.addr      = (uintptr_t) mem->addr;
+    msg.size      = mem->size;
+    msg.rkey      = fi_mr_key(mem->mr);
+    msg.index     = i;
+    msg.railCount = 1;
+
+    struct NFR_CallbackInfo cbInfo = {0};
+    cbInfo.callback = nfr_HostProcessInternalTx;
+
+    struct NFR_TransferInfo ti = {0};
+    ti.opType = NFR_OP_SEND_COPY;
+    ti.data   = &msg;
+    ti.cbInfo = &cbInfo;
+    ti.length = sizeof(msg);
+
+    ssize_t ret = nfr_PostTransfer(res, &ti);
+    if (ret < 0)
+      return ret == -EAGAIN ? nUpdated : (int) ret;
+
+    NFR_LOG_DEBUG("Exposed buffer %d state sync message sent", i);
+    mem->state = MEM_STATE_AVAILABLE;
+    ++nUpdated;
+  }
+
+  return nUpdated;
+}
+
+void nfr_HostUploadReset(struct NFRHostChannel * chan)
+{
+  assert(chan);
+  for (int i = 0; i < NETFR_MAX_MEM_REGIONS; ++i)
+  {
+    struct NFRMemory * mem = chan->res->memRegions + i;
+    if ((chan->exposed & (1u << i)) && mem->state == MEM_STATE_AVAILABLE)
+      mem->state = MEM_STATE_AVAILABLE_UNSYNCED;
+  }
+}
+
+int nfrHostReadBuffer(PNFRHost host, int channelID,
+                      struct NFRHostBufferEvent * evt)
+{
+  assert(host);
+  assert(evt);
+  if (!host || !evt || channelID < 0 || channelID >= NETFR_NUM_CHANNELS)
+    return -EINVAL;
+
+  // Report the oldest write first, in case the client has written several
+  struct NFRHostChannel * chan = host->channels + channelID;
+  struct NFRMemory * oldest = 0;
+  for (int i = 0; i < NETFR_MAX_MEM_REGIONS; ++i)
+  {
+    struct NFRMemory * mem = chan->res->memRegions + i;
+    if (!(chan->exposed & (1u << i)) || mem->state != MEM_STATE_HAS_DATA)
+      continue;
+    if (!oldest || (int32_t) (mem->channelSerial - oldest->channelSerial) < 0)
+      oldest = mem;
+  }
+
+  if (!oldest)
+    return -EAGAIN;
+
+  memset(evt, 0, sizeof(*evt));
+  evt->memRegion     = oldest;
+  evt->ranges        = oldest->ranges;
+  evt->rangeCount    = oldest->rangeCount;
+  evt->udata         = oldest->udata;
+  evt->serial        = oldest->channelSerial;
+  evt->payloadOffset = oldest->payloadOffset;
+  evt->payloadLength = oldest->payloadLength;
+  evt->channelIndex  = (uint8_t) channelID;
+
+  // Reported once; the region returns to the client with nfrAckBuffer
+  oldest->state = MEM_STATE_BUSY;
+  return 0;
+}
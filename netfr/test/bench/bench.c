@@ -0,0 +1,565 @@
+/*
+ * Telescope Network Frame Relay System
+ *
+ * Copyright (c) 2023-2024 Tim Dettmar
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* This program benchmarks the CPU-side processing stages of NetFR, which can be
+   measured without a fabric connection. Each test prints the processing cost
+   next to the amount of data it saves on the wire. Some stages are internal to
+   NetFR and are called through its private headers.
+*/
+
+#include "netfr/netfr_host.h"
+#include "common/nfr_compress.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_DEFAULT_FRAMES 300
+
+/* Link speed in Gbit/s the compressed transfer time is estimated for */
+#define BENCH_LINK_GBPS 10.0
+
+struct BenchTrace
+{
+  uint32_t  width;
+  uint32_t  height;
+  uint32_t  pitch;
+  uint32_t  frames;
+  FILE    * file;     // Recorded trace, or null for a synthetic one
+  uint8_t * frame;    // Current frame
+};
+
+double getTimeSec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void fillRect(struct BenchTrace * t, int x, int y, int w, int h,
+                     uint32_t color)
+{
+  for (int row = y; row < y + h; ++row)
+  {
+    if (row < 0 || row >= (int) t->height)
+      continue;
+    uint32_t * px = (uint32_t *) (t->frame + (size_t) row * t->pitch);
+    for (int col = x; col < x + w; ++col)
+    {
+      if (col >= 0 && col < (int) t->width)
+        px[col] = color;
+    }
+  }
+}
+
+static void drawBackground(struct BenchTrace * t, int x, int y, int w, int h,
+                           uint32_t seed)
+{
+  for (int row = y; row < y + h; ++row)
+  {
+    if (row < 0 || row >= (int) t->height)
+      continue;
+    uint32_t * px = (uint32_t *) (t->frame + (size_t) row * t->pitch);
+    for (int col = x; col < x + w; ++col)
+    {
+      if (col >= 0 && col < (int) t->width)
+        px[col] = 0xFF000000 | ((row + seed) & 0xFF) << 16 
+                  | ((col + seed) & 0xFF) << 8 | ((row ^ col) & 0x3F);
+    }
+  }
+}
+
+/* Generate the next frame of a synthetic desktop session: a terminal with
+   scrolling text, a moving cursor, a window being dragged, idle periods with
+   a blinking caret, and a scene change every 240 frames. */
+static void syntheticFrame(struct BenchTrace * t, uint32_t n)
+{
+  static uint32_t scene = 0;
+  int w = t->width, h = t->height;
+  if (n % 240 == 0)
+  {
+    scene = n / 240;
+    drawBackground(t, 0, 0, w, h, scene * 37);
+    fillRect(t, w / 8, h / 8, w / 2, h / 2, 0xFF202020);
+  }
+
+  uint32_t phase = n % 240;
+
+  // Terminal output scrolls by one text line every 4 frames
+  if (phase < 60 && phase % 4 == 0)
+  {
+    int tx = w / 8, ty = h / 8, tw = w / 2, th = h / 2, line = 16;
+    for (int row = ty; row < ty + th - line; ++row)
+      memmove(t->frame + (size_t) row * t->pitch + tx * 4,
+              t->frame + (size_t) (row + line) * t->pitch + tx * 4, tw * 4);
+    for (int i = 0; i < tw / 10; ++i)
+      fillRect(t, tx + i * 10, ty + th - line + 4, 7, 9,
+               ((n * 7 + i * 13) % 5) ? 0xFFC0C0C0 : 0xFF202020);
+  }
+
+  // A window is dragged across the screen
+  if (phase >= 60 && phase < 120)
+  {
+    int step = phase - 60;
+    drawBackground(t, step * 8 - 8, h / 3, w / 4, h / 4, scene * 37);
+    fillRect(t, step * 8, h / 3, w / 4, h / 4, 0xFF3060A0);
+  }
+
+  // Idle with a blinking caret
+  if (phase >= 120 && phase < 200 && phase % 30 == 0)
+    fillRect(t, w / 8 + 8, h / 8 + h / 2 - 12, 8, 10,
+             (phase / 30) % 2 ? 0xFFFFFFFF : 0xFF202020);
+
+  // The cursor moves in every non-idle frame
+  if (phase < 120 || phase >= 200)
+  {
+    int cx = (n * 13) % w, cy = (n * 7) % h;
+    int px = ((n - 1) * 13) % w, py = ((n - 1) * 7) % h;
+    drawBackground(t, px, py, 16, 16, scene * 37);
+    fillRect(t, cx, cy, 16, 16, 0xFFFFFFFF);
+  }
+}
+
+static int traceOpen(struct BenchTrace * t, const char * path)
+{
+  t->pitch = t->width * 4;
+  t->frame = aligned_alloc(64, (size_t) t->pitch * t->height);
+  if (!t->frame)
+    return -ENOMEM;
+  memset(t->frame, 0, (size_t) t->pitch * t->height);
+
+  if (path)
+  {
+    t->file = fopen(path, "rb");
+    if (!t->file)
+    {
+      fprintf(stderr, "Failed to open trace %s\n", path);
+      return -ENOENT;
+    }
+  }
+  return 0;
+}
+
+static void traceRewind(struct BenchTrace * t)
+{
+  if (t->file)
+    rewind(t->file);
+  memset(t->frame, 0, (size_t) t->pitch * t->height);
+}
+
+// Load frame n; returns 0 at the end of the trace
+static int traceNext(struct BenchTrace * t, uint32_t n)
+{
+  if (n >= t->frames)
+    return 0;
+  if (t->file)
+    return fread(t->frame, (size_t) t->pitch * t->height, 1, t->file) == 1;
+  syntheticFrame(t, n);
+  return 1;
+}
+
+static void traceClose(struct BenchTrace * t)
+{
+  if (t->file)
+    fclose(t->file);
+  free(t->frame);
+}
+
+static const char * simdNames[] = { "auto", "none", "sse2", "avx2", "avx512" };
+
+static int benchDiffRun(struct BenchTrace * t, uint8_t simd, uint32_t threads)
+{
+  struct NFRDiffOpts opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.width   = t->width;
+  opts.height  = t->height;
+  opts.bpp     = 4;
+  opts.pitch   = t->pitch;
+  opts.simd    = simd;
+  opts.threads = threads;
+
+  PNFRHostDiff diff;
+  int ret = nfrHostDiffCreate(0, 0, &opts, &diff);
+  if (ret < 0)
+  {
+    fprintf(stderr, "Failed to create diff engine: %d\n", ret);
+    return ret;
+  }
+
+  struct NFRWriteRange ranges[NETFR_MAX_WRITE_RANGES];
+  uint64_t frameSize = (uint64_t) t->pitch * t->height;
+  uint64_t sent = 0, total = 0;
+  uint32_t repeats = 0, full = 0, n = 0;
+  double   diffTime = 0;
+
+  traceRewind(t);
+  for (; traceNext(t, n); ++n)
+  {
+    double start = getTimeSec();
+    ret = nfrHostDiffUpdate(diff, 0, t->frame, ranges, NETFR_MAX_WRITE_RANGES);
+    double end = getTimeSec();
+    if (ret < 0)
+    {
+      fprintf(stderr, "Diff failed on frame %u: %d\n", n, ret);
+      break;
+    }
+
+    // The first frame is always sent in full and is not representative
+    if (!n)
+      continue;
+
+    diffTime += end - start;
+    total    += frameSize;
+    if (!ret)
+      ++repeats;
+    for (int i = 0; i < ret; ++i)
+      sent += (uint64_t) ranges[i].length * (ranges[i].rows ? ranges[i].rows : 1);
+    if (ret == 1 && ranges[0].length == frameSize)
+      ++full;
+  }
+
+  if (n > 1 && ret >= 0)
+  {
+    double saved = (double) (total - sent);
+    printf("%-7s %7u %9.3f %8.2f %8.1f%% %8u %6u %12.2f\n",
+           simdNames[simd], threads, diffTime * 1000.0 / (n - 1),
+           (double) total / diffTime / 1e9,
+           100.0 * (double) sent / (double) total, repeats, full,
+           saved * 8.0 / diffTime / 1e9);
+  }
+
+  nfrHostDiffFree(&diff);
+  return ret < 0 ? ret : 0;
+}
+
+/* Frame difference engine: comparison cost versus bytes that would be sent.
+   The break-even column is the link speed below which diffing a frame takes
+   less time than sending the bytes it saves. */
+static int benchDiff(int argc, char ** argv)
+{
+  struct BenchTrace t;
+  memset(&t, 0, sizeof(t));
+  t.width  = argc > 0 ? atoi(argv[0]) : 1920;
+  t.height = argc > 1 ? atoi(argv[1]) : 1080;
+  t.frames = argc > 3 ? atoi(argv[3]) : BENCH_DEFAULT_FRAMES;
+  if (!t.width || !t.height || !t.frames)
+    return -EINVAL;
+
+  int ret = traceOpen(&t, argc > 2 && strcmp(argv[2], "-") ? argv[2] : 0);
+  if (ret < 0)
+    goto cleanup;
+
+  printf("Diff: %ux%u, %u frames, %s trace\n", t.width, t.height, t.frames,
+         t.file ? "recorded" : "synthetic");
+  printf("%-7s %7s %9s %8s %9s %8s %6s %12s\n", "simd", "threads", "ms/frame",
+         "GB/s", "sent", "repeats", "full", "break-even");
+
+  for (uint8_t simd = NFR_DIFF_SIMD_NONE; simd < NFR_DIFF_SIMD_MAX; ++simd)
+  {
+    ret = benchDiffRun(&t, simd, 1);
+    if (ret < 0)
+      goto cleanup;
+  }
+  ret = benchDiffRun(&t, NFR_DIFF_SIMD_AUTO, 0);
+  if (ret >= 0)
+    ret = benchDiffRun(&t, NFR_DIFF_SIMD_AUTO, 4);
+  if (ret >= 0)
+    printf("Break-even in Gbit/s; sent is relative to full frames\n");
+
+cleanup:
+  traceClose(&t);
+  return ret;
+}
+
+static int benchCompressRun(struct BenchTrace * t, uint32_t threads)
+{
+  struct NFRThreadPool * pool = 0;
+  int ret = 0;
+  if (threads > 1)
+  {
+    ret = nfr_ThreadPoolCreate(threads, &pool);
+    if (ret < 0)
+    {
+      fprintf(stderr, "Failed to create thread pool: %d\n", ret);
+      return ret;
+    }
+  }
+
+  uint64_t frameSize = (uint64_t) t->pitch * t->height;
+  uint64_t bound     = nfr_CompressBound(frameSize);
+  uint8_t * comp     = malloc(bound);
+  uint8_t * out      = malloc(frameSize);
+  if (!comp || !out)
+  {
+    ret = -ENOMEM;
+    goto cleanup;
+  }
+
+  struct NFRCompressSlice slices[NFR_COMPRESS_MAX_SLICES];
+  uint64_t total = 0, compressed = 0;
+  double   compTime = 0, decompTime = 0;
+  uint32_t n = 0;
+
+  traceRewind(t);
+  for (; traceNext(t, n); ++n)
+  {
+    double start = getTimeSec();
+    ret = nfr_Compress(pool, t->frame, frameSize, comp, bound, slices);
+    double mid = getTimeSec();
+    if (ret < 0)
+    {
+      fprintf(stderr, "Compression failed on frame %u: %d\n", n, ret);
+      goto cleanup;
+    }
+
+    uint32_t count = ret;
+    ret = nfr_Decompress(pool, comp, bound, out, frameSize, slices, count);
+    double end = getTimeSec();
+    if (ret < 0 || memcmp(out, t->frame, frameSize) != 0)
+    {
+      fprintf(stderr, "Decompression mismatch on frame %u: %d\n", n, ret);
+      ret = ret < 0 ? ret : -EIO;
+      goto cleanup;
+    }
+
+    compTime   += mid - start;
+    decompTime += end - mid;
+    total      += frameSize;
+    for (uint32_t i = 0; i < count; ++i)
+      compressed += slices[i].length;
+  }
+
+  if (n)
+  {
+    double wire = (double) compressed * 8.0 / (BENCH_LINK_GBPS * 1e9);
+    printf("%7u %7.2f %9.3f %9.3f %9.2f %9.2f %10.3f\n", threads,
+           (double) total / (double) compressed, compTime * 1000.0 / n,
+           decompTime * 1000.0 / n, (double) total / compTime / 1e9,
+           (double) total / decompTime / 1e9,
+           (wire + compTime + decompTime) * 1000.0 / n);
+  }
+
+cleanup:
+  free(comp);
+  free(out);
+  nfr_ThreadPoolFree(&pool);
+  return ret < 0 ? ret : 0;
+}
+
+/* Compression stage: compression ratio versus CPU cost. The last column is the
+   time to compress, send and decompress a frame over a BENCH_LINK_GBPS link,
+   to be compared with the time to send it uncompressed. */
+static int benchCompress(int argc, char ** argv)
+{
+  if (!nfr_CompressAvailable())
+  {
+    fprintf(stderr, "NetFR was built without compression support\n");
+    return -ENOSYS;
+  }
+
+  struct BenchTrace t;
+  memset(&t, 0, sizeof(t));
+  t.width  = argc > 0 ? atoi(argv[0]) : 1920;
+  t.height = argc > 1 ? atoi(argv[1]) : 1080;
+  t.frames = argc > 3 ? atoi(argv[3]) : BENCH_DEFAULT_FRAMES;
+  if (!t.width || !t.height || !t.frames)
+    return -EINVAL;
+
+  int ret = traceOpen(&t, argc > 2 && strcmp(argv[2], "-") ? argv[2] : 0);
+  if (ret < 0)
+    goto cleanup;
+
+  double raw = (double) t.pitch * t.height * 8.0 / (BENCH_LINK_GBPS * 1e9);
+  printf("Compress: %ux%u, %u frames, %s trace, uncompressed %.3f ms/frame "
+         "at %.0f Gbit/s\n", t.width, t.height, t.frames,
+         t.file ? "recorded" : "synthetic", raw * 1000.0, BENCH_LINK_GBPS);
+  printf("%7s %7s %9s %9s %9s %9s %10s\n", "threads", "ratio", "comp ms",
+         "dec ms", "comp GB/s", "dec GB/s", "link ms");
+
+  uint32_t threadCounts[] = { 1, 2, 4, 8 };
+  for (int i = 0; i < 4 && ret >= 0; ++i)
+  {
+    if (threadCounts[i] > nfr_GetCpuCount())
+      break;
+    ret = benchCompressRun(&t, threadCounts[i]);
+  }
+
+cleanup:
+  traceClose(&t);
+  return ret;
+}
+
+/* Working set the application keeps in cache between frame copies */
+#define BENCH_WORKING_SET (4 << 20)
+
+/* Copy a buffer repeatedly with the given engine, reading a working set after
+   each copy. Copies with regular stores evict the working set, which makes it
+   slower to read again. */
+static void benchCopyRun(PNFRCopyEngine engine, uint8_t * dst,
+                         const uint8_t * src, uint64_t size,
+                         const uint8_t * ws, double * gbps, double * wsUs)
+{
+  uint32_t iters = (uint32_t) ((1ULL << 30) / size);
+  if (iters < 4)
+    iters = 4;
+
+  volatile uint64_t sink = 0;
+  double copyTime = 0, wsTime = 0;
+  for (uint32_t i = 0; i < iters; ++i)
+  {
+    double start = getTimeSec();
+    nfrCopy(engine, dst, src, size);
+    double mid = getTimeSec();
+    uint64_t sum = 0;
+    for (uint64_t j = 0; j < BENCH_WORKING_SET; j += 64)
+      sum += ws[j];
+    sink += sum;
+    double end = getTimeSec();
+
+    copyTime += mid - start;
+    wsTime   += end - mid;
+  }
+  (void) sink;
+
+  *gbps = (double) size * iters / copyTime / 1e9;
+  *wsUs = wsTime * 1e6 / iters;
+}
+
+/* Copy engine: throughput of memcpy, non-temporal stores on one thread and the
+   default engine, along with the time to read a working set afterwards.
+   Streaming on one thread is usually slower than memcpy and only saves the
+   working set. */
+static int benchCopy(int argc, char ** argv)
+{
+  uint64_t maxSize = (argc > 0 ? atoi(argv[0]) : 64) * 1048576ULL;
+  uint32_t threads = argc > 1 ? atoi(argv[1]) : 0;
+  if (!maxSize)
+    return -EINVAL;
+
+  PNFRCopyEngine single = 0, multi = 0;
+  struct NFRCopyOpts opts;
+  memset(&opts, 0, sizeof(opts));
+  // Streaming is forced on one thread, where AUTO would mostly use memcpy
+  opts.threads = 1;
+  opts.simd    = NFR_COPY_SIMD_AVX512;
+  int ret = nfrCopyEngineCreate(&opts, &single);
+  opts.threads = threads;
+  opts.simd    = NFR_COPY_SIMD_AUTO;
+  if (ret >= 0)
+    ret = nfrCopyEngineCreate(&opts, &multi);
+  if (ret < 0)
+  {
+    fprintf(stderr, "Failed to create copy engine: %d\n", ret);
+    goto cleanup;
+  }
+
+  uint8_t * src = aligned_alloc(4096, maxSize);
+  uint8_t * dst = aligned_alloc(4096, maxSize);
+  uint8_t * ws  = aligned_alloc(4096, BENCH_WORKING_SET);
+  if (!src || !dst || !ws)
+  {
+    ret = -ENOMEM;
+    goto freeBufs;
+  }
+  memset(src, 0x5A, maxSize);
+  memset(dst, 0, maxSize);
+  memset(ws, 1, BENCH_WORKING_SET);
+
+  printf("Copy: up to %.0f MiB, working set %d MiB\n", maxSize / 1048576.0,
+         BENCH_WORKING_SET >> 20);
+  printf("%10s %10s %8s %10s %8s %10s %8s\n", "size", "memcpy", "ws us",
+         "nt GB/s", "ws us", "auto GB/s", "ws us");
+
+  // 3840x2160 at 32 bits per pixel is included as the typical frame size
+  uint64_t sizes[] = { 64 << 10, 256 << 10, 1 << 20, 4 << 20, 16 << 20,
+                       3840 * 2160 * 4, 64 << 20 };
+  uint64_t lastSize = 0;
+  double gbps[3], wsUs[3];
+  for (int i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); ++i)
+  {
+    if (sizes[i] > maxSize)
+      break;
+
+    benchCopyRun(0, dst, src, sizes[i], ws, &gbps[0], &wsUs[0]);
+    benchCopyRun(single, dst, src, sizes[i], ws, &gbps[1], &wsUs[1]);
+    benchCopyRun(multi, dst, src, sizes[i], ws, &gbps[2], &wsUs[2]);
+    if (memcmp(dst, src, sizes[i]) != 0)
+    {
+      fprintf(stderr, "Copy mismatch at %lu bytes\n", (unsigned long) sizes[i]);
+      ret = -EIO;
+      goto freeBufs;
+    }
+
+    printf("%9.2fM %10.2f %8.1f %10.2f %8.1f %10.2f %8.1f\n",
+           sizes[i] / 1048576.0, gbps[0], wsUs[0], gbps[1], wsUs[1], gbps[2],
+           wsUs[2]);
+    lastSize = sizes[i];
+  }
+  printf("memcpy in GB/s; nt streams on one thread, auto is the default engine; "
+         "ws is the time to read the working set afterwards\n");
+
+  // A ratio below 1 means the engine is slower than memcpy at this size
+  if (lastSize)
+    printf("At %.2f MiB, nt copies at %.2fx and auto at %.2fx the memcpy "
+           "throughput\n", lastSize / 1048576.0, gbps[1] / gbps[0],
+           gbps[2] / gbps[0]);
+
+freeBufs:
+  free(src);
+  free(dst);
+  free(ws);
+cleanup:
+  nfrCopyEngineFree(&single);
+  nfrCopyEngineFree(&multi);
+  return ret;
+}
+
+struct BenchTest
+{
+  const char * name;
+  const char * args;
+  int (*fn)(int argc, char ** argv);
+};
+
+static const struct BenchTest tests[] = {
+  { "diff", "[width] [height] [trace.raw|-] [frames]", benchDiff },
+  { "compress", "[width] [height] [trace.raw|-] [frames]", benchCompress },
+  { "copy", "[max size in MiB] [threads]", benchCopy },
+};
+
+int main(int argc, char ** argv)
+{
+  const int nTests = sizeof(tests) / sizeof(tests[0]);
+  if (argc >= 2)
+  {
+    for (int i = 0; i < nTests; ++i)
+    {
+      if (strcmp(argv[1], tests[i].name) == 0)
+        return tests[i].fn(argc - 2, argv + 2) < 0 ? 1 : 0;
+    }
+  }
+
+  fprintf(stderr, "Usage: %s <test> [args]\n\nTests:\n", argv[0]);
+  for (int i = 0; i < nTests; ++i)
+    fprintf(stderr, "  %s %s\n", tests[i].name, tests[i].args);
+  fprintf(stderr, "\nRecorded traces are raw 32-bit frames stored back to "
+                  "back.\n");
+  return 1;
+}
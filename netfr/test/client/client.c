@@ -46,7 +46,7 @@ int main(int argc, char ** argv)
   {
     fprintf(stderr, 
             "Usage: %s <transport> <ip> <port> <remote_ip> <remote_port> "
-            " [log_level]\n",
+            " [log_level] [rails] [shared_rx]\n",
             argv[0]);
     return -EINVAL;
   }
@@ -88,6 +88,20 @@ int main(int argc, char ** argv)
 
   remoteOpts.apiVersion = FI_VERSION(1, 18);
 
+  // Must match the rail count of the host
+  int rails = argc > 7 ? atoi(argv[7]) : 1;
+  if (rails < 1 || rails > NETFR_MAX_RAILS)
+  {
+    fprintf(stderr, "Invalid rail count: %d\n", rails);
+    return -EINVAL;
+  }
+  opts.railCounts[0]       = rails;
+  remoteOpts.railCounts[0] = rails;
+
+  // Both channels receive from one pool, as on the host
+  opts.sharedRx       = argc > 8 ? atoi(argv[8]) != 0 : 0;
+  remoteOpts.sharedRx = opts.sharedRx;
+
   PNFRClient client;
   int ret = nfrClientInit(&opts, &remoteOpts, &client);
   if (ret < 0)
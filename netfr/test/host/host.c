@@ -49,18 +49,37 @@ void calcDataRate(const void ** udata)
 {
   unsigned long startTime = (unsigned long) (uintptr_t) udata[0];
   unsigned long len       = (unsigned long) (uintptr_t) udata[1];
-  uint8_t * busyFlag      = (uint8_t *) udata[2];
   unsigned long tdiff     = getTimeMsec() - startTime;
   double rate             = (double) len / (double) tdiff / 1048576.0 * 8.0;
   printf("Data rate: %.2f Gbit/s\n", rate);
-  *busyFlag = 0;
+}
+
+/* Check that a striped write was posted on every connected rail of channel
+   0, given the rail statistics from before the write */
+int checkStriping(PNFRHost host, int rails, const struct NFRRailStats * before)
+{
+  for (int r = 0; r < rails; ++r)
+  {
+    struct NFRRailStats stats;
+    int ret = nfrHostGetRailStats(host, 0, r, &stats);
+    if (ret < 0)
+      return ret;
+    if (stats.connected && stats.writesPosted == before[r].writesPosted)
+    {
+      fprintf(stderr, "Write of %d bytes was not striped over rail %d\n",
+              NETFR_RAIL_STRIPE_MIN_SIZE, r);
+      return -EIO;
+    }
+  }
+  return 0;
 }
 
 int main(int argc, char ** argv)
 {
   if (argc < 4)
   {
-    fprintf(stderr, "Usage: %s <transport> <ip> <port>\n", argv[0]);
+    fprintf(stderr, "Usage: %s <transport> <ip> <port> [rails] [shared_rx]\n",
+            argv[0]);
     return -EINVAL;
   }
   
@@ -82,6 +101,23 @@ int main(int argc, char ** argv)
   opts.addrs[1].sin_family      = AF_INET;
   opts.transportTypes[1]        = transport;
 
+  // Additional rails of channel 0 listen on the following ports
+  int rails = argc > 4 ? atoi(argv[4]) : 1;
+  if (rails < 1 || rails > NETFR_MAX_RAILS)
+  {
+    fprintf(stderr, "Invalid rail count: %d\n", rails);
+    return -EINVAL;
+  }
+  opts.railCounts[0] = rails;
+
+  /* Compressed writes are never striped, and the mostly empty frames compress
+     well, so compression is disabled for the striping check */
+  if (rails > 1)
+    opts.compression[0] = NFR_COMPRESSION_NONE;
+
+  // Both channels receive from one pool, which the client must match
+  opts.sharedRx = argc > 5 ? atoi(argv[5]) != 0 : 0;
+
   opts.apiVersion = FI_VERSION(1, 18);
 
   PNFRHost host;
@@ -94,21 +130,16 @@ int main(int argc, char ** argv)
 
   const size_t frameMemSize = 1048576 * 128;
 
-  void * mem = aligned_alloc(4096, frameMemSize);
-  if (!mem)
-  {
-    fprintf(stderr, "Failed to allocate memory\n");
-    goto cleanup;
-  }
-
-  PNFRMemory frameMem = nfrHostAttachMemory(host, mem, frameMemSize, 0);
-  if (!frameMem)
+  // Frames are captured into one image while the others are being written
+  PNFRHostSwapchain swapchain = 0;
+  ret = nfrHostSwapchainCreate(host, 0, 3, frameMemSize, &swapchain);
+  if (ret < 0)
   {
-    fprintf(stderr, "Failed to attach memory\n");
+    fprintf(stderr, "Failed to create swapchain: %d\n", ret);
     goto cleanup;
   }
 
-  uint8_t busyWriting = 0;
+  uint32_t frameCount = 0;
 
   char msgBuf[256];
   memset(msgBuf, 0, sizeof(msgBuf));
@@ -140,25 +171,40 @@ int main(int argc, char ** argv)
       continue;
     }
 
-    if (!busyWriting)
+    // All images are in flight if none can be acquired
+    void * frame;
+    int image = nfrHostSwapchainAcquire(swapchain, &frame);
+    if (image >= 0)
     {
+      memcpy(frame, &frameCount, sizeof(frameCount));
+
       struct NFRCallbackInfo cbInfo;
       cbInfo.callback = calcDataRate;
       cbInfo.uData[0] = (void *) (uintptr_t) getTimeMsec();
       cbInfo.uData[1] = (void *) (uintptr_t) frameMemSize;
-      cbInfo.uData[2] = &busyWriting;
 
-      ret = nfrHostWriteBuffer(frameMem, 0, 0, frameMemSize, &cbInfo);
+      struct NFRRailStats before[NETFR_MAX_RAILS];
+      for (int r = 0; r < rails; ++r)
+        nfrHostGetRailStats(host, 0, r, before + r);
+
+      ret = nfrHostSwapchainPresent(swapchain, image, frameMemSize, &cbInfo);
       if (ret < 0 && ret != -ENOBUFS && ret != -EAGAIN)
       {
         fprintf(stderr, "Failed to write buffer: %d\n", ret);
         goto cleanup;
       }
-      
+
       if (ret >= 0)
       {
-        printf("Writing buffer\n");
-        busyWriting = 1;
+        printf("Writing frame %u\n", frameCount++);
+        // Frames are far larger than NETFR_RAIL_STRIPE_MIN_SIZE
+        if (rails > 1 && (ret = checkStriping(host, rails, before)) < 0)
+          goto cleanup;
+      }
+      else
+      {
+        // No remote buffer is free; the frame is captured again next time
+        nfrHostSwapchainRelease(swapchain, image);
       }
     }
 
@@ -175,8 +221,7 @@ int main(int argc, char ** argv)
   }
 
 cleanup:
-  nfrFreeMemory(&frameMem);
-  free(mem);
+  nfrHostSwapchainFree(&swapchain);
   nfrHostFree(&host);
   return ret;
 }
\ No newline at end of file